@@ -1,4 +1,5 @@
 #include <libdragon.h>
+#include <stdio.h>
 
 // Mixer channel allocation
 #define CHANNEL_SFX1    0
@@ -45,6 +46,9 @@ int main(void) {
 		graphics_draw_text(disp, 50, 80, "Z - Start / stop background music");
 		graphics_draw_text(disp, 70, 90, "L/R - Change music frequency");
 		graphics_draw_text(disp, 50, 140, "Music courtesy of MishtaLu / indiegamemusic.com");
+		char sbuf[64];
+		sprintf(sbuf, "RSP stall: %d us/s", mixer_get_stall_us());
+		graphics_draw_text(disp, 50, 120, sbuf);
 		display_show(disp);
 
 		controller_scan();
@@ -81,12 +85,9 @@ int main(void) {
 			mixer_ch_stop(CHANNEL_SFX2);
 		}
 
-		// Check whether one audio buffer is ready, otherwise wait for next
-		// frame to perform mixing.
-		if (audio_can_write()) {    	
-			short *buf = audio_write_begin();
-			mixer_poll(buf, audio_get_buffer_length());
-			audio_write_end();
-		}
+		// Mix the next audio buffer in background if one is free (the RSP
+		// will mix it while we go on), and play the one mixed in the previous
+		// frame.
+		mixer_try_play();
 	}
 }
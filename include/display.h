@@ -159,6 +159,35 @@ typedef filter_options_t antialias_t;
 
 ///@endcond
 
+/** @brief Number of entries in the vblank histogram of #display_stats_t */
+#define DISPLAY_STATS_HIST_SIZE     8
+
+/**
+ * @brief Frame pacing and latency statistics (see #display_get_stats)
+ *
+ * Statistics are accumulated since #display_init or the last call to
+ * #display_reset_stats. Times are expressed in ticks (see #TICKS_READ and
+ * #TICKS_TO_US). Averages can be obtained by dividing the totals by the
+ * number of frames (or waits).
+ */
+typedef struct {
+    uint32_t frames;            ///< Number of frames shown on screen
+    uint32_t vblanks;           ///< Number of vblanks elapsed since the first frame was shown
+    uint32_t missed_vblanks;    ///< Number of vblanks in which a new frame was due, but none was ready (so the previous one was repeated)
+    uint32_t late_frames;       ///< Number of frames that were shown for more vblanks than the target (1, or the frame pacing)
+    uint32_t forced_flips;      ///< Number of frames shown immediately, outside of a vblank (also counted in frames)
+    /** @brief Histogram of vblanks per frame: entry i counts the frames shown for i+1 vblanks
+     *         (the last entry also counts longer frames) */
+    uint32_t vblank_hist[DISPLAY_STATS_HIST_SIZE];
+    uint32_t waits;             ///< Number of calls to #display_get
+    uint32_t wait_last;         ///< Time spent waiting for a buffer in the last #display_get
+    uint32_t wait_max;          ///< Maximum time spent waiting for a buffer in #display_get
+    uint64_t wait_total;        ///< Total time spent waiting for a buffer in #display_get
+    uint32_t latency_last;      ///< Time from #display_get to scanout for the last frame shown
+    uint32_t latency_max;       ///< Maximum time from #display_get to scanout
+    uint64_t latency_total;     ///< Total time from #display_get to scanout
+} display_stats_t;
+
 /** 
  * @brief Display context (DEPRECATED: Use #surface_t instead)
  * 
@@ -242,6 +271,27 @@ surface_t* display_try_get(void);
  */
 void display_show(surface_t* surf);
 
+/**
+ * @brief Show only a portion of a display buffer, scaled to the full screen
+ *
+ * This allows to render a frame at a lower resolution, without reallocating
+ * buffers: the frame is drawn in the top-left width x height pixels of the
+ * buffer (eg: attaching rdpq to a sub-surface created with #surface_make_sub),
+ * and the VI scales that area up to fill the screen when the buffer is shown.
+ * The stride of the buffer does not change.
+ *
+ * The size must be configured before calling #display_show, and it is reset
+ * to the full size every time the buffer is returned by #display_get.
+ *
+ * @param[in] surf
+ *            A display buffer (previously retrieved using #display_get)
+ * @param[in] width
+ *            Width of the rendered area in pixels (up to the display width)
+ * @param[in] height
+ *            Height of the rendered area in pixels (up to the display height)
+ */
+void display_set_frame_size(surface_t *surf, uint32_t width, uint32_t height);
+
 /**
  * @brief Get the currently configured width of the display in pixels
  */
@@ -269,6 +319,47 @@ uint32_t display_get_num_buffers(void);
  */
 float display_get_fps(void);
 
+/**
+ * @brief Configure fixed frame pacing
+ *
+ * By default, a frame is shown at the first vblank after #display_show is
+ * called. If the game cannot hold 60 fps, this makes frames last a variable
+ * number of vblanks, which is perceived as jitter.
+ *
+ * With frame pacing, each frame is shown for at least the specified number of
+ * vblanks, so the game runs at a steady lower rate (eg: 2 for 30 fps, 3 for
+ * 20 fps on NTSC). Since buffers are released at a steady rate, #display_get
+ * also paces the game loop. Frames that take longer are still shown late
+ * (see #display_stats_t).
+ *
+ * In interlaced modes, each field counts as a vblank.
+ *
+ * @param vblanks       Minimum number of vblanks each frame is shown for
+ *                      (0 or 1 to disable pacing)
+ */
+void display_set_frame_pacing(int vblanks);
+
+/**
+ * @brief Get the current frame pacing (see #display_set_frame_pacing)
+ */
+int display_get_frame_pacing(void);
+
+/**
+ * @brief Get the frame pacing and latency statistics
+ *
+ * The latency of a frame is measured from the time #display_get returned its
+ * buffer, to the vblank in which it started to be scanned out. If the game reads
+ * the input right after #display_get, this is the input-to-scanout latency.
+ *
+ * @param[out] stats    Statistics
+ */
+void display_get_stats(display_stats_t *stats);
+
+/**
+ * @brief Reset the frame pacing and latency statistics
+ */
+void display_reset_stats(void);
+
 
 /** @cond */
 __attribute__((deprecated("use display_get or display_try_get instead")))
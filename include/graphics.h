@@ -314,6 +314,10 @@ void graphics_set_default_font( void );
  * 
  * You can see an example of a sprite font (that has the default font double sized) under examples/customfont.
  *
+ * The shape of the glyphs (which pixels are transparent) is read from the sprite
+ * by this function, so later changes to the pixels of the sprite are ignored:
+ * call this function again to apply them.
+ *
  * @param[in] font
  *        Sprite font to be used.
  */
@@ -59,6 +59,11 @@
 #include "rdpq_mode.h"
 #include "rdpq_tex.h"
 #include "rdpq_sprite.h"
+#include "rdpq_batch.h"
+#include "rdpq_profile.h"
+#include "rdpq_tilemap.h"
+#include "rdpq_dynres.h"
+#include "rdpq_font.h"
 #include "rdpq_debug.h"
 #include "rdpq_macros.h"
 #include "surface.h"
@@ -295,7 +295,10 @@ void mixer_ch_set_limits(int ch, int max_bits, float max_frequency, int max_buf_
  * buffer's pointer, and pass it to mixer_poll.
  *
  * mixer_poll performs mixing using RSP. If RSP is busy, mixer_poll will
- * spin-wait until the RSP is free, to perform audio processing.
+ * spin-wait until the RSP is free, to perform audio processing. All the
+ * samples between two events are mixed by the RSP at once, after having
+ * processed all the events that trigger within the buffer. To avoid waiting
+ * for the RSP altogether, see #mixer_try_play.
  *
  * Since the N64 AI can only be fed with an even number of samples, mixer_poll
  * does not accept odd numbers.
@@ -305,6 +308,41 @@ void mixer_ch_set_limits(int ch, int max_bits, float max_frequency, int max_buf_
  */
 void mixer_poll(int16_t *out, int nsamples);
 
+/**
+ * @brief Mix audio in background, one buffer ahead of playback.
+ *
+ * This is an alternative to calling #mixer_poll manually. If an audio
+ * buffer is free, this function obtains it (via #audio_write_begin),
+ * prepares the mixing, and schedules it to the RSP without waiting for the
+ * result: the RSP mixes the buffer while the CPU keeps running. The next
+ * call to mixer_try_play sends the buffer to the AI (via #audio_write_end),
+ * and starts mixing the next one.
+ *
+ * The mixing is scheduled in the high-priority RSP queue, so it does not
+ * wait for the commands already enqueued (eg: graphics): the RSP interrupts
+ * them as soon as the running command is finished, so the latency is bounded
+ * by the longest single command in the standard queue. Normally, the previous
+ * buffer is complete when the function is called again, so the CPU does not
+ * wait. Call this function at least once per audio buffer (eg: once per
+ * frame), as a buffer is played only after the following call.
+ * Operations that discard the samples cached for a channel (eg: playing
+ * a different waveform on it) wait for the background mixing to complete.
+ *
+ * This function cannot be mixed with #mixer_poll or other calls to
+ * #audio_write_begin, and cannot be called while recording a rspq block.
+ */
+void mixer_try_play(void);
+
+/**
+ * @brief Get the time spent by the CPU waiting for the RSP to mix audio.
+ *
+ * The time is measured by #mixer_poll and #mixer_try_play, and is refreshed
+ * every second of mixed audio.
+ *
+ * @return      Microseconds spent waiting for the RSP per second of audio
+ */
+int mixer_get_stall_us(void);
+
 /**
  * @brief Callback invoked by mixer_poll at a specified time
  * 
@@ -181,9 +181,11 @@ enum {
     RDPQ_CMD_SET_SCISSOR_EX             = 0x12,
     RDPQ_CMD_SET_PRIM_COLOR_COMPONENT   = 0x13,
     RDPQ_CMD_MODIFY_OTHER_MODES         = 0x14,
+    RDPQ_CMD_RECT_BATCH                 = 0x15,
     RDPQ_CMD_SET_FILL_COLOR_32          = 0x16,
     RDPQ_CMD_SET_BLENDING_MODE          = 0x18,
     RDPQ_CMD_SET_FOG_MODE               = 0x19,
+    RDPQ_CMD_SET_MODE_STATE             = 0x1A,
     RDPQ_CMD_SET_COMBINE_MODE_1PASS     = 0x1B,
     RDPQ_CMD_AUTOTMEM_SET_ADDR          = 0x1C,
     RDPQ_CMD_AUTOTMEM_SET_TILE          = 0x1D,
@@ -225,7 +227,11 @@ enum {
 #define RDPQ_CFG_AUTOSYNCLOAD   (1 << 1)     ///< Configuration flag: enable automatic generation of SYNC_LOAD commands
 #define RDPQ_CFG_AUTOSYNCTILE   (1 << 2)     ///< Configuration flag: enable automatic generation of SYNC_TILE commands
 #define RDPQ_CFG_AUTOSCISSOR    (1 << 3)     ///< Configuration flag: enable automatic generation of SET_SCISSOR commands on render target change
-#define RDPQ_CFG_DEFAULT        (0xFFFF)     ///< Configuration flag: default configuration
+#define RDPQ_CFG_TEXCACHE       (1 << 4)     ///< Configuration flag: enable the TMEM residency cache of #rdpq_tex_upload and #rdpq_tex_upload_tlut (off by default)
+#define RDPQ_CFG_BLOCKOPT       (1 << 5)     ///< Configuration flag: record blocks so that they can be optimized, and optimize them before their first run (see #rdpq_block_optimize)
+#define RDPQ_CFG_TRICLIP        (1 << 6)     ///< Configuration flag: clip triangles against the guard band (see #rdpq_set_triangle_guardband)
+#define RDPQ_CFG_TRIREJECT      (1 << 7)     ///< Configuration flag: let RSP reject triangles outside of the scissor rectangle
+#define RDPQ_CFG_DEFAULT        (0xFFFF & ~(RDPQ_CFG_BLOCKOPT | RDPQ_CFG_TEXCACHE))     ///< Configuration flag: default configuration
 
 ///@cond
 // Used in inline functions as part of the autosync engine. Not part of public API.
@@ -379,6 +385,102 @@ uint32_t rdpq_config_enable(uint32_t cfg_enable_bits);
  */
 uint32_t rdpq_config_disable(uint32_t cfg_disable_bits);
 
+/**
+ * @brief Statistics of the autosync engine
+ *
+ * These counters report how many sync commands were emitted by the autosync
+ * engine (see #RDPQ_CFG_AUTOSYNCPIPE, #RDPQ_CFG_AUTOSYNCLOAD and
+ * #RDPQ_CFG_AUTOSYNCTILE), and how many SYNC_LOAD were avoided thanks to
+ * the tracking of TMEM at the granularity of single portions (as opposed to
+ * considering the whole TMEM as a single resource).
+ *
+ * Syncs emitted while recording a block are counted only once, at recording time.
+ *
+ * @see #rdpq_get_autosync_stats
+ */
+typedef struct {
+    uint32_t sync_pipe;             ///< Number of SYNC_PIPE emitted
+    uint32_t sync_tile;             ///< Number of SYNC_TILE emitted
+    uint32_t sync_load;             ///< Number of SYNC_LOAD emitted
+    uint32_t sync_load_avoided;     ///< Number of SYNC_LOAD avoided because the loaded TMEM portion was not in use
+} rdpq_autosync_stats_t;
+
+/**
+ * @brief Get the statistics of the autosync engine
+ *
+ * Statistics are accumulated since #rdpq_init or since the last call
+ * to #rdpq_reset_autosync_stats. To obtain per-frame figures, read and
+ * reset them once per frame.
+ *
+ * @param[out] stats        Structure that will be filled with the statistics
+ *
+ * @see #rdpq_reset_autosync_stats
+ */
+void rdpq_get_autosync_stats(rdpq_autosync_stats_t *stats);
+
+/**
+ * @brief Reset the statistics of the autosync engine
+ *
+ * @see #rdpq_get_autosync_stats
+ */
+void rdpq_reset_autosync_stats(void);
+
+///@cond
+typedef struct rspq_block_s rspq_block_t;
+///@endcond
+
+/**
+ * @brief Statistics of the block optimizer
+ *
+ * Commands are counted among the RDP commands stored in the block by the CPU.
+ * RDP commands generated by the RSP while running the block (eg: render mode
+ * changes, or triangles) are not visible to the optimizer.
+ *
+ * @see #rdpq_block_optimize
+ */
+typedef struct {
+    int cmds_before;                ///< Number of RDP commands before the optimization
+    int cmds_after;                 ///< Number of RDP commands after the optimization
+    int state_removed;              ///< Number of state changes removed (redundant, or overwritten before use)
+    int sync_removed;               ///< Number of SYNC commands removed (duplicated)
+    int appends_removed;            ///< Number of RSP buffer commands removed (segments merged with the previous one)
+} rdpq_block_optimize_stats_t;
+
+/**
+ * @brief Optimize the RDP commands stored in a block
+ *
+ * When a block is recorded, all the RDP commands are stored as issued. This
+ * function runs an optimization pass over them, that:
+ *
+ *  * Removes state changes (eg: #rdpq_set_env_color, #rdpq_set_combiner_raw,
+ *    #rdpq_set_tile) that set a register to the value it already has, or
+ *    whose value is overwritten before any command uses it.
+ *  * Removes SYNC commands that duplicate a previous SYNC of the same kind
+ *    with no drawing or loading in between.
+ *  * Compacts the RDP buffers of the block, and removes the RSP commands
+ *    sending segments of the buffers that became empty.
+ *
+ * The optimizer is conservative: it only analyzes runs of RDP commands
+ * written by the CPU, and assumes that any command executed by RSP in
+ * between (including nested blocks) might have changed all the RDP state.
+ * So the optimized block always draws exactly the same as the original one.
+ *
+ * The optimizer needs to know where each run of RDP commands begins, which
+ * is recorded during #rspq_block_begin / #rspq_block_end only while
+ * #RDPQ_CFG_BLOCKOPT is enabled (see #rdpq_config_enable). For other blocks,
+ * this function does nothing. Blocks recorded with #RDPQ_CFG_BLOCKOPT are
+ * optimized automatically by #rspq_block_run the first time they are run:
+ * call this function to pay the cost in advance (eg: at loading time), or
+ * to get the statistics.
+ *
+ * The optimization can be done only once per block, and must be done before
+ * the block is run for the first time.
+ *
+ * @param block         Block to optimize
+ * @param[out] stats    If not NULL, filled with the statistics of the optimization
+ */
+void rdpq_block_optimize(rspq_block_t *block, rdpq_block_optimize_stats_t *stats);
+
 /**
  * @brief Low level functions to set the matrix coefficients for texture format conversion
  */
@@ -0,0 +1,183 @@
+/**
+ * @file rdpq_batch.h
+ * @brief RDP Command queue: sorted 2D render queue
+ * @ingroup rdpq
+ *
+ * This file contains an optional deferred render queue for 2D drawing.
+ *
+ * Normally, rdpq draws in submission order. When drawing many sprites coming
+ * from different textures (eg: multiple sprite sheets), and using different
+ * render modes, submission order might cause the same texture to be loaded
+ * in TMEM many times, and the render mode to be changed back and forth.
+ *
+ * The batch API allows to collect blits and rectangles between
+ * #rdpq_batch_begin and #rdpq_batch_end. Each item is tagged with a layer,
+ * a render mode and a texture. When the batch is ended, items are replayed
+ * in an order that groups items with the same render mode and texture,
+ * so that each render mode is applied only once, and consecutive items with
+ * the same texture are drawn without loading it again in TMEM. The batch
+ * tracks which texture is resident in TMEM while it is drawn, independently
+ * of #RDPQ_CFG_TEXCACHE. A load is skipped only if the whole blit fits TMEM
+ * and no render mode is applied between the two items.
+ *
+ * Reordering is always safe:
+ *
+ *  * Layers are drawn in ascending order. Items of a layer are always drawn
+ *    after all items of lower layers.
+ *  * Within a layer, an item is never moved before a previously submitted
+ *    item whose bounding box on screen overlaps with it. So the final image
+ *    is the same as if the items were drawn in submission order.
+ *
+ * Sorting costs O(n) CPU time on average: overlaps are searched only among
+ * items that are close on screen, and items are grouped by render mode and
+ * texture as they become ready to be drawn. The worst case is a batch where
+ * most items overlap with each other (eg: hundreds of sprites stacked in a
+ * small area), which costs O(n^2) as each overlapping pair must be tracked.
+ * Overlaps are only tracked within a layer, so splitting such items in
+ * multiple layers reduces the cost.
+ *
+ * Render modes are specified as rspq blocks containing only mode changes
+ * (eg: #rdpq_set_mode_standard, #rdpq_mode_combiner, etc.):
+ *
+ * @code{.c}
+ *      // Record the render modes once
+ *      rspq_block_begin();
+ *          rdpq_set_mode_copy(true);
+ *      rspq_block_t *mode_sprites = rspq_block_end();
+ *
+ *      rspq_block_begin();
+ *          rdpq_set_mode_standard();
+ *          rdpq_mode_combiner(RDPQ_COMBINER_FLAT);
+ *      rspq_block_t *mode_rects = rspq_block_end();
+ *
+ *      // Every frame
+ *      rdpq_batch_begin();
+ *      for (int i=0; i<num_enemies; i++) {
+ *          rdpq_batch_mode(mode_sprites);
+ *          rdpq_batch_sprite_blit(enemies[i].sprite, enemies[i].x, enemies[i].y, NULL);
+ *          rdpq_batch_mode(mode_rects);
+ *          rdpq_batch_fill_rectangle(enemies[i].x, enemies[i].y - 4,
+ *              enemies[i].x + enemies[i].hp, enemies[i].y - 2, RGBA32(255,0,0,255));
+ *      }
+ *      rdpq_batch_end(NULL);
+ * @endcode
+ */
+
+#ifndef LIBDRAGON_RDPQ_BATCH_H
+#define LIBDRAGON_RDPQ_BATCH_H
+
+#include <stdint.h>
+#include "graphics.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+///@cond
+typedef struct rspq_block_s rspq_block_t;
+typedef struct rdpq_blitparms_s rdpq_blitparms_t;
+///@endcond
+
+/**
+ * @brief Statistics of a batch, returned by #rdpq_batch_end
+ *
+ * Texture switches are counted between consecutive textured items, and
+ * mode switches between consecutive items. They describe the order of the
+ * items: the texture loads that were actually skipped are counted in
+ * tex_loads_skipped.
+ */
+typedef struct rdpq_batch_stats_s {
+    int items;                  ///< Number of items drawn
+    int tex_switches;           ///< Number of texture switches in the replayed order
+    int tex_switches_avoided;   ///< Number of texture switches avoided compared to submission order
+    int mode_switches;          ///< Number of mode switches in the replayed order
+    int mode_switches_avoided;  ///< Number of mode switches avoided compared to submission order
+    int tex_loads_skipped;      ///< Number of texture loads skipped because the texture was still in TMEM
+} rdpq_batch_stats_t;
+
+/**
+ * @brief Begin collecting items into a batch
+ *
+ * After this call, use the rdpq_batch_* functions to add items to the batch.
+ * The layer is reset to 0 and the render mode to NULL (that is, the render
+ * mode active when #rdpq_batch_end is called).
+ *
+ * Batches cannot be nested, and cannot be recorded into rspq blocks.
+ */
+void rdpq_batch_begin(void);
+
+/**
+ * @brief Set the layer for the next items added to the batch
+ *
+ * Layers are drawn in ascending order. Items in different layers are never
+ * reordered relative to each other.
+ *
+ * @param layer     Layer number (default: 0)
+ */
+void rdpq_batch_layer(int layer);
+
+/**
+ * @brief Set the render mode for the next items added to the batch
+ *
+ * The render mode is a rspq block that must contain only render mode
+ * changes. It will be run during #rdpq_batch_end before drawing the items
+ * that use it. The block must stay valid until #rdpq_batch_end is called.
+ *
+ * @param mode      Block that configures the render mode, or NULL to use
+ *                  the render mode active when #rdpq_batch_end is called.
+ */
+void rdpq_batch_mode(rspq_block_t *mode);
+
+/**
+ * @brief Add a blit of a surface to the batch (see #rdpq_tex_blit)
+ *
+ * The surface pixels must not be freed until #rdpq_batch_end is called.
+ *
+ * @param surf      Surface to draw
+ * @param x0        X coordinate on the framebuffer where to draw the surface
+ * @param y0        Y coordinate on the framebuffer where to draw the surface
+ * @param parms     Parameters for the blit operation (or NULL for default)
+ */
+void rdpq_batch_tex_blit(const surface_t *surf, float x0, float y0, const rdpq_blitparms_t *parms);
+
+/**
+ * @brief Add a blit of a sprite to the batch (see #rdpq_sprite_blit)
+ *
+ * The sprite must not be freed until #rdpq_batch_end is called.
+ *
+ * @param sprite    Sprite to draw
+ * @param x0        X coordinate on the framebuffer where to draw the sprite
+ * @param y0        Y coordinate on the framebuffer where to draw the sprite
+ * @param parms     Parameters for the blit operation (or NULL for default)
+ */
+void rdpq_batch_sprite_blit(sprite_t *sprite, float x0, float y0, const rdpq_blitparms_t *parms);
+
+/**
+ * @brief Add a solid rectangle to the batch (see #rdpq_fill_rectangle)
+ *
+ * The color is configured via #rdpq_set_prim_color before drawing, so the
+ * render mode should use the PRIM color (eg: #RDPQ_COMBINER_FLAT).
+ *
+ * @param x0        Top-left X coordinate of the rectangle
+ * @param y0        Top-left Y coordinate of the rectangle
+ * @param x1        Bottom-right *exclusive* X coordinate of the rectangle
+ * @param y1        Bottom-right *exclusive* Y coordinate of the rectangle
+ * @param color     Color of the rectangle
+ */
+void rdpq_batch_fill_rectangle(float x0, float y0, float x1, float y1, color_t color);
+
+/**
+ * @brief Sort the items in the batch and draw them
+ *
+ * The render mode active at the time of the call is preserved: it is used
+ * for items with a NULL mode, and restored after all items are drawn.
+ *
+ * @param[out] stats    If not NULL, filled with statistics about the batch
+ */
+void rdpq_batch_end(rdpq_batch_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -27,6 +27,9 @@
 #define RDPQ_BLOCK_MIN_SIZE   64    ///< RDPQ block minimum size (in 32-bit words)
 #define RDPQ_BLOCK_MAX_SIZE   4192  ///< RDPQ block minimum size (in 32-bit words)
 
+/** @brief Number of records fetched at a time by the rectangle batch command (see #rdpq_fill_rectangle_batch) */
+#define RDPQ_RECT_BATCH_CHUNK      16
+
 /** @brief Set to 1 for the reference implementation of RDPQ_TRIANGLE (on CPU) */
 #define RDPQ_TRIANGLE_REFERENCE    0
 
@@ -154,6 +154,45 @@ surface_t rdpq_debug_get_tmem(void);
  */
 void rdpq_debug_install_hook(void (*hook)(void *ctx, uint64_t* cmd, int cmd_size), void* ctx);
 
+/**
+ * @brief Start capturing the RDP command stream.
+ * 
+ * This function starts recording all RDP commands processed by the debugging
+ * engine (which must be started via #rdpq_debug_start), together with a copy
+ * of the RDRAM ranges that they reference (textures and palettes loaded into
+ * TMEM). The capture can then be saved to a file via #rdpq_debug_capture_stop
+ * and analyzed on the PC with the rdpqdump tool, which can disassemble it,
+ * report per-command statistics, and diff two captures.
+ * 
+ * A typical usage is capturing exactly one frame:
+ * 
+ * @code{.c}
+ *      rdpq_debug_capture_start();
+ *      render_frame();
+ *      FILE *f = fopen("sd:/frame.rdpc", "wb");
+ *      rdpq_debug_capture_stop(f);
+ *      fclose(f);
+ * @endcode
+ * 
+ * Referenced RDRAM ranges are copied at the moment the commands are processed
+ * by the debugging engine, which happens shortly after the RDP has run them.
+ * 
+ * The file format is documented in rdpq_debug_internal.h.
+ */
+void rdpq_debug_capture_start(void);
+
+/**
+ * @brief Stop capturing the RDP command stream and save it.
+ * 
+ * This function waits for all pending commands to be processed (via #rspq_wait),
+ * stops the capture started by #rdpq_debug_capture_start and writes it to
+ * the specified file. All memory used by the capture is then released.
+ * 
+ * @param   out     File to write the capture to, or NULL to discard it
+ * @return  true if the capture was successfully written, false on I/O error
+ */
+bool rdpq_debug_capture_stop(FILE *out);
+
 /**
  * @brief Disassemble a RDP command
  * 
@@ -0,0 +1,104 @@
+/**
+ * @file rdpq_dynres.h
+ * @brief RDP Command queue: dynamic resolution scaling
+ * @ingroup rdpq
+ *
+ * This file contains a helper to keep a steady frame rate in heavy scenes
+ * by lowering the rendering resolution, instead of dropping frames.
+ *
+ * Each frame is rendered into the top-left portion of the display buffer,
+ * and the VI scales it up to fill the screen (see #display_set_frame_size),
+ * so no buffer is ever reallocated. The size of the portion is adjusted
+ * every frame from the RDP busy time of the previous frames, measured via
+ * the RDP hardware counters: when the RDP is busy for longer than the
+ * target fraction of the frame, the resolution is lowered quickly; when it
+ * has some headroom, the resolution is raised slowly, to avoid oscillations.
+ *
+ * @code{.c}
+ *      rdpq_dynres_init(NULL);
+ *
+ *      while (1) {
+ *          surface_t *disp = display_get();
+ *          const surface_t *fb = rdpq_dynres_attach(disp, NULL);
+ *
+ *          // Draw using fb->width and fb->height as screen size
+ *          draw_scene(fb->width, fb->height);
+ *
+ *          rdpq_dynres_detach_show();
+ *      }
+ * @endcode
+ *
+ * Since the frame size can change every frame, the game must draw using the
+ * size of the surface returned by #rdpq_dynres_attach (or scale its coordinates
+ * by #rdpq_dynres_get_scale). HUD elements that must stay sharp can be drawn
+ * at the full resolution only if the scale is 1.
+ */
+
+#ifndef LIBDRAGON_RDPQ_DYNRES_H
+#define LIBDRAGON_RDPQ_DYNRES_H
+
+#include <stdint.h>
+#include "surface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Parameters of dynamic resolution scaling (see #rdpq_dynres_init) */
+typedef struct {
+    float min_scale;        ///< Minimum scale factor of each axis (default: 0.5)
+    float max_scale;        ///< Maximum scale factor of each axis (default: 1.0)
+    float target_load;      ///< Target fraction of the frame time in which the RDP is busy (default: 0.85)
+    float max_increase;     ///< Maximum relative increase of the scale per frame (default: 0.02)
+} rdpq_dynres_parms_t;
+
+/**
+ * @brief Initialize dynamic resolution scaling
+ *
+ * The frame time is the duration of a vblank (depending on the TV type),
+ * multiplied by the frame pacing if configured (see #display_set_frame_pacing).
+ *
+ * @param parms     Parameters (or NULL to use the defaults)
+ */
+void rdpq_dynres_init(const rdpq_dynres_parms_t *parms);
+
+/**
+ * @brief Attach rdpq to a display buffer, at the resolution chosen for this frame
+ *
+ * This function picks the scale of the frame, configures the display
+ * buffer to show the corresponding portion (see #display_set_frame_size),
+ * and attaches rdpq to it (see #rdpq_attach).
+ *
+ * @param disp      Display buffer to draw to (as returned by #display_get)
+ * @param z         Z-buffer with the same size of the display (or NULL).
+ *                  The same portion is used as Z-buffer.
+ * @return          The surface that was attached (a sub-surface of disp),
+ *                  valid until the next call.
+ */
+const surface_t *rdpq_dynres_attach(surface_t *disp, surface_t *z);
+
+/**
+ * @brief Detach rdpq and show the display buffer when the RDP is done
+ *
+ * This is equivalent to #rdpq_detach_show for a frame attached via
+ * #rdpq_dynres_attach.
+ */
+void rdpq_dynres_detach_show(void);
+
+/**
+ * @brief Get the scale factor of the current frame (on each axis)
+ */
+float rdpq_dynres_get_scale(void);
+
+/**
+ * @brief Get the RDP load of the last measured frame
+ *
+ * @return          Fraction of the frame time in which the RDP was busy
+ */
+float rdpq_dynres_get_load(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
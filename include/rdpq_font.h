@@ -0,0 +1,187 @@
+/**
+ * @file rdpq_font.h
+ * @brief RDP Command queue: bitmap font rendering
+ * @ingroup rdpq
+ *
+ * This file contains a text renderer that draws bitmap fonts using the RDP.
+ *
+ * Fonts are created with the mkfont tool, that converts fonts in the BMFont
+ * format into .font64 files. Glyphs are packed into 4bpp atlas pages (I4 or
+ * IA4) that fit entirely in TMEM, so drawing text only requires one texture
+ * load per atlas page in use (and usually Latin text fits a single page).
+ * Kerning pairs are applied during layout.
+ *
+ * Text is laid out once into a #rdpq_text_t object, that contains the list of
+ * glyph rectangles grouped by atlas page. Drawing a laid-out text enqueues one
+ * RSP command per atlas page (see #rdpq_texture_rectangle_batch), independently
+ * of the number of glyphs, so the CPU cost is very small. The same text
+ * can be drawn at any position, any number of times.
+ *
+ * For texts that change often, #rdpq_font_print and #rdpq_font_printf keep
+ * an internal cache of laid-out strings, so that strings drawn every frame
+ * (eg: labels, or a score that changes occasionally) are not laid out again.
+ *
+ * @code{.c}
+ *      rdpq_font_t *fnt = rdpq_font_load("rom:/Roboto.font64");
+ *
+ *      // Lay out a static text once
+ *      rdpq_text_t *title = rdpq_text_layout(fnt, "Press START", -1);
+ *
+ *      while (1) {
+ *          rdpq_attach(display_get(), NULL);
+ *          ...
+ *          rdpq_font_begin(RGBA32(0xFF, 0xFF, 0xFF, 0xFF));
+ *          rdpq_text_draw(title, 100, 200);
+ *          rdpq_font_printf(fnt, 20, 20, "Score: %d", score);
+ *          rdpq_font_end();
+ *          rdpq_detach_show();
+ *      }
+ * @endcode
+ */
+
+#ifndef LIBDRAGON_RDPQ_FONT_H
+#define LIBDRAGON_RDPQ_FONT_H
+
+#include <stdint.h>
+#include "graphics.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief A font loaded from a .font64 file (opaque structure, see #rdpq_font_load) */
+typedef struct rdpq_font_s rdpq_font_t;
+
+/** @brief A laid-out text, ready to be drawn (opaque structure, see #rdpq_text_layout) */
+typedef struct rdpq_text_s rdpq_text_t;
+
+/**
+ * @brief Load a font from a .font64 file
+ *
+ * @param fn            Filename (including filesystem prefix, eg: "rom:/font.font64")
+ * @return              The loaded font
+ */
+rdpq_font_t *rdpq_font_load(const char *fn);
+
+/**
+ * @brief Free a font
+ *
+ * All the texts laid out with the font must be freed before.
+ *
+ * @param fnt           Font to free
+ */
+void rdpq_font_free(rdpq_font_t *fnt);
+
+/**
+ * @brief Get the distance between two lines of text in pixels
+ */
+int rdpq_font_get_line_height(rdpq_font_t *fnt);
+
+/**
+ * @brief Configure the render mode to draw text in the specified color
+ *
+ * This pushes the current render mode (see #rdpq_mode_push) and configures
+ * a standard mode with alpha blending, where the color of the text comes
+ * from the PRIM color, and the coverage of each pixel from the font atlas.
+ * Call #rdpq_font_end to restore the previous render mode.
+ *
+ * Until #rdpq_font_end, consecutive texts drawn with the same atlas page
+ * load it in TMEM only once, unless TMEM is used by other draws in between.
+ *
+ * Texts can also be drawn with a custom render mode, in which case this
+ * function must not be called: the atlas is loaded in TILE0.
+ *
+ * @param color         Color of the text
+ */
+void rdpq_font_begin(color_t color);
+
+/**
+ * @brief Restore the render mode active before #rdpq_font_begin
+ */
+void rdpq_font_end(void);
+
+/**
+ * @brief Lay out a text for drawing
+ *
+ * The text is encoded in UTF-8. Newlines ('\\n') start a new line. Codepoints
+ * that are not present in the font are skipped.
+ *
+ * @param fnt           Font to use
+ * @param text          Text to lay out
+ * @param nbytes        Number of bytes of the text, or -1 if it is null-terminated
+ * @return              The laid-out text (must be freed with #rdpq_text_free)
+ */
+rdpq_text_t *rdpq_text_layout(rdpq_font_t *fnt, const char *text, int nbytes);
+
+/**
+ * @brief Free a laid-out text
+ *
+ * The text can be freed while the RSP is still drawing it: this function
+ * waits for pending draws to be completed before releasing memory.
+ *
+ * @param text          Text to free
+ */
+void rdpq_text_free(rdpq_text_t *text);
+
+/**
+ * @brief Draw a laid-out text
+ *
+ * The position refers to the left end of the baseline of the first line.
+ * The glyph rectangles are read by the RSP when the command is executed.
+ * If this function is called while recording a block, the text must not be
+ * freed until the block is freed.
+ *
+ * @param text          Text to draw
+ * @param x             X coordinate of the beginning of the baseline
+ * @param y             Y coordinate of the baseline of the first line
+ */
+void rdpq_text_draw(rdpq_text_t *text, float x, float y);
+
+/**
+ * @brief Get the size of the bounding box of a laid-out text
+ *
+ * The width is the maximum horizontal advance of the lines, and the height
+ * is the number of lines multiplied by the line height.
+ *
+ * @param text          Text
+ * @param[out] width    Width in pixels (can be NULL)
+ * @param[out] height   Height in pixels (can be NULL)
+ */
+void rdpq_text_get_size(rdpq_text_t *text, int *width, int *height);
+
+/**
+ * @brief Draw a text, using a cache of laid-out texts
+ *
+ * This is equivalent to laying out the text and drawing it, but the layout
+ * is kept in a small internal cache, so drawing the same strings frame after
+ * frame does not lay them out again.
+ *
+ * Texts in the cache can be evicted and freed by later calls, so this
+ * function cannot be called while recording a block: lay out the text with
+ * #rdpq_text_layout and draw it with #rdpq_text_draw instead.
+ *
+ * @param fnt           Font to use
+ * @param x             X coordinate of the beginning of the baseline
+ * @param y             Y coordinate of the baseline of the first line
+ * @param text          Text to draw (UTF-8, null-terminated)
+ */
+void rdpq_font_print(rdpq_font_t *fnt, float x, float y, const char *text);
+
+/**
+ * @brief Draw a formatted text, using a cache of laid-out texts
+ *
+ * @see #rdpq_font_print
+ *
+ * @param fnt           Font to use
+ * @param x             X coordinate of the beginning of the baseline
+ * @param y             Y coordinate of the baseline of the first line
+ * @param fmt           Format string (printf-style)
+ */
+__attribute__((format(printf, 4, 5)))
+void rdpq_font_printf(rdpq_font_t *fnt, float x, float y, const char *fmt, ...);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
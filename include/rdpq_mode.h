@@ -866,6 +866,78 @@ void rdpq_mode_begin(void);
  */
 void rdpq_mode_end(void);
 
+/**
+ * @brief A precompiled render mode
+ *
+ * This structure holds a whole render mode (as configured by the mode API),
+ * together with the SET_COMBINE and SET_OTHER_MODES commands that RSP
+ * calculated for it. It can be created once via #rdpq_mode_state_capture
+ * (eg: one per material, at init time), and then applied any number of
+ * times via #rdpq_mode_state_apply.
+ *
+ * Applying a precompiled render mode is a single command, and RSP sends
+ * the precalculated commands to RDP as-is, without running the render
+ * mode calculations again. This is much faster than configuring the
+ * same render mode via a sequence of `rdpq_set_mode_*` and `rdpq_mode_*`
+ * calls, each of which triggers a full recalculation.
+ *
+ * The contents of this structure must be considered opaque.
+ */
+typedef struct rdpq_mode_state_s {
+    uint64_t combiner;              ///< Combiner formula (as configured via the mode API)
+    uint64_t combiner_mipmapmask;   ///< Combiner mask used for interpolated mipmaps
+    uint32_t blend_step0;           ///< First blender step (fog)
+    uint32_t blend_step1;           ///< Second blender step (blending)
+    uint64_t other_modes;           ///< Calculated SET_OTHER_MODES (with extension flags in the MSB)
+    uint64_t combiner_final;        ///< Calculated SET_COMBINE command
+} rdpq_mode_state_t;
+
+/**
+ * @brief Capture the current render mode into a precompiled render mode
+ *
+ * This function executes a full sync (#rspq_wait) and then reads the current
+ * render mode from the RSP state, so it should be called at init time (or
+ * anyway outside of the main loop). For instance:
+ *
+ * @code{.c}
+ *      // At init time: configure the material and capture it
+ *      rdpq_set_mode_standard();
+ *      rdpq_mode_combiner(RDPQ_COMBINER_TEX_SHADE);
+ *      rdpq_mode_blender(RDPQ_BLENDER_MULTIPLY);
+ *      rdpq_mode_mipmap(MIPMAP_INTERPOLATE, 3);
+ *      rdpq_mode_state_capture(&mat_glass);
+ *
+ *      // Every frame: apply the whole material with a single command
+ *      rdpq_mode_state_apply(&mat_glass);
+ * @endcode
+ *
+ * Only the render mode itself is captured, that is what is configured via
+ * `rdpq_set_mode_*` and `rdpq_mode_*`: this is the same state that is saved
+ * by #rdpq_mode_push. Other RDP registers (eg: colors, like the BLEND color
+ * used by #rdpq_mode_alphacompare) are not part of it.
+ *
+ * This function cannot be called while recording a block, nor between
+ * #rdpq_mode_begin and #rdpq_mode_end.
+ *
+ * @param[out] state    Precompiled render mode to fill
+ */
+void rdpq_mode_state_capture(rdpq_mode_state_t *state);
+
+/**
+ * @brief Apply a precompiled render mode
+ *
+ * This function configures the render mode previously captured with
+ * #rdpq_mode_state_capture. The result is the same as calling again
+ * the mode API functions that were used to configure it, but it is
+ * performed with a single command, and no recalculation is done by RSP.
+ *
+ * After this call, the render mode can be further changed with
+ * the mode API as usual, and saved with #rdpq_mode_push.
+ *
+ * @param state         Precompiled render mode to apply
+ */
+void rdpq_mode_state_apply(const rdpq_mode_state_t *state);
+
 /********************************************************************
  * Internal functions (not part of public API)
  ********************************************************************/
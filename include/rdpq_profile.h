@@ -0,0 +1,180 @@
+/**
+ * @file rdpq_profile.h
+ * @brief RDP Command queue: frame profiler based on RDP hardware counters
+ * @ingroup rdpq
+ *
+ * This file contains a simple profiler that measures how the RDP spends
+ * its time, using the hardware counters of the RDP command interface:
+ *
+ *  * CLOCK: RDP clock cycles elapsed.
+ *  * BUSY: cycles in which the RDP was busy processing commands.
+ *  * PIPE BUSY: cycles in which the RDP pixel pipeline was busy (drawing).
+ *  * TMEM BUSY: cycles in which TMEM was busy (loading textures).
+ *
+ * The counters are sampled around each frame (#rdpq_profile_frame) and
+ * around sections labelled by the user (#rdpq_profile_begin /
+ * #rdpq_profile_end). Since the RDP runs asynchronously, the counters must
+ * be sampled when the RDP reaches a specific point of the command stream,
+ * rather than when the CPU calls the function: this is done by scheduling
+ * a SYNC_FULL (see #rdpq_sync_full) whose callback reads the counters.
+ * Notice that a SYNC_FULL waits for the RDP pipeline to be fully drained,
+ * so each section adds a small overhead: keep the sections coarse (eg:
+ * "sky", "world", "hud").
+ *
+ * Statistics (minimum, average and maximum per frame) are accumulated over
+ * a configurable number of frames, and can be obtained via
+ * #rdpq_profile_get_stats, printed via #rdpq_profile_dump, or drawn on
+ * screen via #rdpq_profile_draw.
+ *
+ * To interpret the results, compare the RDP busy time with the duration
+ * of the frame and with the CPU time:
+ *
+ *  * If the RDP is busy for most of the frame, the game is RDP bound. If
+ *    the pipe is busy most of that time, it is fill-rate bound; if TMEM
+ *    is busy for a large part of it, texture loads are the bottleneck.
+ *  * If the RDP is idle for a large part of the frame, it is being starved
+ *    by the CPU or by the RSP. Bracket the CPU work with #TICKS_READ to
+ *    tell which one: if it takes most of the frame, the game is CPU bound,
+ *    otherwise it is likely RSP bound (or waiting for vblank).
+ *
+ * @code{.c}
+ *      rdpq_profile_start(60);
+ *
+ *      while (1) {
+ *          surface_t *disp = display_get();
+ *          rdpq_attach(disp, NULL);
+ *
+ *          rdpq_profile_begin("sky");
+ *          draw_sky();
+ *          rdpq_profile_end();
+ *
+ *          rdpq_profile_begin("world");
+ *          draw_world();
+ *          rdpq_profile_end();
+ *
+ *          rdpq_detach_wait();
+ *          rdpq_profile_draw(disp, 16, 16);
+ *          display_show(disp);
+ *          rdpq_profile_frame();
+ *      }
+ * @endcode
+ */
+
+#ifndef LIBDRAGON_RDPQ_PROFILE_H
+#define LIBDRAGON_RDPQ_PROFILE_H
+
+#include <stdint.h>
+#include "surface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Maximum number of sections that can be profiled */
+#define RDPQ_PROFILE_MAX_SECTIONS       16
+
+/** @brief Minimum, average and maximum value of a counter per frame */
+typedef struct {
+    uint32_t min;                   ///< Minimum value in a frame
+    uint32_t avg;                   ///< Average value per frame
+    uint32_t max;                   ///< Maximum value in a frame
+} rdpq_profile_value_t;
+
+/**
+ * @brief Statistics of a profiled section (or of the whole frame)
+ *
+ * All the RDP values are expressed in RDP clock cycles (see #RCP_FREQUENCY).
+ * If a section is run multiple times within a frame, the values of a frame
+ * are the sum of all the runs.
+ */
+typedef struct {
+    const char *name;               ///< Name of the section ("frame" for the whole frame)
+    int frames;                     ///< Number of frames in which the section was run
+    rdpq_profile_value_t clock;     ///< RDP clock cycles elapsed
+    rdpq_profile_value_t busy;      ///< RDP clock cycles in which the RDP was busy
+    rdpq_profile_value_t pipe_busy; ///< RDP clock cycles in which the pixel pipeline was busy
+    rdpq_profile_value_t tmem_busy; ///< RDP clock cycles in which TMEM was busy
+    rdpq_profile_value_t cpu;       ///< CPU ticks elapsed between calls to #rdpq_profile_frame (only for the whole frame)
+} rdpq_profile_stats_t;
+
+/**
+ * @brief Start profiling
+ *
+ * Statistics are accumulated over the specified number of frames, and then
+ * published (see #rdpq_profile_get_stats), and accumulation starts again.
+ *
+ * @param num_frames        Number of frames to accumulate statistics over
+ */
+void rdpq_profile_start(int num_frames);
+
+/**
+ * @brief Stop profiling
+ *
+ * Further calls to the other profiling functions are ignored, so they can be
+ * left in the code.
+ */
+void rdpq_profile_stop(void);
+
+/**
+ * @brief Mark the end of a frame
+ *
+ * This must be called once per frame, at the same point of the frame (eg:
+ * after #display_show).
+ */
+void rdpq_profile_frame(void);
+
+/**
+ * @brief Begin a profiled section
+ *
+ * Sections can be nested: each #rdpq_profile_end closes the last section
+ * that was begun.
+ *
+ * @param name              Name of the section. The string is not copied,
+ *                          so it should be a literal.
+ */
+void rdpq_profile_begin(const char *name);
+
+/**
+ * @brief End the last profiled section that was begun
+ */
+void rdpq_profile_end(void);
+
+/**
+ * @brief Get the statistics of the last completed accumulation period
+ *
+ * The first entry is always the whole frame, followed by the sections in
+ * the order in which they were first begun.
+ *
+ * @param[out] stats        Array that will be filled with the statistics
+ * @param max               Size of the array
+ * @return                  Number of entries filled (0 if no period was completed yet)
+ */
+int rdpq_profile_get_stats(rdpq_profile_stats_t *stats, int max);
+
+/**
+ * @brief Print the statistics of the last completed accumulation period to the debug log
+ */
+void rdpq_profile_dump(void);
+
+/**
+ * @brief Draw a compact overlay with the statistics of the last completed period
+ *
+ * For each section, the overlay shows the average RDP time in milliseconds, and
+ * the percentage of time in which the RDP, the pipeline and TMEM were busy.
+ * The last line shows the average duration of the frame as seen by the CPU.
+ * Notice that this function changes the colors configured via #graphics_set_color.
+ *
+ * The overlay is drawn by the CPU, so the RDP must have finished drawing to
+ * the surface (eg: call this after #rdpq_detach_wait).
+ *
+ * @param surf              Surface to draw to
+ * @param x                 X coordinate of the top-left corner of the overlay
+ * @param y                 Y coordinate of the top-left corner of the overlay
+ */
+void rdpq_profile_draw(surface_t *surf, int x, int y);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -407,6 +407,78 @@ inline void __rdpq_texture_rectangle_flip_raw_fx(rdpq_tile_t tile, uint16_t x0,
 })
 
 
+/**
+ * @brief A rectangle in a batch (see #rdpq_fill_rectangle_batch and #rdpq_texture_rectangle_batch)
+ * 
+ * This is a compact 16-byte record describing a rectangle to draw. Coordinates
+ * are stored in fixed point, exactly as the RDP uses them: positions and sizes
+ * are 10.2 (pixels multiplied by 4), texture coordinates are 10.5 (texels
+ * multiplied by 32).
+ * 
+ * Rectangles partially out of the top or left border of the screen are clipped
+ * (adjusting the texture coordinates accordingly). The bottom-right corner must
+ * be within 1024x1024 pixels.
+ */
+typedef struct rdpq_rect_item_s {
+    int16_t x;          ///< Top-left X coordinate (10.2 fixed point)
+    int16_t y;          ///< Top-left Y coordinate (10.2 fixed point)
+    int16_t width;      ///< Width of the rectangle (10.2 fixed point)
+    int16_t height;     ///< Height of the rectangle (10.2 fixed point)
+    int16_t s;          ///< S coordinate of the texture at the top-left corner (10.5 fixed point)
+    int16_t t;          ///< T coordinate of the texture at the top-left corner (10.5 fixed point)
+    color_t color;      ///< Color of the rectangle (used only if requested)
+} __attribute__((aligned(8))) rdpq_rect_item_t;
+
+/**
+ * @brief Draw a batch of solid rectangles, expanded by the RSP
+ * 
+ * This function is equivalent to calling #rdpq_fill_rectangle for each item
+ * of the array (optionally preceded by #rdpq_set_prim_color), but it enqueues
+ * a single RSP command: the RSP fetches the array from RDRAM via DMA, and
+ * generates the RDP commands by itself. This makes the CPU cost independent
+ * of the number of rectangles.
+ * 
+ * Like #rdpq_fill_rectangle, bounds are exclusive in all render modes. Each
+ * rectangle covers the area from (x, y) to (x+width, y+height).
+ * 
+ * The array is read by RSP at the time the command is executed, so it must
+ * not be modified or freed until then (eg: use #rspq_wait, or double buffering).
+ * The data cache is written back by this function. If the command is recorded
+ * in a block, the array is read every time the block is run.
+ * 
+ * @param[in]   rects       Array of rectangles (must be 8-byte aligned)
+ * @param[in]   num_rects   Number of rectangles in the array
+ * @param[in]   prim_color  If true, the color of each rectangle is set as
+ *                          PRIM color (see #rdpq_set_prim_color) before drawing it.
+ *                          The PRIM color is only changed when it differs from the
+ *                          previous one.
+ * 
+ * @see #rdpq_texture_rectangle_batch
+ */
+void rdpq_fill_rectangle_batch(const rdpq_rect_item_t *rects, int num_rects, bool prim_color);
+
+/**
+ * @brief Draw a batch of textured rectangles, expanded by the RSP
+ * 
+ * This function is equivalent to calling #rdpq_texture_rectangle for each item
+ * of the array (optionally preceded by #rdpq_set_prim_color), but it enqueues
+ * a single RSP command (see #rdpq_fill_rectangle_batch). The texture is drawn
+ * without scaling, starting at the S,T coordinates of each item.
+ * 
+ * This is the fastest way to draw a large number of sprites coming from the same
+ * texture in TMEM (eg: tiles of a tile map, particles, or glyphs of a font).
+ * 
+ * @param[in]   tile        Tile descriptor referring to the texture in TMEM to use for drawing
+ * @param[in]   rects       Array of rectangles (must be 8-byte aligned)
+ * @param[in]   num_rects   Number of rectangles in the array
+ * @param[in]   prim_color  If true, the color of each rectangle is set as PRIM color
+ *                          before drawing it (eg: to tint the texture via the combiner).
+ * 
+ * @see #rdpq_fill_rectangle_batch
+ */
+void rdpq_texture_rectangle_batch(rdpq_tile_t tile, const rdpq_rect_item_t *rects, int num_rects, bool prim_color);
+
+
 /**
  * \}
  */
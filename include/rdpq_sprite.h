@@ -20,6 +20,7 @@ extern "C" {
 
 ///@cond
 typedef struct sprite_s sprite_t;
+typedef struct sprite_atlas_s sprite_atlas_t;
 typedef struct rdpq_texparms_s rdpq_texparms_t;
 typedef struct rdpq_blitparms_s rdpq_blitparms_t;
 ///@endcond
@@ -120,6 +121,26 @@ int rdpq_sprite_upload(rdpq_tile_t tile, sprite_t *sprite, const rdpq_texparms_t
  */
 void rdpq_sprite_blit(sprite_t *sprite, float x0, float y0, const rdpq_blitparms_t *parms);
 
+/**
+ * @brief Blit an image of a sprite atlas to the active framebuffer
+ * 
+ * This function is similar to #rdpq_sprite_blit, but it draws an image
+ * of a sprite atlas, selected by name (see #sprite_atlas_find). All the
+ * features of #rdpq_tex_blit are supported; the source rectangle specified
+ * in the parameters (s0, t0, width, height) is relative to the image.
+ * 
+ * Atlas pages always fit TMEM, so the whole page containing the image is
+ * uploaded. Blitting other images of the same page afterwards does not need
+ * to reload TMEM, as long as it was not overwritten in the meantime.
+ * 
+ * @param atlas     Sprite atlas
+ * @param name      Name of the image to blit
+ * @param x0        X coordinate on the framebuffer where to draw the image
+ * @param y0        Y coordinate on the framebuffer where to draw the image
+ * @param parms     Parameters for the blit operation (or NULL for default)
+ */
+void rdpq_sprite_atlas_blit(sprite_atlas_t *atlas, const char *name, float x0, float y0, const rdpq_blitparms_t *parms);
+
 #ifdef __cplusplus
 }
 #endif
@@ -106,6 +106,19 @@ int tex_loader_calc_max_height(tex_loader_t *tload, int width);
  * #surface_make_sub and pass it to #rdpq_tex_upload. See #rdpq_tex_upload_sub
  * for an example of both techniques.
  * 
+ * If the TMEM residency cache is enabled via
+ * `rdpq_config_enable(RDPQ_CFG_TEXCACHE)`, rdpq remembers which textures are
+ * currently resident in TMEM. If the same rectangle of the same surface is
+ * uploaded again at the same TMEM address, and that area of TMEM was not
+ * overwritten in the meantime, the load is skipped and only the tile
+ * descriptor is configured. TMEM contents are forgotten at each
+ * #rdpq_sync_full (eg: at the end of each frame, see #rdpq_detach, or in
+ * #rspq_wait), so hits only happen within a frame or render pass; the
+ * SYNC_FULLs used internally to sample the RDP (eg: by rdpq_profile and
+ * rdpq_dynres) do not invalidate the cache. The cache is disabled by default
+ * because a surface that is modified by the CPU and then uploaded again
+ * before the next #rdpq_sync_full would be drawn with stale TMEM contents.
+ * 
  * @param tile       Tile descriptor that will be initialized with this texture
  * @param tex        Surface containing the texture to load
  * @param parms      All optional parameters on where to load the texture and how to sample it. Refer to #rdpq_texparms_t for more information.
@@ -190,6 +203,15 @@ int rdpq_tex_upload_sub(rdpq_tile_t tile, const surface_t *tex, const rdpq_texpa
  * for 256 colors in total, which allows for one palette for a CI8 texture, or up
  * to 16 palettes for CI4 textures.
  * 
+ * If the TMEM residency cache is enabled via
+ * `rdpq_config_enable(RDPQ_CFG_TEXCACHE)`, the load is skipped when the same
+ * colors of the same palette are still resident in TMEM at the same position,
+ * like for #rdpq_tex_upload. This makes it cheap to upload the palette before
+ * drawing each sprite, when many sprites share the same palette (see
+ * #sprite_palette_load). With the cache disabled (the default), the palette
+ * is always loaded, so that palettes modified by the CPU (eg: for palette
+ * animations) are always drawn with the current colors.
+ * 
  * @param tlut          Pointer to the first color entry to load (must be 8-byte aligned) 
  * @param color_idx     Index of the first color entry in TMEM (0-255)
  * @param num_colors    Number of color entries to load (1-256)
@@ -400,6 +422,28 @@ typedef struct rdpq_blitparms_s {
  */
 void rdpq_tex_blit(const surface_t *surf, float x0, float y0, const rdpq_blitparms_t *parms);
 
+/**
+ * @brief Convert a surface into another format, using the RDP
+ *
+ * This is an accelerated alternative to #surface_convert for large surfaces:
+ * the destination is attached as framebuffer and the source is drawn on it
+ * with #rdpq_tex_blit, so that the RDP performs the conversion. The source
+ * can be in any non-palettized texture format, while the destination must
+ * be #FMT_RGBA16 or #FMT_RGBA32.
+ *
+ * As any other rdpq function, the conversion is asynchronous: it is complete
+ * when the RDP has processed it (eg: after #rspq_wait), but following
+ * rdpq commands can already use the destination as a texture.
+ *
+ * @note The RDP writes coverage information in the alpha channel of the
+ *       framebuffer, so all pixels of the destination will be opaque. Use
+ *       #surface_convert to preserve transparency.
+ *
+ * @param dst            Destination surface (#FMT_RGBA16 or #FMT_RGBA32)
+ * @param src            Source surface (same size as the destination)
+ */
+void rdpq_tex_convert(surface_t *dst, const surface_t *src);
+
 ///@cond
 __attribute__((deprecated("use rdpq_tex_upload instead")))
 static inline int rdpq_tex_load(rdpq_tile_t tile, surface_t *tex, const rdpq_texparms_t *parms) {
@@ -0,0 +1,184 @@
+/**
+ * @file rdpq_tilemap.h
+ * @brief RDP Command queue: tile layer renderer
+ * @ingroup rdpq
+ *
+ * This file contains a renderer for 2D tile layers (tilemaps): a grid of
+ * tile indices, referring to tiles of a tileset sprite, drawn at a scrolling
+ * position within a viewport.
+ *
+ * The renderer is designed so that the cost of drawing a layer is small and
+ * does not depend on the size of the map:
+ *
+ *  * Only the tiles visible in the viewport are drawn.
+ *  * The tileset is split in chunks that fit in TMEM. Visible tiles are
+ *    grouped by chunk, so that each chunk is loaded at most once per frame,
+ *    and all its tiles are drawn with a single RSP command (see
+ *    #rdpq_texture_rectangle_batch).
+ *  * The list of visible tiles is rebuilt only when the layer scrolls by
+ *    a whole tile (or tiles are changed). Scrolling by a fraction of a tile
+ *    just changes the offset applied by the RSP to the whole list.
+ *
+ * Multiple layers (eg: for parallax scrolling) can be drawn by creating
+ * multiple tilemaps, and drawing them in order with different scroll
+ * positions.
+ *
+ * @code{.c}
+ *      sprite_t *tileset = sprite_load("rom:/tileset.sprite");
+ *      rdpq_tilemap_t *bg = rdpq_tilemap_new(tileset, 16, 16, MAP_WIDTH, MAP_HEIGHT, map_bg);
+ *      rdpq_tilemap_t *fg = rdpq_tilemap_new(tileset, 16, 16, MAP_WIDTH, MAP_HEIGHT, map_fg);
+ *
+ *      while (1) {
+ *          rdpq_attach(display_get(), NULL);
+ *          rdpq_set_mode_copy(true);
+ *          rdpq_tilemap_draw(bg, camera_x * 0.5f, camera_y * 0.5f);
+ *          rdpq_tilemap_draw(fg, camera_x, camera_y);
+ *          rdpq_detach_show();
+ *      }
+ * @endcode
+ *
+ * The render mode is not changed by the tilemap, except for the TLUT mode
+ * which is configured according to the format of the tileset (like
+ * #rdpq_sprite_blit does). Tiles are drawn without scaling, so both the
+ * standard and the copy mode can be used.
+ */
+
+#ifndef LIBDRAGON_RDPQ_TILEMAP_H
+#define LIBDRAGON_RDPQ_TILEMAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+///@cond
+typedef struct sprite_s sprite_t;
+///@endcond
+
+/** @brief Tile index of an empty cell (nothing is drawn) */
+#define RDPQ_TILEMAP_EMPTY      0xFFFF
+
+/** @brief A tile layer (opaque structure, see #rdpq_tilemap_new) */
+typedef struct rdpq_tilemap_s rdpq_tilemap_t;
+
+/**
+ * @brief Statistics of a tilemap, returned by #rdpq_tilemap_get_stats
+ */
+typedef struct {
+    int tiles;                      ///< Number of tiles drawn by the last call to #rdpq_tilemap_draw
+    int chunks;                     ///< Number of tileset chunks used by the last call to #rdpq_tilemap_draw
+    int rebuilds;                   ///< Number of times the list of visible tiles was rebuilt (since creation)
+} rdpq_tilemap_stats_t;
+
+/**
+ * @brief Create a tilemap
+ *
+ * The tileset is a sprite containing tiles of the same size, arranged in a
+ * grid. Tiles are numbered in row-major order, starting from 0 at the top-left
+ * corner of the sprite.
+ *
+ * The grid of tile indices is not copied: it must stay valid until the tilemap
+ * is freed. Use #rdpq_tilemap_set_tile to change a tile, or
+ * #rdpq_tilemap_invalidate after modifying the grid directly.
+ *
+ * The viewport is initially 320x240 pixels at the top-left corner of the
+ * screen (see #rdpq_tilemap_set_viewport).
+ *
+ * @param tileset           Sprite containing the tiles
+ * @param tile_w            Width of a tile in pixels
+ * @param tile_h            Height of a tile in pixels
+ * @param map_w             Width of the map in tiles
+ * @param map_h             Height of the map in tiles
+ * @param tiles             Grid of map_w * map_h tile indices, in row-major order.
+ *                          Use #RDPQ_TILEMAP_EMPTY for empty cells.
+ * @return                  The new tilemap
+ */
+rdpq_tilemap_t *rdpq_tilemap_new(sprite_t *tileset, int tile_w, int tile_h, int map_w, int map_h, uint16_t *tiles);
+
+/**
+ * @brief Free a tilemap
+ *
+ * The tilemap can be freed while the RSP is still drawing it: this function
+ * waits for pending draws to be completed before releasing memory.
+ *
+ * @param tm                Tilemap to free
+ */
+void rdpq_tilemap_free(rdpq_tilemap_t *tm);
+
+/**
+ * @brief Configure the area of the screen where the tilemap is drawn
+ *
+ * The top-left corner of the viewport shows the map pixel at the scroll
+ * position passed to #rdpq_tilemap_draw.
+ *
+ * Tiles crossing the right or bottom border of the viewport are drawn entirely.
+ * If the layer must not overflow the viewport, configure a matching scissor
+ * via #rdpq_set_scissor.
+ *
+ * @param tm                Tilemap
+ * @param x0                X coordinate of the top-left corner of the viewport
+ * @param y0                Y coordinate of the top-left corner of the viewport
+ * @param width             Width of the viewport in pixels
+ * @param height            Height of the viewport in pixels
+ */
+void rdpq_tilemap_set_viewport(rdpq_tilemap_t *tm, int x0, int y0, int width, int height);
+
+/**
+ * @brief Change a tile of the map
+ *
+ * @param tm                Tilemap
+ * @param x                 X coordinate of the cell (in tiles)
+ * @param y                 Y coordinate of the cell (in tiles)
+ * @param tile              New tile index (or #RDPQ_TILEMAP_EMPTY)
+ */
+void rdpq_tilemap_set_tile(rdpq_tilemap_t *tm, int x, int y, uint16_t tile);
+
+/**
+ * @brief Read a tile of the map
+ *
+ * @param tm                Tilemap
+ * @param x                 X coordinate of the cell (in tiles)
+ * @param y                 Y coordinate of the cell (in tiles)
+ * @return                  Tile index (or #RDPQ_TILEMAP_EMPTY)
+ */
+uint16_t rdpq_tilemap_get_tile(rdpq_tilemap_t *tm, int x, int y);
+
+/**
+ * @brief Notify the tilemap that the grid of tile indices was modified directly
+ *
+ * The list of visible tiles will be rebuilt at the next draw.
+ *
+ * @param tm                Tilemap
+ */
+void rdpq_tilemap_invalidate(rdpq_tilemap_t *tm);
+
+/**
+ * @brief Draw the tilemap
+ *
+ * Cells outside of the map are empty. The scroll position is rounded to
+ * a multiple of 0.25 pixels (the precision of RDP coordinates).
+ *
+ * This function cannot be called while recording a block, because the list
+ * of visible tiles changes with the scroll position.
+ *
+ * @param tm                Tilemap
+ * @param scroll_x          X coordinate of the map pixel shown at the top-left corner of the viewport
+ * @param scroll_y          Y coordinate of the map pixel shown at the top-left corner of the viewport
+ */
+void rdpq_tilemap_draw(rdpq_tilemap_t *tm, float scroll_x, float scroll_y);
+
+/**
+ * @brief Get the statistics of a tilemap
+ *
+ * @param tm                Tilemap
+ * @param[out] stats        Statistics
+ */
+void rdpq_tilemap_get_stats(rdpq_tilemap_t *tm, rdpq_tilemap_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
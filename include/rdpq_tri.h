@@ -171,7 +171,8 @@ extern const rdpq_trifmt_t TRIFMT_ZBUF_SHADE_TEX;
  * 
  *   * Position. 2 values: X, Y. The values must be in screen coordinates, that is they refer
  *     to the framebuffer pixels. Fractional values allow for subpixel precision. Supported
- *     range is [-4096..4095] (numbers outside that range will be clamped).
+ *     range is [-4096..4095]: triangles crossing the guard band are clipped (see
+ *     #rdpq_set_triangle_guardband).
  *   * Depth. 1 value: Z. Supported range in [0..1].
  *   * Shade. 4 values: R, G, B, A. The values must be in the 0..1 range.
  *   * Texturing. 3 values: S, T, INV_W. The values S,T address the texture specified by the tile
@@ -240,6 +241,119 @@ extern const rdpq_trifmt_t TRIFMT_ZBUF_SHADE_TEX;
  */
 void rdpq_triangle(const rdpq_trifmt_t *fmt, const float *v1, const float *v2, const float *v3);
 
+/** @brief Minimum coordinate accepted for the guard band (see #rdpq_set_triangle_guardband) */
+#define RDPQ_TRI_GUARDBAND_MIN      (-4096.0f)
+/** @brief Maximum coordinate accepted for the guard band (see #rdpq_set_triangle_guardband) */
+#define RDPQ_TRI_GUARDBAND_MAX      (4095.0f)
+/** @brief Default guard band: from -2048 to 2048 on both axes */
+#define RDPQ_TRI_GUARDBAND_DEFAULT  (2048.0f)
+
+/**
+ * @brief Configure the guard band used to clip triangles
+ * 
+ * When #RDPQ_CFG_TRICLIP is enabled (the default), #rdpq_triangle checks
+ * the vertices of each triangle against the guard band, which is a rectangle
+ * in screen coordinates, normally much larger than the screen:
+ * 
+ *   * Triangles fully within the guard band are drawn as-is. Parts outside of
+ *     the screen are discarded by the RDP via scissoring.
+ *   * Triangles fully outside of the guard band are rejected.
+ *   * Triangles crossing the border of the guard band are clipped on the CPU,
+ *     and the resulting polygon is drawn as a triangle fan.
+ * 
+ * Clipping guarantees that the RDP never receives coordinates outside of its
+ * range, which would otherwise cause garbage to be drawn. Moreover, the RDP
+ * walks all the scanlines of a triangle even when they are scissored, so a
+ * smaller guard band reduces the time spent by the RDP on huge triangles, at
+ * the cost of more triangles clipped by the CPU. A good choice is a margin of
+ * a few hundred pixels around the screen.
+ * 
+ * Independently of clipping, when #RDPQ_CFG_TRIREJECT is enabled (the
+ * default), the RSP rejects triangles that are fully outside of the current
+ * scissor rectangle, without sending them to the RDP.
+ * 
+ * @param x0        Left border of the guard band
+ * @param y0        Top border of the guard band
+ * @param x1        Right border of the guard band
+ * @param y1        Bottom border of the guard band
+ * 
+ * @see #rdpq_get_triangle_stats
+ */
+void rdpq_set_triangle_guardband(float x0, float y0, float x1, float y1);
+
+/**
+ * @brief Statistics of triangle clipping and rejection
+ * 
+ * Triangles recorded in a block are counted by the CPU only once, at recording
+ * time, while the RSP counts them every time the block is run.
+ * 
+ * @see #rdpq_get_triangle_stats
+ */
+typedef struct {
+    uint32_t clipped;               ///< Number of triangles clipped against the guard band by the CPU
+    uint32_t clip_output;           ///< Number of triangles generated by clipping
+    uint32_t rejected_cpu;          ///< Number of triangles rejected by the CPU (outside of the guard band)
+    uint32_t rejected_rsp;          ///< Number of triangles rejected by the RSP (outside of the scissor rectangle)
+} rdpq_triangle_stats_t;
+
+/**
+ * @brief Get the statistics of triangle clipping and rejection
+ * 
+ * Statistics are accumulated since #rdpq_init or since the last call to
+ * #rdpq_reset_triangle_stats. Notice that this function waits for the RSP
+ * to process all the pending commands, so it should be called once per frame
+ * at most (eg: after #rspq_wait).
+ * 
+ * @param[out] stats        Structure that will be filled with the statistics
+ * 
+ * @see #rdpq_reset_triangle_stats
+ */
+void rdpq_get_triangle_stats(rdpq_triangle_stats_t *stats);
+
+/**
+ * @brief Reset the statistics of triangle clipping and rejection
+ * 
+ * @see #rdpq_get_triangle_stats
+ */
+void rdpq_reset_triangle_stats(void);
+
+/**
+ * @brief Draw a triangle with fixed-point vertices (RDP command: TRI_*)
+ *
+ * This function is similar to #rdpq_triangle, but the vertex components are
+ * provided as s16.16 fixed-point numbers (eg: `100 << 16` for 100.0) instead
+ * of floating point numbers. Their meaning and range are the same described
+ * in #rdpq_triangle: for instance, shade components are in the 0..1 range,
+ * so `0x10000` is full intensity.
+ *
+ * The triangle is assembled on the CPU with integer arithmetic only. This is
+ * meant for 2D/UI code that already works with integer or fixed-point
+ * coordinates, and avoids the float conversions and setup calculations.
+ * All coefficients are calculated exactly (rounding down, like the RDP does),
+ * so the generated command is the same that the floating point setup
+ * generates for the same triangle, except for the rounding errors of the
+ * latter (at most a few units of the last fractional bit).
+ *
+ * Vertex coordinates should be within the screen (as fractional bits are
+ * kept, intermediate values are calculated with 64-bit integers and very
+ * large values could overflow). Triangles drawn with this function are not
+ * clipped against the guard band (see #rdpq_set_triangle_guardband).
+ *
+ * @code
+ *      // Draw a flat-colored triangle
+ *      int32_t v1[] = { 100 << 16, 100 << 16 };
+ *      int32_t v2[] = { 200 << 16, 200 << 16 };
+ *      int32_t v3[] = { 100 << 16, 200 << 16 };
+ *      rdpq_triangle_fx(&TRIFMT_FILL, v1, v2, v3);
+ * @endcode
+ *
+ * @param fmt            Format of the triangle being drawn (see #rdpq_triangle)
+ * @param v1             Array of components for vertex 1 (s16.16)
+ * @param v2             Array of components for vertex 2 (s16.16)
+ * @param v3             Array of components for vertex 3 (s16.16)
+ */
+void rdpq_triangle_fx(const rdpq_trifmt_t *fmt, const int32_t *v1, const int32_t *v2, const int32_t *v3);
+
 #ifdef __cplusplus
 }
 #endif
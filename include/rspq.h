@@ -108,6 +108,17 @@
  * Syncpoints are implemented using RSP interrupts, so their overhead is small
  * but still measurable. They should not be abused.
  * 
+ * While the CPU is blocked waiting for the RSP (eg: in #rspq_syncpoint_wait
+ * or #rspq_wait), it is possible to let it do some useful work by registering
+ * an idle callback via #rspq_set_idle_callback. The callback is invoked
+ * repeatedly until the RSP interrupt signals that the syncpoint has been
+ * reached. This can be used to run some background processing (eg: audio
+ * mixing or decompression), or to yield to a cooperative scheduler.
+ * 
+ * The time spent by the CPU waiting for the RSP is also accounted in a set
+ * of counters that can be read via #rspq_get_wait_stats. This is useful to
+ * quantify how much CPU time is lost every frame in RSP/RDP stalls.
+ * 
  * ## High-priority queue
  * 
  * This library offers a mechanism to preempt the execution of RSP to give
@@ -137,6 +148,28 @@
  * This feature should normally not be used by end-users, but by libraries
  * in which a very low latency of RSP execution is paramount to their workings.
  * 
+ * ## Ordered batch dispatch
+ * 
+ * When several independent subsystems record work for the RSP during a
+ * frame (eg: rendering, audio mixing, asynchronous decompression), it is
+ * possible to create a user queue for each of them via #rspq_queue_new.
+ * Commands are recorded into a queue as "jobs" (#rspq_queue_begin /
+ * #rspq_queue_end), and are sent to the RSP in a single batch by
+ * #rspq_queue_dispatch.
+ * 
+ * The order of the batch is decided by the CPU at dispatch time: jobs of
+ * queues with a higher rank ("priority") come first, and queues with the
+ * same rank are interleaved with a weighted round-robin, where each queue
+ * sends up to "weight" jobs per round. The batch is then appended to the
+ * normal queue. This is not a scheduler: the RSP runs the batch in order,
+ * after all the commands that were already sent to it (including previous
+ * batches), and a job is never preempted. The rank only decides the order
+ * of the jobs within the same batch, so it does not bound the latency of
+ * a job.
+ * 
+ * Each queue keeps latency statistics (#rspq_queue_get_stats), measuring
+ * the time from when a job is closed to when the RSP finishes running it.
+ * 
  * ## RDP support
  * 
  * RSPQ contains a basic support for sending commands to RDP. It is meant
@@ -219,6 +252,33 @@ typedef struct rspq_block_s rspq_block_t;
  */
 typedef int rspq_syncpoint_t;
 
+/**
+ * @brief Callback invoked while the CPU is waiting for the RSP
+ * 
+ * @see #rspq_set_idle_callback
+ */
+typedef void (*rspq_idle_callback_t)(void *arg);
+
+/**
+ * @brief Statistics on the time spent by the CPU waiting for the RSP
+ * 
+ * These counters are updated every time the CPU has to block waiting for
+ * the RSP (and indirectly, the RDP). Times are expressed in CPU ticks
+ * (see #TICKS_PER_SECOND). Waits that are immediately satisfied (eg: a
+ * syncpoint that was already reached) are not counted.
+ * 
+ * @see #rspq_get_wait_stats
+ */
+typedef struct rspq_wait_stats_s {
+    uint32_t syncpoint_waits;       ///< Number of blocking waits for a syncpoint (including #rspq_wait)
+    uint64_t syncpoint_ticks;       ///< Ticks spent waiting for syncpoints
+    uint32_t buffer_waits;          ///< Number of waits caused by a full queue buffer
+    uint64_t buffer_ticks;          ///< Ticks spent waiting for a queue buffer to be freed
+    uint32_t highpri_waits;         ///< Number of blocking waits in #rspq_highpri_sync
+    uint64_t highpri_ticks;         ///< Ticks spent in #rspq_highpri_sync
+    uint32_t idle_calls;            ///< Number of times the idle callback was invoked
+} rspq_wait_stats_t;
+
 /**
  * @brief Initialize the RSPQ library.
  * 
@@ -664,6 +724,49 @@ bool rspq_syncpoint_check(rspq_syncpoint_t sync_id);
  */
 void rspq_syncpoint_wait(rspq_syncpoint_t sync_id);
 
+/**
+ * @brief Register a callback to be run while the CPU waits for the RSP.
+ * 
+ * When the CPU must block waiting for the RSP (#rspq_syncpoint_wait,
+ * #rspq_wait, #rspq_highpri_sync), rspq will call the specified callback
+ * in a loop until the wait condition is satisfied, instead of just
+ * spinning. The wait condition is updated by the RSP interrupt handler,
+ * so the callback can also check it via #rspq_syncpoint_check and return
+ * as soon as the RSP is done.
+ * 
+ * The callback can be used to run background processing (eg: audio mixing)
+ * or to yield to a cooperative scheduler. It is allowed to enqueue new
+ * RSP commands (including highpri ones) and even to wait for the RSP:
+ * nested waits will not invoke the callback again, but just spin.
+ * 
+ * The callback is not invoked when the CPU waits for a full queue buffer
+ * to be processed, as at that point the queue is not in a consistent state.
+ * 
+ * @param      func     Callback to invoke, or NULL to disable it
+ * @param      arg      Argument passed to the callback
+ */
+void rspq_set_idle_callback(rspq_idle_callback_t func, void *arg);
+
+/**
+ * @brief Read the statistics on time spent by the CPU waiting for the RSP.
+ * 
+ * The statistics are accumulated since the last call to #rspq_reset_wait_stats
+ * (or #rspq_init). A typical usage is reading and resetting them once per frame,
+ * to know how much CPU time was lost in RSP/RDP stalls during the frame.
+ * 
+ * @param[out] stats    Structure that will be filled with the statistics
+ * 
+ * @see #rspq_wait_stats_t
+ */
+void rspq_get_wait_stats(rspq_wait_stats_t *stats);
+
+/**
+ * @brief Reset the statistics on time spent waiting for the RSP.
+ * 
+ * @see #rspq_get_wait_stats
+ */
+void rspq_reset_wait_stats(void);
+
 
 /**
  * @brief Begin creating a new block.
@@ -836,6 +939,109 @@ void rspq_dma_to_rdram(void *rdram_addr, uint32_t dmem_addr, uint32_t len, bool
  */
 void rspq_dma_to_dmem(uint32_t dmem_addr, void *rdram_addr, uint32_t len, bool is_async);
 
+/**
+ * @brief A user-created queue of jobs, sent to the RSP in ordered batches.
+ * 
+ * See #rspq_queue_new for details.
+ */
+typedef struct rspq_queue_s rspq_queue_t;
+
+/**
+ * @brief Latency statistics of a user queue
+ * 
+ * Times are expressed in CPU ticks (see #TICKS_PER_SECOND). The latency
+ * of a job is measured from #rspq_queue_end to the moment in which the
+ * RSP finished running it.
+ * 
+ * @see #rspq_queue_get_stats
+ */
+typedef struct rspq_queue_stats_s {
+    uint32_t jobs_submitted;        ///< Number of jobs recorded in the queue
+    uint32_t jobs_completed;        ///< Number of jobs that the RSP finished running
+    uint32_t jobs_pending;          ///< Number of jobs not yet dispatched
+    uint64_t latency_sum;           ///< Sum of the latencies of all completed jobs
+    uint32_t latency_max;           ///< Maximum latency of a completed job
+} rspq_queue_stats_t;
+
+/**
+ * @brief Create a new user queue.
+ * 
+ * A user queue collects "jobs" (sequences of commands) that are later
+ * sent to the RSP by #rspq_queue_dispatch, in an order that depends on the
+ * priority and weight of all the queues (see "Ordered batch dispatch" in
+ * the module documentation).
+ * 
+ * @param      name      Name of the queue (for debugging purposes)
+ * @param      priority  Rank of the queue within a batch. In each call to
+ *                       #rspq_queue_dispatch, jobs of queues with a higher
+ *                       rank are sent before jobs of queues with a lower
+ *                       rank. It has no effect on work that was already
+ *                       sent to the RSP.
+ * @param      weight    Weight of the queue (>= 1). Among queues with the same
+ *                       rank, a queue with weight N sends up to N jobs in
+ *                       each round of the round-robin.
+ * @return     The new queue
+ */
+rspq_queue_t* rspq_queue_new(const char *name, int priority, int weight);
+
+/**
+ * @brief Destroy a user queue.
+ * 
+ * All jobs of the queue must have been dispatched already. The function
+ * waits for the RSP to finish running them before releasing memory.
+ * 
+ * @param      queue     The queue to destroy
+ */
+void rspq_queue_free(rspq_queue_t *queue);
+
+/**
+ * @brief Begin recording a new job into a user queue.
+ * 
+ * After this function is called, all commands written via #rspq_write (or
+ * any higher-level library) are recorded into the job, until #rspq_queue_end
+ * is called. Jobs are recorded as one-shot blocks, so the same limitations
+ * of #rspq_block_begin apply (eg: it is not possible to create syncpoints).
+ * 
+ * @param      queue     The queue that will hold the job
+ */
+void rspq_queue_begin(rspq_queue_t *queue);
+
+/**
+ * @brief Finish recording a job and append it to its queue.
+ * 
+ * The job is not run until #rspq_queue_dispatch is called.
+ */
+void rspq_queue_end(void);
+
+/**
+ * @brief Send all pending jobs of all user queues to the RSP, as one batch.
+ * 
+ * Jobs are enqueued into the normal queue, sorted by rank and
+ * interleaved via weighted round-robin (see #rspq_queue_new). Jobs
+ * within the same queue are always run in order. The RSP runs the batch
+ * after all the commands that were already enqueued, and does not
+ * preempt it.
+ * 
+ * The function also releases the memory of the jobs that the RSP has
+ * already finished running, and updates their latency statistics.
+ */
+void rspq_queue_dispatch(void);
+
+/**
+ * @brief Read the latency statistics of a user queue.
+ * 
+ * @param      queue     The queue
+ * @param[out] stats     Structure that will be filled with the statistics
+ */
+void rspq_queue_get_stats(rspq_queue_t *queue, rspq_queue_stats_t *stats);
+
+/**
+ * @brief Reset the latency statistics of a user queue.
+ * 
+ * @param      queue     The queue
+ */
+void rspq_queue_reset_stats(rspq_queue_t *queue);
+
 /** @cond */
 __attribute__((deprecated("may not work anymore. use rspq_syncpoint_new/rspq_syncpoint_check instead")))
 void rspq_signal(uint32_t signal);
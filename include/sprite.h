@@ -216,12 +216,73 @@ surface_t sprite_get_tile(sprite_t *sprite, int h, int v);
  * (that is, the format is either #FMT_CI4 or #FMT_CI8).
  * 
  * This function returns a pointer to the raw palette data contained in the sprite.
+ * For sprites that use a shared palette, it returns the colors of the palette
+ * configured with #sprite_set_palette.
  * 
  * @param   sprite      The sprite to access
  * @return              A pointer to the palette data, or NULL if the sprite does not have a palette
  */
 uint16_t* sprite_get_palette(sprite_t *sprite);
 
+/** 
+ * @brief A palette shared by multiple sprites.
+ * 
+ * mksprite can quantize a set of images to the same palette (using the
+ * `--shared-palette` option). In this case, the palette is not stored in each
+ * sprite, but in a separate palette file, that must be loaded with
+ * #sprite_palette_load and assigned to the sprites with #sprite_set_palette.
+ * 
+ * Since all the sprites point to the same palette, #rdpq_sprite_upload and
+ * #rdpq_sprite_blit load it into TMEM only once, as long as it is not
+ * overwritten (see #rdpq_tex_upload_tlut).
+ * 
+ * @code{.c}
+ *      sprite_palette_t *pal = sprite_palette_load("rom:/enemies.palette");
+ *      sprite_t *goomba = sprite_load("rom:/goomba.sprite");
+ *      sprite_t *koopa = sprite_load("rom:/koopa.sprite");
+ *      sprite_set_palette(goomba, pal);
+ *      sprite_set_palette(koopa, pal);
+ * @endcode
+ */
+typedef struct sprite_palette_s sprite_palette_t;
+
+/**
+ * @brief Load a shared palette from a file
+ * 
+ * @param fn            Filename of the palette, including filesystem specifier
+ * @return              The loaded palette
+ */
+sprite_palette_t *sprite_palette_load(const char *fn);
+
+/**
+ * @brief Free a shared palette
+ * 
+ * The sprites using the palette must not be drawn anymore.
+ * 
+ * @param pal           The palette to free
+ */
+void sprite_palette_free(sprite_palette_t *pal);
+
+/**
+ * @brief Access the colors of a shared palette
+ * 
+ * @param pal               The palette
+ * @param[out] num_colors   Number of colors (can be NULL)
+ * @return                  The colors in RGBA16 format
+ */
+uint16_t *sprite_palette_get_colors(sprite_palette_t *pal, int *num_colors);
+
+/**
+ * @brief Assign a shared palette to a sprite
+ * 
+ * The sprite must have been created by mksprite with the `--shared-palette`
+ * option. The palette must stay loaded as long as the sprite is used.
+ * 
+ * @param sprite        The sprite
+ * @param pal           The shared palette (or NULL to remove it)
+ */
+void sprite_set_palette(sprite_t *sprite, sprite_palette_t *pal);
+
 /**
  * @brief Get a copy of the RDP texparms, optionally stored within the sprite.
  * 
@@ -268,6 +329,74 @@ int sprite_get_lod_count(sprite_t *sprite);
  */
 bool sprite_fits_tmem(sprite_t *sprite);
 
+/**
+ * @brief A sprite atlas: a collection of images packed into sprites that fit TMEM
+ * 
+ * A sprite atlas is created by mksprite when a directory is specified as input:
+ * all the PNG images in the directory are packed into one or more pages,
+ * each of which fits TMEM, and are saved into a single `.atlas` file, together
+ * with an index of the images, that can be accessed by name (the filename
+ * without extension).
+ * 
+ * Compared to converting each image as a separate sprite, an atlas is loaded
+ * with a single file access, and drawing multiple images of the same page
+ * with #rdpq_sprite_atlas_blit does not reload TMEM.
+ */
+typedef struct sprite_atlas_s sprite_atlas_t;
+
+/**
+ * @brief Load a sprite atlas from a filesystem (eg: ROM)
+ * 
+ * @param fn            Filename of the atlas, including filesystem specifier.
+ *                      For instance: "rom:/icons.atlas" to load from DFS.
+ * @return              The loaded atlas
+ */
+sprite_atlas_t *sprite_atlas_load(const char *fn);
+
+/** @brief Deallocate a sprite atlas */
+void sprite_atlas_free(sprite_atlas_t *atlas);
+
+/** @brief Return the number of images in a sprite atlas */
+int sprite_atlas_get_count(sprite_atlas_t *atlas);
+
+/**
+ * @brief Find an image in a sprite atlas by name
+ * 
+ * The name is the filename of the original image, without extension. 
+ * The lookup is a binary search, so its cost is logarithmic in the number
+ * of images. The index can be cached to avoid the lookup altogether.
+ * 
+ * @param atlas         The sprite atlas
+ * @param name          Name of the image
+ * @return              Index of the image, or -1 if not found
+ */
+int sprite_atlas_find(sprite_atlas_t *atlas, const char *name);
+
+/**
+ * @brief Get the page and position of an image in a sprite atlas
+ * 
+ * @param atlas         The sprite atlas
+ * @param idx           Index of the image (see #sprite_atlas_find)
+ * @param[out] s0       X position of the image within the page (can be NULL)
+ * @param[out] t0       Y position of the image within the page (can be NULL)
+ * @param[out] width    Width of the image (can be NULL)
+ * @param[out] height   Height of the image (can be NULL)
+ * @return              The page containing the image
+ */
+sprite_t *sprite_atlas_get(sprite_atlas_t *atlas, int idx, int *s0, int *t0, int *width, int *height);
+
+/**
+ * @brief Create a surface_t pointing to an image of a sprite atlas
+ * 
+ * Notice that no memory allocations or copies are performed:
+ * the returned surface will point to the atlas contents.
+ * 
+ * @param atlas         The sprite atlas
+ * @param idx           Index of the image (see #sprite_atlas_find)
+ * @return              The surface pointing to the image
+ */
+surface_t sprite_atlas_get_pixels(sprite_atlas_t *atlas, int idx);
+
 
 #ifdef __cplusplus
 }
@@ -246,6 +246,33 @@ surface_t surface_make_sub(surface_t *parent,
  */
 void surface_free(surface_t *surface);
 
+/**
+ * @brief Convert the pixels of a surface into another surface, with the CPU
+ *
+ * The two surfaces must have the same size, and can have any format among
+ * #FMT_RGBA32, #FMT_RGBA16, #FMT_IA16, #FMT_IA8, #FMT_IA4, #FMT_I8 and #FMT_I4.
+ * Surfaces of the same format are simply copied, so in that case all
+ * formats are supported (including palettized ones).
+ *
+ * Pixels are decoded the same way the RDP does (eg: intensity formats have
+ * alpha equal to the intensity). When converting to intensity formats,
+ * the intensity is the luma of the color; when converting to formats with
+ * 1-bit alpha, pixels with alpha >= 0x80 are opaque.
+ *
+ * The conversion runs synchronously on the CPU, so the source must not
+ * be pending in the RDP queue (see #rspq_wait). Conversions between
+ * RGBA32 and RGBA16, and between intensity formats (I8 to and from IA16,
+ * IA8 and I4, and I4 to I8) use dedicated loops that handle several pixels
+ * per iteration. The other conversions decode each pixel to RGBA32 first, so
+ * they are slower. There is no RSP implementation: to convert large surfaces
+ * into RGBA16 or RGBA32 without transparency, #rdpq_tex_convert can be used
+ * instead to run the conversion on the RDP.
+ *
+ * @param[out] dst      Destination surface
+ * @param[in]  src      Source surface
+ */
+void surface_convert(surface_t *dst, const surface_t *src);
+
 /**
  * @brief Returns the pixel format of a surface
  * 
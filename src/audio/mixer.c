@@ -10,6 +10,7 @@
 #include "utils.h"
 #include "rsp.h"
 #include "rspq.h"
+#include "rspq/rspq_internal.h"
 #include "debug.h"
 #include "samplebuffer.h"
 #include "audio.h"
@@ -51,6 +52,13 @@
  * be calculated and held in memory.
  */
 #define MIXER_POLL_PER_SECOND   8
+/** @brief Maximum number of mixing commands that can be batched in a single RSP job
+ *
+ * Each command mixes the samples between two events, so this is the number
+ * of events that can trigger within a single audio buffer before the mixer
+ * has to stop and wait for the RSP.
+ */
+#define MIXER_MAX_BATCH         4
 
 /**
  * RSP mixer ucode (rsp_mixer.S)
@@ -165,8 +173,22 @@ static struct {
 	mixer_fx15_t lvol[MIXER_MAX_CHANNELS];
 	mixer_fx15_t rvol[MIXER_MAX_CHANNELS];
 
-	rsp_mixer_settings_t ucode_settings __attribute__((aligned(16)));
+	rsp_mixer_settings_t ucode_settings[MIXER_MAX_BATCH] __attribute__((aligned(16)));
+
+	int batch_len;          ///< Number of commands prepared in ucode_settings, not yet sent to RSP
+	struct {
+		uint32_t vol;       ///< Global volume (16.16)
+		int num_samples;    ///< Number of samples to mix
+		int32_t *out;       ///< Output buffer
+	} batch[MIXER_MAX_BATCH];
+
+	bool rsp_busy;          ///< True if commands were sent to RSP and might still be running
+	int rsp_len;            ///< Number of commands in the last job sent to RSP
+	int16_t *async_buf;     ///< Audio buffer being mixed by #mixer_try_play (or NULL)
 
+	uint32_t stall_ticks;   ///< CPU ticks spent waiting for RSP (current measurement)
+	int stall_samples;      ///< Samples mixed (current measurement)
+	int stall_us;           ///< Microseconds per second spent waiting for RSP (last measurement)
 } Mixer;
 
 /** @brief Count of ticks spent in mixer RSP, used for debugging purposes. */
@@ -178,7 +200,7 @@ static inline int mixer_initialized(void) { return Mixer.num_channels != 0; }
 
 void mixer_init(int num_channels) {
 	memset(&Mixer, 0, sizeof(Mixer));
-	data_cache_hit_writeback_invalidate(&Mixer.ucode_settings, sizeof(Mixer.ucode_settings));
+	data_cache_hit_writeback_invalidate(Mixer.ucode_settings, sizeof(Mixer.ucode_settings));
 
 	Mixer.num_channels = num_channels;
 	Mixer.sample_rate = audio_get_frequency();  // actual sample rate obtained via DAC clock
@@ -244,6 +266,14 @@ void mixer_set_vol(float vol) {
 void mixer_close(void) {
 	assert(mixer_initialized());
 
+	// Complete the pending mixing. If a buffer was being mixed
+	// asynchronously, it is valid: send it to the AI.
+	__mixer_wait_rsp();
+	if (Mixer.async_buf) {
+		audio_write_end();
+		Mixer.async_buf = NULL;
+	}
+
 	rspq_overlay_unregister(__mixer_overlay_id);
 	__mixer_overlay_id = 0;
 
@@ -466,6 +496,7 @@ void mixer_ch_set_limits(int ch, int max_bits, float max_frequency, int max_buf_
 	// Changing the limits will invalidate the whole sample buffer
 	// memory area. Invalidate all sample buffers.
 	if (Mixer.ch_buf_mem) {
+		__mixer_wait_rsp();
 		for (int i=0;i<Mixer.num_channels;i++)
 			samplebuffer_close(&Mixer.ch_buf[i]);
 		free_uncached(Mixer.ch_buf_mem);
@@ -473,7 +504,62 @@ void mixer_ch_set_limits(int ch, int max_bits, float max_frequency, int max_buf_
 	}
 }
 
+/**
+ * @brief Send the prepared mixing commands to the RSP, as a single job
+ *
+ * The job is sent to the high-priority queue, so it does not wait for the
+ * commands already in the standard queue (eg: graphics), but only for the
+ * command that the RSP is running when the job is submitted.
+ */
+static void mixer_batch_submit(void) {
+	assert(!Mixer.rsp_busy);
+	if (!Mixer.batch_len)
+		return;
+
+	rspq_highpri_begin();
+	for (int i=0; i<Mixer.batch_len; i++) {
+		rspq_write(__mixer_overlay_id, 0,
+			Mixer.batch[i].vol,
+			(Mixer.batch[i].num_samples << 16) | Mixer.num_channels,
+			PhysicalAddr(Mixer.batch[i].out),
+			PhysicalAddr(&Mixer.ucode_settings[i]));
+	}
+	rspq_highpri_end();
+
+	Mixer.rsp_busy = true;
+	Mixer.rsp_len = Mixer.batch_len;
+	Mixer.batch_len = 0;
+}
+
+/** @brief Wait until the RSP has completed the mixing commands sent to it */
+static void mixer_batch_wait(void) {
+	if (!Mixer.rsp_busy)
+		return;
+
+	uint32_t t0 = TICKS_READ();
+	rspq_highpri_sync();
+	uint32_t stall = TICKS_READ() - t0;
+
+	__mixer_profile_rsp += stall;
+	Mixer.stall_ticks += stall;
+	Mixer.rsp_busy = false;
+}
+
+void __mixer_wait_rsp(void) {
+	// Wait for the commands in flight, and then run the ones still in the
+	// batch, as the caller might be about to change the samples they refer to.
+	mixer_batch_wait();
+	if (Mixer.batch_len) {
+		mixer_batch_submit();
+		mixer_batch_wait();
+	}
+}
+
 static void mixer_exec(int32_t *out, int num_samples) {
+	// Make sure there is a free slot in the batch
+	if (Mixer.batch_len == MIXER_MAX_BATCH)
+		__mixer_wait_rsp();
+
 	if (!Mixer.ch_buf_mem) {
 		// If we have not yet allocated the memory for the sample buffers,
 		// this is a good moment to do so.
@@ -584,7 +670,7 @@ static void mixer_exec(int32_t *out, int num_samples) {
 		}
 	}
 
-	volatile rsp_mixer_settings_t *settings = UncachedAddr(&Mixer.ucode_settings);
+	volatile rsp_mixer_settings_t *settings = UncachedAddr(&Mixer.ucode_settings[Mixer.batch_len]);
 
 	volatile rsp_mixer_channel_t *rsp_wv = settings->channels;
 	mixer_fx15_t lvol[MIXER_MAX_CHANNELS] __attribute__((aligned(8))) = {0};
@@ -623,6 +709,12 @@ static void mixer_exec(int32_t *out, int num_samples) {
 		rsp_wv[ch].ptr = c->ptr + ((c->pos & ~0x7FFFFFFF) >> MIXER_FX64_FRAC);
 		rsp_wv[ch].flags = c->flags;
 
+		// Calculate the position the RSP will reach at the end of this
+		// command. The RSP does exactly the same 32-bit calculation, so we can
+		// update the channel position right away, without waiting for the
+		// RSP to finish: this is what allows to batch multiple commands.
+		uint32_t rsp_pos = ((uint32_t)c->pos & 0x7FFFFFFF) + ((uint32_t)c->step & 0x7FFFFFFF) * num_samples;
+
 		// If the loop is fake (i.e. we are unrolling it), or the current
 		// position has been truncated but it's far from the end of the waveform,
 		// just tell the RSP that there is no loop.
@@ -630,13 +722,22 @@ static void mixer_exec(int32_t *out, int num_samples) {
 			rsp_wv[ch].len = 0xFFFFFFFF;
 			rsp_wv[ch].loop_len = 0;
 		} else {
-			rsp_wv[ch].len = (uint32_t)c->len & 0x7FFFFFFF;
+			uint32_t len = (uint32_t)c->len & 0x7FFFFFFF;
+			rsp_wv[ch].len = len;
 			// We can't represent a very long loop in RSP. But those loops
 			// should be unrolled anyway (and thus be a fake_loop), so we
 			// should not get here.
 			assert(c->loop_len <= 0x7FFFFFFF);
-			rsp_wv[ch].loop_len = (uint32_t)c->loop_len & 0x7FFFFFFF;
+			uint32_t loop_len = (uint32_t)c->loop_len & 0x7FFFFFFF;
+			rsp_wv[ch].loop_len = loop_len;
+
+			// The RSP follows the loop (pos -= loop_len while pos >= len)
+			// only at some points during mixing, so the final position might
+			// be past the end; the wrapped position is equivalent.
+			if (loop_len && rsp_pos >= len)
+				rsp_pos -= ((rsp_pos - len) / loop_len + 1) * loop_len;
 		}
+		c->pos += (uint64_t)rsp_pos - (uint64_t)(c->pos & 0x7FFFFFFF);
 
 		if (c->flags & CH_FLAGS_STEREO) {
 			lvol[ch] = Mixer.lvol[ch];
@@ -666,24 +767,12 @@ static void mixer_exec(int32_t *out, int num_samples) {
 		gvol *= (FADE_OUT_TIME - MIN(elapsed, FADE_OUT_TIME)) / FADE_OUT_TIME;
 	}
 
-	uint32_t t0 = TICKS_READ();
-	rspq_highpri_begin();
-	rspq_write(__mixer_overlay_id, 0,
-		(((uint32_t)MIXER_FX16(gvol)) & 0xFFFF),
-		(num_samples << 16) | Mixer.num_channels,
-		PhysicalAddr(out),
-		PhysicalAddr(&Mixer.ucode_settings));
-	rspq_highpri_end();
-
-	rspq_highpri_sync();
-
-	__mixer_profile_rsp += TICKS_READ() - t0;
-
-	for (int i=0;i<Mixer.num_channels;i++) {
-		mixer_channel_t *ch = &Mixer.channels[i];
-		if (ch->ptr)
-			ch->pos += (uint64_t)rsp_wv[i].pos - (uint64_t)(ch->pos & 0x7FFFFFFF);
-	}
+	// Add the command to the batch. It will be sent to the RSP by the caller
+	// (or earlier, if somebody needs to modify the sample buffers).
+	Mixer.batch[Mixer.batch_len].vol = ((uint32_t)MIXER_FX16(gvol)) & 0xFFFF;
+	Mixer.batch[Mixer.batch_len].num_samples = num_samples;
+	Mixer.batch[Mixer.batch_len].out = out;
+	Mixer.batch_len++;
 
 	Mixer.ticks += num_samples;
 }
@@ -716,14 +805,26 @@ void mixer_remove_event(MixerEvent cb, void *ctx) {
 	assertf("mixer_remove_event: specified event does not exist\ncb:%p ctx:%p", (void*)cb, ctx);
 }
 
-void mixer_poll(int16_t *out16, int num_samples) {
-	int32_t *out = (int32_t*)out16;
-
+// Mix the specified number of samples, running the events at the correct
+// time. The commands for the RSP are prepared in the batch, but not sent yet.
+static void mixer_mix(int32_t *out, int num_samples) {
 	// Since the AI can only play an even number of samples,
 	// it's not possible to call this function with an odd number,
 	// otherwise buffering might become complicated / impossible.
 	assert(num_samples % 2 == 0);
 
+	// Make sure the RSP is not still mixing the previous buffer: we are
+	// going to refill the sample buffers.
+	mixer_batch_wait();
+
+	// Update stall statistics, once per second of audio
+	Mixer.stall_samples += num_samples;
+	if (Mixer.stall_samples >= Mixer.sample_rate) {
+		Mixer.stall_us = (int64_t)TICKS_TO_US((int64_t)Mixer.stall_ticks) * Mixer.sample_rate / Mixer.stall_samples;
+		Mixer.stall_ticks = 0;
+		Mixer.stall_samples = 0;
+	}
+
 	while (num_samples > 0) {
 		mixer_event_t *e = mixer_next_event();
 
@@ -742,3 +843,42 @@ void mixer_poll(int16_t *out16, int num_samples) {
 		}
 	}
 }
+
+void mixer_poll(int16_t *out16, int num_samples) {
+	assertf(!Mixer.async_buf, "mixer_poll cannot be used together with mixer_try_play");
+
+	mixer_mix((int32_t*)out16, num_samples);
+	mixer_batch_submit();
+	mixer_batch_wait();
+}
+
+void mixer_try_play(void) {
+	assertf(!rspq_in_block(), "mixer_try_play cannot be called while recording a rspq block");
+
+	// If the previous call started mixing a buffer, it is now time to
+	// send it to the AI. Normally, the RSP has already finished by now.
+	if (Mixer.async_buf) {
+		mixer_batch_wait();
+		audio_write_end();
+		Mixer.async_buf = NULL;
+	}
+
+	// Start mixing the next buffer, if there is one free. The RSP will
+	// mix it while the CPU goes on.
+	if (audio_can_write()) {
+		Mixer.async_buf = audio_write_begin();
+		mixer_mix((int32_t*)Mixer.async_buf, audio_get_buffer_length());
+		mixer_batch_submit();
+	}
+}
+
+int mixer_get_stall_us(void) {
+	return Mixer.stall_us;
+}
+
+void __mixer_get_ch_pos(int ch, uint32_t *cpu_pos, uint32_t *rsp_pos) {
+	assert(!Mixer.rsp_busy && !Mixer.batch_len && Mixer.rsp_len > 0);
+	volatile rsp_mixer_settings_t *settings = UncachedAddr(&Mixer.ucode_settings[Mixer.rsp_len-1]);
+	*cpu_pos = (uint32_t)Mixer.channels[ch].pos & 0x7FFFFFFF;
+	*rsp_pos = settings->channels[ch].pos;
+}
@@ -6,4 +6,28 @@
 /** @brief RSPQ overlay ID assigned to the mixer ucode */
 extern uint32_t __mixer_overlay_id;
 
+/**
+ * @brief Wait until the RSP is not accessing the sample buffers anymore
+ *
+ * The mixer prepares the RSP commands in advance and runs them later, so
+ * this must be called before samples stored in a sample buffer are moved
+ * or overwritten. Commands that were prepared but not sent yet are run
+ * immediately.
+ */
+void __mixer_wait_rsp(void);
+
+/**
+ * @brief Get the position of a channel at the end of the last RSP job
+ *
+ * This is used by the testsuite to check that the position predicted by the
+ * CPU matches the one reached by the RSP. It must be called after the job
+ * is complete (eg: after #mixer_poll).
+ *
+ * @param[in]   ch          Channel
+ * @param[out]  cpu_pos     Position predicted by the CPU (lower 31 bits)
+ * @param[out]  rsp_pos     Position reached by the RSP, as written back in
+ *                          the ucode settings
+ */
+void __mixer_get_ch_pos(int ch, uint32_t *cpu_pos, uint32_t *rsp_pos);
+
 #endif
@@ -6,6 +6,7 @@
 
 #include "mixer.h"
 #include "samplebuffer.h"
+#include "mixer_internal.h"
 #include "n64sys.h"
 #include "n64types.h"
 #include "utils.h"
@@ -192,6 +193,9 @@ void samplebuffer_discard(samplebuffer_t *buf, int wpos) {
 			return;
 	}
 
+	// The RSP might still be reading the samples we are going to move
+	__mixer_wait_rsp();
+
 	tracef("samplebuffer_discard: wpos=%x idx:%x buf->wpos=%x buf->widx=%x\n", wpos, idx, buf->wpos, buf->widx);
 	int kept_bytes = (buf->widx - idx) << SAMPLES_BPS_SHIFT(buf);
 	if (kept_bytes > 0) {		
@@ -227,6 +231,7 @@ void samplebuffer_discard(samplebuffer_t *buf, int wpos) {
 }
 
 void samplebuffer_flush(samplebuffer_t *buf) {
+	__mixer_wait_rsp();
 	buf->wpos = buf->widx = buf->ridx = 0;
 	buf->wnext = -1;
 }
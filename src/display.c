@@ -45,6 +45,22 @@ static uint32_t frame_times[FPS_WINDOW];
 static int frame_times_index = 0;
 /** @brief Current duration of the frame window (time elapsed for FPS_WINDOW frames) */
 static uint32_t frame_times_duration;
+/** @brief Frame pacing: minimum number of vblanks each frame is shown for (0 = disabled) */
+static int pacing_vblanks = 0;
+/** @brief Number of vblanks elapsed since #display_init */
+static volatile uint32_t vblank_count = 0;
+/** @brief Value of #vblank_count when the current buffer was first shown */
+static uint32_t shown_vblank = 0;
+/** @brief True if a frame has been shown since #display_init (the initial blank buffer doesn't count) */
+static bool frame_shown = false;
+/** @brief Absolute times at which each buffer was returned by #display_try_get */
+static uint32_t get_times[NUM_BUFFERS];
+/** @brief Frame pacing and latency statistics */
+static display_stats_t stats;
+/** @brief Size of the area of each buffer that is scaled to the full screen (see #display_set_frame_size) */
+static uint16_t frame_size[NUM_BUFFERS][2];
+/** @brief Frame size currently configured in the VI scale registers */
+static uint16_t vi_frame_size[2];
 
 /** @brief Get the next buffer index (with wraparound) */
 static inline int buffer_next(int idx) {
@@ -55,23 +71,65 @@ static inline int buffer_next(int idx) {
 }
 
 /**
- * @brief Interrupt handler for vertical blank
+ * @brief Show the next frame if it is ready, and update the frame statistics
  *
- * If there is another frame to display, display the frame
+ * @param force     If true, this is not a vblank (see #display_show_force):
+ *                  frame pacing is ignored, and the vblank statistics
+ *                  (vblanks, missed and late frames, histogram) are not
+ *                  updated. The frame is still counted, with its latency,
+ *                  and it is also recorded as a forced flip.
  */
-static void __display_callback()
+static void __display_flip(bool force)
 {
     /* Least significant bit of the current line register indicates
        if the currently displayed field is odd or even. */
     bool field = (*VI_V_CURRENT) & 1;
     bool interlaced = (*VI_CTRL) & (VI_CTRL_SERRATE);
 
+    if (!force) {
+        vblank_count++;
+        if (frame_shown) stats.vblanks++;
+    }
+
+    /* Check whether a new frame is due. With frame pacing, the current frame
+       is held for the configured number of vblanks. */
+    uint32_t held = vblank_count - shown_vblank;
+    uint32_t target = MAX(pacing_vblanks, 1);
+    bool due = force || held >= target;
+
     /* Check if the next buffer is ready to be displayed, otherwise just
        leave up the current frame */
     int next = buffer_next(now_showing);
-    if (ready_mask & (1 << next)) {
+    if (due && (ready_mask & (1 << next))) {
+        if (!force && frame_shown) {
+            /* Record how many vblanks the previous frame was shown for */
+            stats.vblank_hist[MIN(held, DISPLAY_STATS_HIST_SIZE) - 1]++;
+            if (held > target) stats.late_frames++;
+        }
+
+        /* Record the time from display_get to scanout */
+        uint32_t latency = TICKS_DISTANCE(get_times[next], TICKS_READ());
+        stats.latency_last = latency;
+        stats.latency_max = MAX(stats.latency_max, latency);
+        stats.latency_total += latency;
+        stats.frames++;
+        if (force) stats.forced_flips++;
+
         now_showing = next;
         ready_mask &= ~(1 << next);
+        shown_vblank = vblank_count;
+        frame_shown = true;
+
+        /* Scale the rendered area of the new frame to the full screen */
+        if (frame_size[next][0] != vi_frame_size[0] || frame_size[next][1] != vi_frame_size[1]) {
+            vi_frame_size[0] = frame_size[next][0];
+            vi_frame_size[1] = frame_size[next][1];
+            *VI_X_SCALE = VI_X_SCALE_SET(vi_frame_size[0]);
+            *VI_Y_SCALE = VI_Y_SCALE_SET(vi_frame_size[1]);
+        }
+    } else if (due && !force && frame_shown) {
+        /* A new frame was due, but none was ready: the current one is repeated */
+        stats.missed_vblanks++;
     }
 
     vi_write_dram_register(__safe_buffer[now_showing] + (interlaced && !field ? __width * __bitdepth : 0));
@@ -88,6 +146,16 @@ static void __display_callback()
     }
 }
 
+/**
+ * @brief Interrupt handler for vertical blank
+ *
+ * If there is another frame to display, display the frame
+ */
+static void __display_callback()
+{
+    __display_flip(false);
+}
+
 void display_init( resolution_t res, bitdepth_t bit, uint32_t num_buffers, gamma_t gamma, filter_options_t filters )
 {
     uint32_t tv_type = get_tv_type();
@@ -229,12 +297,21 @@ void display_init( resolution_t res, bitdepth_t bit, uint32_t num_buffers, gamma
 
         /* Baseline is blank */
         memset( __safe_buffer[i], 0, __width * __height * __bitdepth );
+
+        frame_size[i][0] = __width;
+        frame_size[i][1] = __height;
     }
+    vi_frame_size[0] = __width;
+    vi_frame_size[1] = __height;
 
     /* Set the first buffer as the displaying buffer */
     now_showing = 0;
     drawing_mask = 0;
     ready_mask = 0;
+    vblank_count = 0;
+    shown_vblank = 0;
+    frame_shown = false;
+    memset(&stats, 0, sizeof(stats));
 
     /* Show our screen normally. If display is already active, do that during vblank
        to avoid confusing the VI chip with in-frame modifications. */
@@ -312,6 +389,9 @@ surface_t* display_try_get(void)
         if (((drawing_mask | ready_mask) & (1 << next)) == 0)  {
             retval = &surfaces[next];
             drawing_mask |= 1 << next;
+            get_times[next] = TICKS_READ();
+            frame_size[next][0] = __width;
+            frame_size[next][1] = __height;
             break;
         }
         next = buffer_next(next);
@@ -329,11 +409,21 @@ surface_t* display_get(void)
     // it is common for display to become ready again after RSP+RDP
     // have finished processing the previous frame's commands.
     surface_t* disp;
+    uint32_t t0 = TICKS_READ();
     RSP_WAIT_LOOP(200) {
          if ((disp = display_try_get())) {
              break;
          }
     }
+
+    /* Record the time spent waiting for the buffer */
+    uint32_t wait = TICKS_SINCE(t0);
+    disable_interrupts();
+    stats.wait_last = wait;
+    stats.wait_max = MAX(stats.wait_max, wait);
+    stats.wait_total += wait;
+    stats.waits++;
+    enable_interrupts();
     return disp;
 }
 
@@ -389,7 +479,7 @@ void display_show_force( display_context_t disp )
     /* Can't have the video interrupt screwing this up */
     disable_interrupts();
     display_show(disp);
-    __display_callback();
+    __display_flip(true);
     enable_interrupts();
 }
 
@@ -418,3 +508,41 @@ float display_get_fps(void)
     if (!frame_times_duration) return 0;
     return (float)FPS_WINDOW * TICKS_PER_SECOND / frame_times_duration;
 }
+
+void display_set_frame_size(surface_t *surf, uint32_t width, uint32_t height)
+{
+    int i = surf - surfaces;
+    assertf(i >= 0 && i < __buffers, "Display context is not valid!");
+    assertf(width > 0 && width <= __width && height > 0 && height <= __height,
+        "invalid frame size %ldx%ld (display is %ldx%ld)", width, height, __width, __height);
+
+    disable_interrupts();
+    frame_size[i][0] = width;
+    frame_size[i][1] = height;
+    enable_interrupts();
+}
+
+void display_set_frame_pacing(int vblanks)
+{
+    assertf(vblanks >= 0, "invalid frame pacing: %d", vblanks);
+    pacing_vblanks = vblanks;
+}
+
+int display_get_frame_pacing(void)
+{
+    return pacing_vblanks;
+}
+
+void display_get_stats(display_stats_t *out)
+{
+    disable_interrupts();
+    *out = stats;
+    enable_interrupts();
+}
+
+void display_reset_stats(void)
+{
+    disable_interrupts();
+    memset(&stats, 0, sizeof(stats));
+    enable_interrupts();
+}
@@ -13,6 +13,7 @@
 #include "font.h"
 #include "surface.h"
 #include "sprite_internal.h"
+#include "utils.h"
 
 /**
  * @brief Struct that holds the current loaded font. We load the default font on
@@ -22,6 +23,8 @@ static struct {
     sprite_t *sprite;
     int font_width;
     int font_height;
+    int mask_words;     ///< Number of 64-bit words in the bitmask of a glyph row
+    uint64_t *masks;    ///< Bitmasks of the glyph rows (see #__build_font_masks)
 } sprite_font = { .sprite = NULL, .font_width = 8, .font_height = 8 };
 
 
@@ -142,6 +145,228 @@ static int __is_transparent( int bitdepth, uint32_t color )
     return 0;
 }
 
+/** @brief Expand 4 bits of a glyph row bitmask (MSB first) into a mask of 4 16 bpp pixels */
+#define __GLYPH_MASK16(n) ( ((n) & 8 ? 0xFFFF000000000000ull : 0) | ((n) & 4 ? 0x0000FFFF00000000ull : 0) | \
+                            ((n) & 2 ? 0x00000000FFFF0000ull : 0) | ((n) & 1 ? 0x000000000000FFFFull : 0) )
+
+/** @brief Masks of 4 16 bpp pixels for each combination of 4 bits of a glyph row */
+static const uint64_t __glyph_mask16[16] = {
+    __GLYPH_MASK16(0),  __GLYPH_MASK16(1),  __GLYPH_MASK16(2),  __GLYPH_MASK16(3),
+    __GLYPH_MASK16(4),  __GLYPH_MASK16(5),  __GLYPH_MASK16(6),  __GLYPH_MASK16(7),
+    __GLYPH_MASK16(8),  __GLYPH_MASK16(9),  __GLYPH_MASK16(10), __GLYPH_MASK16(11),
+    __GLYPH_MASK16(12), __GLYPH_MASK16(13), __GLYPH_MASK16(14), __GLYPH_MASK16(15),
+};
+
+/** @brief Masks of 2 32 bpp pixels for each combination of 2 bits of a glyph row */
+static const uint64_t __glyph_mask32[4] = {
+    0x0000000000000000ull, 0x00000000FFFFFFFFull, 0xFFFFFFFF00000000ull, 0xFFFFFFFFFFFFFFFFull,
+};
+
+/**
+ * @brief Draw some pixels of a glyph row one by one
+ *
+ * @param[out] dst
+ *             Pointer to the first pixel (16 or 32 bpp)
+ * @param[in]  mask
+ *             Bitmask of the glyph row, starting from the MSB
+ * @param[in]  n
+ *             Number of pixels to draw
+ * @param[in]  trans
+ *             If set, pixels not in the mask are left untouched
+ */
+#define __draw_glyph_pixels( dst, mask, n, trans ) ({ \
+    uint64_t __m = (mask); \
+    for( int __i = 0; __i < (n); __i++, __m <<= 1 ) \
+    { \
+        if( (int64_t)__m < 0 ) { (dst)[__i] = f_color; } \
+        else if( !(trans) ) { (dst)[__i] = b_color; } \
+    } \
+})
+
+/**
+ * @brief Draw a glyph row in a 16 bpp buffer
+ *
+ * Pixels are written 4 at a time with 64-bit stores, selecting the foreground
+ * and background colors through the masks in #__glyph_mask16.
+ *
+ * @param[out] dst
+ *             Pointer to the first pixel
+ * @param[in]  mask
+ *             Bitmask of the glyph row, starting from the MSB
+ * @param[in]  n
+ *             Number of pixels to draw (at most 64)
+ * @param[in]  trans
+ *             If set, pixels not in the mask are left untouched
+ */
+static void __draw_glyph_row16( uint16_t *dst, uint64_t mask, int n, int trans )
+{
+    /* Pixels before the first 64-bit aligned address */
+    int head = MIN( ((8 - ((uint32_t)dst & 7)) & 7) / 2, n );
+    __draw_glyph_pixels( dst, mask, head, trans );
+    dst += head; mask <<= head; n -= head;
+
+    uint64_t fg = (uint16_t)f_color * 0x0001000100010001ull;
+    uint64_t bg = (uint16_t)b_color * 0x0001000100010001ull;
+    for( ; n >= 4; n -= 4, dst += 4, mask <<= 4 )
+    {
+        uint64_t m = __glyph_mask16[mask >> 60];
+        if( !trans ) { *(uint64_t *)dst = (fg & m) | (bg & ~m); }
+        else if( m == ~0ull ) { *(uint64_t *)dst = fg; }
+        else if( m ) { __draw_glyph_pixels( dst, mask, 4, 1 ); }
+    }
+
+    __draw_glyph_pixels( dst, mask, n, trans );
+}
+
+/**
+ * @brief Draw a glyph row in a 32 bpp buffer
+ *
+ * @see #__draw_glyph_row16
+ */
+static void __draw_glyph_row32( uint32_t *dst, uint64_t mask, int n, int trans )
+{
+    /* Pixel before the first 64-bit aligned address */
+    int head = MIN( ((uint32_t)dst & 7) ? 1 : 0, n );
+    __draw_glyph_pixels( dst, mask, head, trans );
+    dst += head; mask <<= head; n -= head;
+
+    uint64_t fg = f_color * 0x0000000100000001ull;
+    uint64_t bg = b_color * 0x0000000100000001ull;
+    for( ; n >= 2; n -= 2, dst += 2, mask <<= 2 )
+    {
+        uint64_t m = __glyph_mask32[mask >> 62];
+        if( !trans ) { *(uint64_t *)dst = (fg & m) | (bg & ~m); }
+        else if( m == ~0ull ) { *(uint64_t *)dst = fg; }
+        else if( m ) { __draw_glyph_pixels( dst, mask, 2, 1 ); }
+    }
+
+    __draw_glyph_pixels( dst, mask, n, trans );
+}
+
+/**
+ * @brief Copy a row of 16 bpp pixels, skipping the transparent ones
+ *
+ * Pixels are processed 4 at a time with 64-bit loads and stores. The alpha
+ * bits of the 4 pixels are spread into a mask, so that fully opaque and fully
+ * transparent groups (the common case) need no per-pixel work.
+ *
+ * @param[out] dst
+ *             Pointer to the first destination pixel
+ * @param[in]  src
+ *             Pointer to the first source pixel
+ * @param[in]  n
+ *             Number of pixels to copy
+ */
+static void __blit_row16_trans( uint16_t *dst, const uint16_t *src, int n )
+{
+    /* Pixels before the first 64-bit aligned address */
+    for( ; n > 0 && ((uint32_t)dst & 7); n--, dst++, src++ )
+    {
+        if( *src & 1 ) { *dst = *src; }
+    }
+
+    for( ; n >= 4; n -= 4, dst += 4, src += 4 )
+    {
+        uint64_t v;
+        memcpy( &v, src, 8 );
+        uint64_t m = (v & 0x0001000100010001ull) * 0xFFFF;
+        if( m == ~0ull ) { *(uint64_t *)dst = v; }
+        else if( m )
+        {
+            for( int i = 0; i < 4; i++ )
+            {
+                if( src[i] & 1 ) { dst[i] = src[i]; }
+            }
+        }
+    }
+
+    for( ; n > 0; n--, dst++, src++ )
+    {
+        if( *src & 1 ) { *dst = *src; }
+    }
+}
+
+/**
+ * @brief Alpha blend a row of 32 bpp pixels
+ *
+ * Fully transparent pixels are skipped and fully opaque pixels are copied,
+ * 2 at a time with 64-bit stores, without reading back the destination.
+ * The other pixels are blended, with the red and blue channels computed
+ * together in a single multiplication.
+ *
+ * @param[out] dst
+ *             Pointer to the first destination pixel
+ * @param[in]  src
+ *             Pointer to the first source pixel
+ * @param[in]  n
+ *             Number of pixels to blend
+ */
+static void __blit_row32_blend( uint32_t *dst, const uint32_t *src, int n )
+{
+    for( int i = 0; i < n; i++ )
+    {
+        if( ((uint32_t)&dst[i] & 7) == 0 && i + 1 < n )
+        {
+            uint64_t v;
+            memcpy( &v, &src[i], 8 );
+            if( (v & 0x000000FF000000FFull) == 0x000000FF000000FFull ) { *(uint64_t *)&dst[i++] = v; continue; }
+            if( (v & 0x000000FF000000FFull) == 0 ) { i++; continue; }
+        }
+
+        uint32_t sc = src[i];
+        uint32_t st = sc & 0xFF;
+        if( st == 0x00 ) { continue; }
+        if( st == 0xFF ) { dst[i] = sc; continue; }
+
+        uint32_t ct = 255 - st;
+        uint32_t cc = dst[i];
+        uint32_t rb = ((((cc >> 8) & 0x00FF00FF) * ct + ((sc >> 8) & 0x00FF00FF) * st) >> 8) & 0x00FF00FF;
+        uint32_t g = ((((cc >> 16) & 0xFF) * ct + ((sc >> 16) & 0xFF) * st) >> 8) & 0xFF;
+        dst[i] = (rb << 8) | (g << 16) | 0xFF;
+    }
+}
+
+/**
+ * @brief Compute the bitmasks of the rows of the glyphs of the current sprite font
+ *
+ * Each row of a glyph is described by #sprite_font.mask_words 64-bit words,
+ * where each bit is set if the corresponding pixel is not transparent
+ * (starting from the MSB of the first word). Drawing a character only
+ * requires going through the bitmasks, without looking at the sprite.
+ */
+static void __build_font_masks( void )
+{
+    sprite_t *sprite = sprite_font.sprite;
+    int bpp = TEX_FORMAT_BITDEPTH(sprite_get_format(sprite));
+    int num_glyphs = sprite->hslices * sprite->vslices;
+    int words = (sprite_font.font_width + 63) / 64;
+
+    free( sprite_font.masks );
+    sprite_font.mask_words = words;
+    sprite_font.masks = calloc( num_glyphs * sprite_font.font_height * words, sizeof(uint64_t) );
+
+    uint64_t *mask = sprite_font.masks;
+    for( int g = 0; g < num_glyphs; g++ )
+    {
+        const int sx = ( g % sprite->hslices ) * sprite_font.font_width;
+        const int sy = ( g / sprite->hslices ) * sprite_font.font_height;
+
+        for( int yp = 0; yp < sprite_font.font_height; yp++, mask += words )
+        {
+            const int run = (sy + yp) * sprite->width + sx;
+
+            for( int xp = 0; xp < sprite_font.font_width; xp++ )
+            {
+                uint32_t c = bpp == 16 ? ((uint16_t *)sprite->data)[run + xp] : ((uint32_t *)sprite->data)[run + xp];
+                if( !__is_transparent( bpp / 8, c ) )
+                {
+                    mask[xp / 64] |= 0x8000000000000000ull >> (xp & 63);
+                }
+            }
+        }
+    }
+}
+
 void graphics_draw_pixel( surface_t* disp, int x, int y, uint32_t color )
 {
     if( disp == 0 ) { return; }
@@ -431,6 +656,8 @@ void graphics_set_default_font( void )
     sprite_font.sprite = NULL;
     sprite_font.font_width = 8;
     sprite_font.font_height = 8;
+    free( sprite_font.masks );
+    sprite_font.masks = NULL;
 }
 
 void graphics_set_font_sprite( sprite_t *font )
@@ -438,6 +665,7 @@ void graphics_set_font_sprite( sprite_t *font )
     sprite_font.sprite = font;
     sprite_font.font_width = sprite_font.sprite->width / sprite_font.sprite->hslices;
     sprite_font.font_height = sprite_font.sprite->height / sprite_font.sprite->vslices;
+    __build_font_masks();
 }
 
 void graphics_draw_character( surface_t* disp, int x, int y, char ch )
@@ -445,7 +673,7 @@ void graphics_draw_character( surface_t* disp, int x, int y, char ch )
     if( disp == 0 ) { return; }
 
     int pix_stride = TEX_FORMAT_BYTES2PIX(surface_get_format(disp), disp->stride);
-    int depth = display_get_bitdepth();
+    int depth = TEX_FORMAT_BITDEPTH(surface_get_format(disp)) / 8;
 
     // resetting to default font if bit depth has been changed
     if( sprite_font.sprite != NULL && depth*8 != TEX_FORMAT_BITDEPTH(sprite_get_format(sprite_font.sprite)) )
@@ -456,136 +684,58 @@ void graphics_draw_character( surface_t* disp, int x, int y, char ch )
     /* Figure out if they want the background to be transparent */
     int trans = __is_transparent( depth, b_color );
 
+    /* Find the bitmasks of the glyph rows */
+    const uint64_t *masks;
+    uint64_t default_masks[8];
+    int words;
+
     if ( sprite_font.sprite != NULL )
     {
         // Use custom font
-        const int sx = ( ch % sprite_font.sprite->hslices ) * sprite_font.font_width;
-        const int sy = ( ch / sprite_font.sprite->hslices ) * sprite_font.font_height;
-        const int ex = sx + sprite_font.font_width;
-        const int ey = sy + sprite_font.font_height;
-
-        const int tx = x - sx;
-        const int ty = y - sy;
+        int glyph = (unsigned char)ch;
+        if( glyph >= sprite_font.sprite->hslices * sprite_font.sprite->vslices ) { return; }
 
-        if( depth == 2 )
+        words = sprite_font.mask_words;
+        masks = sprite_font.masks + glyph * sprite_font.font_height * words;
+    }
+    else
+    {
+        // Use 1bpp default font
+        for( int row = 0; row < 8; row++ )
         {
-            uint16_t *buffer = (uint16_t *)__get_buffer( disp );
-            uint16_t *sp_data = (uint16_t *)sprite_font.sprite->data;
-
-            for( int yp = sy; yp < ey; yp++ )
-            {
-                const register int run = yp * sprite_font.sprite->width;
-
-                for( int xp = sx; xp < ex; xp++ )
-                {
-                    const char c = sp_data[xp + run];
-                    int active = !__is_transparent (depth, c);
-                    if( trans )
-                    {
-                        if( active )
-                        {
-                            /* Only draw it if it is active */
-                            __set_pixel( buffer, tx + xp, ty + yp, f_color );
-                        }
-                    }
-                    else
-                    {
-                        /* Display foreground or background depending on font data */
-                        __set_pixel( buffer, tx + xp, ty + yp, active ? f_color : b_color );
-                    }
-                }
-            }
+            default_masks[row] = (uint64_t)__font_data[((unsigned char)ch * 8) + row] << 56;
         }
-        else
-        {
-            uint32_t *buffer = (uint32_t *)__get_buffer( disp );
-            uint32_t *sp_data = (uint32_t *)sprite_font.sprite->data;
 
-            for( int yp = sy; yp < ey; yp++ )
-            {
-                const register int run = yp * sprite_font.sprite->width;
+        words = 1;
+        masks = default_masks;
+    }
 
-                for( int xp = sx; xp < ex; xp++ )
-                {
-                    const char c = sp_data[xp + run];
-                    int active = !__is_transparent (depth, c);
-                    if( trans )
-                    {
-                        if( active )
-                        {
-                            /* Only draw it if it is active */
-                            __set_pixel( buffer, tx + xp, ty + yp, f_color );
-                        }
-                    }
-                    else
-                    {
-                        /* Display foreground or background depending on font data */
-                        __set_pixel( buffer, tx + xp, ty + yp, active ? f_color : b_color );
-                    }
-                }
-            }
-        }
-    } else {
-        // Use 1bpp default font
-        int trans = __is_transparent( depth, b_color );
+    /* Clip the glyph to the surface */
+    const int r0 = MAX( -y, 0 );
+    const int r1 = MIN( sprite_font.font_height, (int)disp->height - y );
+    const int c0 = MAX( -x, 0 );
+    const int c1 = MIN( sprite_font.font_width, (int)disp->width - x );
 
-        if( depth == 2 )
+    for( int row = r0; row < r1; row++ )
+    {
+        const uint64_t *row_mask = masks + row * words;
+
+        for( int col = c0; col < c1; )
         {
-            uint16_t *buffer = (uint16_t *)__get_buffer( disp );
+            /* Draw up to the end of the current word of the bitmask */
+            int n = MIN( c1, (col & ~63) + 64 ) - col;
+            uint64_t mask = row_mask[col / 64] << (col & 63);
 
-            for( int row = 0; row < 8; row++ )
+            if( depth == 2 )
             {
-                unsigned char c = __font_data[(ch * 8) + row];
-
-                for( int col = 0; col < 8; col++ )
-                {
-                    int active = (c & 0x80) != 0;
-                    if( trans )
-                    {
-                        if( active )
-                        {
-                            /* Only draw it if it is active */
-                            __set_pixel( buffer, x + col, y + row, f_color );
-                        }
-                    }
-                    else
-                    {
-                        /* Display foreground or background depending on font data */
-                        __set_pixel( buffer, x + col, y + row, active ? f_color : b_color );
-                    }
-
-                    c <<= 1;
-                }
+                __draw_glyph_row16( (uint16_t *)__get_buffer( disp ) + x + col + (y + row) * pix_stride, mask, n, trans );
             }
-        }
-        else
-        {
-            uint32_t *buffer = (uint32_t *)__get_buffer( disp );
-
-            for( int row = 0; row < 8; row++ )
+            else
             {
-                unsigned char c = __font_data[(ch * 8) + row];
-
-                for( int col = 0; col < 8; col++ )
-                {
-                    int active = (c & 0x80) != 0;
-                    if( trans )
-                    {
-                        if( active )
-                        {
-                            /* Only draw it if it is active */
-                            __set_pixel( buffer, x + col, y + row, f_color );
-                        }
-                    }
-                    else
-                    {
-                        /* Display foreground or background depending on font data */
-                        __set_pixel( buffer, x + col, y + row, active ? f_color : b_color );
-                    }
-
-                    c <<= 1;
-                }
+                __draw_glyph_row32( (uint32_t *)__get_buffer( disp ) + x + col + (y + row) * pix_stride, mask, n, trans );
             }
+
+            col += n;
         }
     }
 }
@@ -714,12 +864,7 @@ void graphics_draw_sprite_stride( surface_t* disp, int x, int y, sprite_t *sprit
 
         for( int yp = sy; yp < ey; yp++ )
         {
-            const register int run = yp * sprite->width;
-
-            for( int xp = sx; xp < ex; xp++ )
-            {
-                __set_pixel( buffer, tx + xp, ty + yp, sp_data[xp + run] );
-            }
+            memcpy( &buffer[tx + sx + (ty + yp) * pix_stride], &sp_data[sx + yp * sprite->width], (ex - sx) * sizeof(*buffer) );
         }
     }
     else if( depth == 32 && TEX_FORMAT_BITDEPTH(sprite_get_format(sprite)) == 32 )
@@ -729,12 +874,7 @@ void graphics_draw_sprite_stride( surface_t* disp, int x, int y, sprite_t *sprit
 
         for( int yp = sy; yp < ey; yp++ )
         {
-            const register int run = yp * sprite->width;
-
-            for( int xp = sx; xp < ex; xp++ )
-            {
-                __set_pixel( buffer, tx + xp, ty + yp, sp_data[xp + run] );
-            }
+            memcpy( &buffer[tx + sx + (ty + yp) * pix_stride], &sp_data[sx + yp * sprite->width], (ex - sx) * sizeof(*buffer) );
         }
     }
 }
@@ -829,16 +969,8 @@ void graphics_draw_sprite_trans_stride( surface_t* disp, int x, int y, sprite_t
 
         for( int yp = sy; yp < ey; yp++ )
         {
-            const register int run = yp * sprite->width;
-
-            for( int xp = sx; xp < ex; xp++ )
-            {
-                /* Only display the pixel if alpha bit is set */
-                if( !__is_transparent( 2, sp_data[xp + run] ) )
-                {
-                    __set_pixel( buffer, tx + xp, ty + yp, sp_data[xp + run] );
-                }
-            }
+            /* Only display the pixels with the alpha bit set */
+            __blit_row16_trans( &buffer[tx + sx + (ty + yp) * pix_stride], &sp_data[sx + yp * sprite->width], ex - sx );
         }
     }
     else if( depth == 32 && TEX_FORMAT_BITDEPTH(sprite_get_format(sprite)) == 32 )
@@ -848,41 +980,8 @@ void graphics_draw_sprite_trans_stride( surface_t* disp, int x, int y, sprite_t
 
         for( int yp = sy; yp < ey; yp++ )
         {
-            const int run = yp * sprite->width;
-
-            for( int xp = sx; xp < ex; xp++ )
-            {
-                /* Get 32bit representations */
-                uint8_t *new_color = (uint8_t *)(&sp_data[xp + run]);
-                uint32_t cur_color = __get_pixel( buffer, tx + xp, ty + yp );
-
-                /* Get current color */
-                uint32_t cr = (cur_color >> 24) & 0xFF;
-                uint32_t cg = (cur_color >> 16) & 0xFF;
-                uint32_t cb = (cur_color >> 8) & 0xFF;
-
-                /* Get new color */
-                uint32_t sr = new_color[0];
-                uint32_t sg = new_color[1];
-                uint32_t sb = new_color[2];
-
-                /* Transparencies */
-                uint32_t st = new_color[3];
-                uint32_t ct = 255 - st;
-
-                /* Mixed color */
-                uint32_t mixed_color;
-                uint8_t *final_color = (uint8_t *)(&mixed_color);
-
-                final_color[0] = ((cr * ct) + (sr * st)) >> 8;
-                final_color[1] = ((cg * ct) + (sg * st)) >> 8;
-                final_color[2] = ((cb * ct) + (sb * st)) >> 8;
-
-                /* Since we are doing mixing anyway */
-                final_color[3] = 255;
-
-                __set_pixel( buffer, tx + xp, ty + yp, mixed_color );
-            }
+            /* Blend the sprite over the current contents (the result is opaque) */
+            __blit_row32_blend( &buffer[tx + sx + (ty + yp) * pix_stride], &sp_data[sx + yp * sprite->width], ex - sx );
         }
     }
 }
@@ -329,12 +329,26 @@
  *    never used before. This means that having a logic to cycle through tile
  *    descriptors (instead of always using the same) will reduce the number of
  *    `SYNC_TILE` commands.
- *  * TMEM. Currently, the whole TMEM is tracking as a single resource (using
- *    the bit defined by `AUTOSYNC_TMEM(0)`. Any command that writes to TMEM
- *    (eg: #rdpq_load_block) will "change" the resource. Any command that reads
- *    from TMEM (eg: #rdpq_triangle with a texture) will "use" the resource.
- *    Writing to TMEM while something is reading requires a `SYNC_LOAD` command
- *    to be issued.
+ *  * TMEM. TMEM is split into 8 portions of 512 bytes each, tracked by 8 bits
+ *    (`AUTOSYNC_TMEM(n)`). Any command that writes to TMEM (eg: #rdpq_load_block)
+ *    will "change" the portions it writes to. Any command that reads from TMEM
+ *    (eg: #rdpq_triangle with a texture) will "use" the portions that can be
+ *    read through the tile descriptors. Writing to a portion of TMEM while
+ *    something is reading it requires a `SYNC_LOAD` command to be issued.
+ * 
+ * To compute which TMEM portions are accessed, the CPU keeps a copy of the
+ * tile descriptors (#rdpq_tiletrack_t), updated by #rdpq_set_tile,
+ * #rdpq_set_tile_size and the load commands. For loads, the written range
+ * is computed from the TMEM address of the tile and the amount of data
+ * loaded. For draws, since the RDP might sample from multiple tiles (eg:
+ * mipmaps or multi-texturing), all portions reachable by any tile that is
+ * configured for drawing are considered in use; the reachable range is
+ * bounded by the tile extents (when clamping) or the wrapping masks. Whenever
+ * a tile address is not known on the CPU (eg: #RDPQ_AUTOTMEM within blocks),
+ * the whole TMEM is considered. The net effect is that loading a texture into
+ * a TMEM area not used by the previous draws (eg: double-buffering TMEM)
+ * does not cause a `SYNC_LOAD`. See #rdpq_get_autosync_stats to check how many
+ * syncs were emitted and avoided.
  * 
  * Note that there is a limit with the current implementation: the RDP can use
  * multiple tiles with a single command (eg: when using multi-texturing or LODs),
@@ -369,6 +383,7 @@
 #include "utils.h"
 #include "rdp.h"
 #include <string.h>
+#include <stdlib.h>
 #include <math.h>
 #include <float.h>
 
@@ -391,6 +406,8 @@ typedef struct rdpq_state_s {
     uint32_t padding;                   ///< Padding
     uint32_t rdram_state_address;       ///< Address of this state structure in RDRAM
     uint32_t rdram_syncpoint_id;        ///< Address of the syncpoint ID in RDRAM
+    uint32_t tri_rejected;              ///< Number of triangles rejected by RSP (see #RDPQ_CFG_TRIREJECT)
+    uint32_t padding2;                  ///< Padding
 } rdpq_state_t;
 
 /** @brief Mirror in RDRAM of the state of the rdpq ucode. */ 
@@ -407,6 +424,34 @@ rdpq_block_state_t rdpq_block_state;
 /** @brief Tracking state of RDP */
 rdpq_tracking_t rdpq_tracking;
 
+/** @brief Tracking state of RDP tile descriptors (used by the autosync engine) */
+static rdpq_tiletrack_t rdpq_tiles[8];
+
+/** @brief Union of the TMEM portions that can be read by drawing commands (cached) */
+static uint8_t rdpq_tiles_draw_mask;
+
+/** @brief Statistics of the autosync engine */
+static rdpq_autosync_stats_t rdpq_autosync_stats;
+
+/** @brief CPU mirror of the auto-TMEM state of the RSP ucode (see #rdpq_set_tile_autotmem) */
+static struct {
+    int depth;                  ///< Nesting level of auto-TMEM (0 = disabled)
+    int addr;                   ///< Current auto-TMEM address in bytes (-1 if unknown)
+    int prev;                   ///< Previous auto-TMEM address (used by #RDPQ_AUTOTMEM_REUSE)
+} rdpq_autotmem;
+
+/** @brief Counter of TMEM writes, used to version the TMEM contents */
+static uint32_t rdpq_tmem_writes;
+
+/** @brief Value of #rdpq_tmem_writes at the time each 64-byte chunk of TMEM was last written */
+static uint32_t rdpq_tmem_stamps[4096/64];
+
+/** @brief Nesting depth of #__rdpq_tmem_scope_begin */
+static int rdpq_tmem_scope;
+
+/** @brief Value of #rdpq_tmem_writes when the outermost residency scope was opened */
+static uint32_t rdpq_tmem_scope_stamp;
+
 /** 
  * @brief RDP interrupt handler 
  *
@@ -466,8 +511,16 @@ void rdpq_init()
     // Clear library globals
     memset(&rdpq_block_state, 0, sizeof(rdpq_block_state));
     rdpq_config = RDPQ_CFG_DEFAULT;
+    rdpq_tmem_scope = 0;
     rdpq_tracking.autosync = 0;
     rdpq_tracking.mode_freeze = false;
+    for (int i=0; i<8; i++)
+        rdpq_tiles[i] = (rdpq_tiletrack_t){ .tmem_addr = RDPQ_TILETRACK_UNUSED };
+    rdpq_tiles_draw_mask = 0;
+    memset(&rdpq_autosync_stats, 0, sizeof(rdpq_autosync_stats));
+    __rdpq_triangle_init();
+    memset(&rdpq_autotmem, 0, sizeof(rdpq_autotmem));
+    __rdpq_tmem_write(0, 4096);
 
     // Register an interrupt handler for DP interrupts, and activate them.
     register_DP_handler(__rdpq_interrupt);
@@ -514,6 +567,33 @@ uint32_t rdpq_config_disable(uint32_t cfg)
     return rdpq_config_set(rdpq_config & ~cfg);
 }
 
+/** @brief Check whether a configuration flag is enabled (see #rdpq_config_set) */
+bool __rdpq_config_enabled(uint32_t cfg)
+{
+    return (rdpq_config & cfg) != 0;
+}
+
+/**
+ * @brief Return the number of triangles rejected by RSP since #rdpq_init
+ * 
+ * This waits for RSP to go idle, so that the counter is up to date.
+ */
+uint32_t __rdpq_triangle_rejected(void)
+{
+    rspq_overlay_get_state(&rsp_rdpq);
+    return rdpq_state->tri_rejected;
+}
+
+void rdpq_get_autosync_stats(rdpq_autosync_stats_t *stats)
+{
+    *stats = rdpq_autosync_stats;
+}
+
+void rdpq_reset_autosync_stats(void)
+{
+    memset(&rdpq_autosync_stats, 0, sizeof(rdpq_autosync_stats));
+}
+
 void rdpq_fence(void)
 {
     // We want the RSP to wait until the RDP is finished. We do this in
@@ -534,6 +614,9 @@ void rdpq_exec(void *buffer, int size)
     // the static buffer.
     assertf(!rspq_in_block(), "cannot call rdpq_exec() inside a block");
 
+    // We don't know what the buffer loads in TMEM
+    __rdpq_tmem_write(0, 4096);
+
     void *end = buffer + size;
     rspq_int_write(RSPQ_CMD_RDP_SET_BUFFER, PhysicalAddr(end), PhysicalAddr(buffer), PhysicalAddr(end));
 }
@@ -588,13 +671,272 @@ extern inline void __rdpq_autosync_use(uint32_t res);
 void __rdpq_autosync_change(uint32_t res) {
     res &= rdpq_tracking.autosync;
     if (res) {
-        if ((res & AUTOSYNC_TILES) && (rdpq_config & RDPQ_CFG_AUTOSYNCTILE))
+        if ((res & AUTOSYNC_TILES) && (rdpq_config & RDPQ_CFG_AUTOSYNCTILE)) {
             rdpq_sync_tile();
-        if ((res & AUTOSYNC_TMEMS) && (rdpq_config & RDPQ_CFG_AUTOSYNCLOAD))
+            rdpq_autosync_stats.sync_tile++;
+        }
+        if ((res & AUTOSYNC_TMEMS) && (rdpq_config & RDPQ_CFG_AUTOSYNCLOAD)) {
             rdpq_sync_load();
-        if ((res & AUTOSYNC_PIPE)  && (rdpq_config & RDPQ_CFG_AUTOSYNCPIPE))
+            rdpq_autosync_stats.sync_load++;
+        }
+        if ((res & AUTOSYNC_PIPE)  && (rdpq_config & RDPQ_CFG_AUTOSYNCPIPE)) {
             rdpq_sync_pipe();
+            rdpq_autosync_stats.sync_pipe++;
+        }
+    }
+}
+
+/** @brief Compute the AUTOSYNC_TMEM bits for a range of TMEM (wrapping around at 4 KiB) */
+static uint32_t tmem_range_mask(int addr, int bytes)
+{
+    if (bytes <= 0) return 0;
+    if (bytes >= 4096) return AUTOSYNC_TMEMS;
+    uint32_t mask = 0;
+    for (int i = addr / 512; i <= (addr + bytes - 1) / 512; i++)
+        mask |= AUTOSYNC_TMEM(i & 7);
+    return mask;
+}
+
+/** @brief Compute the TMEM portions that a draw command can read through a tile */
+static uint32_t tiletrack_draw_mask(rdpq_tiletrack_t *t)
+{
+    if (t->tmem_addr == RDPQ_TILETRACK_UNUSED) return 0;
+    if (t->tmem_addr == RDPQ_TILETRACK_UNKNOWN) return AUTOSYNC_TMEMS;
+
+    // Texels coordinates are bounded by the extents when clamping,
+    // or by the mask when wrapping. Otherwise, we cannot know.
+    int rows = t->clamp_t && t->rows ? t->rows : (t->mask_t ? 1 << t->mask_t : 0);
+    int cols = t->clamp_s && t->cols ? t->cols : (t->mask_s ? 1 << t->mask_s : 0);
+    if (!rows || !cols) return AUTOSYNC_TMEMS;
+
+    // Bilinear filtering can fetch one texel past the boundary
+    rows++; cols++;
+    int bytes = (rows-1) * t->tmem_pitch + MAX(TEX_FORMAT_PIX2BYTES(t->fmt, cols), t->tmem_pitch);
+    uint32_t mask = tmem_range_mask(t->tmem_addr, bytes);
+
+    // 32-bit and YUV textures are split across the two halves of TMEM
+    if (TEX_FORMAT_BITDEPTH(t->fmt) == 32 || t->fmt == FMT_YUV16)
+        mask |= tmem_range_mask(t->tmem_addr + 2048, bytes);
+    // 4-bit and 8-bit textures can be drawn through a palette (upper half)
+    if (TEX_FORMAT_BITDEPTH(t->fmt) <= 8)
+        mask |= tmem_range_mask(2048, 2048);
+    return mask;
+}
+
+/** @brief Refresh the cached TMEM masks after a tile descriptor changed */
+static void tiletrack_refresh(int tidx)
+{
+    rdpq_tiles[tidx].tmem_mask = tiletrack_draw_mask(&rdpq_tiles[tidx]) >> 8;
+
+    rdpq_tiles_draw_mask = 0;
+    for (int i=0; i<8; i++)
+        if (!rdpq_tiles[i].load_only)
+            rdpq_tiles_draw_mask |= rdpq_tiles[i].tmem_mask;
+}
+
+/** @brief Mark all tile descriptors as unknown (eg: when a block is run) */
+static void tiletrack_reset_unknown(void)
+{
+    for (int i=0; i<8; i++)
+        rdpq_tiles[i] = (rdpq_tiletrack_t){ .tmem_addr = RDPQ_TILETRACK_UNKNOWN, .tmem_mask = 0xFF };
+    rdpq_tiles_draw_mask = 0xFF;
+    // We don't know what the block loads in TMEM either, nor how
+    // much auto-TMEM space it allocates.
+    __rdpq_tmem_write(0, 4096);
+    if (rdpq_autotmem.depth > 0)
+        rdpq_autotmem.addr = rdpq_autotmem.prev = -1;
+}
+
+/** @brief Return the current auto-TMEM address, or -1 if it is not known on the CPU */
+int __rdpq_autotmem_addr(void)
+{
+    return rdpq_autotmem.depth > 0 && !rspq_in_block() ? rdpq_autotmem.addr : -1;
+}
+
+/** @brief Mark a range of TMEM as written (wrapping around at 4 KiB), invalidating its contents */
+void __rdpq_tmem_write(int addr, int bytes)
+{
+    rdpq_tmem_writes++;
+    if (bytes > 4096) bytes = 4096;
+    for (int i = addr / 64; i <= (addr + bytes - 1) / 64; i++)
+        rdpq_tmem_stamps[i & 63] = rdpq_tmem_writes;
+}
+
+/** @brief Return a stamp representing the current TMEM contents (see #__rdpq_tmem_unchanged) */
+uint32_t __rdpq_tmem_stamp(void)
+{
+    return rdpq_tmem_writes;
+}
+
+/**
+ * @brief Check whether a range of TMEM was not written since a stamp was taken
+ * 
+ * This only looks at the TMEM writes, so it is up to the caller to make sure
+ * that the source of the data loaded in TMEM was not modified in the meantime
+ * (eg: a font atlas, which is never modified).
+ * 
+ * @param addr      Start of the TMEM range (in bytes)
+ * @param bytes     Size of the TMEM range (in bytes)
+ * @param stamp     Stamp returned by #__rdpq_tmem_stamp
+ * @return true if the range was not written after the stamp was taken
+ */
+bool __rdpq_tmem_resident(int addr, int bytes, uint32_t stamp)
+{
+    for (int i = addr / 64; i <= (addr + bytes - 1) / 64; i++)
+        if (rdpq_tmem_stamps[i & 63] > stamp)
+            return false;
+    return true;
+}
+
+/**
+ * @brief Check whether a range of TMEM still holds the data of a cached upload
+ * 
+ * This is used by the TMEM residency cache of #rdpq_tex_upload. If the cache
+ * is disabled (see #RDPQ_CFG_TEXCACHE), it returns false unless the stamp
+ * was taken within the current residency scope (see #__rdpq_tmem_scope_begin).
+ * Otherwise, it is the same as #__rdpq_tmem_resident.
+ */
+bool __rdpq_tmem_unchanged(int addr, int bytes, uint32_t stamp)
+{
+    if (!(rdpq_config & RDPQ_CFG_TEXCACHE)) {
+        if (!rdpq_tmem_scope || stamp <= rdpq_tmem_scope_stamp)
+            return false;
+    }
+    return __rdpq_tmem_resident(addr, bytes, stamp);
+}
+
+/**
+ * @brief Open a TMEM residency scope
+ * 
+ * Within a scope, textures and palettes uploaded after the scope was opened
+ * are tracked as resident in TMEM even if #RDPQ_CFG_TEXCACHE is disabled, so
+ * uploading them again is skipped. The caller guarantees that the surfaces
+ * and palettes it uploads are not modified until the scope is closed. Scopes
+ * can be nested.
+ */
+void __rdpq_tmem_scope_begin(void)
+{
+    if (rdpq_tmem_scope++ == 0)
+        rdpq_tmem_scope_stamp = rdpq_tmem_writes;
+}
+
+/** @brief Close a TMEM residency scope (see #__rdpq_tmem_scope_begin) */
+void __rdpq_tmem_scope_end(void)
+{
+    assertf(rdpq_tmem_scope > 0, "TMEM residency scope not open");
+    rdpq_tmem_scope--;
+}
+
+/**
+ * @brief Update the tile tracking for a tile or load command.
+ * 
+ * @return The AUTOSYNC_TMEM bits written by the command (0 if it doesn't write TMEM)
+ */
+static uint32_t tiletrack_cmd(uint32_t cmd_id, uint32_t arg0, uint32_t arg1)
+{
+    int tidx = (arg1 >> 24) & 7;
+    rdpq_tiletrack_t *t = &rdpq_tiles[tidx];
+    bool split = TEX_FORMAT_BITDEPTH(t->fmt) == 32 || t->fmt == FMT_YUV16;
+    uint32_t tmem = 0;
+    int bytes;
+
+    switch (cmd_id) {
+    case RDPQ_CMD_SET_TILE:
+    case RDPQ_CMD_AUTOTMEM_SET_TILE:
+        t->tmem_addr = (arg0 & 0x1FF) * 8;
+        if (cmd_id == RDPQ_CMD_AUTOTMEM_SET_TILE) {
+            // Resolve the auto-TMEM address like the RSP will do. Within
+            // blocks, we can't know the auto-TMEM state at playback time.
+            if (__rdpq_autotmem_addr() >= 0)
+                t->tmem_addr += (arg0 & (1<<18)) ? rdpq_autotmem.prev : rdpq_autotmem.addr;
+            else
+                t->tmem_addr = RDPQ_TILETRACK_UNKNOWN;
+        }
+        t->tmem_pitch = ((arg0 >> 9) & 0x1FF) * 8;
+        t->fmt = (arg0 >> 19) & 0x1F;
+        t->clamp_t = (arg1 >> 19) & 1;
+        t->mask_t = (arg1 >> 14) & 0xF;
+        t->clamp_s = (arg1 >> 9) & 1;
+        t->mask_s = (arg1 >> 4) & 0xF;
+        t->load_only = false;
+        break;
+    case RDPQ_CMD_SET_TILE_SIZE:
+    case RDPQ_CMD_LOAD_TILE:
+        t->cols = MAX((int)((arg1 >> 14) & 0x3FF) - (int)((arg0 >> 14) & 0x3FF) + 1, 0);
+        t->rows = MAX((int)((arg1 >>  2) & 0x3FF) - (int)((arg0 >>  2) & 0x3FF) + 1, 0);
+        if (cmd_id == RDPQ_CMD_SET_TILE_SIZE) break;
+        bytes = t->rows * t->tmem_pitch;
+        goto load;
+    case RDPQ_CMD_LOAD_BLOCK:
+        bytes = TEX_FORMAT_PIX2BYTES(t->fmt, ((arg1 >> 12) & 0xFFF) + 1);
+        t->load_only = true;
+        goto load;
+    case RDPQ_CMD_LOAD_TLUT:
+        // Each color is replicated 4 times in TMEM
+        bytes = (((arg1 >> 14) & 0xFF) - ((arg0 >> 14) & 0xFF) + 1) * 8;
+        t->load_only = true;
+        split = false;
+    load:
+        if (t->tmem_addr < 0) {
+            tmem = AUTOSYNC_TMEMS;
+            __rdpq_tmem_write(0, 4096);
+            break;
+        }
+        tmem = tmem_range_mask(t->tmem_addr, bytes);
+        __rdpq_tmem_write(t->tmem_addr, bytes);
+        if (split) {
+            tmem |= tmem_range_mask(t->tmem_addr + 2048, bytes);
+            __rdpq_tmem_write(t->tmem_addr + 2048, bytes);
+        }
+        break;
+    default:
+        return 0;
+    }
+
+    tiletrack_refresh(tidx);
+    return tmem;
+}
+
+/**
+ * @brief Autosync engine: refine the TMEM resources changed by a command.
+ * 
+ * Commands changing TMEM are declared as changing `AUTOSYNC_TMEM(0)`; this
+ * function replaces it with the actual portions being written, using the tile
+ * tracking state, and also updates the tile tracking for tile commands.
+ */
+static uint32_t autosync_tmem_change(uint32_t cmd_id, uint32_t arg0, uint32_t arg1, uint32_t res)
+{
+    uint32_t tmem = tiletrack_cmd(cmd_id, arg0, arg1);
+    if (res & AUTOSYNC_TMEMS) {
+        // Count syncs that would have been emitted if the whole TMEM was
+        // tracked as a single resource.
+        if ((rdpq_tracking.autosync & AUTOSYNC_TMEMS) && !(rdpq_tracking.autosync & tmem) &&
+            (rdpq_config & RDPQ_CFG_AUTOSYNCLOAD))
+            rdpq_autosync_stats.sync_load_avoided++;
+        res = (res & ~AUTOSYNC_TMEMS) | tmem;
     }
+    return res;
+}
+
+/**
+ * @brief Autosync engine: refine the TMEM resources used by a draw command.
+ * 
+ * Draw commands are declared as using `AUTOSYNC_TMEM(0)`; this function replaces
+ * it with the portions of TMEM that can be read by the RDP, using the tile
+ * tracking state.
+ * 
+ * @param res       Resources used by the command
+ * @param tile      Tile used by the command
+ * @return          Refined resources
+ */
+uint32_t __rdpq_autosync_tmem_use(uint32_t res, int tile)
+{
+    if (res & AUTOSYNC_TMEMS) {
+        rdpq_tiletrack_t *t = &rdpq_tiles[tile];
+        uint32_t mask = rdpq_tiles_draw_mask | (t->tmem_addr == RDPQ_TILETRACK_UNUSED ? 0xFF : t->tmem_mask);
+        res = (res & ~AUTOSYNC_TMEMS) | (mask << 8);
+    }
+    return res;
 }
 
 /**
@@ -607,6 +949,19 @@ void __rdpq_autosync_change(uint32_t res) {
  * @{
  */
 
+/** @brief Record a new segment of the block being created (see #rdpq_block_segment_t) */
+static void __rdpq_block_add_segment(volatile uint32_t *cmd, uint32_t start)
+{
+    struct rdpq_block_state_s *st = &rdpq_block_state;
+    if (!st->optimize) return;
+    if (st->num_segs == st->max_segs) {
+        st->max_segs = st->max_segs ? st->max_segs * 2 : 16;
+        st->segs = realloc(st->segs, st->max_segs * sizeof(rdpq_block_segment_t));
+        assert(st->segs);
+    }
+    st->segs[st->num_segs++] = (rdpq_block_segment_t){ .cmd = cmd, .start = start };
+}
+
 /** 
  * @brief Initialize RDP block mangament
  * 
@@ -625,9 +980,11 @@ void __rdpq_autosync_change(uint32_t res) {
 void __rdpq_block_begin()
 {
     memset(&rdpq_block_state, 0, sizeof(rdpq_block_state));
+    rdpq_block_state.optimize = (rdpq_config & RDPQ_CFG_BLOCKOPT) != 0;
 
     // Save the tracking state (to be recovered when the block is done)
     rdpq_block_state.previous_tracking = rdpq_tracking;
+    memcpy(rdpq_block_state.previous_tiles, rdpq_tiles, sizeof(rdpq_tiles));
 
     // Set for unknown state (like if we just run another unknown block: we lost track of the RDP state)
     __rdpq_block_run(NULL);    
@@ -667,6 +1024,9 @@ void __rdpq_block_next_buffer(void)
 
         // Chain the block to the current one (if any)
         b->next = NULL;
+        b->segs = NULL;
+        b->num_segs = 0;
+        b->run = false;
         if (st->last_node) {
             st->last_node->next = b;
         }
@@ -687,6 +1047,7 @@ void __rdpq_block_next_buffer(void)
     // to write a RSPQ_CMD_RDP_SET_BUFFER that we might need to coalesce later.
     extern volatile uint32_t *rspq_cur_pointer;
     st->last_rdp_append_buffer = rspq_cur_pointer;
+    __rdpq_block_add_segment(rspq_cur_pointer, PhysicalAddr(st->wptr));
 
     // Enqueue a rspq command that will make the RDP DMA registers point to the
     // new buffer (though with DP_START==DP_END, as the buffer is currently empty).
@@ -719,12 +1080,22 @@ rdpq_block_t* __rdpq_block_end()
     rdpq_block_t *ret = st->first_node;
 
     // Save the current autosync state in the first node of the RDP block.
-    // This makes it easy to recover it when the block is run
-    if (st->first_node)
+    // This makes it easy to recover it when the block is run. Also save
+    // the segments (if recorded), that are needed to optimize the block
+    // before it is run.
+    if (st->first_node) {
         st->first_node->tracking = rdpq_tracking;
+        st->first_node->segs = st->segs;
+        st->first_node->num_segs = st->num_segs;
+    } else {
+        free(st->segs);
+    }
+    st->segs = NULL;
 
     // Recover tracking state before the block creation started
     rdpq_tracking = st->previous_tracking;
+    memcpy(rdpq_tiles, st->previous_tiles, sizeof(rdpq_tiles));
+    for (int i=0; i<8; i++) tiletrack_refresh(i);
 
     // NOTE: no rspq command is enqueued at the end of block. Specifically,
     // there is no RSPQ_CMD_RDP_SET_BUFFER to switch back to the dynamic RDP buffers. 
@@ -741,6 +1112,9 @@ rdpq_block_t* __rdpq_block_end()
 void __rdpq_block_run(rdpq_block_t *block)
 {
     if (block) {
+        // The block might be executing from now on: it cannot be optimized anymore
+        block->run = true;
+
         // We have run a block that contains rdpq commands.
         // During creation, we tracked some state for the block 
         // and saved it into the block structure; set it as current,
@@ -757,6 +1131,9 @@ void __rdpq_block_run(rdpq_block_t *block)
         if (rdpq_tracking.cycle_type_frozen == 0)
             rdpq_tracking.cycle_type_frozen = prev.cycle_type_frozen;
 
+        // Tile descriptors might have been changed by the block
+        tiletrack_reset_unknown();
+
         // The called block has switched static buffer. Adjust our state to set
         // our buffer as pending; if a new RDP command is issued, we will switch
         // back to it.
@@ -781,6 +1158,8 @@ void __rdpq_block_run(rdpq_block_t *block)
             .cycle_type_known = 0,
             .cycle_type_frozen = 0,
         };
+        // we don't know the tile descriptors either
+        tiletrack_reset_unknown();
     }
 }
 
@@ -794,6 +1173,8 @@ void __rdpq_block_run(rdpq_block_t *block)
  */
 void __rdpq_block_free(rdpq_block_t *block)
 {
+    if (block) free(block->segs);
+
     // Go through the chain and free all nodes
     while (block) {
         void *b = block;
@@ -881,6 +1262,7 @@ void __rdpq_block_update(volatile uint32_t *wptr)
         // queue of the block
         extern volatile uint32_t *rspq_cur_pointer;
         st->last_rdp_append_buffer = rspq_cur_pointer;
+        __rdpq_block_add_segment(rspq_cur_pointer, phys_old);
         rspq_int_write(RSPQ_CMD_RDP_APPEND_BUFFER, phys_new);
     }
 }
@@ -910,6 +1292,8 @@ void __rdpq_write8(uint32_t cmd_id, uint32_t arg0, uint32_t arg1)
 __attribute__((noinline))
 void __rdpq_write8_syncchange(uint32_t cmd_id, uint32_t arg0, uint32_t arg1, uint32_t autosync)
 {
+    if (autosync & AUTOSYNC_TILES)
+        autosync = autosync_tmem_change(cmd_id, arg0, arg1, autosync);
     __rdpq_autosync_change(autosync);
     __rdpq_write8(cmd_id, arg0, arg1);
 }
@@ -926,6 +1310,7 @@ void __rdpq_write8_syncuse(uint32_t cmd_id, uint32_t arg0, uint32_t arg1, uint32
 __attribute__((noinline))
 void __rdpq_write8_syncchangeuse(uint32_t cmd_id, uint32_t arg0, uint32_t arg1, uint32_t autosync_c, uint32_t autosync_u)
 {
+    autosync_c = autosync_tmem_change(cmd_id, arg0, arg1, autosync_c);
     __rdpq_autosync_change(autosync_c);
     __rdpq_autosync_use(autosync_u);
     __rdpq_write8(cmd_id, arg0, arg1);
@@ -942,7 +1327,7 @@ void __rdpq_write16(uint32_t cmd_id, uint32_t arg0, uint32_t arg1, uint32_t arg2
 __attribute__((noinline))
 void __rdpq_write16_syncuse(uint32_t cmd_id, uint32_t arg0, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t autosync)
 {
-    __rdpq_autosync_use(autosync);
+    __rdpq_autosync_use(__rdpq_autosync_tmem_use(autosync, (arg1 >> 24) & 7));
     __rdpq_write16(cmd_id, arg0, arg1, arg2, arg3);
 }
 
@@ -950,6 +1335,8 @@ void __rdpq_write16_syncuse(uint32_t cmd_id, uint32_t arg0, uint32_t arg1, uint3
 __attribute__((noinline))
 void __rdpq_fixup_write8_syncchange(uint32_t cmd_id, uint32_t w0, uint32_t w1, uint32_t autosync)
 {
+    if (autosync & AUTOSYNC_TILES)
+        autosync = autosync_tmem_change(cmd_id, w0, w1, autosync);
     __rdpq_autosync_change(autosync);
     rdpq_write(1, RDPQ_OVL_ID, cmd_id, w0, w1);
 }
@@ -1082,6 +1469,19 @@ uint64_t rdpq_get_other_modes_raw(void)
 
 void rdpq_set_tile_autotmem(int16_t tmem_bytes)
 {
+    if (!rspq_in_block()) {
+        // Keep track of the auto-TMEM address on the CPU too, to resolve
+        // the TMEM address of tiles (see #tiletrack_cmd).
+        if (tmem_bytes == 0) {
+            if (rdpq_autotmem.depth++ == 0)
+                rdpq_autotmem.addr = rdpq_autotmem.prev = 0;
+        } else if (tmem_bytes < 0) {
+            if (rdpq_autotmem.depth > 0) rdpq_autotmem.depth--;
+        } else if (rdpq_autotmem.addr >= 0) {
+            rdpq_autotmem.prev = rdpq_autotmem.addr;
+            rdpq_autotmem.addr += tmem_bytes;
+        }
+    }
     if (tmem_bytes >= 0) {
         assertf((tmem_bytes % 8) == 0   , "tmem_bytes must be a multiple of 8");
         tmem_bytes /= 8;
@@ -1090,6 +1490,22 @@ void rdpq_set_tile_autotmem(int16_t tmem_bytes)
 }
 
 void rdpq_sync_full(void (*callback)(void*), void* arg)
+{
+    // A SYNC_FULL marks the end of a frame or of a render-to-texture pass
+    // (see #rdpq_detach). Surfaces might be modified after it (by the CPU or
+    // because they were the render target), so forget about TMEM contents.
+    __rdpq_tmem_write(0, 4096);
+    __rdpq_sync_full_sample(callback, arg);
+}
+
+/**
+ * @brief Enqueue a SYNC_FULL that does not mark the end of a pass
+ * 
+ * This is used to sample RDP state in a callback (eg: by the profiler). TMEM
+ * is not affected by SYNC_FULL, so contrary to #rdpq_sync_full, the TMEM
+ * residency cache of #rdpq_tex_upload is kept valid.
+ */
+void __rdpq_sync_full_sample(void (*callback)(void*), void* arg)
 {
     uint32_t w0 = PhysicalAddr(callback);
     uint32_t w1 = (uint32_t)arg;
@@ -0,0 +1,525 @@
+/**
+ * @file rdpq_batch.c
+ * @brief RDP Command queue: sorted 2D render queue
+ * @ingroup rdp
+ */
+
+#include "rspq.h"
+#include "rdpq.h"
+#include "rdpq_batch.h"
+#include "rdpq_mode.h"
+#include "rdpq_rect.h"
+#include "rdpq_tex.h"
+#include "rdpq_sprite.h"
+#include "sprite.h"
+#include "rdpq_internal.h"
+#include "rdpq_tex_internal.h"
+#include "utils.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** @brief Type of an item in the batch */
+typedef enum {
+    BATCH_FILL_RECT,            ///< Solid rectangle
+    BATCH_TEX_BLIT,             ///< Surface blit
+    BATCH_SPRITE_BLIT,          ///< Sprite blit
+} batch_item_type_t;
+
+/** @brief An item in the batch */
+typedef struct {
+    uint8_t type;               ///< Type of the item (#batch_item_type_t)
+    bool has_parms;             ///< True if the blit parameters were specified
+    int16_t layer;              ///< Layer of the item
+    int16_t bbox[4];            ///< Bounding box on screen (x0, y0, x1, y1)
+    uint8_t cells[4];           ///< Range of grid cells covered by the bounding box (x0, y0, x1, y1)
+    int index;                  ///< Submission index
+    int deps;                   ///< Number of overlapping items that must be drawn before this one
+    int bucket;                 ///< Bucket of the item (same mode and texture)
+    int next_ready;             ///< Next ready item in the same bucket (-1 if none)
+    rspq_block_t *mode;         ///< Render mode block (or NULL)
+    const void *tex;            ///< Texture key (NULL for untextured items)
+    float x0, y0, x1, y1;       ///< Position (blits) or rectangle (fills)
+    union {
+        surface_t surf;         ///< Surface to blit (#BATCH_TEX_BLIT)
+        sprite_t *sprite;       ///< Sprite to blit (#BATCH_SPRITE_BLIT)
+        color_t color;          ///< Color of the rectangle (#BATCH_FILL_RECT)
+    };
+    rdpq_blitparms_t parms;     ///< Blit parameters (if has_parms is true)
+} batch_item_t;
+
+/** @brief State of the batch being collected */
+static struct {
+    bool active;                ///< True between #rdpq_batch_begin and #rdpq_batch_end
+    int layer;                  ///< Current layer
+    rspq_block_t *mode;         ///< Current render mode block
+    batch_item_t *items;        ///< Items collected so far
+    int num_items;              ///< Number of items collected so far
+    int max_items;              ///< Allocated size of the items array
+} batch;
+
+void rdpq_batch_begin(void)
+{
+    assertf(!batch.active, "rdpq_batch_begin called twice without rdpq_batch_end");
+    assertf(!rspq_in_block(), "rdpq batches cannot be recorded in blocks");
+    batch.active = true;
+    batch.layer = 0;
+    batch.mode = NULL;
+    batch.num_items = 0;
+}
+
+void rdpq_batch_layer(int layer)
+{
+    batch.layer = layer;
+}
+
+void rdpq_batch_mode(rspq_block_t *mode)
+{
+    batch.mode = mode;
+}
+
+/** @brief Allocate a new item in the batch, tagged with the current layer and mode */
+static batch_item_t* batch_add(batch_item_type_t type)
+{
+    assertf(batch.active, "rdpq_batch_begin must be called before adding items");
+    if (batch.num_items == batch.max_items) {
+        batch.max_items = batch.max_items ? batch.max_items * 2 : 64;
+        batch.items = realloc(batch.items, batch.max_items * sizeof(batch_item_t));
+        assert(batch.items);
+    }
+    batch_item_t *item = &batch.items[batch.num_items];
+    item->type = type;
+    item->layer = batch.layer;
+    item->mode = batch.mode;
+    item->index = batch.num_items++;
+    return item;
+}
+
+/** @brief Compute a conservative bounding box of a blit */
+static void blit_bbox(batch_item_t *item, int width, int height)
+{
+    const rdpq_blitparms_t *p = &item->parms;
+    int w = p->width ? p->width : width;
+    int h = p->height ? p->height : height;
+    float sx = p->scale_x ? fabsf(p->scale_x) : 1.0f;
+    float sy = p->scale_y ? fabsf(p->scale_y) : 1.0f;
+    float x0, y0, x1, y1;
+
+    // Repetitions extend the blit to the right and to the bottom
+    int rw = w * MAX(p->nx, 1), rh = h * MAX(p->ny, 1);
+
+    if (p->theta != 0) {
+        // Rotation: use a circle around the hotspot
+        float r = hypotf(MAX(p->cx, rw - p->cx) * sx, MAX(p->cy, rh - p->cy) * sy);
+        x0 = item->x0 - r; x1 = item->x0 + r;
+        y0 = item->y0 - r; y1 = item->y0 + r;
+    } else {
+        // Negative scales or flips mirror the blit around the hotspot
+        x0 = item->x0 - MAX(p->cx, rw - p->cx) * sx; x1 = item->x0 + MAX(p->cx, rw - p->cx) * sx;
+        y0 = item->y0 - MAX(p->cy, rh - p->cy) * sy; y1 = item->y0 + MAX(p->cy, rh - p->cy) * sy;
+    }
+
+    item->bbox[0] = floorf(x0) - 1; item->bbox[1] = floorf(y0) - 1;
+    item->bbox[2] = ceilf(x1) + 1;  item->bbox[3] = ceilf(y1) + 1;
+}
+
+void rdpq_batch_tex_blit(const surface_t *surf, float x0, float y0, const rdpq_blitparms_t *parms)
+{
+    batch_item_t *item = batch_add(BATCH_TEX_BLIT);
+    item->surf = *surf;
+    item->tex = surf->buffer;
+    item->x0 = x0; item->y0 = y0;
+    item->has_parms = parms != NULL;
+    item->parms = parms ? *parms : (rdpq_blitparms_t){0};
+    blit_bbox(item, surf->width, surf->height);
+}
+
+void rdpq_batch_sprite_blit(sprite_t *sprite, float x0, float y0, const rdpq_blitparms_t *parms)
+{
+    batch_item_t *item = batch_add(BATCH_SPRITE_BLIT);
+    item->sprite = sprite;
+    item->tex = sprite;
+    item->x0 = x0; item->y0 = y0;
+    item->has_parms = parms != NULL;
+    item->parms = parms ? *parms : (rdpq_blitparms_t){0};
+    blit_bbox(item, sprite->width, sprite->height);
+}
+
+void rdpq_batch_fill_rectangle(float x0, float y0, float x1, float y1, color_t color)
+{
+    batch_item_t *item = batch_add(BATCH_FILL_RECT);
+    item->color = color;
+    item->tex = NULL;
+    item->x0 = x0; item->y0 = y0; item->x1 = x1; item->y1 = y1;
+    item->bbox[0] = floorf(x0); item->bbox[1] = floorf(y0);
+    item->bbox[2] = ceilf(x1);  item->bbox[3] = ceilf(y1);
+}
+
+/** @brief Check whether the bounding boxes of two items overlap */
+static bool batch_overlap(const batch_item_t *a, const batch_item_t *b)
+{
+    return a->bbox[0] < b->bbox[2] && b->bbox[0] < a->bbox[2] &&
+           a->bbox[1] < b->bbox[3] && b->bbox[1] < a->bbox[3];
+}
+
+/** @brief Sort items by layer, keeping submission order within each layer */
+static int batch_cmp_layer(const void *a, const void *b)
+{
+    const batch_item_t *ia = a, *ib = b;
+    if (ia->layer != ib->layer) return ia->layer - ib->layer;
+    return ia->index - ib->index;
+}
+
+/** @brief Count texture and mode switches in a sequence of items */
+static void batch_count_switches(batch_item_t **order, int n, int *tex_switches, int *mode_switches)
+{
+    const void *tex = NULL;
+    rspq_block_t *mode = NULL;
+    *tex_switches = *mode_switches = 0;
+    for (int i=0; i<n; i++) {
+        if (order[i]->tex && order[i]->tex != tex) {
+            tex = order[i]->tex;
+            (*tex_switches)++;
+        }
+        if (order[i]->mode != mode) {
+            mode = order[i]->mode;
+            (*mode_switches)++;
+        }
+    }
+}
+
+/** @brief Draw an item */
+static void batch_draw(batch_item_t *item)
+{
+    const rdpq_blitparms_t *parms = item->has_parms ? &item->parms : NULL;
+    switch (item->type) {
+    case BATCH_FILL_RECT:
+        rdpq_set_prim_color(item->color);
+        rdpq_fill_rectangle(item->x0, item->y0, item->x1, item->y1);
+        break;
+    case BATCH_TEX_BLIT:
+        rdpq_tex_blit(&item->surf, item->x0, item->y0, parms);
+        break;
+    case BATCH_SPRITE_BLIT:
+        rdpq_sprite_blit(item->sprite, item->x0, item->y0, parms);
+        break;
+    }
+}
+
+/**
+ * @name Overlap grid
+ *
+ * To find overlapping items without testing all pairs, the screen is divided
+ * in a grid of cells, and each item is added to the list of all the cells
+ * covered by its bounding box. Only items that share a cell are tested.
+ * Items outside the grid are clamped to the border cells.
+ * @{
+ */
+#define GRID_SHIFT      5                           ///< Size of a cell (log2 of pixels)
+#define GRID_SIZE       32                          ///< Number of cells per side (1024x1024 pixels)
+/** @} */
+
+/** @brief An entry in the list of items of a grid cell */
+typedef struct {
+    int item;                   ///< Item index
+    int next;                   ///< Next entry in the cell (previous item in submission order), or -1
+} grid_entry_t;
+
+/** @brief Kind of a scheduler node */
+enum {
+    NODE_ALL,                   ///< List of all buckets with ready items
+    NODE_MODE,                  ///< List of buckets with ready items and the same render mode
+    NODE_TEX,                   ///< List of buckets with ready items and the same texture
+    NUM_LISTS,                  ///< Number of lists a bucket belongs to
+    NODE_BUCKET = NUM_LISTS,    ///< Bucket of items with the same render mode and texture
+};
+
+/**
+ * @brief A node of the scheduler: either a bucket or a list of buckets
+ *
+ * A bucket holds the ready items with the same render mode and texture, and
+ * is linked in three lists (one for each list kind) while it is not empty.
+ */
+typedef struct {
+    int kind;                   ///< Kind of node (NODE_*)
+    const void *key[2];         ///< Key of the node (mode and/or texture)
+    int head, tail;             ///< Bucket: first and last ready item. List: first and last bucket
+    int list[NUM_LISTS];        ///< Bucket: lists the bucket belongs to
+    int prev[NUM_LISTS];        ///< Bucket: previous bucket in each list
+    int next[NUM_LISTS];        ///< Bucket: next bucket in each list
+} batch_node_t;
+
+/** @brief Scratch state used by #rdpq_batch_end */
+static struct {
+    int grid[GRID_SIZE * GRID_SIZE];    ///< Head of the list of entries of each cell (-1 if empty)
+    grid_entry_t *entries;              ///< Entries of all cells
+    int *seen;                          ///< Per item: last item it was tested against (to test each pair once)
+    batch_node_t *nodes;                ///< Buckets and lists
+    int num_nodes;                      ///< Number of nodes
+    int *hash;                          ///< Hash table of nodes by kind and key (-1 if empty)
+    int hash_mask;                      ///< Size of the hash table minus one
+} sched;
+
+/** @brief Compute the grid cell range covered by an item */
+static void batch_cells(batch_item_t *item)
+{
+    for (int i=0; i<4; i++) {
+        // bbox[2] and bbox[3] are exclusive
+        int v = (item->bbox[i] - (i >= 2)) >> GRID_SHIFT;
+        item->cells[i] = CLAMP(v, 0, GRID_SIZE-1);
+    }
+}
+
+/** @brief Find a node by kind and key (-1 if it does not exist, unless create is true) */
+static int batch_node(int kind, const void *k0, const void *k1, bool create)
+{
+    uint32_t h = ((uint32_t)(uintptr_t)k0 * 0x9E3779B1u) ^ ((uint32_t)(uintptr_t)k1 * 0x85EBCA77u) ^ kind;
+    h ^= h >> 16;
+    int i = h & sched.hash_mask;
+    for (; sched.hash[i] >= 0; i = (i+1) & sched.hash_mask) {
+        batch_node_t *nd = &sched.nodes[sched.hash[i]];
+        if (nd->kind == kind && nd->key[0] == k0 && nd->key[1] == k1)
+            return sched.hash[i];
+    }
+    if (!create)
+        return -1;
+
+    int id = sched.num_nodes++;
+    sched.nodes[id] = (batch_node_t){ .kind = kind, .key = { k0, k1 }, .head = -1, .tail = -1 };
+    sched.hash[i] = id;
+    if (kind == NODE_BUCKET) {
+        int l0 = batch_node(NODE_ALL, NULL, NULL, true);
+        int l1 = batch_node(NODE_MODE, k0, NULL, true);
+        int l2 = batch_node(NODE_TEX, k1, NULL, true);
+        sched.nodes[id].list[NODE_ALL] = l0;
+        sched.nodes[id].list[NODE_MODE] = l1;
+        sched.nodes[id].list[NODE_TEX] = l2;
+    }
+    return id;
+}
+
+/** @brief Return the first bucket with ready items in a list, or -1 */
+static int batch_list_first(int kind, const void *key)
+{
+    int l = batch_node(kind, key, NULL, false);
+    return l >= 0 ? sched.nodes[l].head : -1;
+}
+
+/** @brief Mark an item as ready to be drawn */
+static void batch_ready(batch_item_t *items, int idx)
+{
+    int b = items[idx].bucket;
+    batch_node_t *bk = &sched.nodes[b];
+    items[idx].next_ready = -1;
+    if (bk->head >= 0) {
+        items[bk->tail].next_ready = idx;
+        bk->tail = idx;
+        return;
+    }
+
+    // The bucket was empty: append it to its lists
+    bk->head = bk->tail = idx;
+    for (int k=0; k<NUM_LISTS; k++) {
+        batch_node_t *l = &sched.nodes[bk->list[k]];
+        bk->next[k] = -1;
+        bk->prev[k] = l->tail;
+        if (l->tail >= 0) sched.nodes[l->tail].next[k] = b;
+        else l->head = b;
+        l->tail = b;
+    }
+}
+
+/** @brief Remove the first ready item of a bucket, and return it */
+static int batch_pop(batch_item_t *items, int b)
+{
+    batch_node_t *bk = &sched.nodes[b];
+    int idx = bk->head;
+    bk->head = items[idx].next_ready;
+    if (bk->head >= 0)
+        return idx;
+
+    // The bucket is now empty: remove it from its lists
+    for (int k=0; k<NUM_LISTS; k++) {
+        batch_node_t *l = &sched.nodes[bk->list[k]];
+        if (bk->prev[k] >= 0) sched.nodes[bk->prev[k]].next[k] = bk->next[k];
+        else l->head = bk->next[k];
+        if (bk->next[k] >= 0) sched.nodes[bk->next[k]].prev[k] = bk->prev[k];
+        else l->tail = bk->prev[k];
+    }
+    return idx;
+}
+
+/**
+ * @brief Compute the drawing order of a layer
+ *
+ * Items in the range [start, end) are all in the same layer, and sorted by
+ * submission order. An item is ready to be drawn once all previously
+ * submitted items overlapping with it were drawn. At each step, among the
+ * ready items, this prefers one that requires no mode or texture switch.
+ * Ready items are kept in buckets by mode and texture, and non-empty buckets
+ * in lists by mode and by texture, so that each pick is O(1).
+ */
+static void batch_schedule_layer(batch_item_t *items, int start, int end,
+    batch_item_t **order, int *num_order, rspq_block_t **mode, const void **tex)
+{
+    // Add all items to the grid, counting for each item how many previous
+    // items overlap with it. Cells lists are built from the most recent item.
+    int num_entries = 0;
+    for (int j=start; j<end; j++) {
+        batch_item_t *item = &items[j];
+        sched.seen[j] = -1;
+        item->deps = 0;
+        for (int cy=item->cells[1]; cy<=item->cells[3]; cy++) {
+            for (int cx=item->cells[0]; cx<=item->cells[2]; cx++) {
+                int *head = &sched.grid[cy*GRID_SIZE + cx];
+                for (int e=*head; e>=0; e=sched.entries[e].next) {
+                    int i = sched.entries[e].item;
+                    if (sched.seen[i] == j) continue;
+                    sched.seen[i] = j;
+                    if (batch_overlap(&items[i], item))
+                        item->deps++;
+                }
+                sched.entries[num_entries] = (grid_entry_t){ .item = j, .next = *head };
+                *head = num_entries++;
+            }
+        }
+        item->bucket = batch_node(NODE_BUCKET, item->mode, item->tex, true);
+    }
+
+    for (int j=start; j<end; j++) {
+        sched.seen[j] = -1;
+        if (items[j].deps == 0)
+            batch_ready(items, j);
+    }
+
+    for (int left = end-start; left > 0; left--) {
+        // Pick the next bucket, in order of preference: same mode and
+        // texture, same mode and no texture, same mode, same texture,
+        // no texture, and finally the one that became ready first.
+        int b = batch_node(NODE_BUCKET, *mode, *tex, false);
+        if (b >= 0 && sched.nodes[b].head < 0) b = -1;
+        if (b < 0) b = batch_node(NODE_BUCKET, *mode, NULL, false);
+        if (b >= 0 && sched.nodes[b].head < 0) b = -1;
+        if (b < 0) b = batch_list_first(NODE_MODE, *mode);
+        if (b < 0) b = batch_list_first(NODE_TEX, *tex);
+        if (b < 0) b = batch_list_first(NODE_TEX, NULL);
+        if (b < 0) b = batch_list_first(NODE_ALL, NULL);
+        assert(b >= 0);
+
+        int i = batch_pop(items, b);
+        batch_item_t *item = &items[i];
+        order[(*num_order)++] = item;
+        if (item->tex) *tex = item->tex;
+        *mode = item->mode;
+
+        // Release the items that were waiting for this one: they are the
+        // following items in the cells covered by it.
+        for (int cy=item->cells[1]; cy<=item->cells[3]; cy++) {
+            for (int cx=item->cells[0]; cx<=item->cells[2]; cx++) {
+                for (int e=sched.grid[cy*GRID_SIZE + cx]; e>=0; e=sched.entries[e].next) {
+                    int j = sched.entries[e].item;
+                    if (j == i) break;
+                    if (sched.seen[j] == i) continue;
+                    sched.seen[j] = i;
+                    if (batch_overlap(item, &items[j]) && --items[j].deps == 0)
+                        batch_ready(items, j);
+                }
+            }
+        }
+    }
+
+    // Clear the cells used by this layer
+    for (int j=start; j<end; j++)
+        for (int cy=items[j].cells[1]; cy<=items[j].cells[3]; cy++)
+            for (int cx=items[j].cells[0]; cx<=items[j].cells[2]; cx++)
+                sched.grid[cy*GRID_SIZE + cx] = -1;
+}
+
+void rdpq_batch_end(rdpq_batch_stats_t *stats)
+{
+    assertf(batch.active, "rdpq_batch_end called without rdpq_batch_begin");
+    batch.active = false;
+
+    int n = batch.num_items;
+    batch_item_t *items = batch.items;
+    batch_item_t **order = malloc(MAX(n, 1) * sizeof(batch_item_t*));
+
+    // Count switches in submission order, for statistics
+    int sub_tex_switches = 0, sub_mode_switches = 0;
+    if (stats) {
+        for (int i=0; i<n; i++) order[i] = &items[i];
+        batch_count_switches(order, n, &sub_tex_switches, &sub_mode_switches);
+    }
+
+    // Group items by layer, and schedule each layer independently.
+    qsort(items, n, sizeof(batch_item_t), batch_cmp_layer);
+
+    int num_entries = 0;
+    for (int i=0; i<n; i++) {
+        batch_cells(&items[i]);
+        num_entries += (items[i].cells[2] - items[i].cells[0] + 1) * (items[i].cells[3] - items[i].cells[1] + 1);
+    }
+    // Each item creates at most one bucket and two lists, plus the global list
+    int max_nodes = n*3 + 1;
+    int hash_size = 16;
+    while (hash_size < max_nodes*2) hash_size *= 2;
+    sched.entries = malloc(MAX(num_entries, 1) * sizeof(grid_entry_t));
+    sched.seen = malloc(MAX(n, 1) * sizeof(int));
+    sched.nodes = malloc(max_nodes * sizeof(batch_node_t));
+    sched.hash = malloc(hash_size * sizeof(int));
+    assert(sched.entries && sched.seen && sched.nodes && sched.hash);
+    sched.hash_mask = hash_size - 1;
+    sched.num_nodes = 0;
+    memset(sched.hash, 0xFF, hash_size * sizeof(int));
+    memset(sched.grid, 0xFF, sizeof(sched.grid));
+
+    rspq_block_t *mode = NULL;
+    const void *tex = NULL;
+    int num_order = 0;
+    for (int start=0; start<n; ) {
+        int end = start;
+        while (end < n && items[end].layer == items[start].layer) end++;
+        batch_schedule_layer(items, start, end, order, &num_order, &mode, &tex);
+        start = end;
+    }
+    assert(num_order == n);
+
+    // Draw the items, switching render mode when required. We save the
+    // current render mode, to be used by items with no mode, and to be
+    // restored at the end. The surfaces of the batch cannot change while
+    // it is being drawn, so track their residency in TMEM, to skip the
+    // upload of consecutive items with the same texture.
+    uint32_t cache_hits = __rdpq_tex_cache_hits();
+    __rdpq_tmem_scope_begin();
+    rdpq_mode_push();
+    mode = NULL;
+    for (int i=0; i<n; i++) {
+        if (order[i]->mode != mode) {
+            mode = order[i]->mode;
+            if (mode) {
+                rspq_block_run(mode);
+            } else {
+                rdpq_mode_pop();
+                rdpq_mode_push();
+            }
+        }
+        batch_draw(order[i]);
+    }
+    rdpq_mode_pop();
+    __rdpq_tmem_scope_end();
+
+    if (stats) {
+        stats->items = n;
+        batch_count_switches(order, n, &stats->tex_switches, &stats->mode_switches);
+        stats->tex_switches_avoided = sub_tex_switches - stats->tex_switches;
+        stats->mode_switches_avoided = sub_mode_switches - stats->mode_switches;
+        stats->tex_loads_skipped = __rdpq_tex_cache_hits() - cache_hits;
+    }
+
+    free(sched.entries);
+    free(sched.seen);
+    free(sched.nodes);
+    free(sched.hash);
+    free(order);
+    batch.num_items = 0;
+}
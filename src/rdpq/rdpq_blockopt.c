@@ -0,0 +1,270 @@
+/**
+ * @file rdpq_blockopt.c
+ * @brief RDP Command queue: block optimizer
+ * @ingroup rdp
+ *
+ * The optimizer works on the segments of a block (see #rdpq_block_segment_t).
+ * Each segment begins with the slots reserved for RDP commands that will be
+ * generated by RSP when the block is run, followed by a run of RDP commands
+ * written by the CPU. Only the latter are analyzed: the state of the RDP is
+ * considered unknown at the beginning of each run, as the RSP might have
+ * changed it.
+ *
+ * Commands are removed by compacting each RDP buffer in place. The rspq
+ * commands that send the segments to RDP are then patched to refer to the
+ * new positions. Since the reserved slots are moved together with the segment
+ * they belong to, RSP will write the generated commands at the right position.
+ */
+
+#include "rdpq.h"
+#include "rdpq_internal.h"
+#include "rdpq_debug.h"
+#include "rspq.h"
+#include "rspq/rspq_internal.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+/** @brief Extract the RDP command ID from the first word of a command */
+#define CMD_ID(w0)              (((w0) >> 24) & 0x3F)
+
+/** @brief Convert a physical address of a RDP buffer to a pointer */
+#define RDP_BUFFER_PTR(phys)    ((uint32_t*)UncachedAddr(0x80000000 | (phys)))
+
+/** @brief Number of state registers tracked by the optimizer */
+#define NUM_STATE_SLOTS         28
+/** @brief First state slot for SET_TILE (one per tile) */
+#define SLOT_SET_TILE           12
+/** @brief First state slot for SET_TILE_SIZE (one per tile) */
+#define SLOT_SET_TILE_SIZE      20
+
+/**
+ * @brief Get the state slot written by a RDP command
+ *
+ * @return The state slot, or -1 if the command is not a pure state change.
+ */
+static int state_slot(uint32_t w0, uint32_t w1)
+{
+    switch (CMD_ID(w0)) {
+    case RDPQ_CMD_SET_KEY_GB:           return 0;
+    case RDPQ_CMD_SET_KEY_R:            return 1;
+    case RDPQ_CMD_SET_CONVERT:          return 2;
+    case RDPQ_CMD_SET_SCISSOR:          return 3;
+    case RDPQ_CMD_SET_PRIM_DEPTH:       return 4;
+    case RDPQ_CMD_SET_OTHER_MODES:      return 5;
+    case RDPQ_CMD_SET_FILL_COLOR:       return 6;
+    case RDPQ_CMD_SET_FOG_COLOR:        return 7;
+    case RDPQ_CMD_SET_BLEND_COLOR:      return 8;
+    case RDPQ_CMD_SET_PRIM_COLOR:       return 9;
+    case RDPQ_CMD_SET_ENV_COLOR:        return 10;
+    case RDPQ_CMD_SET_COMBINE_MODE_RAW: return 11;
+    case RDPQ_CMD_SET_TILE:             return SLOT_SET_TILE + ((w1 >> 24) & 7);
+    case RDPQ_CMD_SET_TILE_SIZE:        return SLOT_SET_TILE_SIZE + ((w1 >> 24) & 7);
+    default:                            return -1;
+    }
+}
+
+/** @brief Check whether a RDP command only uses the state (draws primitives or loads textures) */
+static bool is_consumer(uint32_t w0)
+{
+    switch (CMD_ID(w0)) {
+    case 0x08 ... 0x0F:                 // Triangles
+    case RDPQ_CMD_TEXTURE_RECTANGLE:
+    case RDPQ_CMD_TEXTURE_RECTANGLE_FLIP:
+    case RDPQ_CMD_FILL_RECTANGLE:
+    case RDPQ_CMD_LOAD_TLUT:
+    case RDPQ_CMD_LOAD_BLOCK:
+    case RDPQ_CMD_LOAD_TILE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/** @brief State of the analysis of a run of RDP commands */
+typedef struct {
+    uint64_t value[NUM_STATE_SLOTS];    ///< Last value written to each state slot
+    bool known[NUM_STATE_SLOTS];        ///< True if the value of the slot is known
+    int pending[NUM_STATE_SLOTS];       ///< Index of the last write to the slot not used yet (or -1)
+    bool sync_pending[3];               ///< True if a SYNC_LOAD/PIPE/TILE was emitted, with nothing to wait for since
+} run_state_t;
+
+/** @brief Scratch buffers used to split a run into commands */
+typedef struct {
+    uint16_t *offs;                     ///< Offset of each command in the run (in words)
+    bool *drop;                         ///< True if the command must be removed
+    int max_cmds;                       ///< Allocated size of the arrays
+} run_scratch_t;
+
+/** @brief Forget everything about the RDP state (eg: because RSP might have changed it) */
+static void run_reset(run_state_t *rs)
+{
+    memset(rs->known, 0, sizeof(rs->known));
+    memset(rs->sync_pending, 0, sizeof(rs->sync_pending));
+    for (int i=0; i<NUM_STATE_SLOTS; i++) rs->pending[i] = -1;
+}
+
+/**
+ * @brief Optimize a run of RDP commands written by the CPU, compacting it in place
+ *
+ * @param src       Pointer to the first command of the run
+ * @param end       Pointer to the end of the run
+ * @param dst       Where to move the commands that are kept (dst <= src)
+ * @param scratch   Scratch buffers
+ * @param stats     Statistics to update
+ * @return          Pointer to the end of the compacted run
+ */
+static uint32_t* optimize_run(uint32_t *src, uint32_t *end, uint32_t *dst, run_scratch_t *scratch, rdpq_block_optimize_stats_t *stats)
+{
+    run_state_t rs;
+    int n = 0;
+
+    // Split the run into commands. If the run does not contain valid commands,
+    // just move it without optimizing.
+    for (uint32_t *p = src; p < end; n++) {
+        if (n == scratch->max_cmds) {
+            scratch->max_cmds = scratch->max_cmds ? scratch->max_cmds * 2 : 256;
+            scratch->offs = realloc(scratch->offs, scratch->max_cmds * sizeof(uint16_t));
+            scratch->drop = realloc(scratch->drop, scratch->max_cmds * sizeof(bool));
+            assert(scratch->offs && scratch->drop);
+        }
+        uint16_t *offs = scratch->offs; bool *drop = scratch->drop;
+        offs[n] = p - src;
+        drop[n] = false;
+        p += rdpq_debug_disasm_size((uint64_t*)p) * 2;
+        if (p > end) {
+            memmove(dst, src, (end - src) * sizeof(uint32_t));
+            return dst + (end - src);
+        }
+    }
+
+    uint16_t *offs = scratch->offs; bool *drop = scratch->drop;
+    run_reset(&rs);
+    for (int i=0; i<n; i++) {
+        uint32_t w0 = src[offs[i]], w1 = src[offs[i]+1];
+        int id = CMD_ID(w0);
+        int slot = state_slot(w0, w1);
+
+        if (slot >= 0) {
+            // State change: remove it if it sets the value that the register
+            // already has. Otherwise, if the previous write to the same register
+            // was never used, remove that instead.
+            uint64_t v = ((uint64_t)w0 << 32) | w1;
+            if (rs.known[slot] && rs.value[slot] == v) {
+                drop[i] = true;
+                stats->state_removed++;
+                continue;
+            }
+            if (rs.pending[slot] >= 0) {
+                drop[rs.pending[slot]] = true;
+                stats->state_removed++;
+            }
+            rs.value[slot] = v;
+            rs.known[slot] = true;
+            rs.pending[slot] = i;
+        } else if (id >= RDPQ_CMD_SYNC_LOAD && id <= RDPQ_CMD_SYNC_TILE) {
+            // SYNC: remove it if the same SYNC was already emitted, and nothing
+            // was drawn or loaded since.
+            int k = id - RDPQ_CMD_SYNC_LOAD;
+            if (rs.sync_pending[k]) {
+                drop[i] = true;
+                stats->sync_removed++;
+                continue;
+            }
+            rs.sync_pending[k] = true;
+        } else if (is_consumer(w0)) {
+            // Drawing or loading: all the state written so far might be used
+            for (int j=0; j<NUM_STATE_SLOTS; j++) rs.pending[j] = -1;
+            memset(rs.sync_pending, 0, sizeof(rs.sync_pending));
+            // Loads also change the extents of the tile
+            if (id == RDPQ_CMD_LOAD_TLUT || id == RDPQ_CMD_LOAD_BLOCK || id == RDPQ_CMD_LOAD_TILE)
+                rs.known[SLOT_SET_TILE_SIZE + ((w1 >> 24) & 7)] = false;
+        } else {
+            // Any other command (NOP, SYNC_FULL, etc.): assume the worst
+            run_reset(&rs);
+        }
+    }
+
+    // Compact the run, moving down the commands that are kept
+    for (int i=0; i<n; i++) {
+        int sz = (i+1 < n ? offs[i+1] : end - src) - offs[i];
+        stats->cmds_before++;
+        if (drop[i]) continue;
+        stats->cmds_after++;
+        memmove(dst, src + offs[i], sz * sizeof(uint32_t));
+        dst += sz;
+    }
+    return dst;
+}
+
+void __rdpq_block_optimize(rdpq_block_t *block, rdpq_block_optimize_stats_t *stats)
+{
+    rdpq_block_optimize_stats_t st = {0};
+
+    if (block && block->segs) {
+        run_scratch_t scratch = {0};
+        uint32_t prev_end = 0;          // End of the previous segment
+        uint32_t new_prev_end = 0;      // End of the previous segment, after compaction
+        uint32_t sentinel = 0;          // Sentinel of the current RDP buffer
+        uint32_t shift = 0;             // Bytes removed so far from the current RDP buffer
+
+        for (int i=0; i<block->num_segs; i++) {
+            volatile uint32_t *cmd = block->segs[i].cmd;
+            uint32_t start = block->segs[i].start;
+            uint32_t end = cmd[0] & 0xFFFFFF;
+            uint32_t seg_start = prev_end;
+
+            if ((cmd[0] >> 24) == RSPQ_CMD_RDP_SET_BUFFER) {
+                // A new RDP buffer has a different sentinel. Otherwise, we are
+                // going back to the same buffer after running RSP commands that
+                // used the dynamic buffer; the slots that were reserved for them
+                // must be moved as well.
+                seg_start = cmd[1];
+                if (cmd[2] != sentinel) {
+                    sentinel = cmd[2];
+                    shift = 0;
+                } else if (shift) {
+                    memmove(RDP_BUFFER_PTR(prev_end - shift), RDP_BUFFER_PTR(prev_end), seg_start - prev_end);
+                }
+                cmd[1] = seg_start - shift;
+            }
+
+            // Move the reserved slots, and then optimize the commands written by the CPU
+            if (shift)
+                memmove(RDP_BUFFER_PTR(seg_start - shift), RDP_BUFFER_PTR(seg_start), start - seg_start);
+            uint32_t *new_end = optimize_run(RDP_BUFFER_PTR(start), RDP_BUFFER_PTR(end),
+                RDP_BUFFER_PTR(start - shift), &scratch, &st);
+            uint32_t new_end_phys = PhysicalAddr(new_end);
+            shift = end - new_end_phys;
+            cmd[0] = (cmd[0] & 0xFF000000) | new_end_phys;
+
+            // If an append command doesn't send anything anymore, remove it
+            if ((cmd[0] >> 24) == RSPQ_CMD_RDP_APPEND_BUFFER && new_end_phys == new_prev_end) {
+                cmd[0] = RSPQ_CMD_NOOP << 24;
+                st.appends_removed++;
+            }
+
+            prev_end = end;
+            new_prev_end = new_end_phys;
+        }
+
+        free(scratch.offs);
+        free(scratch.drop);
+
+        // The segments refer to the old positions of the commands, so the
+        // block cannot be optimized again
+        free(block->segs);
+        block->segs = NULL;
+        block->num_segs = 0;
+    }
+
+    if (stats) *stats = st;
+}
+
+void rdpq_block_optimize(rspq_block_t *block, rdpq_block_optimize_stats_t *stats)
+{
+    assertf(block, "invalid block");
+    assertf(!block->rdp_block || !block->rdp_block->run,
+        "rdpq_block_optimize must be called before the block is run for the first time");
+    __rdpq_block_optimize(block->rdp_block, stats);
+}
@@ -128,21 +128,21 @@ static struct {
         bool mode_changed : 1;               ///< True if there is a pending mode change to validate (SET_OTHER_MODES / SET_COMBINE)
         bool rendertarget_changed : 1;       ///< True if there is a pending render target change to validate (SET_COLOR_IMAGE / SET_SCISSOR)
     };
-    uint64_t *last_som;                  ///< Pointer to last SOM command sent
+    uint32_t last_som;                   ///< RDRAM address of last SOM command sent
     uint64_t last_som_data;              ///< Last SOM command (raw)
-    uint64_t *last_cc;                   ///< Pointer to last CC command sent
+    uint32_t last_cc;                    ///< RDRAM address of last CC command sent
     uint64_t last_cc_data;               ///< Last CC command (raw)
-    uint64_t *last_col;                  ///< Pointer to last SET_COLOR_IMAGE command sent
+    uint32_t last_col;                   ///< RDRAM address of last SET_COLOR_IMAGE command sent
     uint64_t last_col_data;              ///< Last COLOR command (raw)
-    uint64_t *last_tex;                  ///< Pointer to last SET_TEX_IMAGE command sent
+    uint32_t last_tex;                   ///< RDRAM address of last SET_TEX_IMAGE command sent
     uint64_t last_tex_data;              ///< Last TEX command (raw)
-    uint64_t *last_z;                    ///< Pointer to last SET_Z_IMAGE command sent
+    uint32_t last_z;                     ///< RDRAM address of last SET_Z_IMAGE command sent
     uint64_t last_z_data;                ///< Last Z command (raw)
     setothermodes_t som;                 ///< Current SOM state
     colorcombiner_t cc;                  ///< Current CC state
     struct tile_s { 
-        uint64_t *last_settile;            ///< Pointer to last SET_TILE command sent
-        uint64_t *last_setsize;            ///< Pointer to last LOAD_TILE/SET_TILE_SIZE command sent
+        uint32_t last_settile;             ///< RDRAM address of last SET_TILE command sent
+        uint32_t last_setsize;             ///< RDRAM address of last LOAD_TILE/SET_TILE_SIZE command sent
         uint64_t last_settile_data;        ///< Last SET_TILE command (raw)
         uint64_t last_setsize_data;        ///< Last LOAD_TILE/SET_TILE_SIZE command (raw)
         uint8_t fmt, size;                 ///< Format & size (RDP format/size bits)
@@ -175,6 +175,7 @@ static struct {
  */
 struct {
     uint64_t *buf;                         ///< Current instruction
+    uint32_t addr;                         ///< RDRAM address of the current instruction
     uint32_t flags;                        ///< Flags (see RDPQ_VALIDATION_*)
     int warns, errs;                       ///< Validators warnings/errors (stats)
     bool crashed;                          ///< True if the RDP chip crashed
@@ -198,6 +199,27 @@ static int show_log;                                      ///< != 0 if logging i
 static void (*hooks[MAX_HOOKS])(void*, uint64_t*, int);   ///< Custom hooks
 static void* hooks_ctx[MAX_HOOKS];                        ///< Context for the hooks
 
+/** @brief A chunk of a RDP capture (see #rdpq_debug_capture_start) */
+typedef struct {
+    uint32_t type;                                        ///< Chunk type (RDPQ_CAPTURE_CHUNK_*)
+    uint32_t addr;                                        ///< RDRAM physical address
+    uint32_t size;                                        ///< Size of the data in bytes
+    uint32_t capacity;                                    ///< Allocated size of the data in bytes
+    uint8_t *data;                                        ///< Chunk data
+} capture_chunk_t;
+
+/** @brief State of the RDP capture engine */
+static struct {
+    bool active;                                          ///< True if a capture is in progress
+    capture_chunk_t *chunks;                              ///< Captured chunks
+    int num_chunks;                                       ///< Number of captured chunks
+    int max_chunks;                                       ///< Allocated number of chunks
+    uint32_t cmds_end;                                    ///< RDRAM address just after the last captured command
+    uint64_t tex_image;                                   ///< Last SET_TEX_IMAGE command seen
+} capture;
+
+static void capture_cmd(uint64_t *cmd, int sz);
+
 // Documented in rdpq_debug_internal.h
 void (*rdpq_trace)(void);
 void (*rdpq_trace_fetch)(bool new_buffer);
@@ -349,6 +371,9 @@ void __rdpq_trace_flush(void)
             for (int i=0;i<MAX_HOOKS && hooks[i];i++)
                 hooks[i](hooks_ctx[i], cur, sz);
 
+            // Record the command if a capture is in progress
+            if (capture.active) capture_cmd(cur, sz);
+
             // If this is a RDPQ_DEBUG command, execute it
             if (cmd == RDPQ_CMD_DEBUG) __rdpq_debug_cmd(cur[0]);
             cur += sz;
@@ -407,6 +432,136 @@ void rdpq_debug_install_hook(void (*hook)(void*, uint64_t*, int), void* ctx)
     assertf(0, "reached maximum number of hooks (%d)", MAX_HOOKS);
 }
 
+/** @brief Append a new empty chunk to the capture */
+static capture_chunk_t* capture_new_chunk(uint32_t type, uint32_t addr)
+{
+    if (capture.num_chunks == capture.max_chunks) {
+        capture.max_chunks = capture.max_chunks ? capture.max_chunks * 2 : 64;
+        capture.chunks = realloc(capture.chunks, capture.max_chunks * sizeof(capture_chunk_t));
+        assertf(capture.chunks, "rdpq_debug: out of memory while capturing");
+    }
+    capture_chunk_t *c = &capture.chunks[capture.num_chunks++];
+    *c = (capture_chunk_t){ .type = type, .addr = addr };
+    return c;
+}
+
+/** @brief Append data to a capture chunk */
+static void capture_chunk_append(capture_chunk_t *c, const void *data, uint32_t size)
+{
+    if (c->size + size > c->capacity) {
+        c->capacity = MAX(c->capacity * 2, c->size + size);
+        c->data = realloc(c->data, c->capacity);
+        assertf(c->data, "rdpq_debug: out of memory while capturing");
+    }
+    memcpy(c->data + c->size, data, size);
+    c->size += size;
+}
+
+/** @brief Capture a range of RDRAM referenced by a LOAD command */
+static void capture_rdram(uint32_t start, uint32_t end)
+{
+    start = start & ~7;
+    end = MIN(ROUND_UP(end, 8), 0x800000);
+    if (start >= end) return;
+
+    // Avoid capturing twice the same range
+    for (int i=0; i<capture.num_chunks; i++) {
+        capture_chunk_t *c = &capture.chunks[i];
+        if (c->type == RDPQ_CAPTURE_CHUNK_DATA && c->addr <= start && c->addr + c->size >= end)
+            return;
+    }
+
+    capture_chunk_t *c = capture_new_chunk(RDPQ_CAPTURE_CHUNK_DATA, start);
+    capture_chunk_append(c, (void*)(0xA0000000 | start), end - start);
+}
+
+/** @brief Record a RDP command into the current capture */
+static void capture_cmd(uint64_t *cmd, int sz)
+{
+    uint32_t addr = PhysicalAddr(cmd);
+
+    // Append the command to the current CMDS chunk if it is contiguous, otherwise
+    // create a new one.
+    capture_chunk_t *c = capture.num_chunks ? &capture.chunks[capture.num_chunks-1] : NULL;
+    if (!c || c->type != RDPQ_CAPTURE_CHUNK_CMDS || capture.cmds_end != addr)
+        c = capture_new_chunk(RDPQ_CAPTURE_CHUNK_CMDS, addr);
+    capture_chunk_append(c, cmd, sz*8);
+    capture.cmds_end = addr + sz*8;
+
+    // Compute the RDRAM range accessed by texture loads
+    uint64_t ti = capture.tex_image;
+    uint32_t tex_addr = BITS(ti, 0, 25);
+    int tex_width = BITS(ti, 32, 41)+1;
+    int tex_bits = 4 << BITS(ti, 51, 52);
+    switch (CMD(cmd[0])) {
+    case 0x3D: // SET_TEX_IMAGE
+        capture.tex_image = cmd[0];
+        break;
+    case 0x34: { // LOAD_TILE
+        int s0 = BITS(cmd[0], 44, 55) >> 2, t0 = BITS(cmd[0], 32, 43) >> 2;
+        int s1 = BITS(cmd[0], 12, 23) >> 2, t1 = BITS(cmd[0],  0, 11) >> 2;
+        capture_rdram(tex_addr + (t0*tex_width + s0) * tex_bits / 8,
+                      tex_addr + ((t1*tex_width + s1 + 1) * tex_bits + 7) / 8);
+    }   break;
+    case 0x33: { // LOAD_BLOCK
+        int s0 = BITS(cmd[0], 44, 55), t0 = BITS(cmd[0], 32, 43);
+        int n = BITS(cmd[0], 12, 23) + 1;
+        uint32_t start = tex_addr + (t0*tex_width + s0) * tex_bits / 8;
+        capture_rdram(start, start + (n * tex_bits + 7) / 8);
+    }   break;
+    case 0x30: { // LOAD_TLUT
+        int i0 = BITS(cmd[0], 44, 55) >> 2, i1 = BITS(cmd[0], 12, 23) >> 2;
+        capture_rdram(tex_addr + i0 * tex_bits / 8, tex_addr + (i1 + 1) * tex_bits / 8);
+    }   break;
+    }
+}
+
+/** @brief Free all the memory used by the current capture */
+static void capture_free(void)
+{
+    for (int i=0; i<capture.num_chunks; i++)
+        free(capture.chunks[i].data);
+    free(capture.chunks);
+    memset(&capture, 0, sizeof(capture));
+}
+
+void rdpq_debug_capture_start(void)
+{
+    assertf(rdpq_trace, "rdpq trace engine not started");
+    assertf(!capture.active, "a RDP capture is already in progress");
+
+    // Make sure all previous commands are traced before starting
+    rspq_wait();
+    capture_free();
+    capture.active = true;
+}
+
+bool rdpq_debug_capture_stop(FILE *out)
+{
+    assertf(capture.active, "no RDP capture in progress");
+
+    // Make sure all commands are traced
+    rspq_wait();
+    capture.active = false;
+
+    bool ok = true;
+    if (out) {
+        // The N64 is big-endian, so we can write the integers as they are.
+        uint32_t header[2] = { RDPQ_CAPTURE_VERSION, capture.num_chunks };
+        ok = fwrite(RDPQ_CAPTURE_MAGIC, 1, 4, out) == 4 &&
+             fwrite(header, 4, 2, out) == 2;
+        for (int i=0; ok && i<capture.num_chunks; i++) {
+            capture_chunk_t *c = &capture.chunks[i];
+            uint32_t chunk_header[3] = { c->type, c->addr, c->size };
+            ok = fwrite(chunk_header, 4, 3, out) == 3 &&
+                 fwrite(c->data, 1, c->size, out) == c->size;
+        }
+    }
+
+    capture_free();
+    return ok;
+}
+
 #endif
 
 /** @brief Decode a SET_COMBINE command into a #colorcombiner_t structure */
@@ -466,7 +621,7 @@ int rdpq_debug_disasm_size(uint64_t *buf) {
 /** @brief Convert a 16.16 fixed point number into floating point */
 #define FX32(hi,lo)    ((int16_t)(hi) + (lo) * (1.f / 65536.f))
 
-static void __rdpq_debug_disasm(uint64_t *addr, uint64_t *buf, FILE *out)
+static void __rdpq_debug_disasm(uint32_t addr, uint64_t *buf, FILE *out)
 {
     const char* flag_prefix = "";
     ///@cond
@@ -477,7 +632,7 @@ static void __rdpq_debug_disasm(uint64_t *addr, uint64_t *buf, FILE *out)
     static const char *fmt[8] = {"rgba", "yuv", "ci", "ia", "i", "?fmt=5?", "?fmt=6?", "?fmt=7?"};
     static const char *size[4] = {"4", "8", "16", "32" };
 
-    fprintf(out, "[%p] %016" PRIx64 "    ", addr, buf[0]);
+    fprintf(out, "[%08" PRIx32 "] %016" PRIx64 "    ", addr, buf[0]);
     switch (CMD(buf[0])) {
     default:   fprintf(out, "???\n"); return;
     case 0x00: fprintf(out, "NOP\n"); return;
@@ -613,7 +768,7 @@ static void __rdpq_debug_disasm(uint64_t *addr, uint64_t *buf, FILE *out)
             fprintf(out, "TEX_RECT_FLIP    ");
         fprintf(out, "tile=%d xy=(%.2f,%.2f)-(%.2f,%.2f)\n", BITS(buf[0], 24, 26),
             BITS(buf[0], 12, 23)*FX(2), BITS(buf[0], 0, 11)*FX(2), BITS(buf[0], 44, 55)*FX(2), BITS(buf[0], 32, 43)*FX(2));
-        fprintf(out, "[%p] %016" PRIx64 "                     ", &addr[1], buf[1]);
+        fprintf(out, "[%08" PRIx32 "] %016" PRIx64 "                     ", addr+8, buf[1]);
         fprintf(out, "st=(%.2f,%.2f) dst=(%.5f,%.5f)\n",
             SBITS(buf[1], 48, 63)*FX(5), SBITS(buf[1], 32, 47)*FX(5), SBITS(buf[1], 16, 31)*FX(10), SBITS(buf[1], 0, 15)*FX(10));
         return;
@@ -637,66 +792,66 @@ static void __rdpq_debug_disasm(uint64_t *addr, uint64_t *buf, FILE *out)
         fprintf(out, "%s tile=%d lvl=%d y=(%.2f, %.2f, %.2f)\n",
             BITS(buf[0], 55, 55) ? "left" : "right", BITS(buf[0], 48, 50), BITS(buf[0], 51, 53)+1,
             SBITS(buf[0], 0, 13)*FX(2), SBITS(buf[0], 16, 29)*FX(2), SBITS(buf[0], 32, 45)*FX(2));
-        fprintf(out, "[%p] %016" PRIx64 "                     xl=%.4f isl=%.4f\n", &addr[1], buf[1],
+        fprintf(out, "[%08" PRIx32 "] %016" PRIx64 "                     xl=%.4f isl=%.4f\n", addr+8, buf[1],
             SBITS(buf[1], 32, 63)*FX(16), SBITS(buf[1], 0, 31)*FX(16));
-        fprintf(out, "[%p] %016" PRIx64 "                     xh=%.4f ish=%.4f\n", &addr[2], buf[2],
+        fprintf(out, "[%08" PRIx32 "] %016" PRIx64 "                     xh=%.4f ish=%.4f\n", addr+16, buf[2],
             SBITS(buf[2], 32, 63)*FX(16), SBITS(buf[2], 0, 31)*FX(16));
-        fprintf(out, "[%p] %016" PRIx64 "                     xm=%.4f ism=%.4f\n", &addr[3], buf[3],
+        fprintf(out, "[%08" PRIx32 "] %016" PRIx64 "                     xm=%.4f ism=%.4f\n", addr+24, buf[3],
             SBITS(buf[3], 32, 63)*FX(16), SBITS(buf[3], 0, 31)*FX(16));
         int i=4;
         if (cmd & 0x4) {
-            fprintf(out, "[%p] %016" PRIx64 "                     r=%.5f g=%.5f b=%.5f a=%.5f\n", &addr[i], buf[i],
+            fprintf(out, "[%08" PRIx32 "] %016" PRIx64 "                     r=%.5f g=%.5f b=%.5f a=%.5f\n", addr+i*8, buf[i],
                 FX32(BITS(buf[i], 48, 63), BITS(buf[i+2], 48, 63)),
                 FX32(BITS(buf[i], 32, 47), BITS(buf[i+2], 32, 47)),
                 FX32(BITS(buf[i], 16, 31), BITS(buf[i+2], 16, 31)),
                 FX32(BITS(buf[i],  0, 15), BITS(buf[i+2],  0, 15))); i++;
-            fprintf(out, "[%p] %016" PRIx64 "                     drdx=%.5f dgdx=%.5f dbdx=%.5f dadx=%.5f\n", &buf[i], buf[i],
+            fprintf(out, "[%08" PRIx32 "] %016" PRIx64 "                     drdx=%.5f dgdx=%.5f dbdx=%.5f dadx=%.5f\n", addr+i*8, buf[i],
                 FX32(BITS(buf[i], 48, 63), BITS(buf[i+2], 48, 63)),
                 FX32(BITS(buf[i], 32, 47), BITS(buf[i+2], 32, 47)),
                 FX32(BITS(buf[i], 16, 31), BITS(buf[i+2], 16, 31)),
                 FX32(BITS(buf[i],  0, 15), BITS(buf[i+2],  0, 15))); i++;
-            fprintf(out, "[%p] %016" PRIx64 "                     \n", &addr[i], buf[i]); i++;
-            fprintf(out, "[%p] %016" PRIx64 "                     \n", &addr[i], buf[i]); i++;
-            fprintf(out, "[%p] %016" PRIx64 "                     drde=%.5f dgde=%.5f dbde=%.5f dade=%.5f\n", &addr[i], buf[i],
+            fprintf(out, "[%08" PRIx32 "] %016" PRIx64 "                     \n", addr+i*8, buf[i]); i++;
+            fprintf(out, "[%08" PRIx32 "] %016" PRIx64 "                     \n", addr+i*8, buf[i]); i++;
+            fprintf(out, "[%08" PRIx32 "] %016" PRIx64 "                     drde=%.5f dgde=%.5f dbde=%.5f dade=%.5f\n", addr+i*8, buf[i],
                 FX32(BITS(buf[i], 48, 63), BITS(buf[i+2], 48, 63)),
                 FX32(BITS(buf[i], 32, 47), BITS(buf[i+2], 32, 47)),
                 FX32(BITS(buf[i], 16, 31), BITS(buf[i+2], 16, 31)),
                 FX32(BITS(buf[i],  0, 15), BITS(buf[i+2],  0, 15))); i++;
-            fprintf(out, "[%p] %016" PRIx64 "                     drdy=%.5f dgdy=%.5f dbdy=%.5f dady=%.5f\n", &addr[i], buf[i],
+            fprintf(out, "[%08" PRIx32 "] %016" PRIx64 "                     drdy=%.5f dgdy=%.5f dbdy=%.5f dady=%.5f\n", addr+i*8, buf[i],
                 FX32(BITS(buf[i], 48, 63), BITS(buf[i+2], 48, 63)),
                 FX32(BITS(buf[i], 32, 47), BITS(buf[i+2], 32, 47)),
                 FX32(BITS(buf[i], 16, 31), BITS(buf[i+2], 16, 31)),
                 FX32(BITS(buf[i],  0, 15), BITS(buf[i+2],  0, 15))); i++;
-            fprintf(out, "[%p] %016" PRIx64 "                     \n", &addr[i], buf[i]); i++;
-            fprintf(out, "[%p] %016" PRIx64 "                     \n", &addr[i], buf[i]); i++;
+            fprintf(out, "[%08" PRIx32 "] %016" PRIx64 "                     \n", addr+i*8, buf[i]); i++;
+            fprintf(out, "[%08" PRIx32 "] %016" PRIx64 "                     \n", addr+i*8, buf[i]); i++;
         }
         if (cmd & 0x2) {
-            fprintf(out, "[%p] %016" PRIx64 "                     s=%.5f t=%.5f w=%.5f\n", &addr[i], buf[i],
+            fprintf(out, "[%08" PRIx32 "] %016" PRIx64 "                     s=%.5f t=%.5f w=%.5f\n", addr+i*8, buf[i],
                 FX32(BITS(buf[i], 48, 63), BITS(buf[i+2], 48, 63)), 
                 FX32(BITS(buf[i], 32, 47), BITS(buf[i+2], 32, 47)),
                 FX32(BITS(buf[i], 16, 31), BITS(buf[i+2], 16, 31))); i++;
-            fprintf(out, "[%p] %016" PRIx64 "                     dsdx=%.5f dtdx=%.5f dwdx=%.5f\n", &addr[i], buf[i],
+            fprintf(out, "[%08" PRIx32 "] %016" PRIx64 "                     dsdx=%.5f dtdx=%.5f dwdx=%.5f\n", addr+i*8, buf[i],
                 FX32(BITS(buf[i], 48, 63), BITS(buf[i+2], 48, 63)), 
                 FX32(BITS(buf[i], 32, 47), BITS(buf[i+2], 32, 47)),
                 FX32(BITS(buf[i], 16, 31), BITS(buf[i+2], 16, 31))); i++;
-            fprintf(out, "[%p] %016" PRIx64 "                     \n", &addr[i], buf[i]); i++;
-            fprintf(out, "[%p] %016" PRIx64 "                     \n", &addr[i], buf[i]); i++;
-            fprintf(out, "[%p] %016" PRIx64 "                     dsde=%.5f dtde=%.5f dwde=%.5f\n", &addr[i], buf[i],
+            fprintf(out, "[%08" PRIx32 "] %016" PRIx64 "                     \n", addr+i*8, buf[i]); i++;
+            fprintf(out, "[%08" PRIx32 "] %016" PRIx64 "                     \n", addr+i*8, buf[i]); i++;
+            fprintf(out, "[%08" PRIx32 "] %016" PRIx64 "                     dsde=%.5f dtde=%.5f dwde=%.5f\n", addr+i*8, buf[i],
                 FX32(BITS(buf[i], 48, 63), BITS(buf[i+2], 48, 63)), 
                 FX32(BITS(buf[i], 32, 47), BITS(buf[i+2], 32, 47)),
                 FX32(BITS(buf[i], 16, 31), BITS(buf[i+2], 16, 31))); i++;
-            fprintf(out, "[%p] %016" PRIx64 "                     dsdy=%.5f dtdy=%.5f dwdy=%.5f\n", &addr[i], buf[i],
+            fprintf(out, "[%08" PRIx32 "] %016" PRIx64 "                     dsdy=%.5f dtdy=%.5f dwdy=%.5f\n", addr+i*8, buf[i],
                 FX32(BITS(buf[i], 48, 63), BITS(buf[i+2], 48, 63)), 
                 FX32(BITS(buf[i], 32, 47), BITS(buf[i+2], 32, 47)),
                 FX32(BITS(buf[i], 16, 31), BITS(buf[i+2], 16, 31))); i++;
-            fprintf(out, "[%p] %016" PRIx64 "                     \n", &addr[i], buf[i]); i++;
-            fprintf(out, "[%p] %016" PRIx64 "                     \n", &addr[i], buf[i]); i++;
+            fprintf(out, "[%08" PRIx32 "] %016" PRIx64 "                     \n", addr+i*8, buf[i]); i++;
+            fprintf(out, "[%08" PRIx32 "] %016" PRIx64 "                     \n", addr+i*8, buf[i]); i++;
         }
         if (cmd & 0x1) {
-            fprintf(out, "[%p] %016" PRIx64 "                     z=%.5f dzdx=%.5f\n", &addr[i], buf[i],
+            fprintf(out, "[%08" PRIx32 "] %016" PRIx64 "                     z=%.5f dzdx=%.5f\n", addr+i*8, buf[i],
                 FX32(BITS(buf[i], 48, 63), BITS(buf[i], 32, 47)), 
                 FX32(BITS(buf[i], 16, 31), BITS(buf[i],  0, 15))); i++;
-            fprintf(out, "[%p] %016" PRIx64 "                     dzde=%.5f dzdy=%.5f\n", &addr[i], buf[i],
+            fprintf(out, "[%08" PRIx32 "] %016" PRIx64 "                     dzde=%.5f dzdy=%.5f\n", addr+i*8, buf[i],
                 FX32(BITS(buf[i], 48, 63), BITS(buf[i], 32, 47)), 
                 FX32(BITS(buf[i], 16, 31), BITS(buf[i],  0, 15))); i++;
         }
@@ -753,13 +908,14 @@ static bool log_coalesce_tris(uint8_t cmd, uint8_t *last_tri_cmd, int *num_tris)
 }
 
 
-bool rdpq_debug_disasm(uint64_t *buf, FILE *out) {
+/** @brief Disassemble a command (see #rdpq_debug_disasm), showing the specified RDRAM address */
+static bool rdpq_debug_disasm_at(uint32_t addr, uint64_t *buf, FILE *out) {
     static uint8_t last_tri_cmd = 0; static int num_tris = 0;
  
     if (buf) {
         uint8_t cmd = BITS(buf[0],56,61);
         if ((__rdpq_debug_log_flags & RDPQ_LOG_FLAG_SHOWTRIS) || log_coalesce_tris(cmd, &last_tri_cmd, &num_tris)) {
-            __rdpq_debug_disasm(buf, buf, out);
+            __rdpq_debug_disasm(addr, buf, out);
             return true;
         }
     } else {
@@ -768,6 +924,10 @@ bool rdpq_debug_disasm(uint64_t *buf, FILE *out) {
     return false;
 }
 
+bool rdpq_debug_disasm(uint64_t *buf, FILE *out) {
+    return rdpq_debug_disasm_at((uint32_t)(uintptr_t)buf, buf, out);
+}
+
 #define EMIT_TYPE         0x3                 ///< Type of message (mask)
 #define EMIT_CRASH        0x0                 ///< Message is a RDP crash
 #define EMIT_ERROR        0x1                 ///< Message is an error
@@ -799,7 +959,7 @@ static void validate_emit_error(int flags, const char *msg, ...)
                 }
             }
         }
-        rdpq_debug_disasm(vctx.buf, stderr);
+        rdpq_debug_disasm_at(vctx.addr, vctx.buf, stderr);
     }
 
     switch (flags & EMIT_TYPE) {
@@ -825,18 +985,18 @@ static void validate_emit_error(int flags, const char *msg, ...)
     if ((flags & EMIT_TYPE) == EMIT_CRASH)
         fprintf(stderr, "[RDPQ_VALIDATION]        This is a fatal error: a real RDP chip would stop working until reboot\n");
 
-    if (flags & EMIT_CTX_SOM) fprintf(stderr, "[RDPQ_VALIDATION]        SET_OTHER_MODES last sent at %p\n", rdp.last_som);
-    if (flags & EMIT_CTX_CC)  fprintf(stderr, "[RDPQ_VALIDATION]        SET_COMBINE_MODE last sent at %p\n", rdp.last_cc);
-    if (flags & EMIT_CTX_TEX) fprintf(stderr, "[RDPQ_VALIDATION]        SET_TEX_IMAGE last sent at %p\n", rdp.last_tex);
+    if (flags & EMIT_CTX_SOM) fprintf(stderr, "[RDPQ_VALIDATION]        SET_OTHER_MODES last sent at 0x%08" PRIx32 "\n", rdp.last_som);
+    if (flags & EMIT_CTX_CC)  fprintf(stderr, "[RDPQ_VALIDATION]        SET_COMBINE_MODE last sent at 0x%08" PRIx32 "\n", rdp.last_cc);
+    if (flags & EMIT_CTX_TEX) fprintf(stderr, "[RDPQ_VALIDATION]        SET_TEX_IMAGE last sent at 0x%08" PRIx32 "\n", rdp.last_tex);
     if (flags & EMIT_CTX_TILES) {
         for (int i = 0; i < 8; i++) {
             if (flags & EMIT_CTX_TILE(i)) {
                 if (flags & EMIT_CTX_TILESIZE)
-                    fprintf(stderr, "[RDPQ_VALIDATION]        %s last sent at %p\n",
+                    fprintf(stderr, "[RDPQ_VALIDATION]        %s last sent at 0x%08" PRIx32 "\n",
                         CMD(rdp.tile[i].last_setsize_data) == 0x32 ? "SET_TILE_SIZE" : "LOAD_TILE",
                         rdp.tile[i].last_setsize);
                 else
-                    fprintf(stderr, "[RDPQ_VALIDATION]        SET_TILE last sent at %p\n", rdp.tile[i].last_settile);
+                    fprintf(stderr, "[RDPQ_VALIDATION]        SET_TILE last sent at 0x%08" PRIx32 "\n", rdp.tile[i].last_settile);
                 break;
             }
         }
@@ -927,11 +1087,11 @@ static void lazy_validate_rendertarget(void) {
     if (!rdp.rendertarget_changed) return;
     rdp.rendertarget_changed = false;
 
-    VALIDATE_ERR(rdp.last_col,
+    VALIDATE_ERR(rdp.last_col_data,
         "undefined behavior: drawing command before a SET_COLOR_IMAGE was sent");
     VALIDATE_ERR(rdp.sent_scissor,
         "undefined behavior: drawing command before a SET_SCISSOR was sent");
-    if (!rdp.last_col || !rdp.sent_scissor) return;
+    if (!rdp.last_col_data || !rdp.sent_scissor) return;
 
     // copy/fill mode use inclusive X coordinates for most things, including scissor
     int x1 = rdp.clip.x1;
@@ -989,7 +1149,7 @@ static void lazy_validate_rendermode(void) {
 
     // Fill mode validation
     if (rdp.som.cycle_type == 3) {
-        if (rdp.last_col) {
+        if (rdp.last_col_data) {
             VALIDATE_CRASH_SOM(rdp.col.size != 0, "FILL mode not supported on 4-bit framebuffers");   
         }
         // These are a bunch of SOM settings that, in addition of being useless in FILL mode, they cause
@@ -1002,7 +1162,7 @@ static void lazy_validate_rendermode(void) {
 
     // Copy mode validation
     if (rdp.som.cycle_type == 2) {
-        if (rdp.last_col) {
+        if (rdp.last_col_data) {
             int size = BITS(rdp.last_col_data, 51, 52);
             VALIDATE_CRASH_SOM(size != 3, "COPY mode not supported on 32-bit framebuffers");   
         }
@@ -1037,12 +1197,12 @@ static void lazy_validate_rendermode(void) {
             "sharpen/detail texture require texture LOD to be active");
     }
     if (rdp.som.z.cmp || rdp.som.z.upd) {
-        VALIDATE_ERR_SOM(rdp.last_z,
+        VALIDATE_ERR_SOM(rdp.last_z_data,
             "Z buffer image not configured but Z buffer mode was requested in SOM");
     }
 
-    if (!rdp.last_cc) {
-        VALIDATE_ERR(rdp.last_cc, "SET_COMBINE not called before drawing primitive");
+    if (!rdp.last_cc_data) {
+        VALIDATE_ERR(rdp.last_cc_data, "SET_COMBINE not called before drawing primitive");
         return;
     }
 
@@ -1227,8 +1387,8 @@ static void validate_use_tile(int tidx, int cycle, float *texcoords, int ncoords
     bool use_outside = false;
     float out_s, out_t;
 
-    if (!tile->last_settile)
-        VALIDATE_ERR(tile->last_settile, "tile %d was not configured", tidx);
+    if (!tile->last_settile_data)
+        VALIDATE_ERR(tile->last_settile_data, "tile %d was not configured", tidx);
     else if (!tile->has_extents)
         VALIDATE_ERR_TILE(tile->has_extents, tidx, "tile %d has no extents set, missing LOAD_TILE or SET_TILE_SIZE", tidx);
     else {
@@ -1307,8 +1467,14 @@ static void validate_use_tile(int tidx, int cycle, float *texcoords, int ncoords
 }
 
 void rdpq_validate(uint64_t *buf, uint32_t flags, int *r_errs, int *r_warns)
+{
+    __rdpq_validate_at((uint32_t)(uintptr_t)buf, buf, flags, r_errs, r_warns);
+}
+
+void __rdpq_validate_at(uint32_t addr, uint64_t *buf, uint32_t flags, int *r_errs, int *r_warns)
 {
     vctx.buf = buf;
+    vctx.addr = addr;
     vctx.flags = flags;
     if (r_errs)  *r_errs  = vctx.errs;
     if (r_warns) *r_warns = vctx.warns;
@@ -1339,12 +1505,11 @@ void rdpq_validate(uint64_t *buf, uint32_t flags, int *r_errs, int *r_warns)
             // special case for libdragon: if the address is 0x800000, then it means
             // that the developer requested to detach the framebuffer. Treat it as
             // if SET_COLOR_IMAGE was never sent.
-            rdp.last_col = NULL;
             rdp.last_col_data = 0;
         } else {
             VALIDATE_ERR(addr > 0x400, "color image address set to low RDRAM");
             VALIDATE_WARN(addr < 0x800000, "color image address is out of RDRAM");
-            rdp.last_col = &buf[0];
+            rdp.last_col = vctx.addr;
             rdp.last_col_data = buf[0];
         }
         rdp.mode_changed = true; // revalidate render mode on different framebuffer format  
@@ -1358,12 +1523,11 @@ void rdpq_validate(uint64_t *buf, uint32_t flags, int *r_errs, int *r_warns)
             // special case for libdragon: if the address is 0x800000, then it means
             // that the developer requested to detach the Z buffer. Treat it as
             // if SET_Z_IMAGE was never sent.
-            rdp.last_z = NULL;
             rdp.last_z_data = 0;
         } else {
             VALIDATE_ERR(addr > 0x400, "Z image address set to low RDRAM");
             VALIDATE_WARN(addr < 0x800000, "Z image address is out of RDRAM");
-            rdp.last_z = &buf[0];
+            rdp.last_z = vctx.addr;
             rdp.last_z_data = buf[0];
         }
         rdp.mode_changed = true; // revalidate render mode on different Z buffer
@@ -1374,7 +1538,7 @@ void rdpq_validate(uint64_t *buf, uint32_t flags, int *r_errs, int *r_warns)
         rdp.tex.physaddr = BITS(buf[0], 0, 24);
         rdp.tex.fmt = BITS(buf[0], 53, 55);
         rdp.tex.size = BITS(buf[0], 51, 52);
-        rdp.last_tex = &buf[0];        
+        rdp.last_tex = vctx.addr;        
         rdp.last_tex_data = buf[0];
         break;
     case 0x35: { // SET_TILE
@@ -1382,7 +1546,7 @@ void rdpq_validate(uint64_t *buf, uint32_t flags, int *r_errs, int *r_warns)
         validate_busy_tile(tidx);
         struct tile_s *t = &rdp.tile[tidx];
         *t = (struct tile_s){
-            .last_settile = &buf[0],
+            .last_settile = vctx.addr,
             .last_settile_data = buf[0],
             .fmt = BITS(buf[0], 53, 55), .size = BITS(buf[0], 51, 52),
             .pal = BITS(buf[0], 20, 23),
@@ -1408,7 +1572,7 @@ void rdpq_validate(uint64_t *buf, uint32_t flags, int *r_errs, int *r_warns)
             VALIDATE_CRASH_TEX(rdp.tex.size != 0, "LOAD_TILE does not support 4-bit textures");
         }
         t->has_extents = true;
-        t->last_setsize = &buf[0];
+        t->last_setsize = vctx.addr;
         t->last_setsize_data = buf[0];
         t->s0 = BITS(buf[0], 44, 55)*FX(2); t->t0 = BITS(buf[0], 32, 43)*FX(2);
         t->s1 = BITS(buf[0], 12, 23)*FX(2); t->t1 = BITS(buf[0],  0, 11)*FX(2);
@@ -1443,7 +1607,7 @@ void rdpq_validate(uint64_t *buf, uint32_t flags, int *r_errs, int *r_warns)
     case 0x2F: // SET_OTHER_MODES
         validate_busy_pipe();
         rdp.som = decode_som(buf[0]);
-        rdp.last_som = &buf[0];
+        rdp.last_som = vctx.addr;
         rdp.last_som_data = buf[0];
         rdp.mode_changed = true;
         rdp.rendertarget_changed = true; // revalidate clipping extents on render target (cycle mode mught be changed)
@@ -1451,7 +1615,7 @@ void rdpq_validate(uint64_t *buf, uint32_t flags, int *r_errs, int *r_warns)
     case 0x3C: // SET_COMBINE
         validate_busy_pipe();
         rdp.cc = decode_cc(buf[0]);
-        rdp.last_cc = &buf[0];
+        rdp.last_cc = vctx.addr;
         rdp.last_cc_data = buf[0];
         rdp.mode_changed = true;
         break;
@@ -42,6 +42,20 @@ extern void (*rdpq_trace_fetch)(bool new_buffer);
  */
 void rdpq_validate(uint64_t *buf, uint32_t flags, int *errs, int *warns);
 
+/**
+ * @brief Like #rdpq_validate, for a command that is not stored at its RDRAM address
+ * 
+ * This is used by tools that validate a captured stream: the RDRAM address
+ * of the command is only used in messages.
+ * 
+ * @param       addr    RDRAM address of the command
+ * @param       buf     Pointer to the RDP command
+ * @param       flags   Flags that configure the validation 
+ * @param[out]  errs    Number of validation errors (see #rdpq_validate)
+ * @param[out]  warns   Number of validation warnings (see #rdpq_validate)
+ */
+void __rdpq_validate_at(uint32_t addr, uint64_t *buf, uint32_t flags, int *errs, int *warns);
+
 /** @brief Disable echo of commands triggering validation errors */
 #define RDPQ_VALIDATE_FLAG_NOECHO    0x00000001
 
@@ -68,4 +82,34 @@ extern int __rdpq_debug_log_flags;
  */
 #define RDPQ_VALIDATE_DETACH_ADDR    0x00800000
 
+/**
+ * @name RDP capture file format
+ * 
+ * A capture file (produced by #rdpq_debug_capture_stop) is made of a header
+ * followed by a sequence of chunks. All integers are stored big-endian.
+ * 
+ * Header:
+ *   * 4 bytes: magic (#RDPQ_CAPTURE_MAGIC)
+ *   * u32: version (#RDPQ_CAPTURE_VERSION)
+ *   * u32: number of chunks
+ * 
+ * Each chunk:
+ *   * u32: type (#RDPQ_CAPTURE_CHUNK_CMDS or #RDPQ_CAPTURE_CHUNK_DATA)
+ *   * u32: RDRAM physical address of the data
+ *   * u32: size of the data in bytes (always a multiple of 8)
+ *   * data bytes
+ * 
+ * A CMDS chunk contains a contiguous run of RDP commands, as they were sent
+ * to the RDP from the specified address. A DATA chunk contains a copy of a range
+ * of RDRAM referenced by the commands (textures and palettes read by LOAD_*
+ * commands). Chunks appear in the order they were captured.
+ * 
+ * @{
+ */
+#define RDPQ_CAPTURE_MAGIC          "RDPC"        ///< Magic number of capture files
+#define RDPQ_CAPTURE_VERSION        1             ///< Version of the capture file format
+#define RDPQ_CAPTURE_CHUNK_CMDS     0x434D4453    ///< Chunk type: RDP commands ("CMDS")
+#define RDPQ_CAPTURE_CHUNK_DATA     0x44415441    ///< Chunk type: RDRAM contents ("DATA")
+/** @} */
+
 #endif /* LIBDRAGON_RDPQ_DEBUG_INTERNAL_H */
@@ -0,0 +1,157 @@
+/**
+ * @file rdpq_dynres.c
+ * @brief RDP Command queue: dynamic resolution scaling
+ * @ingroup rdp
+ *
+ * The RDP busy counter is sampled at the beginning of each frame via a
+ * SYNC_FULL callback, that is when the RDP has finished all the commands
+ * of the previous frames. The difference between two consecutive samples
+ * is the busy time of a frame. The counter does not advance while the RDP
+ * is idle, so the time spent waiting for the CPU or for vblank between
+ * frames is not counted.
+ */
+
+#include "rdpq.h"
+#include "rdpq_dynres.h"
+#include "rdpq_attach.h"
+#include "rdpq_internal.h"
+#include "display.h"
+#include "rdp.h"
+#include "n64sys.h"
+#include "interrupt.h"
+#include "debug.h"
+#include "utils.h"
+#include <math.h>
+
+/** @brief Mask of the valid bits of the RDP counters */
+#define COUNTER_MASK        0xFFFFFF
+
+/** @brief Current parameters */
+static rdpq_dynres_parms_t dynres_parms;
+/** @brief Scale factor of the current frame */
+static float cur_scale = 1.0f;
+/** @brief RDP load of the last measured frame */
+static float last_load = 0.0f;
+/** @brief Display buffer of the current frame */
+static surface_t *cur_disp;
+/** @brief Portion of the display buffer attached for the current frame */
+static surface_t cur_color;
+/** @brief Portion of the Z-buffer attached for the current frame */
+static surface_t cur_z;
+
+/** @brief Value of the busy counter at the last sample (written by the callback) */
+static uint32_t sample_busy;
+/** @brief Scale of the frame that began at the last sample, in 16.16 (written by the callback) */
+static uint32_t sample_scale;
+/** @brief True if a sample was taken */
+static bool sample_valid;
+/** @brief Busy cycles of the last measured frame */
+static volatile uint32_t meas_busy;
+/** @brief Scale of the last measured frame, in 16.16 */
+static volatile uint32_t meas_scale;
+/** @brief True if a new measurement is available */
+static volatile bool meas_ready;
+
+/** @brief SYNC_FULL callback: sample the busy counter at the beginning of a frame */
+static void sample_cb(void *arg)
+{
+    uint32_t busy = *DP_BUSY;
+    if (sample_valid) {
+        meas_busy = (busy - sample_busy) & COUNTER_MASK;
+        meas_scale = sample_scale;
+        meas_ready = true;
+    }
+    sample_busy = busy;
+    sample_scale = (uint32_t)arg;
+    sample_valid = true;
+}
+
+void rdpq_dynres_init(const rdpq_dynres_parms_t *parms)
+{
+    if (parms) {
+        dynres_parms = *parms;
+    } else {
+        dynres_parms = (rdpq_dynres_parms_t){
+            .min_scale = 0.5f, .max_scale = 1.0f,
+            .target_load = 0.85f, .max_increase = 0.02f,
+        };
+    }
+    assertf(dynres_parms.min_scale > 0 && dynres_parms.min_scale <= dynres_parms.max_scale && dynres_parms.max_scale <= 1.0f,
+        "invalid scale range: %f-%f", dynres_parms.min_scale, dynres_parms.max_scale);
+    assertf(dynres_parms.target_load > 0, "invalid target load: %f", dynres_parms.target_load);
+
+    disable_interrupts();
+    sample_valid = false;
+    meas_ready = false;
+    enable_interrupts();
+    cur_scale = dynres_parms.max_scale;
+    last_load = 0;
+}
+
+/**
+ * @brief Update the scale factor from a measured frame
+ *
+ * @param busy      RDP busy cycles of the frame
+ * @param scale     Scale at which the frame was drawn
+ */
+void __rdpq_dynres_update(uint32_t busy, float scale)
+{
+    int vblanks = MAX(display_get_frame_pacing(), 1);
+    float budget = (float)RCP_FREQUENCY * vblanks / (get_tv_type() == TV_PAL ? 50 : 60);
+    last_load = busy / budget;
+    if (busy == 0) return;
+
+    // The drawn area is proportional to the square of the scale. Pick the
+    // scale that would have made the measured frame hit the target load,
+    // but raise it slowly to avoid oscillations.
+    float ideal = scale * sqrtf(dynres_parms.target_load * budget / busy);
+    cur_scale = MIN(ideal, cur_scale * (1.0f + dynres_parms.max_increase));
+    cur_scale = CLAMP(cur_scale, dynres_parms.min_scale, dynres_parms.max_scale);
+}
+
+/** @brief Update the scale factor from the last measurement (if any) */
+static void dynres_update(void)
+{
+    disable_interrupts();
+    bool ready = meas_ready;
+    uint32_t busy = meas_busy;
+    float scale = meas_scale * (1.0f / 65536.0f);
+    meas_ready = false;
+    enable_interrupts();
+
+    if (ready)
+        __rdpq_dynres_update(busy, scale);
+}
+
+const surface_t *rdpq_dynres_attach(surface_t *disp, surface_t *z)
+{
+    dynres_update();
+
+    int width = MAX((int)(disp->width * cur_scale), 1);
+    int height = MAX((int)(disp->height * cur_scale), 1);
+    display_set_frame_size(disp, width, height);
+
+    cur_disp = disp;
+    cur_color = surface_make_sub(disp, 0, 0, width, height);
+    if (z) cur_z = surface_make_sub(z, 0, 0, width, height);
+
+    // Sample the busy counter when the RDP begins this frame
+    __rdpq_sync_full_sample(sample_cb, (void*)(uint32_t)(cur_scale * 65536.0f));
+    rdpq_attach(&cur_color, z ? &cur_z : NULL);
+    return &cur_color;
+}
+
+void rdpq_dynres_detach_show(void)
+{
+    rdpq_detach_cb((void (*)(void*))display_show, (void*)cur_disp);
+}
+
+float rdpq_dynres_get_scale(void)
+{
+    return cur_scale;
+}
+
+float rdpq_dynres_get_load(void)
+{
+    return last_load;
+}
@@ -0,0 +1,367 @@
+/**
+ * @file rdpq_font.c
+ * @brief RDP Command queue: bitmap font rendering
+ * @ingroup rdp
+ */
+
+#include "rspq.h"
+#include "rdpq.h"
+#include "rdpq_font.h"
+#include "rdpq_font_internal.h"
+#include "rdpq_mode.h"
+#include "rdpq_rect.h"
+#include "rdpq_tex.h"
+#include "rdpq_internal.h"
+#include "rdpq_tex_internal.h"
+#include "asset.h"
+#include "n64sys.h"
+#include "debug.h"
+#include "utils.h"
+#include <malloc.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** @brief Number of laid-out texts kept by #rdpq_font_print */
+#define TEXT_CACHE_SIZE     32
+
+/** @brief Font (see #rdpq_font_load) */
+typedef struct rdpq_font_s {
+    font_header_t *hdr;             ///< Font file (owned buffer)
+    font_glyph_t *glyphs;           ///< Glyphs, sorted by codepoint
+    font_kerning_t *kerning;        ///< Kerning pairs, sorted by glyph indices
+    surface_t *atlases;             ///< Atlas pages
+    int16_t ascii[128];             ///< Glyph index of each ASCII codepoint (-1 if missing)
+} rdpq_font_t;
+
+/** @brief A range of glyphs of a text that use the same atlas page */
+typedef struct {
+    uint16_t atlas;                 ///< Index of the atlas page
+    uint16_t start;                 ///< Index of the first rectangle
+    uint16_t count;                 ///< Number of rectangles
+} text_range_t;
+
+/** @brief Laid-out text (see #rdpq_text_layout) */
+typedef struct rdpq_text_s {
+    rdpq_font_t *fnt;               ///< Font used for the layout
+    rdpq_rect_item_t *rects;        ///< Glyph rectangles, relative to the beginning of the baseline
+    text_range_t *ranges;           ///< Ranges of rectangles using the same atlas page
+    int num_ranges;                 ///< Number of ranges
+    int width, height;              ///< Size of the bounding box
+    rspq_syncpoint_t sync;          ///< Syncpoint after the last draw
+    bool pending;                   ///< True if sync refers to a draw that might still be pending
+} rdpq_text_t;
+
+/** @brief An entry of the cache of laid-out texts used by #rdpq_font_print */
+typedef struct {
+    rdpq_font_t *fnt;               ///< Font
+    uint32_t hash;                  ///< Hash of the string
+    char *str;                      ///< Copy of the string
+    rdpq_text_t *text;              ///< Laid-out text
+    uint32_t last_use;              ///< Value of #text_cache_tick when last used
+} text_cache_entry_t;
+
+/** @brief Cache of laid-out texts used by #rdpq_font_print */
+static text_cache_entry_t text_cache[TEXT_CACHE_SIZE];
+/** @brief Counter used to find the least recently used cache entry */
+static uint32_t text_cache_tick;
+
+/** @brief Draw state between #rdpq_font_begin and #rdpq_font_end */
+static struct {
+    bool active;                    ///< True between #rdpq_font_begin and #rdpq_font_end
+    const surface_t *atlas;         ///< Atlas page loaded in TMEM by the last draw (NULL: none)
+    uint32_t stamp;                 ///< TMEM stamp after the atlas page was loaded
+} font_draw;
+
+rdpq_font_t *rdpq_font_load(const char *fn)
+{
+    int sz;
+    font_header_t *hdr = asset_load(fn, &sz);
+    assertf(memcmp(hdr->magic, FONT_MAGIC, 3) == 0, "invalid font file: %s", fn);
+    assertf(hdr->version == FONT_VERSION, "unsupported font version %d (%s); please regenerate your asset files", hdr->version, fn);
+    data_cache_hit_writeback(hdr, sz);
+
+    rdpq_font_t *fnt = calloc(1, sizeof(rdpq_font_t));
+    fnt->hdr = hdr;
+    fnt->glyphs = (void*)hdr + hdr->glyphs_offset;
+    fnt->kerning = (void*)hdr + hdr->kerning_offset;
+
+    font_atlas_t *atlases = (void*)hdr + hdr->atlases_offset;
+    fnt->atlases = malloc(hdr->num_atlases * sizeof(surface_t));
+    for (int i=0; i<hdr->num_atlases; i++)
+        fnt->atlases[i] = surface_make_linear((void*)hdr + atlases[i].data_offset,
+            atlases[i].format, atlases[i].width, atlases[i].height);
+
+    memset(fnt->ascii, 0xFF, sizeof(fnt->ascii));
+    for (int i=0; i<hdr->num_glyphs && fnt->glyphs[i].codepoint < 128; i++)
+        fnt->ascii[fnt->glyphs[i].codepoint] = i;
+    return fnt;
+}
+
+void rdpq_font_free(rdpq_font_t *fnt)
+{
+    for (int i=0; i<TEXT_CACHE_SIZE; i++) {
+        text_cache_entry_t *e = &text_cache[i];
+        if (e->fnt == fnt) {
+            rdpq_text_free(e->text);
+            free(e->str);
+            memset(e, 0, sizeof(*e));
+        }
+    }
+    free(fnt->atlases);
+    free(fnt->hdr);
+    free(fnt);
+}
+
+int rdpq_font_get_line_height(rdpq_font_t *fnt)
+{
+    return fnt->hdr->line_height;
+}
+
+void rdpq_font_begin(color_t color)
+{
+    rdpq_mode_push();
+    rdpq_set_mode_standard();
+    rdpq_mode_combiner(RDPQ_COMBINER1((0,0,0,PRIM), (TEX0,0,PRIM,0)));
+    rdpq_mode_blender(RDPQ_BLENDER_MULTIPLY);
+    rdpq_set_prim_color(color);
+    font_draw.active = true;
+    font_draw.atlas = NULL;
+}
+
+void rdpq_font_end(void)
+{
+    rdpq_mode_pop();
+    font_draw.active = false;
+    font_draw.atlas = NULL;
+}
+
+/** @brief Find the glyph of a codepoint (-1 if missing) */
+static int font_find_glyph(rdpq_font_t *fnt, uint32_t codepoint)
+{
+    if (codepoint < 128)
+        return fnt->ascii[codepoint];
+
+    int lo = 0, hi = fnt->hdr->num_glyphs - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        uint32_t cp = fnt->glyphs[mid].codepoint;
+        if (cp == codepoint) return mid;
+        if (cp < codepoint) lo = mid + 1; else hi = mid - 1;
+    }
+    return -1;
+}
+
+/** @brief Get the kerning adjustment between two glyphs */
+static int font_find_kerning(rdpq_font_t *fnt, int glyph1, int glyph2)
+{
+    uint32_t key = (glyph1 << 16) | glyph2;
+    int lo = 0, hi = fnt->hdr->num_kerning - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        font_kerning_t *k = &fnt->kerning[mid];
+        uint32_t kkey = (k->glyph1 << 16) | k->glyph2;
+        if (kkey == key) return k->amount;
+        if (kkey < key) lo = mid + 1; else hi = mid - 1;
+    }
+    return 0;
+}
+
+/** @brief Decode the next UTF-8 codepoint, advancing the pointer (invalid bytes are returned as-is) */
+static uint32_t utf8_decode(const uint8_t **p, const uint8_t *end)
+{
+    const uint8_t *s = *p;
+    uint32_t c = *s++;
+    int n = 0;
+    if ((c & 0xE0) == 0xC0)      { c &= 0x1F; n = 1; }
+    else if ((c & 0xF0) == 0xE0) { c &= 0x0F; n = 2; }
+    else if ((c & 0xF8) == 0xF0) { c &= 0x07; n = 3; }
+    if (s + n > end) n = 0;
+    while (n-- > 0) {
+        if ((*s & 0xC0) != 0x80) break;
+        c = (c << 6) | (*s++ & 0x3F);
+    }
+    *p = s;
+    return c;
+}
+
+rdpq_text_t *rdpq_text_layout(rdpq_font_t *fnt, const char *text, int nbytes)
+{
+    if (nbytes < 0) nbytes = strlen(text);
+    const uint8_t *end = (const uint8_t*)text + nbytes;
+    int num_atlases = fnt->hdr->num_atlases;
+
+    // First pass: count the visible glyphs of each atlas page
+    int count[num_atlases];
+    memset(count, 0, sizeof(count));
+    int num_rects = 0;
+    for (const uint8_t *p = (const uint8_t*)text; p < end; ) {
+        int g = font_find_glyph(fnt, utf8_decode(&p, end));
+        if (g >= 0 && fnt->glyphs[g].width) {
+            count[fnt->glyphs[g].atlas]++;
+            num_rects++;
+        }
+    }
+
+    rdpq_text_t *t = calloc(1, sizeof(rdpq_text_t));
+    t->fnt = fnt;
+    t->rects = memalign(8, MAX(num_rects, 1) * sizeof(rdpq_rect_item_t));
+    t->ranges = malloc(MAX(num_atlases, 1) * sizeof(text_range_t));
+
+    // Allocate a contiguous range of rectangles to each used atlas page
+    int next[num_atlases];
+    int start = 0;
+    for (int i=0; i<num_atlases; i++) {
+        next[i] = start;
+        if (count[i] == 0) continue;
+        t->ranges[t->num_ranges++] = (text_range_t){ .atlas = i, .start = start, .count = count[i] };
+        start += count[i];
+    }
+
+    // Second pass: place the glyphs, relative to the beginning of the baseline
+    int pen_x = 0, pen_y = 0, prev = -1, lines = 1;
+    for (const uint8_t *p = (const uint8_t*)text; p < end; ) {
+        uint32_t cp = utf8_decode(&p, end);
+        if (cp == '\n') {
+            t->width = MAX(t->width, pen_x);
+            pen_x = 0;
+            pen_y += fnt->hdr->line_height;
+            prev = -1;
+            lines++;
+            continue;
+        }
+
+        int g = font_find_glyph(fnt, cp);
+        if (g < 0) continue;
+        if (prev >= 0 && fnt->hdr->num_kerning)
+            pen_x += font_find_kerning(fnt, prev, g);
+
+        font_glyph_t *glyph = &fnt->glyphs[g];
+        if (glyph->width) {
+            rdpq_rect_item_t *r = &t->rects[next[glyph->atlas]++];
+            r->x = (pen_x + glyph->xoff) * 4;
+            r->y = (pen_y + glyph->yoff - fnt->hdr->ascent) * 4;
+            r->width = glyph->width * 4;
+            r->height = glyph->height * 4;
+            r->s = glyph->s * 32;
+            r->t = glyph->t * 32;
+            r->color = (color_t){0};
+        }
+        pen_x += glyph->xadvance;
+        prev = g;
+    }
+    t->width = MAX(t->width, pen_x);
+    t->height = lines * fnt->hdr->line_height;
+    return t;
+}
+
+void rdpq_text_free(rdpq_text_t *text)
+{
+    if (!text) return;
+    if (text->pending)
+        rspq_syncpoint_wait(text->sync);
+    free(text->rects);
+    free(text->ranges);
+    free(text);
+}
+
+void rdpq_text_draw(rdpq_text_t *text, float x, float y)
+{
+    if (text->num_ranges == 0) return;
+
+    // Load each atlas page once and draw all its glyphs with a single command.
+    // Between rdpq_font_begin and rdpq_font_end, remember which page is in
+    // TMEM, so that drawing multiple texts with the same page loads it only
+    // once. Atlas pages are never modified, so the page is still resident
+    // as long as TMEM was not written in the meantime. Within blocks, the
+    // TMEM contents at playback time are unknown, so the page is always loaded.
+    int16_t dx = x * 4, dy = y * 4;
+    bool track = font_draw.active && !rspq_in_block();
+    for (int i=0; i<text->num_ranges; i++) {
+        text_range_t *range = &text->ranges[i];
+        const surface_t *atlas = &text->fnt->atlases[range->atlas];
+        if (track && atlas == font_draw.atlas && __rdpq_tmem_resident(0, 4096, font_draw.stamp)) {
+            __rdpq_tex_settile(TILE0, atlas);
+        } else {
+            rdpq_tex_upload(TILE0, atlas, NULL);
+            font_draw.atlas = track ? atlas : NULL;
+            font_draw.stamp = __rdpq_tmem_stamp();
+        }
+        __rdpq_texture_rectangle_batch_offset(TILE0, &text->rects[range->start], range->count, false, dx, dy);
+    }
+
+    if (!rspq_in_block()) {
+        text->sync = rspq_syncpoint_new();
+        text->pending = true;
+    }
+}
+
+void rdpq_text_get_size(rdpq_text_t *text, int *width, int *height)
+{
+    if (width) *width = text->width;
+    if (height) *height = text->height;
+}
+
+/** @brief FNV-1a hash of a string */
+static uint32_t str_hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+    while (*s) h = (h ^ (uint8_t)*s++) * 16777619u;
+    return h;
+}
+
+void rdpq_font_print(rdpq_font_t *fnt, float x, float y, const char *str)
+{
+    // Texts in the cache can be evicted and freed at any time, so they can't
+    // be referenced by a block.
+    assertf(!rspq_in_block(), "rdpq_font_print cannot be called while recording a block: use rdpq_text_layout and rdpq_text_draw");
+
+    uint32_t hash = str_hash(str);
+    text_cache_entry_t *lru = &text_cache[0];
+    text_cache_tick++;
+
+    for (int i=0; i<TEXT_CACHE_SIZE; i++) {
+        text_cache_entry_t *e = &text_cache[i];
+        if (e->fnt == fnt && e->hash == hash && strcmp(e->str, str) == 0) {
+            e->last_use = text_cache_tick;
+            rdpq_text_draw(e->text, x, y);
+            return;
+        }
+        if (!e->fnt || (lru->fnt && e->last_use < lru->last_use))
+            lru = e;
+    }
+
+    // Not found: replace the least recently used entry
+    if (lru->fnt) {
+        rdpq_text_free(lru->text);
+        free(lru->str);
+    }
+    lru->fnt = fnt;
+    lru->hash = hash;
+    lru->str = strdup(str);
+    lru->text = rdpq_text_layout(fnt, str, -1);
+    lru->last_use = text_cache_tick;
+    rdpq_text_draw(lru->text, x, y);
+}
+
+void rdpq_font_printf(rdpq_font_t *fnt, float x, float y, const char *fmt, ...)
+{
+    char buf[256];
+    va_list va;
+    va_start(va, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, va);
+    va_end(va);
+
+    if (n < sizeof(buf)) {
+        rdpq_font_print(fnt, x, y, buf);
+        return;
+    }
+
+    char *str = malloc(n + 1);
+    va_start(va, fmt);
+    vsnprintf(str, n + 1, fmt, va);
+    va_end(va);
+    rdpq_font_print(fnt, x, y, str);
+    free(str);
+}
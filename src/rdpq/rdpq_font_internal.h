@@ -0,0 +1,63 @@
+#ifndef LIBDRAGON_RDPQ_FONT_INTERNAL_H
+#define LIBDRAGON_RDPQ_FONT_INTERNAL_H
+
+#include <stdint.h>
+
+/** @brief Magic number of font files ("FNT") */
+#define FONT_MAGIC          "FNT"
+/** @brief Current version of the font file format */
+#define FONT_VERSION        1
+
+/** @brief Width of a font atlas page in texels */
+#define FONT_ATLAS_WIDTH    128
+/** @brief Maximum height of a font atlas page in texels (a 4bpp page fills TMEM) */
+#define FONT_ATLAS_HEIGHT   64
+
+/** @brief A glyph in a font file (sorted by codepoint) */
+typedef struct {
+    uint32_t codepoint;     ///< Unicode codepoint
+    int16_t xadvance;       ///< Horizontal advance of the pen after drawing the glyph
+    int16_t xoff;           ///< X offset of the glyph rectangle from the pen position
+    int16_t yoff;           ///< Y offset of the glyph rectangle from the top of the line
+    uint8_t width;          ///< Width of the glyph rectangle (0 for blank glyphs)
+    uint8_t height;         ///< Height of the glyph rectangle
+    uint8_t s;              ///< S coordinate of the glyph within the atlas page
+    uint8_t t;              ///< T coordinate of the glyph within the atlas page
+    uint8_t atlas;          ///< Index of the atlas page containing the glyph
+    uint8_t reserved;       ///< Reserved (0)
+} font_glyph_t;
+
+/** @brief A kerning pair in a font file (sorted by glyph1, then glyph2) */
+typedef struct {
+    uint16_t glyph1;        ///< Index of the first glyph
+    uint16_t glyph2;        ///< Index of the second glyph
+    int16_t amount;         ///< Adjustment of the horizontal advance of the first glyph
+    uint16_t reserved;      ///< Reserved (0)
+} font_kerning_t;
+
+/** @brief An atlas page in a font file */
+typedef struct {
+    uint32_t data_offset;   ///< Offset of the pixels from the start of the file (8-byte aligned)
+    uint16_t width;         ///< Width of the page in texels
+    uint16_t height;        ///< Height of the page in texels
+    uint8_t format;         ///< Texture format of the page (#tex_format_t)
+    uint8_t reserved[3];    ///< Reserved (0)
+} font_atlas_t;
+
+/** @brief Header of a font file */
+typedef struct {
+    char magic[3];          ///< Magic number (#FONT_MAGIC)
+    uint8_t version;        ///< Version of the format (#FONT_VERSION)
+    int16_t line_height;    ///< Distance between two lines of text
+    int16_t ascent;         ///< Distance between the top of the line and the baseline
+    uint16_t num_glyphs;    ///< Number of glyphs
+    uint16_t num_kerning;   ///< Number of kerning pairs
+    uint16_t num_atlases;   ///< Number of atlas pages
+    uint16_t reserved;      ///< Reserved (0)
+    uint32_t glyphs_offset;     ///< Offset of the glyphs from the start of the file
+    uint32_t kerning_offset;    ///< Offset of the kerning pairs from the start of the file
+    uint32_t atlases_offset;    ///< Offset of the atlas pages from the start of the file
+    uint32_t reserved2;         ///< Reserved (0)
+} font_header_t;
+
+#endif
@@ -60,6 +60,51 @@ typedef struct {
 
 extern rdpq_tracking_t rdpq_tracking;
 
+/** @brief Tile descriptor tracking: the tile was never configured */
+#define RDPQ_TILETRACK_UNUSED   -2
+/** @brief Tile descriptor tracking: the TMEM address of the tile is unknown */
+#define RDPQ_TILETRACK_UNKNOWN  -1
+
+/**
+ * @brief CPU-side tracking of a RDP tile descriptor
+ * 
+ * This is used by the autosync engine to compute which portions of TMEM
+ * are accessed by load and draw commands, so that a SYNC_LOAD is only
+ * emitted when a load overwrites a portion of TMEM that might be in use.
+ * 
+ * Like #rdpq_tracking_t, this state is not known while recording a block,
+ * and after a block is run: in those cases, tiles are marked with an
+ * unknown address, which causes the whole TMEM to be considered.
+ */
+typedef struct {
+    int16_t tmem_addr;        ///< TMEM address in bytes (or RDPQ_TILETRACK_*)
+    uint16_t tmem_pitch;      ///< TMEM pitch in bytes
+    uint16_t rows;            ///< Number of rows in the tile extents (0 = unknown)
+    uint16_t cols;            ///< Number of columns in the tile extents (0 = unknown)
+    uint8_t fmt;              ///< Texture format (#tex_format_t)
+    uint8_t mask_s : 4;       ///< Wrapping mask on S (0 = none)
+    uint8_t mask_t : 4;       ///< Wrapping mask on T (0 = none)
+    bool clamp_s : 1;         ///< Clamping on S
+    bool clamp_t : 1;         ///< Clamping on T
+    bool load_only : 1;       ///< Tile last used for LOAD_BLOCK / LOAD_TLUT: not usable for drawing
+    uint8_t tmem_mask;        ///< Cached TMEM portions (AUTOSYNC_TMEM bits >> 8) that can be read via this tile
+} rdpq_tiletrack_t;
+
+/**
+ * @brief A segment of RDP commands in a block
+ * 
+ * Each #RSPQ_CMD_RDP_SET_BUFFER or #RSPQ_CMD_RDP_APPEND_BUFFER command in a
+ * block sends a segment of the RDP static buffer to RDP. The segment starts
+ * with the slots reserved for RDP commands generated by RSP (see #__rdpq_block_reserve),
+ * followed by the RDP commands written by the CPU. Segments are recorded
+ * during block creation only if #RDPQ_CFG_BLOCKOPT is enabled, so that the
+ * block can be later optimized (see #rdpq_block_optimize).
+ */
+typedef struct {
+    volatile uint32_t *cmd;     ///< Pointer to the rspq command in the block
+    uint32_t start;             ///< Physical address of the first RDP command written by the CPU
+} rdpq_block_segment_t;
+
 /**
  * @brief A buffer that piggybacks onto rspq_block_t to store RDP commands
  * 
@@ -73,6 +118,9 @@ extern rdpq_tracking_t rdpq_tracking;
 typedef struct rdpq_block_s {
     rdpq_block_t *next;                           ///< Link to next buffer (or NULL if this is the last one for this block)
     rdpq_tracking_t tracking;                     ///< Tracking state at the end of a block (this is populated only on the first link)
+    rdpq_block_segment_t *segs;                   ///< Segments of the block, until it is optimized (this is populated only on the first link)
+    int num_segs;                                 ///< Number of segments (this is populated only on the first link)
+    bool run;                                     ///< True once the block was run, so it cannot be optimized anymore (this is populated only on the first link)
     uint32_t cmds[] __attribute__((aligned(8)));  ///< RDP commands
 } rdpq_block_t;
 
@@ -106,6 +154,18 @@ typedef struct rdpq_block_state_s {
      * @brief Tracking state before starting building the block.
      */
     rdpq_tracking_t previous_tracking;
+    /**
+     * @brief Tile tracking state before starting building the block.
+     */
+    rdpq_tiletrack_t previous_tiles[8];
+    /** @brief True if the segments of the block must be recorded (#RDPQ_CFG_BLOCKOPT was enabled) */
+    bool optimize;
+    /** @brief Segments of the block being created */
+    rdpq_block_segment_t *segs;
+    /** @brief Number of segments of the block being created */
+    int num_segs;
+    /** @brief Allocated size of the segs array */
+    int max_segs;
 } rdpq_block_state_t;
 
 void __rdpq_block_begin();
@@ -115,16 +175,35 @@ void __rdpq_block_run(rdpq_block_t *block);
 void __rdpq_block_next_buffer(void);
 void __rdpq_block_update(volatile uint32_t *wptr);
 void __rdpq_block_reserve(int num_rdp_commands);
+void __rdpq_block_optimize(rdpq_block_t *block, rdpq_block_optimize_stats_t *stats);
 
 inline void __rdpq_autosync_use(uint32_t res)
 {
     rdpq_tracking.autosync |= res;
 }
 void __rdpq_autosync_change(uint32_t res);
+uint32_t __rdpq_autosync_tmem_use(uint32_t res, int tile);
+
+int __rdpq_autotmem_addr(void);
+void __rdpq_tmem_write(int addr, int bytes);
+uint32_t __rdpq_tmem_stamp(void);
+bool __rdpq_tmem_resident(int addr, int bytes, uint32_t stamp);
+bool __rdpq_tmem_unchanged(int addr, int bytes, uint32_t stamp);
+void __rdpq_tmem_scope_begin(void);
+void __rdpq_tmem_scope_end(void);
+void __rdpq_sync_full_sample(void (*callback)(void*), void* arg);
+void __rdpq_dynres_update(uint32_t busy, float scale);
+
+bool __rdpq_config_enabled(uint32_t cfg);
+uint32_t __rdpq_triangle_rejected(void);
+void __rdpq_triangle_init(void);
 
 void __rdpq_write8(uint32_t cmd_id, uint32_t arg0, uint32_t arg1);
 void __rdpq_write16(uint32_t cmd_id, uint32_t arg0, uint32_t arg1, uint32_t arg2, uint32_t arg3);
 
+struct rdpq_rect_item_s;
+void __rdpq_texture_rectangle_batch_offset(int tile, const struct rdpq_rect_item_s *rects, int num_rects, bool prim_color, int16_t dx, int16_t dy);
+
 void rdpq_triangle_cpu(const rdpq_trifmt_t *fmt, const float *v1, const float *v2, const float *v3);
 void rdpq_triangle_rsp(const rdpq_trifmt_t *fmt, const float *v1, const float *v2, const float *v3);
 
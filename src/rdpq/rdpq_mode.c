@@ -148,6 +148,38 @@ void rdpq_mode_end(void)
     __rdpq_mode_change_som(SOMX_UPDATE_FREEZE, 0);
 }
 
+void rdpq_mode_state_capture(rdpq_mode_state_t *state)
+{
+    assertf(!rspq_in_block(), "rdpq_mode_state_capture cannot be called while recording a block");
+    assertf(!rdpq_tracking.mode_freeze, "rdpq_mode_state_capture cannot be called between rdpq_mode_begin and rdpq_mode_end");
+
+    rsp_queue_t *rspq_state = __rspq_get_state();
+    state->combiner = rspq_state->rdp_mode.combiner;
+    state->combiner_mipmapmask = rspq_state->rdp_mode.combiner_mipmapmask;
+    state->blend_step0 = rspq_state->rdp_mode.blend_step0;
+    state->blend_step1 = rspq_state->rdp_mode.blend_step1;
+    state->other_modes = rspq_state->rdp_mode.other_modes;
+    state->combiner_final = rspq_state->rdp_combiner_final;
+}
+
+void rdpq_mode_state_apply(const rdpq_mode_state_t *state)
+{
+    __rdpq_autosync_change(AUTOSYNC_PIPE);
+    // SetModeState can generate: SCISSOR+COMBINE+SOM
+    rdpq_mode_write(3, RDPQ_OVL_ID, RDPQ_CMD_SET_MODE_STATE, 0,
+        state->combiner >> 32, state->combiner & 0xFFFFFFFF,
+        state->combiner_mipmapmask >> 32, state->combiner_mipmapmask & 0xFFFFFFFF,
+        state->blend_step0, state->blend_step1,
+        state->other_modes >> 32, state->other_modes & 0xFFFFFFFF,
+        state->combiner_final >> 32, state->combiner_final & 0xFFFFFFFF);
+
+    // Track the cycle type: FILL and COPY modes have the same bit set
+    int cycle_type = (state->other_modes & (1ull << (SOM_CYCLE_SHIFT+1))) ? 2 : 1;
+    if (!rdpq_tracking.mode_freeze)
+        rdpq_tracking.cycle_type_known = cycle_type;
+    else
+        rdpq_tracking.cycle_type_frozen = cycle_type;
+}
 
 /* Extern inline instantiations. */
 extern inline void rdpq_set_mode_fill(color_t color);
@@ -0,0 +1,328 @@
+/**
+ * @file rdpq_profile.c
+ * @brief RDP Command queue: frame profiler based on RDP hardware counters
+ * @ingroup rdp
+ *
+ * Each sample is a SYNC_FULL whose callback reads the RDP counters, so that
+ * the counters are read exactly when the RDP reaches that point of the
+ * command stream. Samples are kept in a ring buffer in submission order,
+ * and they are processed (in the same order) by #rdpq_profile_frame, as
+ * soon as their callback has run.
+ *
+ * The counters are 24-bit wide, so they wrap around after about 0.27 seconds
+ * (at 62.5 MHz). Differences are calculated modulo 2^24, so the only
+ * requirement is that a frame is shorter than that.
+ */
+
+#include "rdpq.h"
+#include "rdpq_profile.h"
+#include "rspq.h"
+#include "rdpq_internal.h"
+#include "rdp.h"
+#include "n64sys.h"
+#include "graphics.h"
+#include "debug.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+
+/** @brief Number of samples in the ring buffer */
+#define NUM_SAMPLES         128
+
+/** @brief Mask of the valid bits of the RDP counters */
+#define COUNTER_MASK        0xFFFFFF
+
+/** @brief Index of the values tracked for each section */
+enum {
+    VAL_CLOCK,              ///< RDP clock counter
+    VAL_BUSY,               ///< RDP busy counter
+    VAL_PIPE_BUSY,          ///< RDP pipe busy counter
+    VAL_TMEM_BUSY,          ///< RDP TMEM busy counter
+    VAL_CPU,                ///< CPU ticks
+    NUM_VALS
+};
+
+/** @brief A sample of the counters, taken when the RDP reaches a SYNC_FULL */
+typedef struct {
+    int8_t section;             ///< Section index (0 = frame)
+    bool begin;                 ///< True if this begins a section, false if it ends it
+    volatile bool done;         ///< True when the counters were read by the callback
+    uint32_t vals[NUM_VALS];    ///< Sampled values
+} sample_t;
+
+/** @brief Statistics accumulated for a section */
+typedef struct {
+    const char *name;           ///< Name of the section
+    bool run;                   ///< True if the section was run in the current frame
+    int frames;                 ///< Number of frames in which the section was run
+    uint32_t cur[NUM_VALS];     ///< Values accumulated in the current frame
+    uint32_t min[NUM_VALS];     ///< Minimum values per frame
+    uint32_t max[NUM_VALS];     ///< Maximum values per frame
+    uint64_t sum[NUM_VALS];     ///< Sum of the values of all frames
+} section_t;
+
+/** @brief State of the profiler */
+static struct {
+    bool active;                ///< True if profiling is active
+    int num_frames;             ///< Number of frames in each accumulation period
+    int frame_count;            ///< Number of frames accumulated in the current period
+
+    sample_t samples[NUM_SAMPLES];  ///< Ring buffer of samples
+    int head;                   ///< Next sample to write
+    int tail;                   ///< Next sample to process
+
+    section_t sections[RDPQ_PROFILE_MAX_SECTIONS+1];    ///< Sections (0 = frame)
+    int num_sections;           ///< Number of sections (including the frame)
+    int open[RDPQ_PROFILE_MAX_SECTIONS];                ///< Stack of begun sections (submission)
+    int num_open;               ///< Depth of the stack of begun sections
+    uint32_t begin_vals[RDPQ_PROFILE_MAX_SECTIONS][NUM_VALS];  ///< Values at the beginning of open sections (processing)
+    int num_begin;              ///< Depth of the stack of values
+    bool has_frame;             ///< True if a frame boundary was processed
+    uint32_t frame_vals[NUM_VALS];  ///< Values at the last frame boundary
+
+    rdpq_profile_stats_t stats[RDPQ_PROFILE_MAX_SECTIONS+1];  ///< Published statistics
+    int num_stats;              ///< Number of published entries
+} prof;
+
+/** @brief SYNC_FULL callback: read the RDP counters (called under interrupt) */
+static void sample_cb(void *arg)
+{
+    sample_t *s = arg;
+    s->vals[VAL_CLOCK] = *DP_CLOCK;
+    s->vals[VAL_BUSY] = *DP_BUSY;
+    s->vals[VAL_PIPE_BUSY] = *DP_PIPE_BUSY;
+    s->vals[VAL_TMEM_BUSY] = *DP_TMEM_BUSY;
+    s->done = true;
+}
+
+/** @brief Calculate the difference between two samples */
+static void sample_diff(const uint32_t *from, const uint32_t *to, uint32_t *diff)
+{
+    for (int i=0; i<VAL_CPU; i++)
+        diff[i] = (to[i] - from[i]) & COUNTER_MASK;
+    diff[VAL_CPU] = TICKS_DISTANCE(from[VAL_CPU], to[VAL_CPU]);
+}
+
+/** @brief Reset the accumulated statistics */
+static void stats_reset(void)
+{
+    for (int i=0; i<prof.num_sections; i++) {
+        section_t *sec = &prof.sections[i];
+        sec->frames = 0;
+        sec->run = false;
+        memset(sec->cur, 0, sizeof(sec->cur));
+        memset(sec->sum, 0, sizeof(sec->sum));
+        memset(sec->max, 0, sizeof(sec->max));
+        memset(sec->min, 0xFF, sizeof(sec->min));
+    }
+    prof.frame_count = 0;
+}
+
+/** @brief Publish the statistics of the current period */
+static void stats_publish(void)
+{
+    prof.num_stats = 0;
+    for (int i=0; i<prof.num_sections; i++) {
+        section_t *sec = &prof.sections[i];
+        if (!sec->frames) continue;
+        rdpq_profile_stats_t *st = &prof.stats[prof.num_stats++];
+        rdpq_profile_value_t *vals[NUM_VALS] = { &st->clock, &st->busy, &st->pipe_busy, &st->tmem_busy, &st->cpu };
+        st->name = sec->name;
+        st->frames = sec->frames;
+        for (int j=0; j<NUM_VALS; j++) {
+            vals[j]->min = sec->min[j];
+            vals[j]->max = sec->max[j];
+            vals[j]->avg = sec->sum[j] / sec->frames;
+        }
+    }
+}
+
+/** @brief Account a frame boundary */
+static void process_frame(const sample_t *s)
+{
+    if (prof.has_frame) {
+        sample_diff(prof.frame_vals, s->vals, prof.sections[0].cur);
+        prof.sections[0].run = true;
+
+        for (int i=0; i<prof.num_sections; i++) {
+            section_t *sec = &prof.sections[i];
+            if (!sec->run) continue;
+            for (int j=0; j<NUM_VALS; j++) {
+                sec->min[j] = MIN(sec->min[j], sec->cur[j]);
+                sec->max[j] = MAX(sec->max[j], sec->cur[j]);
+                sec->sum[j] += sec->cur[j];
+            }
+            sec->frames++;
+            sec->run = false;
+            memset(sec->cur, 0, sizeof(sec->cur));
+        }
+
+        if (++prof.frame_count == prof.num_frames) {
+            stats_publish();
+            stats_reset();
+        }
+    }
+    memcpy(prof.frame_vals, s->vals, sizeof(prof.frame_vals));
+    prof.has_frame = true;
+}
+
+/** @brief Process all the samples whose counters were read, in order */
+static void process_samples(void)
+{
+    while (prof.tail != prof.head && prof.samples[prof.tail].done) {
+        sample_t *s = &prof.samples[prof.tail];
+        if (s->section == 0) {
+            process_frame(s);
+        } else if (s->begin) {
+            memcpy(prof.begin_vals[prof.num_begin++], s->vals, sizeof(s->vals));
+        } else {
+            section_t *sec = &prof.sections[(int)s->section];
+            uint32_t diff[NUM_VALS];
+            sample_diff(prof.begin_vals[--prof.num_begin], s->vals, diff);
+            diff[VAL_CPU] = 0;
+            for (int j=0; j<NUM_VALS; j++)
+                sec->cur[j] += diff[j];
+            sec->run = true;
+        }
+        prof.tail = (prof.tail + 1) % NUM_SAMPLES;
+    }
+}
+
+/** @brief Schedule a new sample */
+static void add_sample(int section, bool begin)
+{
+    int next = (prof.head + 1) % NUM_SAMPLES;
+    if (next == prof.tail) {
+        // The ring buffer is full: wait for the oldest sample to be done
+        process_samples();
+        if (next == prof.tail) {
+            rspq_flush();
+            while (!prof.samples[prof.tail].done) {}
+            process_samples();
+        }
+    }
+
+    sample_t *s = &prof.samples[prof.head];
+    s->section = section;
+    s->begin = begin;
+    s->done = false;
+    s->vals[VAL_CPU] = TICKS_READ();
+    prof.head = next;
+    __rdpq_sync_full_sample(sample_cb, s);
+}
+
+void rdpq_profile_start(int num_frames)
+{
+    assertf(num_frames > 0, "invalid number of frames: %d", num_frames);
+
+    // Make sure that no callback of a previous session is pending
+    rspq_wait();
+    memset(&prof, 0, sizeof(prof));
+    prof.sections[0].name = "frame";
+    prof.num_sections = 1;
+    prof.num_frames = num_frames;
+    prof.active = true;
+    stats_reset();
+}
+
+void rdpq_profile_stop(void)
+{
+    if (!prof.active) return;
+    rspq_wait();
+    prof.active = false;
+}
+
+void rdpq_profile_frame(void)
+{
+    if (!prof.active) return;
+    assertf(prof.num_open == 0, "rdpq_profile_begin(\"%s\") without rdpq_profile_end",
+        prof.sections[prof.open[prof.num_open-1]].name);
+    add_sample(0, false);
+    process_samples();
+}
+
+void rdpq_profile_begin(const char *name)
+{
+    if (!prof.active) return;
+    assertf(!rspq_in_block(), "rdpq_profile_begin cannot be called in a block");
+    assertf(prof.num_open < RDPQ_PROFILE_MAX_SECTIONS, "too many nested profile sections");
+
+    int idx;
+    for (idx=1; idx<prof.num_sections; idx++)
+        if (prof.sections[idx].name == name || !strcmp(prof.sections[idx].name, name))
+            break;
+    if (idx == prof.num_sections) {
+        assertf(prof.num_sections <= RDPQ_PROFILE_MAX_SECTIONS, "too many profile sections (max: %d)", RDPQ_PROFILE_MAX_SECTIONS);
+        section_t *sec = &prof.sections[prof.num_sections++];
+        memset(sec, 0, sizeof(*sec));
+        memset(sec->min, 0xFF, sizeof(sec->min));
+        sec->name = name;
+    }
+
+    prof.open[prof.num_open++] = idx;
+    add_sample(idx, true);
+}
+
+void rdpq_profile_end(void)
+{
+    if (!prof.active) return;
+    assertf(!rspq_in_block(), "rdpq_profile_end cannot be called in a block");
+    assertf(prof.num_open > 0, "rdpq_profile_end without rdpq_profile_begin");
+    add_sample(prof.open[--prof.num_open], false);
+}
+
+int rdpq_profile_get_stats(rdpq_profile_stats_t *stats, int max)
+{
+    int n = MIN(max, prof.num_stats);
+    memcpy(stats, prof.stats, n * sizeof(rdpq_profile_stats_t));
+    return n;
+}
+
+/** @brief Convert RDP clock cycles to microseconds */
+static uint32_t rdp_cycles_to_us(uint32_t cycles)
+{
+    return (uint64_t)cycles * 1000000 / RCP_FREQUENCY;
+}
+
+/** @brief Percentage of a counter relative to the clock */
+static int percent(uint32_t val, uint32_t clock)
+{
+    return clock ? (uint64_t)val * 100 / clock : 0;
+}
+
+void rdpq_profile_dump(void)
+{
+    debugf("RDP profile (%d frames):\n", prof.num_frames);
+    for (int i=0; i<prof.num_stats; i++) {
+        rdpq_profile_stats_t *st = &prof.stats[i];
+        debugf("  %-12s rdp:%6lu/%6lu/%6lu us  busy:%3d%%  pipe:%3d%%  tmem:%3d%%",
+            st->name,
+            rdp_cycles_to_us(st->clock.min), rdp_cycles_to_us(st->clock.avg), rdp_cycles_to_us(st->clock.max),
+            percent(st->busy.avg, st->clock.avg), percent(st->pipe_busy.avg, st->clock.avg),
+            percent(st->tmem_busy.avg, st->clock.avg));
+        if (i == 0)
+            debugf("  cpu:%6lu/%6lu/%6lu us", TICKS_TO_US(st->cpu.min), TICKS_TO_US(st->cpu.avg), TICKS_TO_US(st->cpu.max));
+        debugf("\n");
+    }
+}
+
+void rdpq_profile_draw(surface_t *surf, int x, int y)
+{
+    char buf[64];
+
+    graphics_set_color(graphics_convert_color(RGBA32(255,255,255,255)), graphics_convert_color(RGBA32(0,0,0,255)));
+    graphics_draw_text(surf, x, y, "section    ms rdp% pip% tmm%");
+    for (int i=0; i<prof.num_stats; i++) {
+        rdpq_profile_stats_t *st = &prof.stats[i];
+        uint32_t us = rdp_cycles_to_us(st->clock.avg);
+        snprintf(buf, sizeof(buf), "%-8.8s %2lu.%lu %4d %4d %4d", st->name, us / 1000, (us / 100) % 10,
+            percent(st->busy.avg, st->clock.avg), percent(st->pipe_busy.avg, st->clock.avg),
+            percent(st->tmem_busy.avg, st->clock.avg));
+        graphics_draw_text(surf, x, y + (i+1) * 8, buf);
+    }
+    if (prof.num_stats) {
+        uint32_t us = TICKS_TO_US(prof.stats[0].cpu.avg);
+        snprintf(buf, sizeof(buf), "cpu      %2lu.%lu", us / 1000, (us / 100) % 10);
+        graphics_draw_text(surf, x, y + (prof.num_stats+1) * 8, buf);
+    }
+}
@@ -7,6 +7,8 @@
 
 #include "rdpq_rect.h"
 #include "rdpq_internal.h"
+#include "n64sys.h"
+#include "utils.h"
 
 // The fixup for fill rectangle and texture rectangle uses the exact same code in IMEM.
 // It needs to also adjust the command ID with the same constant (via XOR), so make
@@ -43,7 +45,7 @@ void __rdpq_texture_rectangle(uint32_t w0, uint32_t w1, uint32_t w2, uint32_t w3
     int tile = (w1 >> 24) & 7;
     // FIXME: this can also use tile+1 in case the combiner refers to TEX1
     // FIXME: this can also use tile+2 and +3 in case SOM activates texture detail / sharpen
-    __rdpq_autosync_use(AUTOSYNC_PIPE | AUTOSYNC_TILE(tile) | AUTOSYNC_TMEM(0));
+    __rdpq_autosync_use(__rdpq_autosync_tmem_use(AUTOSYNC_PIPE | AUTOSYNC_TILE(tile) | AUTOSYNC_TMEM(0), tile));
     if (rdpq_tracking.cycle_type_known) {
         if (rdpq_tracking.cycle_type_known == 2) {
             w0 -= (4<<12) | 4;
@@ -64,6 +66,49 @@ void __rdpq_texture_rectangle_scaled_offline(rdpq_tile_t tile, int32_t x0, int32
     __rdpq_texture_rectangle_scaled_inline(tile, x0, y0, x1, y1, s0, t0, s1, t1);
 }
 
+/** @brief Enqueue the RSP commands to draw a batch of rectangles */
+static void __rdpq_rect_batch(uint32_t flags, int rdp_words, const rdpq_rect_item_t *rects, int num_rects, uint32_t offset)
+{
+    assertf(((uint32_t)rects & 7) == 0, "rectangle batch must be 8-byte aligned: %p", rects);
+    if (num_rects <= 0) return;
+    data_cache_hit_writeback(rects, num_rects * sizeof(rdpq_rect_item_t));
+
+    while (num_rects > 0) {
+        // The number of records is encoded in 16 bits in the command
+        int n = MIN(num_rects, 0xFFFF);
+        rdpq_write(n * rdp_words, RDPQ_OVL_ID, RDPQ_CMD_RECT_BATCH, flags | n, PhysicalAddr(rects), offset);
+        rects += n;
+        num_rects -= n;
+    }
+}
+
+void rdpq_fill_rectangle_batch(const rdpq_rect_item_t *rects, int num_rects, bool prim_color)
+{
+    __rdpq_autosync_use(AUTOSYNC_PIPE);
+    __rdpq_rect_batch(prim_color ? (1<<20) : 0, prim_color ? 2 : 1, rects, num_rects, 0);
+}
+
+void rdpq_texture_rectangle_batch(rdpq_tile_t tile, const rdpq_rect_item_t *rects, int num_rects, bool prim_color)
+{
+    __rdpq_texture_rectangle_batch_offset(tile, rects, num_rects, prim_color, 0, 0);
+}
+
+/**
+ * @brief Like #rdpq_texture_rectangle_batch, but moving all the rectangles by an offset
+ * 
+ * The offset is applied by the RSP, so the same array of rectangles can be drawn
+ * at different positions without modifying it (eg: to scroll a tilemap).
+ * 
+ * @param dx        X offset (10.2 fixed point)
+ * @param dy        Y offset (10.2 fixed point)
+ */
+void __rdpq_texture_rectangle_batch_offset(int tile, const struct rdpq_rect_item_s *rects, int num_rects, bool prim_color, int16_t dx, int16_t dy)
+{
+    __rdpq_autosync_use(__rdpq_autosync_tmem_use(AUTOSYNC_PIPE | AUTOSYNC_TILE(tile) | AUTOSYNC_TMEM(0), tile));
+    __rdpq_rect_batch((prim_color ? (1<<20) : 0) | (1<<19) | ((tile & 7) << 16), prim_color ? 3 : 2, rects, num_rects,
+        ((uint16_t)dx << 16) | (uint16_t)dy);
+}
+
 extern inline void __rdpq_fill_rectangle_inline(int32_t x0, int32_t y0, int32_t x1, int32_t y1);
 extern inline void __rdpq_fill_rectangle_fx(int32_t x0, int32_t y0, int32_t x1, int32_t y1);
 extern inline void __rdpq_texture_rectangle_fx(rdpq_tile_t tile, int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t s, int32_t t);
@@ -10,6 +10,8 @@
 #include "rdpq_sprite_internal.h"
 #include "rdpq_mode.h"
 #include "rdpq_tex.h"
+#include "rdpq_tex_internal.h"
+#include "rdpq_internal.h"
 #include "sprite.h"
 #include "sprite_internal.h"
 
@@ -25,10 +27,10 @@ static void sprite_upload_palette(sprite_t *sprite, int palidx, bool set_mode)
     }
 
     if (tlut_mode != TLUT_NONE) {
-        // Load the palette (if any). We account for sprites being CI4
-        // but without embedded palette: mksprite doesn't create sprites like
-        // this today, but it could in the future (eg: sharing a palette across
-        // multiple sprites).
+        // Load the palette (if any). Sprites using a shared palette point to
+        // the same colors, so the load is skipped while the palette is still
+        // resident in TMEM. If no shared palette was set on the sprite,
+        // the user is expected to load the palette manually.
         uint16_t *pal = sprite_get_palette(sprite);
         if (pal) rdpq_tex_upload_tlut(pal, palidx*16, fmt == FMT_CI4 ? 16 : 256);
     }
@@ -137,3 +139,62 @@ void rdpq_sprite_blit(sprite_t *sprite, float x0, float y0, const rdpq_blitparms
     surface_t surf = sprite_get_pixels(sprite);
     rdpq_tex_blit(&surf, x0, y0, parms);
 }
+
+/** @brief Atlas page loaded in TMEM by the last #rdpq_sprite_atlas_blit */
+static struct {
+    const void *buffer;             ///< Pixels of the page (NULL: none)
+    int tmem_bytes;                 ///< Number of bytes occupied in TMEM (in each half, for RGBA32)
+    uint32_t stamp;                 ///< TMEM stamp after the page was loaded
+} atlas_resident;
+
+/** 
+ * @brief Implement large_tex_draw protocol for atlas pages
+ * 
+ * Atlas pages always fit TMEM, so the whole page is uploaded rather than just
+ * the rectangle being drawn, and it is remembered as resident. When other
+ * images of the same page are blitted, only the tile is configured, as long
+ * as the page was not overwritten in TMEM in the meantime.
+ */
+static void ltd_atlas_page(rdpq_tile_t tile, const surface_t *tex, int s0, int t0, int s1, int t1, 
+    void (*draw_cb)(rdpq_tile_t tile, int s0, int t0, int s1, int t1), bool filtering)
+{
+    // Within blocks, we can't know the TMEM contents at playback time.
+    bool track = !rspq_in_block();
+    bool split = surface_get_format(tex) == FMT_RGBA32;
+    if (track && atlas_resident.buffer == tex->buffer &&
+        __rdpq_tmem_resident(0, atlas_resident.tmem_bytes, atlas_resident.stamp) &&
+        (!split || __rdpq_tmem_resident(2048, atlas_resident.tmem_bytes, atlas_resident.stamp))) {
+        __rdpq_tex_settile(tile, tex);
+    } else {
+        atlas_resident.tmem_bytes = rdpq_tex_upload(tile, tex, NULL);
+        atlas_resident.buffer = track ? tex->buffer : NULL;
+        atlas_resident.stamp = __rdpq_tmem_stamp();
+    }
+    draw_cb(tile, s0, t0, s1, t1);
+}
+
+void __rdpq_sprite_atlas_forget(void)
+{
+    atlas_resident.buffer = NULL;
+}
+
+void rdpq_sprite_atlas_blit(sprite_atlas_t *atlas, const char *name, float x0, float y0, const rdpq_blitparms_t *parms)
+{
+    int idx = sprite_atlas_find(atlas, name);
+    assertf(idx >= 0, "image not found in sprite atlas: %s", name);
+    int s0, t0, width, height;
+    sprite_t *page = sprite_atlas_get(atlas, idx, &s0, &t0, &width, &height);
+
+    // Upload the palette and configure the render mode
+    sprite_upload_palette(page, 0, true);
+
+    // Convert the source rectangle from image to page coordinates
+    rdpq_blitparms_t page_parms = parms ? *parms : (rdpq_blitparms_t){0};
+    if (!page_parms.width) page_parms.width = width - page_parms.s0;
+    if (!page_parms.height) page_parms.height = height - page_parms.t0;
+    page_parms.s0 += s0;
+    page_parms.t0 += t0;
+
+    surface_t surf = sprite_get_pixels(page);
+    __rdpq_tex_blit(&surf, x0, y0, &page_parms, ltd_atlas_page);
+}
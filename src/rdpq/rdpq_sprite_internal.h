@@ -9,4 +9,7 @@ typedef struct rdpq_texparms_s rdpq_texparms_t;
 
 int __rdpq_sprite_upload(rdpq_tile_t tile, sprite_t *sprite, const rdpq_texparms_t *parms, bool set_mode);
 
+/** @brief Forget the atlas page tracked as resident in TMEM (its memory is about to be freed) */
+void __rdpq_sprite_atlas_forget(void);
+
 #endif
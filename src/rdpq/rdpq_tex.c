@@ -12,6 +12,9 @@
 #include "rdpq_rect.h"
 #include "rdpq_tex.h"
 #include "rdpq_tex_internal.h"
+#include "rdpq_internal.h"
+#include "rdpq_attach.h"
+#include "rdpq_mode.h"
 #include "utils.h"
 #include <math.h>
 
@@ -28,6 +31,56 @@ tex_loader_t last_tload;
 /** @brief Address in TMEM where the palettes must be loaded */
 #define TMEM_PALETTE_ADDR   0x800
 
+/** @brief Number of entries in the TMEM residency cache */
+#define TEX_CACHE_SIZE      8
+
+/** 
+ * @brief An entry of the TMEM residency cache.
+ * 
+ * Each entry remembers a rectangle of a surface that was uploaded to TMEM
+ * by #rdpq_tex_upload_sub. The entry is valid as long as the TMEM portions
+ * it occupies were not written after the upload (see #__rdpq_tmem_unchanged).
+ */
+typedef struct {
+    const void *buffer;     ///< Pixel buffer of the surface (NULL: free entry)
+    uint16_t stride;        ///< Stride of the surface
+    uint8_t fmt;            ///< Format of the surface
+    int16_t s0, t0, s1, t1; ///< Rectangle of the surface that was loaded
+    int16_t tmem_addr;      ///< TMEM address where the rectangle was loaded
+    int16_t tmem_bytes;     ///< Number of bytes occupied in TMEM (in each half, for split formats)
+    bool tmem_split;        ///< True if the texture is split across the two halves of TMEM
+    uint32_t stamp;         ///< TMEM stamp after the upload
+} tex_cache_entry_t;
+
+/** @brief TMEM residency cache */
+static tex_cache_entry_t tex_cache[TEX_CACHE_SIZE];
+/** @brief Next entry of the TMEM residency cache to replace */
+static int tex_cache_next;
+/** @brief Number of uploads skipped by the TMEM residency cache (see #__rdpq_tex_cache_hits) */
+static uint32_t tex_cache_hits;
+
+/** @brief Number of entries in the TMEM residency cache for palettes */
+#define TLUT_CACHE_SIZE     4
+
+/** 
+ * @brief An entry of the TMEM residency cache for palettes.
+ * 
+ * Each entry remembers a range of colors uploaded by #rdpq_tex_upload_tlut.
+ * Like #tex_cache_entry_t, it is valid as long as the TMEM portion was not
+ * written after the upload.
+ */
+typedef struct {
+    const uint16_t *tlut;   ///< Palette that was loaded (NULL: free entry)
+    uint16_t color_idx;     ///< Index of the first color entry in TMEM
+    uint16_t num_colors;    ///< Number of color entries
+    uint32_t stamp;         ///< TMEM stamp after the upload
+} tlut_cache_entry_t;
+
+/** @brief TMEM residency cache for palettes */
+static tlut_cache_entry_t tlut_cache[TLUT_CACHE_SIZE];
+/** @brief Next entry of the palette residency cache to replace */
+static int tlut_cache_next;
+
 /// @brief Calculates the first power of 2 that is equal or larger than size
 /// @param x input in units
 /// @return Power of 2 that is equal or larger than x
@@ -362,19 +415,93 @@ int tex_loader_calc_max_height(tex_loader_t *tload, int width)
 
 ///@endcond
 
+/** @brief Find a TMEM residency cache entry for a rectangle of a surface (NULL if not resident) */
+static tex_cache_entry_t* tex_cache_lookup(const surface_t *tex, int tmem_addr, int s0, int t0, int s1, int t1)
+{
+    for (int i=0; i<TEX_CACHE_SIZE; i++) {
+        tex_cache_entry_t *e = &tex_cache[i];
+        if (e->buffer == tex->buffer && e->stride == tex->stride && e->fmt == surface_get_format(tex) &&
+            e->s0 == s0 && e->t0 == t0 && e->s1 == s1 && e->t1 == t1 && e->tmem_addr == tmem_addr) {
+            if (__rdpq_tmem_unchanged(e->tmem_addr, e->tmem_bytes, e->stamp) &&
+                (!e->tmem_split || __rdpq_tmem_unchanged(e->tmem_addr + 2048, e->tmem_bytes, e->stamp)))
+                return e;
+            e->buffer = NULL;
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+/** @brief Record in the TMEM residency cache a rectangle of a surface that was just uploaded */
+static void tex_cache_insert(const surface_t *tex, int tmem_addr, int s0, int t0, int s1, int t1, int nbytes)
+{
+    tex_format_t fmt = surface_get_format(tex);
+    tex_cache[tex_cache_next] = (tex_cache_entry_t){
+        .buffer = tex->buffer, .stride = tex->stride, .fmt = fmt,
+        .s0 = s0, .t0 = t0, .s1 = s1, .t1 = t1,
+        .tmem_addr = tmem_addr, .tmem_bytes = nbytes,
+        // 32-bit and YUV textures are split across the two halves of TMEM
+        .tmem_split = fmt == FMT_RGBA32 || fmt == FMT_YUV16,
+        .stamp = __rdpq_tmem_stamp(),
+    };
+    tex_cache_next = (tex_cache_next + 1) % TEX_CACHE_SIZE;
+}
+
+/** @brief Configure the tile descriptor for a rectangle that is already loaded in TMEM, without loading it */
+static int tex_loader_settile_resident(tex_loader_t *tload, int s0, int t0, int s1, int t1)
+{
+    int nbytes = texload_set_rect(tload, s0, t0, s1, t1);
+    if (TEX_FORMAT_BITDEPTH(surface_get_format(tload->tex)) == 4) {
+        s0 &= ~1; s1 = (s1+1) & ~1;
+    }
+    texload_settile(tload, s0, t0, s1, t1);
+    // The loading configuration was not emitted, so force it on next load
+    tload->load_mode = TEX_LOAD_UNKNOWN;
+    return nbytes;
+}
+
+/**
+ * @brief Load a rectangle via the texloader, unless it is still resident in TMEM
+ * 
+ * If the same rectangle of the same surface is still resident in TMEM at the
+ * same address, only the tile descriptor is configured.
+ * 
+ * @param tload         Texloader
+ * @param tmem_addr     TMEM address where the rectangle is loaded (-1 if not known on the CPU)
+ * @return Number of bytes used in TMEM
+ */
+static int tex_loader_load_cached(tex_loader_t *tload, int tmem_addr, int s0, int t0, int s1, int t1)
+{
+    // Within blocks, we can't know the TMEM contents at playback time.
+    bool cacheable = !rspq_in_block() && tmem_addr >= 0;
+    if (cacheable && tex_cache_lookup(tload->tex, tmem_addr, s0, t0, s1, t1)) {
+        tex_cache_hits++;
+        return tex_loader_settile_resident(tload, s0, t0, s1, t1);
+    }
+
+    int nbytes = tex_loader_load(tload, s0, t0, s1, t1);
+    if (cacheable) tex_cache_insert(tload->tex, tmem_addr, s0, t0, s1, t1, nbytes);
+    return nbytes;
+}
+
 int rdpq_tex_upload_sub(rdpq_tile_t tile, const surface_t *tex, const rdpq_texparms_t *parms, int s0, int t0, int s1, int t1)
 {
     last_tload = tex_loader_init(tile, tex);
     if (parms) tex_loader_set_texparms(&last_tload, parms);
     
+    // TMEM address where the texture will be loaded. With a multi-texture
+    // upload, this is the current auto-TMEM address, if known.
+    int tmem_addr;
     if (multi_upload.used) {
         assertf(parms == NULL || parms->tmem_addr == 0, "Do not specify a TMEM address while doing a multi-texture upload");
         tex_loader_set_tmem_addr(&last_tload, RDPQ_AUTOTMEM);
+        tmem_addr = __rdpq_autotmem_addr();
     } else {
-        tex_loader_set_tmem_addr(&last_tload, parms ? parms->tmem_addr : 0);
+        tmem_addr = parms ? parms->tmem_addr : 0;
+        tex_loader_set_tmem_addr(&last_tload, tmem_addr);
     }
 
-    int nbytes = tex_loader_load(&last_tload, s0, t0, s1, t1);
+    int nbytes = tex_loader_load_cached(&last_tload, tmem_addr, s0, t0, s1, t1);
 
     if (multi_upload.used) {
         rdpq_set_tile_autotmem(nbytes);
@@ -400,6 +527,12 @@ int rdpq_tex_upload(rdpq_tile_t tile, const surface_t *tex, const rdpq_texparms_
     return rdpq_tex_upload_sub(tile, tex, parms, 0, 0, tex->width, tex->height);
 }
 
+int __rdpq_tex_settile(rdpq_tile_t tile, const surface_t *tex)
+{
+    tex_loader_t tload = tex_loader_init(tile, tex);
+    return tex_loader_settile_resident(&tload, 0, 0, tex->width, tex->height);
+}
+
 int rdpq_tex_reuse_sub(rdpq_tile_t tile, const rdpq_texparms_t *parms, int s0, int t0, int s1, int t1)
 {
     assertf(multi_upload.used, "Reusing existing texture needs to be done through multi-texture upload");
@@ -472,8 +605,9 @@ static void ltd_texloader(rdpq_tile_t tile, const surface_t *tex, int s0, int t0
         int tm = filtering ? MAX(t0 - 1, 0) : t0;
         int tn = MIN(tm + tile_h, t1);
 
-        // Load the current strip
-        tex_loader_load(&tload, s0, tm, s1, tn);
+        // Load the current strip (unless it is still in TMEM, eg: when
+        // blitting the same small texture multiple times in a row)
+        tex_loader_load_cached(&tload, tload.tmem_addr, s0, tm, s1, tn);
 
         // Call the draw callback for this strip
         int tx = (!filtering || tn == t1) ? tn : tn - 1;
@@ -501,8 +635,8 @@ static void tex_xblit_norotate_noscale(const surface_t *surf, float x0, float y0
     {
         int ks0 = s0, kt0 = t0, ks1 = s1, kt1 = t1;
 
-        if (flip_x) { ks0 = src_width - s0 - 1;  ks1 = src_width - s1 - 1; }
-        if (flip_y) { kt0 = src_height - t0 - 1; kt1 = src_height - t1 - 1; }
+        if (flip_x) { ks0 = 2*parms->s0 + src_width - s0 - 1;  ks1 = 2*parms->s0 + src_width - s1 - 1; }
+        if (flip_y) { kt0 = 2*parms->t0 + src_height - t0 - 1; kt1 = 2*parms->t0 + src_height - t1 - 1; }
 
         rdpq_texture_rectangle(tile, x0 + ks0 - cx, y0 + kt0 - cy, x0 + ks1 - cx, y0 + kt1 - cy, s0, t0);
     }
@@ -536,8 +670,8 @@ static void tex_xblit_norotate(const surface_t *surf, float x0, float y0, const
     {
         int ks0 = s0, kt0 = t0, ks1 = s1, kt1 = t1;
 
-        if (flip_x) { ks0 = src_width - s0 - 1;  ks1 = src_width - s1 - 1;  }
-        if (flip_y) { kt0 = src_height - t0 - 1; kt1 = src_height - t1 - 1; }
+        if (flip_x) { ks0 = 2*parms->s0 + src_width - s0 - 1;  ks1 = 2*parms->s0 + src_width - s1 - 1;  }
+        if (flip_y) { kt0 = 2*parms->t0 + src_height - t0 - 1; kt1 = 2*parms->t0 + src_height - t1 - 1; }
 
         float k0x = mtx[0][0] * ks0 + mtx[1][0] * kt0 + mtx[2][0];
         float k0y = mtx[0][1] * ks0 + mtx[1][1] * kt0 + mtx[2][1];
@@ -579,8 +713,8 @@ static void tex_xblit(const surface_t *surf, float x0, float y0, const rdpq_blit
     {
         int ks0 = s0, kt0 = t0, ks1 = s1, kt1 = t1;
 
-        if (parms->flip_x) { ks0 = src_width - ks0; ks1 = src_width - ks1; }
-        if (parms->flip_y) { kt0 = src_height - kt0; kt1 = src_height - kt1; }
+        if (parms->flip_x) { ks0 = 2*parms->s0 + src_width - ks0; ks1 = 2*parms->s0 + src_width - ks1; }
+        if (parms->flip_y) { kt0 = 2*parms->t0 + src_height - kt0; kt1 = 2*parms->t0 + src_height - kt1; }
 
         float k0x = mtx[0][0] * ks0 + mtx[1][0] * kt0 + mtx[2][0];
         float k0y = mtx[0][1] * ks0 + mtx[1][1] * kt0 + mtx[2][1];
@@ -602,8 +736,8 @@ static void tex_xblit(const surface_t *surf, float x0, float y0, const rdpq_blit
     void draw_cb_multi_rot(rdpq_tile_t tile, int s0, int t0, int s1, int t1)
     {
         int ks0 = s0, kt0 = t0, ks1 = s1, kt1 = t1;
-        if (parms->flip_x) { ks0 = src_width - ks0; ks1 = src_width - ks1; }
-        if (parms->flip_y) { kt0 = src_height - kt0; kt1 = src_height - kt1; }
+        if (parms->flip_x) { ks0 = 2*parms->s0 + src_width - ks0; ks1 = 2*parms->s0 + src_width - ks1; }
+        if (parms->flip_y) { kt0 = 2*parms->t0 + src_height - kt0; kt1 = 2*parms->t0 + src_height - kt1; }
 
         assert(s1-s0 == src_width);
 
@@ -647,6 +781,11 @@ static void tex_xblit(const surface_t *surf, float x0, float y0, const rdpq_blit
     }
 }
 
+uint32_t __rdpq_tex_cache_hits(void)
+{
+    return tex_cache_hits;
+}
+
 /** @brief Internal implementation of #rdpq_tex_blit, using a custom large tex loader callback function */
 void __rdpq_tex_blit(const surface_t *surf, float x0, float y0, const rdpq_blitparms_t *parms, large_tex_draw ltd)
 {
@@ -669,15 +808,66 @@ void rdpq_tex_blit(const surface_t *surf, float x0, float y0, const rdpq_blitpar
     __rdpq_tex_blit(surf, x0, y0, parms, ltd_texloader);
 }
 
+void rdpq_tex_convert(surface_t *dst, const surface_t *src)
+{
+    tex_format_t dfmt = surface_get_format(dst);
+    tex_format_t sfmt = surface_get_format(src);
+    assertf(dst->width == src->width && dst->height == src->height,
+        "surfaces must have the same size: %dx%d vs %dx%d",
+        dst->width, dst->height, src->width, src->height);
+    assertf(dfmt == FMT_RGBA16 || dfmt == FMT_RGBA32,
+        "cannot convert to %s with the RDP", tex_format_name(dfmt));
+    assertf(sfmt != FMT_CI4 && sfmt != FMT_CI8 && sfmt != FMT_YUV16,
+        "cannot convert from %s with the RDP", tex_format_name(sfmt));
+
+    // Draw the source as a texture onto the destination. The standard mode
+    // passes the texels through the combiner, and the RDP itself converts
+    // them to the framebuffer format (truncating, as dithering is disabled).
+    rdpq_attach(dst, NULL);
+    rdpq_mode_push();
+        rdpq_set_mode_standard();
+        rdpq_tex_blit(src, 0, 0, NULL);
+    rdpq_mode_pop();
+    rdpq_detach();
+}
+
 void rdpq_tex_upload_tlut(uint16_t *tlut, int color_idx, int num_colors)
 {
     // TODO: this is a conservative limit. It should be possible to workaround
     // this limit by playing with the tlut pointer passed to SET_TEX_IMAGE and
     // then adjust the first_color offset in rdpq_load_tlut_raw.
     assertf((PhysicalAddr(tlut) & 7) == 0, "TLUT pointer must be 8-byte aligned");
+
+    // Skip the load if the same colors are still resident in TMEM. Each color
+    // is replicated 4 times in TMEM, so it takes 8 bytes. Like for textures,
+    // this requires RDPQ_CFG_TEXCACHE (or a residency scope): otherwise,
+    // __rdpq_tmem_unchanged always fails, as the palette might have been
+    // modified by the CPU since it was loaded.
+    int tmem_addr = TMEM_PALETTE_ADDR + color_idx*4*2;
+    bool cacheable = !rspq_in_block();
+    if (cacheable) {
+        for (int i=0; i<TLUT_CACHE_SIZE; i++) {
+            tlut_cache_entry_t *e = &tlut_cache[i];
+            if (e->tlut == tlut && e->color_idx == color_idx && e->num_colors == num_colors) {
+                if (__rdpq_tmem_unchanged(tmem_addr, num_colors*8, e->stamp))
+                    return;
+                e->tlut = NULL;
+                break;
+            }
+        }
+    }
+
     rdpq_set_texture_image_raw(0, PhysicalAddr(tlut), FMT_RGBA16, 256, 1);
-    rdpq_set_tile(RDPQ_TILE_INTERNAL, FMT_I4, TMEM_PALETTE_ADDR + color_idx*4*2, 256, NULL);
+    rdpq_set_tile(RDPQ_TILE_INTERNAL, FMT_I4, tmem_addr, 256, NULL);
     rdpq_load_tlut_raw(RDPQ_TILE_INTERNAL, 0, num_colors);
+
+    if (cacheable) {
+        tlut_cache[tlut_cache_next] = (tlut_cache_entry_t){
+            .tlut = tlut, .color_idx = color_idx, .num_colors = num_colors,
+            .stamp = __rdpq_tmem_stamp(),
+        };
+        tlut_cache_next = (tlut_cache_next + 1) % TLUT_CACHE_SIZE;
+    }
 }
 
 void rdpq_tex_multi_begin(void)
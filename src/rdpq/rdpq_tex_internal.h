@@ -29,4 +29,25 @@ typedef void (*large_tex_draw)(rdpq_tile_t tile, const surface_t *tex, int s0, i
 
 void __rdpq_tex_blit(const surface_t *surf, float x0, float y0, const rdpq_blitparms_t *parms, large_tex_draw ltd);
 
+/**
+ * @brief Configure a tile descriptor for a surface that is already loaded in TMEM
+ * 
+ * This emits the same tile configuration as #rdpq_tex_upload with default
+ * parameters (TMEM address 0), but without loading the surface. It is used
+ * by callers that track on their own whether a surface is still resident.
+ * 
+ * @param tile          Tile descriptor to configure
+ * @param tex           Surface previously uploaded with #rdpq_tex_upload
+ * @return Number of bytes used in TMEM
+ */
+int __rdpq_tex_settile(rdpq_tile_t tile, const surface_t *tex);
+
+/**
+ * @brief Return the number of texture uploads skipped so far because the texture was resident in TMEM
+ * 
+ * The counter is never reset: compare two readings to count the uploads
+ * skipped by a sequence of draws.
+ */
+uint32_t __rdpq_tex_cache_hits(void);
+
 #endif
@@ -0,0 +1,304 @@
+/**
+ * @file rdpq_tilemap.c
+ * @brief RDP Command queue: tile layer renderer
+ * @ingroup rdp
+ */
+
+#include "rspq.h"
+#include "rdpq.h"
+#include "rdpq_tilemap.h"
+#include "rdpq_mode.h"
+#include "rdpq_rect.h"
+#include "rdpq_tex.h"
+#include "sprite.h"
+#include "rdpq_internal.h"
+#include "utils.h"
+#include "debug.h"
+#include <math.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** @brief Maximum number of TMEM chunks a tileset can be split into */
+#define TILEMAP_MAX_CHUNKS      64
+
+/** @brief A range of the list of visible tiles, referring to the same tileset chunk */
+typedef struct {
+    uint16_t chunk;                 ///< Index of the chunk
+    uint16_t start;                 ///< Index of the first rectangle in the list
+    uint16_t count;                 ///< Number of rectangles
+} tilemap_range_t;
+
+/** @brief A list of visible tiles, grouped by chunk */
+typedef struct {
+    rdpq_rect_item_t *rects;        ///< Rectangles to draw (one per visible tile)
+    tilemap_range_t *ranges;        ///< Ranges of rectangles using the same chunk
+    int num_ranges;                 ///< Number of ranges
+    int num_rects;                  ///< Number of rectangles
+    rspq_syncpoint_t sync;          ///< Syncpoint after the last draw that used this list
+    bool pending;                   ///< True if sync refers to a draw that might still be pending
+} tilemap_list_t;
+
+/** @brief Tilemap (see #rdpq_tilemap_new) */
+typedef struct rdpq_tilemap_s {
+    sprite_t *tileset;              ///< Tileset sprite
+    surface_t tex;                  ///< Pixels of the tileset
+    uint16_t *tiles;                ///< Grid of tile indices (not owned)
+    int tile_w, tile_h;             ///< Size of a tile in pixels
+    int map_w, map_h;               ///< Size of the map in tiles
+    int tileset_cols;               ///< Number of tiles per row in the tileset
+    int num_tiles;                  ///< Number of tiles in the tileset
+    int chunk_cols, chunk_rows;     ///< Size of a chunk in tiles
+    int chunks_x;                   ///< Number of chunks per row of the tileset
+    int num_chunks;                 ///< Total number of chunks
+    int vp_x0, vp_y0;               ///< Top-left corner of the viewport
+    int vp_cols, vp_rows;           ///< Maximum number of visible tiles per row/column
+    tilemap_list_t lists[2];        ///< Lists of visible tiles (double buffered)
+    int cur_list;                   ///< Index of the list used by the last draw
+    int origin_x, origin_y;         ///< Cell shown at the top-left corner by the current list
+    bool dirty;                     ///< True if the current list must be rebuilt
+    rdpq_tilemap_stats_t stats;     ///< Statistics
+} rdpq_tilemap_t;
+
+/** @brief Integer division rounding towards negative infinity */
+static inline int floor_div(int a, int b)
+{
+    return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+static void tilemap_list_wait(tilemap_list_t *list)
+{
+    if (list->pending) {
+        rspq_syncpoint_wait(list->sync);
+        list->pending = false;
+    }
+}
+
+static void tilemap_list_free(tilemap_list_t *list)
+{
+    tilemap_list_wait(list);
+    free(list->rects); list->rects = NULL;
+    free(list->ranges); list->ranges = NULL;
+    list->num_rects = list->num_ranges = 0;
+}
+
+rdpq_tilemap_t *rdpq_tilemap_new(sprite_t *tileset, int tile_w, int tile_h, int map_w, int map_h, uint16_t *tiles)
+{
+    assertf(tile_w > 0 && tile_h > 0, "invalid tile size %dx%d", tile_w, tile_h);
+    assertf(map_w > 0 && map_h > 0, "invalid map size %dx%d", map_w, map_h);
+    assertf(tiles, "tiles grid cannot be NULL");
+
+    rdpq_tilemap_t *tm = calloc(1, sizeof(rdpq_tilemap_t));
+    tm->tileset = tileset;
+    tm->tex = sprite_get_pixels(tileset);
+    tm->tiles = tiles;
+    tm->tile_w = tile_w;
+    tm->tile_h = tile_h;
+    tm->map_w = map_w;
+    tm->map_h = map_h;
+
+    tm->tileset_cols = tm->tex.width / tile_w;
+    int tileset_rows = tm->tex.height / tile_h;
+    assertf(tm->tileset_cols > 0 && tileset_rows > 0,
+        "tileset (%dx%d) smaller than a tile (%dx%d)", tm->tex.width, tm->tex.height, tile_w, tile_h);
+    tm->num_tiles = tm->tileset_cols * tileset_rows;
+
+    // Split the tileset into chunks that fit in TMEM. Keep chunks as wide
+    // as possible (whole rows of tiles are loaded more efficiently), and then
+    // put as many rows of tiles as possible in each chunk.
+    tex_loader_t tload = tex_loader_init(TILE0, &tm->tex);
+    int cols = tm->tileset_cols;
+    int max_height = 0;
+    while (cols > 0) {
+        max_height = tex_loader_calc_max_height(&tload, cols * tile_w);
+        if (max_height >= tile_h) break;
+        cols--;
+    }
+    assertf(cols > 0, "tile %dx%d does not fit in TMEM", tile_w, tile_h);
+    tm->chunk_cols = cols;
+    tm->chunk_rows = MIN(max_height / tile_h, tileset_rows);
+    tm->chunks_x = DIVIDE_CEIL(tm->tileset_cols, tm->chunk_cols);
+    tm->num_chunks = tm->chunks_x * DIVIDE_CEIL(tileset_rows, tm->chunk_rows);
+    assertf(tm->num_chunks <= TILEMAP_MAX_CHUNKS, "tileset too large: %d TMEM chunks (max %d)",
+        tm->num_chunks, TILEMAP_MAX_CHUNKS);
+
+    rdpq_tilemap_set_viewport(tm, 0, 0, 320, 240);
+    return tm;
+}
+
+void rdpq_tilemap_free(rdpq_tilemap_t *tm)
+{
+    if (!tm) return;
+    tilemap_list_free(&tm->lists[0]);
+    tilemap_list_free(&tm->lists[1]);
+    free(tm);
+}
+
+void rdpq_tilemap_set_viewport(rdpq_tilemap_t *tm, int x0, int y0, int width, int height)
+{
+    assertf(width > 0 && height > 0, "invalid viewport size %dx%d", width, height);
+    tm->vp_x0 = x0;
+    tm->vp_y0 = y0;
+
+    // With a fractional scroll, a partial tile is visible on both sides
+    int cols = DIVIDE_CEIL(width, tm->tile_w) + 1;
+    int rows = DIVIDE_CEIL(height, tm->tile_h) + 1;
+    if (cols != tm->vp_cols || rows != tm->vp_rows) {
+        tm->vp_cols = cols;
+        tm->vp_rows = rows;
+        for (int i=0; i<2; i++) {
+            tilemap_list_t *list = &tm->lists[i];
+            tilemap_list_free(list);
+            list->rects = memalign(8, cols * rows * sizeof(rdpq_rect_item_t));
+            list->ranges = malloc(tm->num_chunks * sizeof(tilemap_range_t));
+        }
+    }
+    tm->dirty = true;
+}
+
+void rdpq_tilemap_set_tile(rdpq_tilemap_t *tm, int x, int y, uint16_t tile)
+{
+    assertf(x >= 0 && x < tm->map_w && y >= 0 && y < tm->map_h, "invalid cell %d,%d", x, y);
+    assertf(tile == RDPQ_TILEMAP_EMPTY || tile < tm->num_tiles, "invalid tile index %d", tile);
+    uint16_t *cell = &tm->tiles[y * tm->map_w + x];
+    if (*cell == tile) return;
+    *cell = tile;
+
+    // Rebuild only if the cell is currently visible
+    if (x >= tm->origin_x && x < tm->origin_x + tm->vp_cols &&
+        y >= tm->origin_y && y < tm->origin_y + tm->vp_rows)
+        tm->dirty = true;
+}
+
+uint16_t rdpq_tilemap_get_tile(rdpq_tilemap_t *tm, int x, int y)
+{
+    if (x < 0 || x >= tm->map_w || y < 0 || y >= tm->map_h)
+        return RDPQ_TILEMAP_EMPTY;
+    return tm->tiles[y * tm->map_w + x];
+}
+
+void rdpq_tilemap_invalidate(rdpq_tilemap_t *tm)
+{
+    tm->dirty = true;
+}
+
+/** @brief Get the chunk that contains a tile of the tileset */
+static inline int tilemap_chunk(rdpq_tilemap_t *tm, int tile)
+{
+    int col = tile % tm->tileset_cols;
+    int row = tile / tm->tileset_cols;
+    return (row / tm->chunk_rows) * tm->chunks_x + col / tm->chunk_cols;
+}
+
+/** @brief Rebuild the list of visible tiles for the specified origin cell */
+static void tilemap_rebuild(rdpq_tilemap_t *tm, tilemap_list_t *list, int origin_x, int origin_y)
+{
+    // Count the visible tiles of each chunk. Cells outside of the map are empty.
+    int x0 = MAX(origin_x, 0), x1 = MIN(origin_x + tm->vp_cols, tm->map_w);
+    int y0 = MAX(origin_y, 0), y1 = MIN(origin_y + tm->vp_rows, tm->map_h);
+    uint16_t count[TILEMAP_MAX_CHUNKS] = {0};
+    for (int y=y0; y<y1; y++) {
+        const uint16_t *row = &tm->tiles[y * tm->map_w];
+        for (int x=x0; x<x1; x++) {
+            if (row[x] == RDPQ_TILEMAP_EMPTY) continue;
+            assertf(row[x] < tm->num_tiles, "invalid tile index %d at %d,%d", row[x], x, y);
+            count[tilemap_chunk(tm, row[x])]++;
+        }
+    }
+
+    // Allocate a contiguous range of the list to each used chunk
+    uint16_t next[TILEMAP_MAX_CHUNKS];
+    int start = 0;
+    list->num_ranges = 0;
+    for (int c=0; c<tm->num_chunks; c++) {
+        next[c] = start;
+        if (count[c] == 0) continue;
+        list->ranges[list->num_ranges++] = (tilemap_range_t){ .chunk = c, .start = start, .count = count[c] };
+        start += count[c];
+    }
+    list->num_rects = start;
+
+    // Fill the rectangles, relative to the top-left corner of the viewport.
+    // The sub-tile scroll is applied as an offset at draw time.
+    for (int y=y0; y<y1; y++) {
+        const uint16_t *row = &tm->tiles[y * tm->map_w];
+        int py = tm->vp_y0 + (y - origin_y) * tm->tile_h;
+        for (int x=x0; x<x1; x++) {
+            int tile = row[x];
+            if (tile == RDPQ_TILEMAP_EMPTY) continue;
+            int px = tm->vp_x0 + (x - origin_x) * tm->tile_w;
+            rdpq_rect_item_t *r = &list->rects[next[tilemap_chunk(tm, tile)]++];
+            r->x = px * 4;
+            r->y = py * 4;
+            r->width = tm->tile_w * 4;
+            r->height = tm->tile_h * 4;
+            r->s = (tile % tm->tileset_cols) * tm->tile_w * 32;
+            r->t = (tile / tm->tileset_cols) * tm->tile_h * 32;
+            r->color = (color_t){0};
+        }
+    }
+
+    tm->stats.rebuilds++;
+}
+
+void rdpq_tilemap_draw(rdpq_tilemap_t *tm, float scroll_x, float scroll_y)
+{
+    assertf(!rspq_in_block(), "rdpq_tilemap_draw cannot be called while recording a block");
+
+    // Split the scroll position into a cell and a sub-tile offset (10.2)
+    int sx = floorf(scroll_x * 4.0f);
+    int sy = floorf(scroll_y * 4.0f);
+    int origin_x = floor_div(sx, tm->tile_w * 4);
+    int origin_y = floor_div(sy, tm->tile_h * 4);
+    int dx = sx - origin_x * tm->tile_w * 4;
+    int dy = sy - origin_y * tm->tile_h * 4;
+
+    // Rebuild the list only when scrolling by a whole tile. The list used
+    // by the previous draw might still be read by the RSP, so build the new
+    // one in the other buffer.
+    if (tm->dirty || origin_x != tm->origin_x || origin_y != tm->origin_y) {
+        tm->cur_list ^= 1;
+        tilemap_list_t *list = &tm->lists[tm->cur_list];
+        tilemap_list_wait(list);
+        tilemap_rebuild(tm, list, origin_x, origin_y);
+        tm->origin_x = origin_x;
+        tm->origin_y = origin_y;
+        tm->dirty = false;
+    }
+
+    tilemap_list_t *list = &tm->lists[tm->cur_list];
+    tm->stats.tiles = list->num_rects;
+    tm->stats.chunks = list->num_ranges;
+    if (list->num_ranges == 0)
+        return;
+
+    // Configure the palette, if any
+    tex_format_t fmt = surface_get_format(&tm->tex);
+    rdpq_tlut_t tlut_mode = rdpq_tlut_from_format(fmt);
+    rdpq_mode_tlut(tlut_mode);
+    if (tlut_mode != TLUT_NONE) {
+        uint16_t *pal = sprite_get_palette(tm->tileset);
+        if (pal) rdpq_tex_upload_tlut(pal, 0, fmt == FMT_CI4 ? 16 : 256);
+    }
+
+    // Load each chunk once, and draw all its tiles with a single command.
+    // Texture coordinates are relative to the whole tileset, so they don't
+    // depend on the chunk.
+    for (int i=0; i<list->num_ranges; i++) {
+        tilemap_range_t *range = &list->ranges[i];
+        int s0 = (range->chunk % tm->chunks_x) * tm->chunk_cols * tm->tile_w;
+        int t0 = (range->chunk / tm->chunks_x) * tm->chunk_rows * tm->tile_h;
+        int s1 = MIN(s0 + tm->chunk_cols * tm->tile_w, tm->tileset_cols * tm->tile_w);
+        int t1 = MIN(t0 + tm->chunk_rows * tm->tile_h, tm->num_tiles / tm->tileset_cols * tm->tile_h);
+        rdpq_tex_upload_sub(TILE0, &tm->tex, NULL, s0, t0, s1, t1);
+        __rdpq_texture_rectangle_batch_offset(TILE0, &list->rects[range->start], range->count, false, -dx, -dy);
+    }
+
+    list->sync = rspq_syncpoint_new();
+    list->pending = true;
+}
+
+void rdpq_tilemap_get_stats(rdpq_tilemap_t *tm, rdpq_tilemap_stats_t *stats)
+{
+    *stats = tm->stats;
+}
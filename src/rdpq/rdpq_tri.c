@@ -3,7 +3,8 @@
  * @brief RDP Command queue: triangle drawing routine
  * @ingroup rdp
  * 
- * This file contains the implementation of a single function: #rdpq_triangle.
+ * This file contains the implementation of #rdpq_triangle, and of its
+ * fixed-point variant #rdpq_triangle_fx.
  * 
  * The RDP triangle commands are complex to assemble because they are designed
  * for the hardware that will be drawing them, rather than for the programmer
@@ -13,10 +14,17 @@
  * to draw triangles with subpixel precision, so input coordinates are fixed
  * point and the setup code must take into account exactly how the rasterizer
  * will handle fractional values.
+ * 
+ * Before setup, #rdpq_triangle clips triangles against a guard band (see
+ * #rdpq_set_triangle_guardband), so that the RDP never receives coordinates
+ * outside of its range. Triangles that are fully outside of the scissor
+ * rectangle are instead rejected by the RSP, as only the RSP knows the
+ * current scissor rectangle.
  */
 
 #include <math.h>
 #include <float.h>
+#include <string.h>
 #include "rdpq.h"
 #include "rdpq_tri.h"
 #include "rspq.h"
@@ -36,6 +44,23 @@
 #define tracef(fmt, ...)  ({ })
 #endif
 
+/** @brief Bit of the RDPQ_CMD_TRIANGLE command that requests rejection of off-scissor triangles */
+#define RDPQ_TRI_RSP_REJECT             (1 << 16)
+
+/** @brief Maximum number of components per vertex supported by the clipper */
+#define RDPQ_TRI_CLIP_MAX_COMPONENTS    16
+/** @brief Maximum number of vertices of a triangle clipped against 4 planes */
+#define RDPQ_TRI_CLIP_MAX_VERTICES      7
+
+/** @brief Guard band used to clip triangles (x0, y0, x1, y1) */
+static float tri_guardband[4] = { -RDPQ_TRI_GUARDBAND_DEFAULT, -RDPQ_TRI_GUARDBAND_DEFAULT, RDPQ_TRI_GUARDBAND_DEFAULT, RDPQ_TRI_GUARDBAND_DEFAULT };
+
+/** @brief Triangle statistics accumulated by the CPU */
+static rdpq_triangle_stats_t tri_stats;
+
+/** @brief Value of the RSP rejection counter at the time of the last stats reset */
+static uint32_t tri_rejected_base;
+
 const rdpq_trifmt_t TRIFMT_FILL = (rdpq_trifmt_t){
     .pos_offset = 0, .shade_offset = -1, .tex_offset = -1, .z_offset = -1,
 };
@@ -342,7 +367,7 @@ static inline void __rdpq_write_tex_coeffs(rspq_write_t *w, rdpq_tri_edge_data_t
     rspq_write_arg(w, (DwDy_fixed&0xffff0000));
     rspq_write_arg(w, (DsDe_fixed<<16) | (DtDe_fixed&0xffff));
     rspq_write_arg(w, (DwDe_fixed<<16));
-    rspq_write_arg(w, (DsDy_fixed<<16) | (DtDy_fixed&&0xffff));
+    rspq_write_arg(w, (DsDy_fixed<<16) | (DtDy_fixed&0xffff));
     rspq_write_arg(w, (DwDy_fixed<<16));
 
     tracef("invw1-mul: %f (%08lx)\n", invw1, (int32_t)(invw1*65536));
@@ -407,6 +432,241 @@ static inline void __rdpq_write_zbuf_coeffs(rspq_write_t *w, rdpq_tri_edge_data_
     tracef("dzde: %f (%08llx)\n", DzDe, (uint64_t)(DzDe * 65536.0f));
 }
 
+/** @brief Saturate a s16.16 number calculated with 64-bit precision (like #float_to_s16_16) */
+static inline int32_t fx_sat(int64_t v)
+{
+    if (v > INT32_MAX) return INT32_MAX;
+    if (v < INT32_MIN) return INT32_MIN;
+    return v;
+}
+
+/** @brief Divide two integers, rounding down (like floorf(a/b)) */
+static inline int64_t fx_floordiv(int64_t a, int64_t b)
+{
+    int64_t q, r;
+    if (a == (int32_t)a && b == (int32_t)b && a != INT32_MIN) {
+        // A 32-bit division is much faster than a 64-bit one on VR4300,
+        // and it is enough for most 2D triangles.
+        q = (int32_t)a / (int32_t)b;
+        r = (int32_t)a % (int32_t)b;
+    } else {
+        q = a / b;
+        r = a % b;
+    }
+    if (r != 0 && ((r < 0) != (b < 0)))
+        q--;
+    return q;
+}
+
+/** @brief Reciprocal of a divisor, to replace repeated divisions with multiplications (see #fx_recip_floordiv) */
+typedef struct {
+    uint64_t d;             ///< Absolute value of the divisor
+    uint32_t r;             ///< Reciprocal of the normalized divisor (about 2^95 / (d << shift), rounded down)
+    uint8_t shift;          ///< Shift that normalizes the divisor (number of leading zeros)
+    bool neg;               ///< True if the divisor is negative
+} fx_recip_t;
+
+/** @brief Calculate the reciprocal of a divisor (must be non-zero, and less than 2^62 in absolute value) */
+static inline void fx_recip(fx_recip_t *rc, int64_t b)
+{
+    rc->neg = b < 0;
+    rc->d = rc->neg ? -b : b;
+    rc->shift = __builtin_clzll(rc->d);
+    // Use the top 32 bits of the normalized divisor, rounded up, so that the
+    // reciprocal is never larger than the exact one.
+    uint64_t dh = ((rc->d << rc->shift) >> 32) + 1;
+    rc->r = (1ull << 63) / dh;
+}
+
+/** @brief Divide by a reciprocal calculated by #fx_recip, rounding down (same result as #fx_floordiv) */
+static inline int64_t fx_recip_floordiv(int64_t a, const fx_recip_t *rc)
+{
+    bool neg = (a < 0) != rc->neg;
+    uint64_t m = a < 0 ? -(uint64_t)a : a;
+
+    // Estimate the quotient with a 64x32 multiplication. The reciprocal is
+    // at most 2^-30 smaller than the exact one, so the estimate is never larger
+    // than the exact quotient, and smaller by a few units at most.
+    uint64_t hi = (m >> 32) * rc->r;
+    uint64_t lo = (m & 0xFFFFFFFF) * rc->r;
+    uint64_t q = (hi + (lo >> 32)) >> (63 - rc->shift);
+
+    // Fix the estimate to get the exact result. Quotients way out of the
+    // s16.16 range are saturated anyway (see #fx_sat), so they are left as is.
+    uint64_t rem = m - q * rc->d;
+    if (q < (1ull << 34)) {
+        while (rem >= rc->d) {
+            rem -= rc->d;
+            q++;
+        }
+    }
+    if (!neg) return q;
+    return -(int64_t)q - (rem != 0);
+}
+
+/** @brief Precomputed information about edges (fixed-point version of #rdpq_tri_edge_data_t). */
+typedef struct {
+    int64_t hx;             ///< High edge (X, s.16)
+    int64_t hy;             ///< High edge (Y, s.2)
+    int64_t mx;             ///< Middle edge (X, s.16)
+    int64_t my;             ///< Middle edge (Y, s.2)
+    int64_t det;            ///< Triangle determinant (hy*mx - hx*my, s.18), 0 if degenerate
+    int32_t fy;             ///< Fractional part of Y1 (top vertex), in quarters of pixel
+    fx_recip_t inv_hy;      ///< Reciprocal of hy (valid only if hy is not 0)
+    fx_recip_t inv_det;     ///< Reciprocal of det (valid only if det is not 0)
+} rdpq_tri_edge_data_fx_t;
+
+/**
+ * @brief Calculate the RDP coefficients of a vertex attribute, using integer arithmetic
+ * 
+ * This calculates the same values of the floating point version, but it
+ * simplifies the gradient along the major edge, which is just the attribute
+ * delta over the edge height.
+ * 
+ * @param data      Edge data
+ * @param a1        Attribute value at vertex 1 (s.16)
+ * @param a2        Attribute value at vertex 2 (s.16)
+ * @param a3        Attribute value at vertex 3 (s.16)
+ * @param c         Output coefficients (s16.16): initial value, DxDx, DxDe, DxDy
+ */
+__attribute__((always_inline))
+static inline void __rdpq_attr_coeffs_fx(const rdpq_tri_edge_data_fx_t *data, int64_t a1, int64_t a2, int64_t a3, int32_t c[4])
+{
+    const int64_t ma = a2 - a1;
+    const int64_t ha = a3 - a1;
+
+    // Constant attribute (eg: flat shading, or 2D texturing with constant INV_W)
+    if (data->det == 0 || (ma == 0 && ha == 0)) {
+        c[0] = fx_sat(a1); c[1] = c[2] = c[3] = 0;
+        return;
+    }
+
+    // Notice that hy cannot be 0 here, otherwise the triangle would be degenerate.
+    // The divisions use the reciprocals calculated once per triangle.
+    c[0] = fx_sat(data->fy ? a1 + fx_recip_floordiv(-data->fy * ha, &data->inv_hy) : a1);
+    c[1] = fx_sat(fx_recip_floordiv((data->hy*ma - data->my*ha) * 65536, &data->inv_det));
+    c[2] = fx_sat(fx_recip_floordiv(ha * 4, &data->inv_hy));
+    c[3] = fx_sat(fx_recip_floordiv((data->mx*ha - data->hx*ma) * 4, &data->inv_det));
+}
+
+/**
+ * @brief Write the coefficients of up to 4 attributes in the RDP format
+ * 
+ * The RDP groups the attributes by 4 (eg: R,G,B,A or S,T,W,-), and splits
+ * the integer and the fractional parts of the coefficients.
+ */
+__attribute__((always_inline))
+static inline void __rdpq_write_attr_coeffs_fx(rspq_write_t *w, int32_t c[4][4])
+{
+    for (int k=0; k<4; k+=2) {
+        for (int j=k; j<k+2; j++) {
+            rspq_write_arg(w, (c[0][j]&0xffff0000) | (0xffff&(c[1][j]>>16)));
+            rspq_write_arg(w, (c[2][j]&0xffff0000) | (0xffff&(c[3][j]>>16)));
+        }
+        for (int j=k; j<k+2; j++) {
+            rspq_write_arg(w, (c[0][j]<<16) | (c[1][j]&0xffff));
+            rspq_write_arg(w, (c[2][j]<<16) | (c[3][j]&0xffff));
+        }
+    }
+}
+
+__attribute__((always_inline))
+static inline void __rdpq_write_edge_coeffs_fx(rspq_write_t *w, rdpq_tri_edge_data_fx_t *data, uint8_t tile, uint8_t mipmaps, const int32_t *v1, const int32_t *v2, const int32_t *v3)
+{
+    const int64_t x1 = v1[0];
+    const int64_t x2 = v2[0];
+    const int64_t x3 = v3[0];
+    // Y coordinates are truncated to s.2, like the RDP does
+    const int32_t y1 = v1[1] >> 14;
+    const int32_t y2 = v2[1] >> 14;
+    const int32_t y3 = v3[1] >> 14;
+
+    int32_t y1f = CLAMP(y1, -4096*4, 4095*4);
+    int32_t y2f = CLAMP(y2, -4096*4, 4095*4);
+    int32_t y3f = CLAMP(y3, -4096*4, 4095*4);
+
+    data->hx = x3 - x1;
+    data->hy = y3 - y1;
+    data->mx = x2 - x1;
+    data->my = y2 - y1;
+    const int64_t lx = x3 - x2;
+    const int64_t ly = y3 - y2;
+
+    data->det = data->hy*data->mx - data->hx*data->my;
+    const uint32_t lft = data->det > 0;
+    data->fy = y1 & 3;
+
+    // Calculate the reciprocals used for all the divisions by hy and det,
+    // both here and for the attributes (see __rdpq_attr_coeffs_fx).
+    if (data->hy) fx_recip(&data->inv_hy, data->hy);
+    if (data->det) fx_recip(&data->inv_det, data->det);
+
+    // Inverse slopes: X is s.16 and Y is s.2, so the quotient must be scaled by 4
+    const int32_t ish = data->hy ? fx_sat(fx_recip_floordiv(data->hx * 4, &data->inv_hy)) : 0;
+    const int32_t ism = data->my ? fx_sat(fx_floordiv(data->mx * 4, data->my)) : 0;
+    const int32_t isl = ly ? fx_sat(fx_floordiv(lx * 4, ly)) : 0;
+
+    const int64_t xh = (data->fy && data->hy) ? x1 + fx_recip_floordiv(-data->fy * data->hx, &data->inv_hy) : x1;
+    const int64_t xm = (data->fy && data->my) ? x1 + fx_floordiv(-data->fy * data->mx, data->my) : x1;
+    const int64_t xl = x2;
+
+    rspq_write_arg(w, _carg(lft, 0x1, 23) | _carg(mipmaps ? mipmaps-1 : 0, 0x7, 19) | _carg(tile, 0x7, 16) | _carg(y3f, 0x3FFF, 0));
+    rspq_write_arg(w, _carg(y2f, 0x3FFF, 16) | _carg(y1f, 0x3FFF, 0));
+    rspq_write_arg(w, fx_sat(xl));
+    rspq_write_arg(w, isl);
+    rspq_write_arg(w, fx_sat(xh));
+    rspq_write_arg(w, ish);
+    rspq_write_arg(w, fx_sat(xm));
+    rspq_write_arg(w, ism);
+}
+
+__attribute__((always_inline))
+static inline void __rdpq_write_shade_coeffs_fx(rspq_write_t *w, rdpq_tri_edge_data_fx_t *data, const int32_t *v1, const int32_t *v2, const int32_t *v3)
+{
+    int32_t c[4][4];
+    for (int i=0; i<4; i++)
+        __rdpq_attr_coeffs_fx(data, (int64_t)v1[i] * 255, (int64_t)v2[i] * 255, (int64_t)v3[i] * 255, c[i]);
+    __rdpq_write_attr_coeffs_fx(w, c);
+}
+
+__attribute__((always_inline))
+static inline void __rdpq_write_tex_coeffs_fx(rspq_write_t *w, rdpq_tri_edge_data_fx_t *data, const int32_t *v1, const int32_t *v2, const int32_t *v3)
+{
+    int64_t s1 = (int64_t)v1[0] * 32, t1 = (int64_t)v1[1] * 32, invw1 = 0x7FFF << 16;
+    int64_t s2 = (int64_t)v2[0] * 32, t2 = (int64_t)v2[1] * 32, invw2 = 0x7FFF << 16;
+    int64_t s3 = (int64_t)v3[0] * 32, t3 = (int64_t)v3[1] * 32, invw3 = 0x7FFF << 16;
+
+    // Normalize INV_W so that the maximum is 0x7FFF, and premultiply S,T.
+    // This is not required for 2D triangles, where INV_W is constant.
+    if (v1[2] != v2[2] || v1[2] != v3[2]) {
+        const int64_t maxw = MAX(MAX(v1[2], v2[2]), v3[2]);
+        assertf(maxw > 0, "invalid INV_W");
+        s1 = fx_floordiv(s1 * v1[2], maxw); t1 = fx_floordiv(t1 * v1[2], maxw);
+        s2 = fx_floordiv(s2 * v2[2], maxw); t2 = fx_floordiv(t2 * v2[2], maxw);
+        s3 = fx_floordiv(s3 * v3[2], maxw); t3 = fx_floordiv(t3 * v3[2], maxw);
+        invw1 = fx_floordiv((int64_t)v1[2] * (0x7FFF << 16), maxw);
+        invw2 = fx_floordiv((int64_t)v2[2] * (0x7FFF << 16), maxw);
+        invw3 = fx_floordiv((int64_t)v3[2] * (0x7FFF << 16), maxw);
+    }
+
+    int32_t c[4][4] = {0};
+    __rdpq_attr_coeffs_fx(data, s1, s2, s3, c[0]);
+    __rdpq_attr_coeffs_fx(data, t1, t2, t3, c[1]);
+    __rdpq_attr_coeffs_fx(data, invw1, invw2, invw3, c[2]);
+    __rdpq_write_attr_coeffs_fx(w, c);
+}
+
+__attribute__((always_inline))
+static inline void __rdpq_write_zbuf_coeffs_fx(rspq_write_t *w, rdpq_tri_edge_data_fx_t *data, const int32_t *v1, const int32_t *v2, const int32_t *v3)
+{
+    int32_t c[4];
+    __rdpq_attr_coeffs_fx(data, (int64_t)v1[0] * 0x7FFF, (int64_t)v2[0] * 0x7FFF, (int64_t)v3[0] * 0x7FFF, c);
+    rspq_write_arg(w, c[0]);
+    rspq_write_arg(w, c[1]);
+    rspq_write_arg(w, c[2]);
+    rspq_write_arg(w, c[3]);
+}
+
 /** @brief RDP triangle primitive assembled on the CPU */
 void rdpq_triangle_cpu(const rdpq_trifmt_t *fmt, const float *v1, const float *v2, const float *v3)
 {
@@ -416,7 +676,7 @@ void rdpq_triangle_cpu(const rdpq_trifmt_t *fmt, const float *v1, const float *v
         // effects such as detail and sharpen. Figure it out a way to handle these in the
         // autosync engine.
         res |= AUTOSYNC_TILE(fmt->tex_tile);
-        res |= AUTOSYNC_TMEMS;
+        res = __rdpq_autosync_tmem_use(res | AUTOSYNC_TMEM(0), fmt->tex_tile);
     }
     __rdpq_autosync_use(res);
 
@@ -462,8 +722,12 @@ void rdpq_triangle_cpu(const rdpq_trifmt_t *fmt, const float *v1, const float *v
     rspq_write_end(&w);
 }
 
-/** @brief RDP triangle primitive assembled on the RSP */
-void rdpq_triangle_rsp(const rdpq_trifmt_t *fmt, const float *v1, const float *v2, const float *v3)
+/** 
+ * @brief RDP triangle primitive assembled on the RSP
+ * 
+ * @param flags     Additional bits for the command (eg: #RDPQ_TRI_RSP_REJECT)
+ */
+static void __rdpq_triangle_rsp(const rdpq_trifmt_t *fmt, const float *v1, const float *v2, const float *v3, uint32_t flags)
 {
     uint32_t res = AUTOSYNC_PIPE;
     if (fmt->tex_offset >= 0) {
@@ -471,7 +735,7 @@ void rdpq_triangle_rsp(const rdpq_trifmt_t *fmt, const float *v1, const float *v
         // effects such as detail and sharpen. Figure it out a way to handle these in the
         // autosync engine.
         res |= AUTOSYNC_TILE(fmt->tex_tile);
-        res |= AUTOSYNC_TMEM(0);
+        res = __rdpq_autosync_tmem_use(res | AUTOSYNC_TMEM(0), fmt->tex_tile);
     }
     __rdpq_autosync_use(res);
 
@@ -525,16 +789,215 @@ void rdpq_triangle_rsp(const rdpq_trifmt_t *fmt, const float *v1, const float *v
     }
 
     rspq_write(RDPQ_OVL_ID, RDPQ_CMD_TRIANGLE, 
-        0xC000 | (cmd_id << 8) | 
+        flags | 0xC000 | (cmd_id << 8) | 
         (fmt->tex_mipmaps ? (fmt->tex_mipmaps-1) << 3 : 0) | 
         (fmt->tex_tile & 7));
 }
 
-void rdpq_triangle(const rdpq_trifmt_t *fmt, const float *v1, const float *v2, const float *v3)
+/** @brief RDP triangle primitive assembled on the RSP (no rejection) */
+void rdpq_triangle_rsp(const rdpq_trifmt_t *fmt, const float *v1, const float *v2, const float *v3)
+{
+    __rdpq_triangle_rsp(fmt, v1, v2, v3, 0);
+}
+
+/** @brief Draw a triangle that is fully within the guard band */
+static void __rdpq_triangle_draw(const rdpq_trifmt_t *fmt, const float *v1, const float *v2, const float *v3)
 {
 #if RDPQ_TRIANGLE_REFERENCE
     rdpq_triangle_cpu(fmt, v1, v2, v3);
 #else
-    rdpq_triangle_rsp(fmt, v1, v2, v3);
+    uint32_t flags = __rdpq_config_enabled(RDPQ_CFG_TRIREJECT) ? RDPQ_TRI_RSP_REJECT : 0;
+    __rdpq_triangle_rsp(fmt, v1, v2, v3, flags);
 #endif
 }
+
+/** @brief Return a bitmask of the guard band planes that the vertex is outside of */
+static inline int guardband_outcode(const float *pos)
+{
+    return (pos[0] < tri_guardband[0] ? 1 : 0) | (pos[1] < tri_guardband[1] ? 2 : 0) |
+           (pos[0] > tri_guardband[2] ? 4 : 0) | (pos[1] > tri_guardband[3] ? 8 : 0);
+}
+
+/**
+ * @brief Clip a triangle against the guard band and draw the resulting polygon
+ * 
+ * This is a standard Sutherland-Hodgman clipper, which outputs a convex polygon
+ * with up to 7 vertices, that is then drawn as a triangle fan. Attributes are
+ * interpolated linearly in screen space, which is what RDP does. For
+ * texture coordinates, this means interpolating S/W and T/W rather than S and T.
+ */
+static void __rdpq_triangle_clip(const rdpq_trifmt_t *fmt, const float *v1, const float *v2, const float *v3)
+{
+    // Number of components used by the format
+    int nc = fmt->pos_offset + 2;
+    if (fmt->z_offset >= 0)     nc = MAX(nc, fmt->z_offset + 1);
+    if (fmt->shade_offset >= 0) nc = MAX(nc, fmt->shade_offset + 4);
+    if (fmt->tex_offset >= 0)   nc = MAX(nc, fmt->tex_offset + 3);
+    assertf(nc <= RDPQ_TRI_CLIP_MAX_COMPONENTS, "triangle format has too many components for clipping (%d)", nc);
+
+    float buf[2][RDPQ_TRI_CLIP_MAX_VERTICES][RDPQ_TRI_CLIP_MAX_COMPONENTS];
+    int n = 3;
+    const float *vtx[3] = { v1, v2, v3 };
+    for (int i=0; i<3; i++) {
+        float *v = buf[0][i];
+        memcpy(v, vtx[i], nc * sizeof(float));
+        // With flat shading, the shade of the first vertex is used for
+        // all the triangles generated by clipping.
+        if (fmt->shade_offset >= 0 && fmt->shade_flat)
+            memcpy(v + fmt->shade_offset, v1 + fmt->shade_offset, 4 * sizeof(float));
+        if (fmt->tex_offset >= 0) {
+            v[fmt->tex_offset+0] *= v[fmt->tex_offset+2];
+            v[fmt->tex_offset+1] *= v[fmt->tex_offset+2];
+        }
+    }
+
+    // Clip against the four planes
+    int cur = 0;
+    for (int plane=0; plane<4 && n>0; plane++) {
+        int axis = fmt->pos_offset + (plane & 1);
+        float limit = tri_guardband[plane];
+        float sign = plane < 2 ? 1.0f : -1.0f;
+        float (*in)[RDPQ_TRI_CLIP_MAX_COMPONENTS] = buf[cur];
+        float (*out)[RDPQ_TRI_CLIP_MAX_COMPONENTS] = buf[cur^1];
+        int nout = 0;
+
+        for (int i=0; i<n; i++) {
+            float *a = in[i], *b = in[(i+1) % n];
+            float da = (a[axis] - limit) * sign;
+            float db = (b[axis] - limit) * sign;
+            if (da >= 0)
+                memcpy(out[nout++], a, nc * sizeof(float));
+            if ((da >= 0) != (db >= 0)) {
+                float t = da / (da - db);
+                float *v = out[nout++];
+                for (int j=0; j<nc; j++)
+                    v[j] = a[j] + (b[j] - a[j]) * t;
+                v[axis] = limit;
+            }
+        }
+        n = nout;
+        cur ^= 1;
+    }
+
+    if (n < 3) {
+        tri_stats.rejected_cpu++;
+        return;
+    }
+
+    float (*poly)[RDPQ_TRI_CLIP_MAX_COMPONENTS] = buf[cur];
+    if (fmt->tex_offset >= 0) {
+        for (int i=0; i<n; i++) {
+            float *v = poly[i];
+            if (v[fmt->tex_offset+2] != 0) {
+                v[fmt->tex_offset+0] /= v[fmt->tex_offset+2];
+                v[fmt->tex_offset+1] /= v[fmt->tex_offset+2];
+            }
+        }
+    }
+
+    tri_stats.clipped++;
+    tri_stats.clip_output += n - 2;
+    for (int i=1; i<n-1; i++)
+        __rdpq_triangle_draw(fmt, poly[0], poly[i], poly[i+1]);
+}
+
+void rdpq_triangle(const rdpq_trifmt_t *fmt, const float *v1, const float *v2, const float *v3)
+{
+    if (__rdpq_config_enabled(RDPQ_CFG_TRICLIP)) {
+        int out1 = guardband_outcode(v1 + fmt->pos_offset);
+        int out2 = guardband_outcode(v2 + fmt->pos_offset);
+        int out3 = guardband_outcode(v3 + fmt->pos_offset);
+        if (out1 & out2 & out3) {
+            // All vertices are outside of the same plane: the triangle is not visible
+            tri_stats.rejected_cpu++;
+            return;
+        }
+        if (out1 | out2 | out3) {
+            __rdpq_triangle_clip(fmt, v1, v2, v3);
+            return;
+        }
+    }
+    __rdpq_triangle_draw(fmt, v1, v2, v3);
+}
+
+void rdpq_set_triangle_guardband(float x0, float y0, float x1, float y1)
+{
+    assertf(x0 < x1 && y0 < y1, "invalid guard band: (%f,%f)-(%f,%f)", x0, y0, x1, y1);
+    assertf(x0 >= RDPQ_TRI_GUARDBAND_MIN && y0 >= RDPQ_TRI_GUARDBAND_MIN &&
+            x1 <= RDPQ_TRI_GUARDBAND_MAX && y1 <= RDPQ_TRI_GUARDBAND_MAX,
+            "guard band outside of the RDP coordinate range: (%f,%f)-(%f,%f)", x0, y0, x1, y1);
+    tri_guardband[0] = x0; tri_guardband[1] = y0;
+    tri_guardband[2] = x1; tri_guardband[3] = y1;
+}
+
+void rdpq_get_triangle_stats(rdpq_triangle_stats_t *stats)
+{
+    *stats = tri_stats;
+    stats->rejected_rsp = __rdpq_triangle_rejected() - tri_rejected_base;
+}
+
+void rdpq_reset_triangle_stats(void)
+{
+    memset(&tri_stats, 0, sizeof(tri_stats));
+    tri_rejected_base = __rdpq_triangle_rejected();
+}
+
+/** @brief Reset the guard band and the statistics (called by #rdpq_init, when the RSP counter is zero) */
+void __rdpq_triangle_init(void)
+{
+    tri_guardband[0] = tri_guardband[1] = -RDPQ_TRI_GUARDBAND_DEFAULT;
+    tri_guardband[2] = tri_guardband[3] = RDPQ_TRI_GUARDBAND_DEFAULT;
+    memset(&tri_stats, 0, sizeof(tri_stats));
+    tri_rejected_base = 0;
+}
+
+void rdpq_triangle_fx(const rdpq_trifmt_t *fmt, const int32_t *v1, const int32_t *v2, const int32_t *v3)
+{
+    uint32_t res = AUTOSYNC_PIPE;
+    if (fmt->tex_offset >= 0) {
+        res |= AUTOSYNC_TILE(fmt->tex_tile);
+        res = __rdpq_autosync_tmem_use(res | AUTOSYNC_TMEM(0), fmt->tex_tile);
+    }
+    __rdpq_autosync_use(res);
+
+    uint32_t cmd_id = RDPQ_CMD_TRI;
+
+    uint32_t size = 8;
+    if (fmt->shade_offset >= 0) {
+        size += 16;
+        cmd_id |= 0x4;
+    }
+    if (fmt->tex_offset >= 0) {
+        size += 16;
+        cmd_id |= 0x2;
+    }
+    if (fmt->z_offset >= 0) {
+        size += 4;
+        cmd_id |= 0x1;
+    }
+
+    rspq_write_t w = rspq_write_begin(RDPQ_OVL_ID, cmd_id, size);
+
+    if( v1[fmt->pos_offset + 1] > v2[fmt->pos_offset + 1] ) { SWAP(v1, v2); }
+    if( v2[fmt->pos_offset + 1] > v3[fmt->pos_offset + 1] ) { SWAP(v2, v3); }
+    if( v1[fmt->pos_offset + 1] > v2[fmt->pos_offset + 1] ) { SWAP(v1, v2); }
+
+    rdpq_tri_edge_data_fx_t data;
+    __rdpq_write_edge_coeffs_fx(&w, &data, fmt->tex_tile, fmt->tex_mipmaps, v1 + fmt->pos_offset, v2 + fmt->pos_offset, v3 + fmt->pos_offset);
+
+    if (fmt->shade_offset >= 0) {
+        const int32_t *shade_v2 = fmt->shade_flat ? v1 : v2;
+        const int32_t *shade_v3 = fmt->shade_flat ? v1 : v3;
+        __rdpq_write_shade_coeffs_fx(&w, &data, v1 + fmt->shade_offset, shade_v2 + fmt->shade_offset, shade_v3 + fmt->shade_offset);
+    }
+
+    if (fmt->tex_offset >= 0) {
+        __rdpq_write_tex_coeffs_fx(&w, &data, v1 + fmt->tex_offset, v2 + fmt->tex_offset, v3 + fmt->tex_offset);
+    }
+
+    if (fmt->z_offset >= 0) {
+        __rdpq_write_zbuf_coeffs_fx(&w, &data, v1 + fmt->z_offset, v2 + fmt->z_offset, v3 + fmt->z_offset);
+    }
+
+    rspq_write_end(&w);
+}
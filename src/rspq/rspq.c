@@ -164,6 +164,21 @@
  * Some careful tricks are necessary to allow multiple highpri queues to be
  * pending, see #rspq_highpri_begin for details.
  * 
+ * ## User queues
+ * 
+ * User queues (#rspq_queue_t) implement an ordered batch dispatch, done by
+ * the CPU: the RSP ucode only knows about the lowpri and highpri queues, and
+ * all the SP signals are already in use, so there is no scheduling or
+ * preemption on the RSP side. Each job of a user queue is recorded as a
+ * one-shot block (completed jobs and the first chunk of their block are kept
+ * in a small pool, so that recording does not normally allocate memory).
+ * #rspq_queue_dispatch then enqueues a call to each pending block in the
+ * lowpri queue, in priority / weighted round-robin order, each followed by
+ * a syncpoint. The syncpoint is used to know when the job is
+ * finished (so that the block can be freed) and to measure its latency:
+ * the RSP interrupt handler records the time at which each syncpoint is
+ * reached in a small ring buffer (#rspq_syncpoint_ticks).
+ * 
  * ## rdpq integrations
  * 
  * There are a few places where the rsqp code is hooked with rdpq to provide
@@ -333,14 +348,45 @@ static int rspq_syncpoints_genid;
 /** @brief ID of the last syncpoint reached by RSP. */
 volatile int __rspq_syncpoints_done  __attribute__((aligned(8)));
 
+/** @brief Number of entries in #rspq_syncpoint_ticks (must be a power of two) */
+#define RSPQ_SYNCPOINT_TICKS_COUNT   32
+/** @brief Time at which the most recent syncpoints were reached by RSP (indexed by ID) */
+static volatile uint32_t rspq_syncpoint_ticks[RSPQ_SYNCPOINT_TICKS_COUNT];
+
 /** @brief True if the RSP queue engine is running in the RSP. */
 static bool rspq_is_running;
 
+/** @brief Callback invoked while waiting for the RSP (see #rspq_set_idle_callback) */
+static rspq_idle_callback_t rspq_idle_func;
+/** @brief Argument for #rspq_idle_func */
+static void *rspq_idle_arg;
+/** @brief True while the idle callback is running (to avoid reentrancy) */
+static bool rspq_idle_running;
+/** @brief Statistics on CPU time spent waiting for the RSP */
+static rspq_wait_stats_t rspq_wait_stats;
+
 /** @brief Dummy state used for overlay 0 */
 static uint64_t dummy_overlay_state[2];
 
 static void rspq_flush_internal(void);
 
+/** 
+ * @brief Invoke the idle callback while the CPU is waiting for the RSP.
+ * 
+ * The callback is not reentrant: if it ends up waiting for the RSP itself,
+ * the nested wait will just spin.
+ */
+static void rspq_idle(void)
+{
+    if (!rspq_idle_func || rspq_idle_running)
+        return;
+
+    rspq_idle_running = true;
+    rspq_idle_func(rspq_idle_arg);
+    rspq_idle_running = false;
+    rspq_wait_stats.idle_calls++;
+}
+
 /** @brief RSP interrupt handler, used for syncpoints. */
 static void rspq_sp_interrupt(void) 
 {
@@ -352,6 +398,7 @@ static void rspq_sp_interrupt(void)
     if (status & SP_STATUS_SIG_SYNCPOINT) {
         wstatus |= SP_WSTATUS_CLEAR_SIG_SYNCPOINT;
         ++__rspq_syncpoints_done;
+        rspq_syncpoint_ticks[__rspq_syncpoints_done & (RSPQ_SYNCPOINT_TICKS_COUNT-1)] = TICKS_READ();
         // writeback to memory; this is required for RDPQCmd_SyncFull to fetch the correct value 
         data_cache_hit_writeback(&__rspq_syncpoints_done, sizeof(__rspq_syncpoints_done));
     }
@@ -631,6 +678,9 @@ void rspq_init(void)
     rspq_syncpoints_genid = 0;
     __rspq_syncpoints_done = 0;
 
+    // Init wait statistics
+    rspq_reset_wait_stats();
+
     // Init blocks
     rspq_block = NULL;
     rspq_is_running = false;
@@ -971,13 +1021,18 @@ void rspq_next_buffer(void) {
     // FIXME: this should probably transition to a sync-point,
     // so that the kernel can switch away while waiting. Even
     // if the overhead of an interrupt is obviously higher.
+    // Notice that we cannot call the idle callback here, as the queue
+    // is halfway through a buffer switch.
     MEMORY_BARRIER();
     if (!(*SP_STATUS & rspq_ctx->sp_status_bufdone)) {
+        uint32_t t0 = TICKS_READ();
         rspq_flush_internal();
         RSP_WAIT_LOOP(200) {
             if (*SP_STATUS & rspq_ctx->sp_status_bufdone)
                 break;
         }
+        rspq_wait_stats.buffer_waits++;
+        rspq_wait_stats.buffer_ticks += TICKS_SINCE(t0);
     }
     MEMORY_BARRIER();
     *SP_STATUS = rspq_ctx->sp_wstatus_clear_bufdone;
@@ -1100,23 +1155,31 @@ void rspq_highpri_sync(void)
 {
     assertf(rspq_ctx != &highpri, "this function can only be called outside of highpri mode");
 
+    if (!(*SP_STATUS & (SP_STATUS_SIG_HIGHPRI_REQUESTED | SP_STATUS_SIG_HIGHPRI_RUNNING)))
+        return;
+
     // Make sure the RSP is running, otherwise we might be blocking forever.
+    uint32_t t0 = TICKS_READ();
     rspq_flush_internal();
 
     RSP_WAIT_LOOP(200) {
         if (!(*SP_STATUS & (SP_STATUS_SIG_HIGHPRI_REQUESTED | SP_STATUS_SIG_HIGHPRI_RUNNING)))
             break;
+        rspq_idle();
     }
+
+    rspq_wait_stats.highpri_waits++;
+    rspq_wait_stats.highpri_ticks += TICKS_SINCE(t0);
 }
 
-void rspq_block_begin(void)
+/** @brief Begin a block, using the specified memory as first chunk (#RSPQ_BLOCK_MIN_SIZE words) */
+static void rspq_block_begin_chunk(rspq_block_t *block)
 {
     assertf(!rspq_block, "a block was already being created");
     assertf(rspq_ctx != &highpri, "cannot create a block in highpri mode");
 
-    // Allocate a new block (at minimum size) and initialize it.
     rspq_block_size = RSPQ_BLOCK_MIN_SIZE;
-    rspq_block = malloc_uncached(sizeof(rspq_block_t) + rspq_block_size*sizeof(uint32_t));
+    rspq_block = block;
     rspq_block->nesting_level = 0;
     rspq_block->rdp_block = NULL;
 
@@ -1128,6 +1191,12 @@ void rspq_block_begin(void)
     __rdpq_block_begin();
 }
 
+void rspq_block_begin(void)
+{
+    // Allocate a new block (at minimum size) and initialize it.
+    rspq_block_begin_chunk(malloc_uncached(sizeof(rspq_block_t) + RSPQ_BLOCK_MIN_SIZE*sizeof(uint32_t)));
+}
+
 rspq_block_t* rspq_block_end(void)
 {
     assertf(rspq_block, "a block was not being created");
@@ -1148,10 +1217,12 @@ rspq_block_t* rspq_block_end(void)
     return b;
 }
 
-void rspq_block_free(rspq_block_t *block)
+/** @brief Free the memory of a block, optionally keeping its first chunk for reuse */
+static void rspq_block_free_chunks(rspq_block_t *block, bool keep_first)
 {
     // Free RDP blocks first
     __rdpq_block_free(block->rdp_block);
+    block->rdp_block = NULL;
 
     // Start from the commands in the first chunk of the block
     int size = RSPQ_BLOCK_MIN_SIZE;
@@ -1165,7 +1236,8 @@ void rspq_block_free(rspq_block_t *block)
         // If the last command is a JUMP
         if (cmd>>24 == RSPQ_CMD_JUMP) {
             // Free the memory of the current chunk.
-            free_uncached(start);
+            if (!keep_first || start != block)
+                free_uncached(start);
             // Get the pointer to the next chunk
             start = UncachedAddr(0x80000000 | (cmd & 0xFFFFFF));
             if (size < RSPQ_BLOCK_MAX_SIZE) size *= 2;
@@ -1175,7 +1247,8 @@ void rspq_block_free(rspq_block_t *block)
         // If the last command is a RET
         if (cmd>>24 == RSPQ_CMD_RET) {
             // This is the last chunk, free it and exit
-            free_uncached(start);
+            if (!keep_first || start != block)
+                free_uncached(start);
             return;
         }
         // The last command is neither a JUMP nor a RET:
@@ -1184,6 +1257,11 @@ void rspq_block_free(rspq_block_t *block)
     }
 }
 
+void rspq_block_free(rspq_block_t *block)
+{
+    rspq_block_free_chunks(block, false);
+}
+
 void rspq_block_run(rspq_block_t *block)
 {
     // TODO: add support for block execution in highpri mode. This would be
@@ -1193,6 +1271,10 @@ void rspq_block_run(rspq_block_t *block)
     // mode, but it might be an acceptable limitation.
     assertf(rspq_ctx != &highpri, "block run is not supported in highpri mode");
 
+    // Optimize the RDP commands of the block if requested when it was
+    // recorded. This must be done before RSP can see the block.
+    __rdpq_block_optimize(block->rdp_block, NULL);
+
     // Write the CALL op. The second argument is the nesting level
     // which is used as stack slot in the RSP to save the current
     // pointer position.
@@ -1263,15 +1345,38 @@ void rspq_syncpoint_wait(rspq_syncpoint_t sync_id)
         "deadlock: interrupts are disabled");
 
     // Make sure the RSP is running, otherwise we might be blocking forever.
+    uint32_t t0 = TICKS_READ();
     rspq_flush_internal();
 
-    // Spinwait until the the syncpoint is reached.
+    // Wait until the the syncpoint is reached, which happens in the RSP
+    // interrupt handler. Meanwhile, give the idle callback (if any) a chance
+    // to do some useful work.
     // TODO: with the kernel, it will be possible to wait for the RSP interrupt
     // to happen, without spinwaiting.
     RSP_WAIT_LOOP(200) {
         if (rspq_syncpoint_check(sync_id))
             break;
+        rspq_idle();
     }
+
+    rspq_wait_stats.syncpoint_waits++;
+    rspq_wait_stats.syncpoint_ticks += TICKS_SINCE(t0);
+}
+
+void rspq_set_idle_callback(rspq_idle_callback_t func, void *arg)
+{
+    rspq_idle_func = func;
+    rspq_idle_arg = arg;
+}
+
+void rspq_get_wait_stats(rspq_wait_stats_t *stats)
+{
+    *stats = rspq_wait_stats;
+}
+
+void rspq_reset_wait_stats(void)
+{
+    memset(&rspq_wait_stats, 0, sizeof(rspq_wait_stats));
 }
 
 void rspq_wait(void)
@@ -1320,6 +1425,230 @@ void rspq_signal(uint32_t signal)
 }
 /// @endcond
 
+/** @brief A job recorded in a user queue */
+typedef struct rspq_job_s {
+    rspq_block_t *block;                ///< Commands of the job
+    rspq_syncpoint_t sync;              ///< Syncpoint created after the job was dispatched
+    uint32_t submit_ticks;              ///< Time at which the job was closed
+    struct rspq_job_s *next;            ///< Next job in the list
+} rspq_job_t;
+
+/** @brief A user queue (see #rspq_queue_new) */
+typedef struct rspq_queue_s {
+    const char *name;                   ///< Name of the queue
+    int priority;                       ///< Priority of the queue
+    int weight;                         ///< Weight for the round-robin
+    rspq_job_t *pending;                ///< List of jobs not yet dispatched
+    rspq_job_t **pending_tail;          ///< Tail of the pending list
+    rspq_job_t *inflight;               ///< List of jobs dispatched but not yet reaped
+    rspq_job_t **inflight_tail;         ///< Tail of the inflight list
+    rspq_queue_stats_t stats;           ///< Latency statistics
+    struct rspq_queue_s *next;          ///< Next queue (sorted by priority)
+} rspq_queue_t;
+
+/** @brief Maximum number of completed jobs kept in #rspq_job_pool */
+#define RSPQ_JOB_POOL_SIZE      16
+
+/** @brief List of user queues, sorted by decreasing priority */
+static rspq_queue_t *rspq_queues;
+/** @brief User queue whose job is currently being recorded */
+static rspq_queue_t *rspq_queue_recording;
+/** @brief Job currently being recorded */
+static rspq_job_t *rspq_job_recording;
+/** @brief Completed jobs kept for reuse, together with the first chunk of their block */
+static rspq_job_t *rspq_job_pool;
+/** @brief Number of jobs in #rspq_job_pool */
+static int rspq_job_pool_count;
+
+/** @brief Free all the jobs of a queue that were completed by the RSP, updating stats */
+static void rspq_queue_reap(rspq_queue_t *q)
+{
+    while (q->inflight && rspq_syncpoint_check(q->inflight->sync)) {
+        rspq_job_t *job = q->inflight;
+
+        // Get the time at which the syncpoint was reached from the ring buffer.
+        // If the ring buffer was overwritten already, just use the current time
+        // (this can only happen if we are reaping very late).
+        uint32_t done_ticks = TICKS_READ();
+        if ((uint32_t)__rspq_syncpoints_done - (uint32_t)job->sync < RSPQ_SYNCPOINT_TICKS_COUNT)
+            done_ticks = rspq_syncpoint_ticks[job->sync & (RSPQ_SYNCPOINT_TICKS_COUNT-1)];
+
+        uint32_t latency = TICKS_DISTANCE(job->submit_ticks, done_ticks);
+        q->stats.jobs_completed++;
+        q->stats.latency_sum += latency;
+        if (latency > q->stats.latency_max) q->stats.latency_max = latency;
+
+        q->inflight = job->next;
+        if (!q->inflight) q->inflight_tail = &q->inflight;
+
+        // Keep the job in the pool, so that recording a new one does
+        // not need to allocate memory.
+        if (rspq_job_pool_count < RSPQ_JOB_POOL_SIZE) {
+            rspq_block_free_chunks(job->block, true);
+            job->next = rspq_job_pool;
+            rspq_job_pool = job;
+            rspq_job_pool_count++;
+        } else {
+            rspq_block_free(job->block);
+            free(job);
+        }
+    }
+}
+
+rspq_queue_t* rspq_queue_new(const char *name, int priority, int weight)
+{
+    assertf(weight >= 1, "invalid weight for queue %s: %d", name, weight);
+
+    rspq_queue_t *q = calloc(1, sizeof(rspq_queue_t));
+    q->name = name;
+    q->priority = priority;
+    q->weight = weight;
+    q->pending_tail = &q->pending;
+    q->inflight_tail = &q->inflight;
+
+    // Insert in the list, keeping it sorted by decreasing priority. Queues with
+    // the same priority are kept in creation order.
+    rspq_queue_t **prev = &rspq_queues;
+    while (*prev && (*prev)->priority >= priority)
+        prev = &(*prev)->next;
+    q->next = *prev;
+    *prev = q;
+    return q;
+}
+
+void rspq_queue_free(rspq_queue_t *queue)
+{
+    assertf(!queue->pending, "queue %s still has pending jobs", queue->name);
+    assertf(rspq_queue_recording != queue, "queue %s is recording a job", queue->name);
+
+    // Wait for all jobs to be finished, and free them.
+    if (queue->inflight) {
+        rspq_syncpoint_t last = 0;
+        for (rspq_job_t *job = queue->inflight; job; job = job->next)
+            last = job->sync;
+        rspq_syncpoint_wait(last);
+        rspq_queue_reap(queue);
+    }
+
+    rspq_queue_t **prev = &rspq_queues;
+    while (*prev != queue)
+        prev = &(*prev)->next;
+    *prev = queue->next;
+    free(queue);
+
+    // Release the job pool when the last queue is destroyed
+    if (!rspq_queues) {
+        while (rspq_job_pool) {
+            rspq_job_t *job = rspq_job_pool;
+            rspq_job_pool = job->next;
+            free_uncached(job->block);
+            free(job);
+        }
+        rspq_job_pool_count = 0;
+    }
+}
+
+void rspq_queue_begin(rspq_queue_t *queue)
+{
+    assertf(!rspq_queue_recording, "a job for queue %s is already being recorded", rspq_queue_recording->name);
+
+    rspq_job_t *job = rspq_job_pool;
+    if (job) {
+        rspq_job_pool = job->next;
+        rspq_job_pool_count--;
+        rspq_block_begin_chunk(job->block);
+    } else {
+        job = malloc(sizeof(rspq_job_t));
+        rspq_block_begin();
+    }
+    rspq_queue_recording = queue;
+    rspq_job_recording = job;
+}
+
+void rspq_queue_end(void)
+{
+    assertf(rspq_queue_recording, "a job was not being recorded");
+    rspq_queue_t *q = rspq_queue_recording;
+    rspq_queue_recording = NULL;
+
+    rspq_job_t *job = rspq_job_recording;
+    rspq_job_recording = NULL;
+    job->block = rspq_block_end();
+    job->sync = 0;
+    job->next = NULL;
+    job->submit_ticks = TICKS_READ();
+
+    *q->pending_tail = job;
+    q->pending_tail = &job->next;
+    q->stats.jobs_submitted++;
+    q->stats.jobs_pending++;
+}
+
+/** @brief Dispatch the first pending job of a queue to the RSP */
+static void rspq_queue_dispatch_job(rspq_queue_t *q)
+{
+    rspq_job_t *job = q->pending;
+    q->pending = job->next;
+    if (!q->pending) q->pending_tail = &q->pending;
+    q->stats.jobs_pending--;
+
+    rspq_block_run(job->block);
+    job->sync = rspq_syncpoint_new();
+
+    job->next = NULL;
+    *q->inflight_tail = job;
+    q->inflight_tail = &job->next;
+}
+
+void rspq_queue_dispatch(void)
+{
+    assertf(!rspq_block, "cannot dispatch queues while recording a block");
+    assertf(rspq_ctx != &highpri, "cannot dispatch queues in highpri mode");
+
+    rspq_queue_t *group = rspq_queues;
+    while (group) {
+        // Find the range of queues with the same priority.
+        rspq_queue_t *group_end = group->next;
+        while (group_end && group_end->priority == group->priority)
+            group_end = group_end->next;
+
+        // Run the weighted round-robin within the group, until all
+        // queues are empty.
+        bool dispatched;
+        do {
+            dispatched = false;
+            for (rspq_queue_t *q = group; q != group_end; q = q->next) {
+                for (int i = 0; i < q->weight && q->pending; i++) {
+                    rspq_queue_dispatch_job(q);
+                    dispatched = true;
+                }
+            }
+        } while (dispatched);
+
+        group = group_end;
+    }
+
+    rspq_flush();
+
+    // Release memory of the jobs that were completed in the meanwhile.
+    for (rspq_queue_t *q = rspq_queues; q; q = q->next)
+        rspq_queue_reap(q);
+}
+
+void rspq_queue_get_stats(rspq_queue_t *queue, rspq_queue_stats_t *stats)
+{
+    rspq_queue_reap(queue);
+    *stats = queue->stats;
+}
+
+void rspq_queue_reset_stats(rspq_queue_t *queue)
+{
+    rspq_queue_reap(queue);
+    uint32_t pending = queue->stats.jobs_pending;
+    memset(&queue->stats, 0, sizeof(rspq_queue_stats_t));
+    queue->stats.jobs_pending = pending;
+}
+
 /* Extern inline instantiations. */
 extern inline rspq_write_t rspq_write_begin(uint32_t ovl_id, uint32_t cmd_id, int size);
 extern inline void rspq_write_arg(rspq_write_t *w, uint32_t value);
@@ -220,6 +220,7 @@ typedef struct rsp_queue_s {
     uint32_t rspq_rdp_sentinel;          ///< Current RDP RDRAM end pointer (when rdp_current reaches this, the buffer is full)
     rspq_rdp_mode_t rdp_mode;            ///< RDP current render mode definition
     uint64_t rdp_scissor_rect;           ///< Current RDP scissor rectangle
+    uint64_t rdp_combiner_final;         ///< Last SET_COMBINE calculated by the render mode API
     uint32_t rspq_rdp_buffers[2];        ///< RDRAM Address of dynamic RDP buffers
     uint32_t rspq_rdp_current;           ///< Current RDP RDRAM write pointer (normally DP_END)
     uint32_t rdp_fill_color;             ///< Current RDP fill color
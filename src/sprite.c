@@ -7,6 +7,7 @@
 #include "asset.h"
 #include "utils.h"
 #include "rdpq_tex.h"
+#include "rdpq/rdpq_sprite_internal.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -160,9 +161,39 @@ uint16_t* sprite_get_palette(sprite_t *sprite) {
     sprite_ext_t *sx = __sprite_ext(sprite);
     if(!sx || !sx->pal_file_pos)
         return NULL;
+    if (sx->flags & SPRITE_FLAG_SHARED_PALETTE)
+        return (uint16_t*)sx->pal_file_pos;
     return (void*)sprite + sx->pal_file_pos;
 }
 
+sprite_palette_t *sprite_palette_load(const char *fn)
+{
+    int sz;
+    sprite_palette_t *pal = asset_load(fn, &sz);
+    assertf(memcmp(pal->magic, SPRITE_PALETTE_MAGIC, 3) == 0, "invalid sprite palette file: %s", fn);
+    assertf(pal->version == SPRITE_PALETTE_VERSION, "unsupported sprite palette version (%d): %s; please regenerate your asset files", pal->version, fn);
+    data_cache_hit_writeback(pal, sz);
+    return pal;
+}
+
+void sprite_palette_free(sprite_palette_t *pal)
+{
+    free(pal);
+}
+
+uint16_t *sprite_palette_get_colors(sprite_palette_t *pal, int *num_colors)
+{
+    if (num_colors) *num_colors = pal->num_colors;
+    return pal->colors;
+}
+
+void sprite_set_palette(sprite_t *sprite, sprite_palette_t *pal)
+{
+    sprite_ext_t *sx = __sprite_ext(sprite);
+    assertf(sx && (sx->flags & SPRITE_FLAG_SHARED_PALETTE), "sprite does not use a shared palette");
+    sx->pal_file_pos = pal ? (uint32_t)pal->colors : 0;
+}
+
 surface_t sprite_get_tile(sprite_t *sprite, int h, int v) {
     static int tile_width = 0, tile_height = 0;
 
@@ -224,4 +255,71 @@ bool sprite_fits_tmem(sprite_t *sprite)
     return (sx->flags & SPRITE_FLAG_FITS_TMEM) != 0;
 }
 
+sprite_atlas_t *sprite_atlas_load(const char *fn)
+{
+    int sz;
+    sprite_atlas_header_t *hdr = asset_load(fn, &sz);
+    assertf(memcmp(hdr->magic, SPRITE_ATLAS_MAGIC, 3) == 0, "invalid sprite atlas file: %s", fn);
+    assertf(hdr->version == SPRITE_ATLAS_VERSION, "unsupported sprite atlas version (%d): %s; please regenerate your asset files", hdr->version, fn);
+
+    sprite_atlas_t *atlas = malloc(sizeof(sprite_atlas_t));
+    atlas->hdr = hdr;
+    atlas->images = (void*)hdr + hdr->images_offset;
+    atlas->pages = malloc(hdr->num_pages * sizeof(sprite_t*));
+
+    sprite_atlas_page_t *pages = (void*)hdr + hdr->pages_offset;
+    for (int i=0; i<hdr->num_pages; i++)
+        atlas->pages[i] = sprite_load_buf((void*)hdr + pages[i].sprite_offset, pages[i].sprite_size);
+    return atlas;
+}
+
+void sprite_atlas_free(sprite_atlas_t *atlas)
+{
+    // Another atlas might be allocated at the same address later, so the
+    // page must not be assumed resident in TMEM anymore.
+    __rdpq_sprite_atlas_forget();
+    for (int i=0; i<atlas->hdr->num_pages; i++)
+        sprite_free(atlas->pages[i]);
+    free(atlas->pages);
+    free(atlas->hdr);
+    free(atlas);
+}
+
+int sprite_atlas_get_count(sprite_atlas_t *atlas)
+{
+    return atlas->hdr->num_images;
+}
+
+int sprite_atlas_find(sprite_atlas_t *atlas, const char *name)
+{
+    int lo = 0, hi = atlas->hdr->num_images - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int cmp = strcmp(name, (const char*)atlas->hdr + atlas->images[mid].name_offset);
+        if (cmp == 0) return mid;
+        if (cmp < 0) hi = mid - 1;
+        else lo = mid + 1;
+    }
+    return -1;
+}
+
+sprite_t *sprite_atlas_get(sprite_atlas_t *atlas, int idx, int *s0, int *t0, int *width, int *height)
+{
+    assertf(idx >= 0 && idx < atlas->hdr->num_images, "invalid atlas image index: %d", idx);
+    sprite_atlas_image_t *img = &atlas->images[idx];
+    if (s0) *s0 = img->s0;
+    if (t0) *t0 = img->t0;
+    if (width) *width = img->width;
+    if (height) *height = img->height;
+    return atlas->pages[img->page];
+}
+
+surface_t sprite_atlas_get_pixels(sprite_atlas_t *atlas, int idx)
+{
+    int s0, t0, width, height;
+    sprite_t *page = sprite_atlas_get(atlas, idx, &s0, &t0, &width, &height);
+    surface_t surf = sprite_get_pixels(page);
+    return surface_make_sub(&surf, s0, t0, width, height);
+}
+
 extern inline tex_format_t sprite_get_format(sprite_t *sprite);
@@ -8,6 +8,7 @@
 #define SPRITE_FLAG_HAS_TEXPARMS            0x0008   ///< Sprite contains texture parameters
 #define SPRITE_FLAG_HAS_DETAIL              0x0010   ///< Sprite contains detail texture
 #define SPRITE_FLAG_FITS_TMEM               0x0020   ///< Set if the sprite does fit TMEM without splitting
+#define SPRITE_FLAG_SHARED_PALETTE          0x0040   ///< Sprite uses a palette stored in a separate file (see #sprite_set_palette)
 
 /** 
  * @brief Internal structure used as additional sprite header
@@ -21,7 +22,7 @@
 typedef struct sprite_ext_s {
     uint16_t size;              ///< Size of the structure itself (for forward compatibility)
     uint16_t version;           ///< Version of the structure (currently 1)
-    uint32_t pal_file_pos;      ///< Position of the palette in the file
+    uint32_t pal_file_pos;      ///< Position of the palette in the file (with #SPRITE_FLAG_SHARED_PALETTE: pointer to the colors set by #sprite_set_palette)
     /// Information on LODs
     struct sprite_lod_s {
         uint16_t width;            ///< Width of this LOD
@@ -53,6 +54,60 @@ typedef struct sprite_ext_s {
 
 _Static_assert(sizeof(sprite_ext_t) == 124, "invalid sizeof(sprite_ext_t)");
 
+/** @brief Magic number of sprite atlas files */
+#define SPRITE_ATLAS_MAGIC          "ATL"
+/** @brief Current version of the sprite atlas file format */
+#define SPRITE_ATLAS_VERSION        1
+
+/** @brief Header of a sprite atlas file (created by mksprite) */
+typedef struct {
+    char magic[3];              ///< Magic number (#SPRITE_ATLAS_MAGIC)
+    uint8_t version;            ///< Version of the format (#SPRITE_ATLAS_VERSION)
+    uint16_t num_pages;         ///< Number of pages
+    uint16_t num_images;        ///< Number of images
+    uint32_t pages_offset;      ///< Offset of the page table from the start of the file
+    uint32_t images_offset;     ///< Offset of the image index from the start of the file
+} sprite_atlas_header_t;
+
+/** @brief An image in a sprite atlas file (the index is sorted by name) */
+typedef struct {
+    uint32_t name_offset;       ///< Offset of the name (null-terminated) from the start of the file
+    uint16_t page;              ///< Page containing the image
+    uint16_t s0, t0;            ///< Position of the image within the page
+    uint16_t width, height;     ///< Size of the image
+    uint16_t padding;           ///< Padding
+} sprite_atlas_image_t;
+
+/** @brief A page in a sprite atlas file. Each page is a complete sprite, that fits TMEM. */
+typedef struct {
+    uint32_t sprite_offset;     ///< Offset of the sprite from the start of the file (16-byte aligned)
+    uint32_t sprite_size;       ///< Size of the sprite in bytes
+} sprite_atlas_page_t;
+
+_Static_assert(sizeof(sprite_atlas_header_t) == 16, "invalid sizeof(sprite_atlas_header_t)");
+_Static_assert(sizeof(sprite_atlas_image_t) == 16, "invalid sizeof(sprite_atlas_image_t)");
+
+/** @brief A loaded sprite atlas */
+struct sprite_atlas_s {
+    sprite_atlas_header_t *hdr;     ///< File contents
+    sprite_atlas_image_t *images;   ///< Index of the images
+    struct sprite_s **pages;        ///< Pages, loaded as sprites
+};
+
+/** @brief Magic number of sprite palette files */
+#define SPRITE_PALETTE_MAGIC        "PAL"
+/** @brief Current version of the sprite palette file format */
+#define SPRITE_PALETTE_VERSION      1
+
+/** @brief A palette shared by multiple sprites (as stored in a palette file created by mksprite) */
+struct sprite_palette_s {
+    char magic[3];              ///< Magic number (#SPRITE_PALETTE_MAGIC)
+    uint8_t version;            ///< Version of the format (#SPRITE_PALETTE_VERSION)
+    uint16_t num_colors;        ///< Number of colors (16 for CI4, 256 for CI8)
+    uint16_t padding;           ///< Padding
+    uint16_t colors[];          ///< Colors in RGBA16 format (8-byte aligned)
+};
+
 /** @brief Convert a sprite from the old format with implicit texture format */ 
 bool __sprite_upgrade(sprite_t *sprite);
 
@@ -0,0 +1,286 @@
+/**
+ * @file surface_convert.c
+ * @brief Surface buffers used to draw images: pixel format conversion
+ * @ingroup graphics
+ *
+ * Conversion between two arbitrary formats goes through a small intermediate
+ * buffer of RGBA32 pixels: a chunk of a row of the source is decoded into it,
+ * and then encoded into the destination. The most common conversions
+ * (copies and RGBA32 <-> RGBA16) use direct loops instead, and conversions
+ * between intensity formats (eg: I8 -> IA16) use row kernels that convert
+ * 4 pixels at a time with 32-bit word operations.
+ *
+ * Pixels are accessed as big-endian words independently of the host, and
+ * this file only depends on surface.h, so that it can also be compiled into
+ * the host tools (eg: mksprite) to produce exactly the same output.
+ */
+
+#include "surface.h"
+#include <assert.h>
+#include <string.h>
+#ifdef N64
+#include "debug.h"
+#else
+#define assertf(expr, ...)  assert(expr)
+#endif
+
+/** @brief Number of pixels converted at a time through the intermediate buffer */
+#define CONVERT_CHUNK       64
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define BE16(x)     __builtin_bswap16(x)        ///< Convert a 16-bit big-endian word to host order
+#define BE32(x)     __builtin_bswap32(x)        ///< Convert a 32-bit big-endian word to host order
+#else
+#define BE16(x)     (x)                         ///< Convert a 16-bit big-endian word to host order
+#define BE32(x)     (x)                         ///< Convert a 32-bit big-endian word to host order
+#endif
+
+static inline uint16_t load16(const uint8_t *p) { uint16_t v; memcpy(&v, p, 2); return BE16(v); }
+static inline uint32_t load32(const uint8_t *p) { uint32_t v; memcpy(&v, p, 4); return BE32(v); }
+static inline void store16(uint8_t *p, uint16_t v) { v = BE16(v); memcpy(p, &v, 2); }
+static inline void store32(uint8_t *p, uint32_t v) { v = BE32(v); memcpy(p, &v, 4); }
+
+/** @brief Expand a RGBA 5551 pixel to RGBA 8888, like the RDP does */
+static inline uint32_t rgba16_to_32(uint16_t c)
+{
+    uint32_t r = (c >> 11) & 0x1F, g = (c >> 6) & 0x1F, b = (c >> 1) & 0x1F;
+    r = (r << 3) | (r >> 2);
+    g = (g << 3) | (g >> 2);
+    b = (b << 3) | (b >> 2);
+    return (r << 24) | (g << 16) | (b << 8) | ((c & 1) ? 0xFF : 0);
+}
+
+/** @brief Truncate a RGBA 8888 pixel to RGBA 5551 (alpha is set if >= 0x80) */
+static inline uint16_t rgba32_to_16(uint32_t c)
+{
+    return ((c >> 16) & 0xF800) | ((c >> 13) & 0x07C0) | ((c >> 10) & 0x003E) | ((c >> 7) & 1);
+}
+
+/** @brief Compute the intensity of a RGBA 8888 pixel (BT.601 luma, exact for grays) */
+static inline uint32_t rgba32_to_i(uint32_t c)
+{
+    return ((c >> 24) * 77 + ((c >> 16) & 0xFF) * 150 + ((c >> 8) & 0xFF) * 29) >> 8;
+}
+
+/** @brief Decode a chunk of pixels into RGBA 8888 (4bpp chunks must start at an even pixel) */
+static void decode_chunk(tex_format_t fmt, const uint8_t *src, uint32_t *out, int n)
+{
+    switch (fmt) {
+    case FMT_RGBA32:
+        for (int i=0; i<n; i++) out[i] = load32(src + i*4);
+        break;
+    case FMT_RGBA16:
+        for (int i=0; i<n; i++) out[i] = rgba16_to_32(load16(src + i*2));
+        break;
+    case FMT_IA16:
+        for (int i=0; i<n; i++) {
+            uint32_t v = load16(src + i*2);
+            out[i] = (v >> 8) * 0x01010100 | (v & 0xFF);
+        }
+        break;
+    case FMT_IA8:
+        for (int i=0; i<n; i++) {
+            uint32_t v = src[i];
+            out[i] = (v >> 4) * 0x11111100 | (v & 0xF) * 0x11;
+        }
+        break;
+    case FMT_I8:
+        for (int i=0; i<n; i++) out[i] = src[i] * 0x01010101;
+        break;
+    case FMT_IA4:
+        for (int i=0; i<n; i++) {
+            uint32_t v = (i & 1) ? src[i/2] & 0xF : src[i/2] >> 4;
+            uint32_t I = v >> 1;
+            I = (I << 5) | (I << 2) | (I >> 1);
+            out[i] = I * 0x01010100 | ((v & 1) ? 0xFF : 0);
+        }
+        break;
+    case FMT_I4:
+        for (int i=0; i<n; i++) {
+            uint32_t v = (i & 1) ? src[i/2] & 0xF : src[i/2] >> 4;
+            out[i] = v * 0x11111111;
+        }
+        break;
+    default:
+        assertf(0, "format not supported for conversion: %s", tex_format_name(fmt));
+    }
+}
+
+/** @brief Store a 4-bit pixel, preserving the other pixel in the same byte */
+static inline void store4(uint8_t *dst, int i, uint8_t v)
+{
+    if (i & 1) dst[i/2] = (dst[i/2] & 0xF0) | v;
+    else       dst[i/2] = (dst[i/2] & 0x0F) | (v << 4);
+}
+
+/** @brief Encode a chunk of RGBA 8888 pixels (4bpp chunks must start at an even pixel) */
+static void encode_chunk(tex_format_t fmt, uint8_t *dst, const uint32_t *in, int n)
+{
+    switch (fmt) {
+    case FMT_RGBA32:
+        for (int i=0; i<n; i++) store32(dst + i*4, in[i]);
+        break;
+    case FMT_RGBA16:
+        for (int i=0; i<n; i++) store16(dst + i*2, rgba32_to_16(in[i]));
+        break;
+    case FMT_IA16:
+        for (int i=0; i<n; i++) store16(dst + i*2, (rgba32_to_i(in[i]) << 8) | (in[i] & 0xFF));
+        break;
+    case FMT_IA8:
+        for (int i=0; i<n; i++) dst[i] = (rgba32_to_i(in[i]) & 0xF0) | ((in[i] & 0xFF) >> 4);
+        break;
+    case FMT_I8:
+        for (int i=0; i<n; i++) dst[i] = rgba32_to_i(in[i]);
+        break;
+    case FMT_IA4:
+        for (int i=0; i+1<n; i+=2) {
+            dst[i/2] = ((rgba32_to_i(in[i]) >> 4) & 0xE) << 4 | (in[i] & 0x80) >> 3 |
+                       ((rgba32_to_i(in[i+1]) >> 4) & 0xE) | (in[i+1] & 0x80) >> 7;
+        }
+        if (n & 1) store4(dst, n-1, ((rgba32_to_i(in[n-1]) >> 4) & 0xE) | (in[n-1] & 0x80) >> 7);
+        break;
+    case FMT_I4:
+        for (int i=0; i+1<n; i+=2)
+            dst[i/2] = (rgba32_to_i(in[i]) & 0xF0) | (rgba32_to_i(in[i+1]) >> 4);
+        if (n & 1) store4(dst, n-1, rgba32_to_i(in[n-1]) >> 4);
+        break;
+    default:
+        assertf(0, "format not supported for conversion: %s", tex_format_name(fmt));
+    }
+}
+
+/** 
+ * @brief A kernel that converts a row of pixels between two formats
+ * 
+ * Each iteration converts 4 pixels, reading and writing whole 32-bit words
+ * when possible. The number of pixels must be a multiple of 4.
+ */
+typedef void (*convert_row_func)(uint8_t *dst, const uint8_t *src, int n);
+
+/** @brief Convert a row from I8 to IA16 (alpha is equal to the intensity) */
+static void convert_row_i8_ia16(uint8_t *dst, const uint8_t *src, int n)
+{
+    for (int i=0; i<n; i+=4) {
+        // Duplicate each byte: 0xAABBCCDD -> 0xAAAABBBB 0xCCCCDDDD
+        uint32_t v = load32(src + i);
+        uint32_t hi = ((v >> 8) & 0x00FF0000) | ((v >> 16) & 0xFF);
+        uint32_t lo = ((v << 8) & 0x00FF0000) | (v & 0xFF);
+        store32(dst + i*2 + 0, hi * 0x101);
+        store32(dst + i*2 + 4, lo * 0x101);
+    }
+}
+
+/** @brief Convert a row from IA16 to I8 (the luma of a gray is its intensity) */
+static void convert_row_ia16_i8(uint8_t *dst, const uint8_t *src, int n)
+{
+    for (int i=0; i<n; i+=4) {
+        uint32_t v0 = load32(src + i*2 + 0);
+        uint32_t v1 = load32(src + i*2 + 4);
+        store32(dst + i, (v0 & 0xFF000000) | ((v0 << 8) & 0x00FF0000) |
+                         ((v1 >> 16) & 0x0000FF00) | ((v1 >> 8) & 0x000000FF));
+    }
+}
+
+/** @brief Convert a row from I8 to IA8, or from IA8 to I8 (same operation) */
+static void convert_row_i8_ia8(uint8_t *dst, const uint8_t *src, int n)
+{
+    // Replicate the high nibble of each byte in the low nibble
+    for (int i=0; i<n; i+=4) {
+        uint32_t v = load32(src + i);
+        store32(dst + i, (v & 0xF0F0F0F0) | ((v >> 4) & 0x0F0F0F0F));
+    }
+}
+
+/** @brief Convert a row from I4 to I8 */
+static void convert_row_i4_i8(uint8_t *dst, const uint8_t *src, int n)
+{
+    // Move each nibble to its own byte and replicate it: 0xABCD -> 0xAABBCCDD
+    for (int i=0; i<n; i+=4) {
+        uint32_t v = load16(src + i/2);
+        v = ((v & 0xF000) << 12) | ((v & 0x0F00) << 8) | ((v & 0x00F0) << 4) | (v & 0x000F);
+        store32(dst + i, v * 0x11);
+    }
+}
+
+/** @brief Convert a row from I8 to I4 */
+static void convert_row_i8_i4(uint8_t *dst, const uint8_t *src, int n)
+{
+    // Pack the high nibbles of each byte: 0xA?B?C?D? -> 0xABCD
+    for (int i=0; i<n; i+=4) {
+        uint32_t v = load32(src + i);
+        store16(dst + i/2, ((v >> 16) & 0xF000) | ((v >> 12) & 0x0F00) | ((v >> 8) & 0x00F0) | ((v >> 4) & 0x000F));
+    }
+}
+
+/** @brief Return the row kernel for a conversion (NULL if there is none) */
+static convert_row_func convert_row_kernel(tex_format_t sfmt, tex_format_t dfmt)
+{
+    if (sfmt == FMT_I8 && dfmt == FMT_IA16)  return convert_row_i8_ia16;
+    if (sfmt == FMT_IA16 && dfmt == FMT_I8)  return convert_row_ia16_i8;
+    if (sfmt == FMT_I8 && dfmt == FMT_IA8)   return convert_row_i8_ia8;
+    if (sfmt == FMT_IA8 && dfmt == FMT_I8)   return convert_row_i8_ia8;
+    if (sfmt == FMT_I4 && dfmt == FMT_I8)    return convert_row_i4_i8;
+    if (sfmt == FMT_I8 && dfmt == FMT_I4)    return convert_row_i8_i4;
+    return NULL;
+}
+
+void surface_convert(surface_t *dst, const surface_t *src)
+{
+    assertf(dst->width == src->width && dst->height == src->height,
+        "surfaces must have the same size: %dx%d vs %dx%d",
+        dst->width, dst->height, src->width, src->height);
+
+    tex_format_t sfmt = surface_get_format(src);
+    tex_format_t dfmt = surface_get_format(dst);
+    const uint8_t *srow = src->buffer;
+    uint8_t *drow = dst->buffer;
+    int width = src->width;
+
+    if (sfmt == dfmt) {
+        // Plain copy. Any format is supported, including palettized ones.
+        // The last pixel of an odd 4bpp row shares the byte with a pixel that
+        // might not belong to the destination surface, so copy it separately.
+        bool odd4 = TEX_FORMAT_BITDEPTH(sfmt) == 4 && (width & 1);
+        int nbytes = TEX_FORMAT_PIX2BYTES(sfmt, odd4 ? width-1 : width);
+        for (int y=0; y<src->height; y++) {
+            memmove(drow, srow, nbytes);
+            if (odd4) store4(drow, width-1, srow[nbytes] >> 4);
+            srow += src->stride; drow += dst->stride;
+        }
+        return;
+    }
+
+    if (sfmt == FMT_RGBA32 && dfmt == FMT_RGBA16) {
+        for (int y=0; y<src->height; y++) {
+            for (int x=0; x<width; x++)
+                store16(drow + x*2, rgba32_to_16(load32(srow + x*4)));
+            srow += src->stride; drow += dst->stride;
+        }
+        return;
+    }
+
+    if (sfmt == FMT_RGBA16 && dfmt == FMT_RGBA32) {
+        for (int y=0; y<src->height; y++) {
+            for (int x=0; x<width; x++)
+                store32(drow + x*4, rgba16_to_32(load16(srow + x*2)));
+            srow += src->stride; drow += dst->stride;
+        }
+        return;
+    }
+
+    // Use the row kernel if there is one, and convert the remaining pixels
+    // (less than 4) through the intermediate buffer.
+    convert_row_func kernel = convert_row_kernel(sfmt, dfmt);
+    int xk = kernel ? width & ~3 : 0;
+
+    uint32_t buf[CONVERT_CHUNK];
+    for (int y=0; y<src->height; y++) {
+        if (xk) kernel(drow, srow, xk);
+        for (int x=xk; x<width; x+=CONVERT_CHUNK) {
+            int n = width - x < CONVERT_CHUNK ? width - x : CONVERT_CHUNK;
+            decode_chunk(sfmt, srow + TEX_FORMAT_PIX2BYTES(sfmt, x), buf, n);
+            encode_chunk(dfmt, drow + TEX_FORMAT_PIX2BYTES(dfmt, x), buf, n);
+        }
+        srow += src->stride; drow += dst->stride;
+    }
+}
@@ -0,0 +1,162 @@
+#include <libdragon.h>
+#include "../src/vi.h"
+
+void display_show_force(display_context_t disp);
+
+void test_display_stats(TestContext *ctx)
+{
+    // The display is initialized by the console of the testsuite
+    ASSERT(display_get_num_buffers() >= 2, "display not initialized");
+    display_stats_t stats;
+
+    // Make sure a frame is on screen
+    display_show(display_get());
+    wait_ms(50);
+
+    // Reset: everything is zero (block vblanks between the two calls)
+    disable_interrupts();
+    display_reset_stats();
+    display_get_stats(&stats);
+    enable_interrupts();
+    ASSERT_EQUAL_UNSIGNED(stats.frames, 0, "frames not reset");
+    ASSERT_EQUAL_UNSIGNED(stats.vblanks, 0, "vblanks not reset");
+    ASSERT_EQUAL_UNSIGNED(stats.waits, 0, "waits not reset");
+    ASSERT_EQUAL_UNSIGNED(stats.latency_max, 0, "latency not reset");
+    for (int i=0; i<DISPLAY_STATS_HIST_SIZE; i++)
+        ASSERT_EQUAL_UNSIGNED(stats.vblank_hist[i], 0, "histogram not reset");
+
+    // Show some frames, and wait for the last one to be on screen
+    const int NUM_FRAMES = 4;
+    for (int i=0; i<NUM_FRAMES; i++)
+        display_show(display_get());
+    wait_ms(100);
+
+    display_get_stats(&stats);
+    ASSERT_EQUAL_UNSIGNED(stats.waits, NUM_FRAMES, "invalid number of waits");
+    ASSERT_EQUAL_UNSIGNED(stats.frames, NUM_FRAMES, "invalid number of frames");
+    ASSERT(stats.vblanks >= NUM_FRAMES, "too few vblanks: %lu", stats.vblanks);
+    ASSERT(stats.wait_max <= stats.wait_total, "invalid wait times");
+    ASSERT(stats.latency_last > 0 && stats.latency_last <= stats.latency_max, "invalid last latency");
+    ASSERT(stats.latency_max <= stats.latency_total, "invalid latency times");
+
+    // A frame was already shown before the reset, so the duration of each
+    // previous frame is recorded when a new one is shown
+    uint32_t hist_total = 0;
+    for (int i=0; i<DISPLAY_STATS_HIST_SIZE; i++)
+        hist_total += stats.vblank_hist[i];
+    ASSERT_EQUAL_UNSIGNED(hist_total, NUM_FRAMES, "invalid histogram total");
+
+    // A forced flip counts the frame, but does not count as a vblank
+    surface_t *disp = display_get();
+    display_stats_t before;
+    disable_interrupts();
+    display_get_stats(&before);
+    display_show_force(disp);
+    display_get_stats(&stats);
+    enable_interrupts();
+    ASSERT_EQUAL_UNSIGNED(stats.frames, before.frames + 1, "forced frame not counted");
+    ASSERT_EQUAL_UNSIGNED(stats.vblanks, before.vblanks, "forced flip counted as a vblank");
+    ASSERT_EQUAL_MEM((uint8_t*)stats.vblank_hist, (uint8_t*)before.vblank_hist, sizeof(stats.vblank_hist),
+        "forced flip updated the histogram");
+    ASSERT_EQUAL_UNSIGNED(stats.missed_vblanks, before.missed_vblanks, "forced flip counted as a missed vblank");
+
+    // Statistics keep accumulating until they are reset
+    display_show(display_get());
+    wait_ms(50);
+    display_get_stats(&stats);
+    ASSERT_EQUAL_UNSIGNED(stats.frames, NUM_FRAMES + 2, "statistics not accumulated");
+    ASSERT_EQUAL_UNSIGNED(stats.waits, NUM_FRAMES + 2, "waits not accumulated");
+
+    disable_interrupts();
+    display_reset_stats();
+    display_get_stats(&stats);
+    enable_interrupts();
+    ASSERT_EQUAL_UNSIGNED(stats.frames, 0, "frames not reset");
+    ASSERT_EQUAL_UNSIGNED(stats.waits, 0, "waits not reset");
+    ASSERT_EQUAL_UNSIGNED(stats.latency_total, 0, "latency not reset");
+}
+
+void test_display_frame_size(TestContext *ctx)
+{
+    ASSERT(display_get_num_buffers() >= 2, "display not initialized");
+    int width = display_get_width(), height = display_get_height();
+
+    // The configured size is the one that is shown
+    surface_t *disp = display_get();
+    display_set_frame_size(disp, width/2, height/2);
+    display_show(disp);
+    wait_ms(50);
+    ASSERT_EQUAL_HEX(*VI_X_SCALE, VI_X_SCALE_SET(width/2), "invalid horizontal scale");
+
+    // The full size is restored on the next buffer
+    display_show(display_get());
+    wait_ms(50);
+    ASSERT_EQUAL_HEX(*VI_X_SCALE, VI_X_SCALE_SET(width), "horizontal scale not restored");
+}
+
+void test_display_pacing(TestContext *ctx)
+{
+    ASSERT(display_get_num_buffers() >= 2, "display not initialized");
+    int old_pacing = display_get_frame_pacing();
+    DEFER(display_set_frame_pacing(old_pacing));
+    display_stats_t stats;
+
+    // Make sure a frame is on screen, then hold each frame for 2 vblanks
+    display_show(display_get());
+    wait_ms(50);
+    display_set_frame_pacing(2);
+
+    disable_interrupts();
+    display_reset_stats();
+    enable_interrupts();
+
+    // Queue frames as fast as possible: each one is ready well before
+    // it is due, so pacing alone decides how long the previous one is shown
+    const int NUM_FRAMES = 6;
+    for (int i=0; i<NUM_FRAMES; i++)
+        display_show(display_get());
+    wait_ms(100);
+
+    display_get_stats(&stats);
+    ASSERT_EQUAL_UNSIGNED(stats.frames, NUM_FRAMES, "invalid number of frames");
+    ASSERT_EQUAL_UNSIGNED(stats.forced_flips, 0, "paced frames counted as forced flips");
+    ASSERT_EQUAL_UNSIGNED(stats.vblank_hist[0], 0, "frame shown for less than the pacing");
+
+    // The first frame replaces the one shown before the reset, which was
+    // on screen for longer; all the others are held exactly 2 vblanks
+    uint32_t hist_total = 0;
+    for (int i=0; i<DISPLAY_STATS_HIST_SIZE; i++)
+        hist_total += stats.vblank_hist[i];
+    ASSERT_EQUAL_UNSIGNED(hist_total, NUM_FRAMES, "invalid histogram total");
+    ASSERT(stats.vblank_hist[1] >= NUM_FRAMES-1, "frames not held for 2 vblanks: %lu", stats.vblank_hist[1]);
+    ASSERT(stats.late_frames <= 1, "too many late frames: %lu", stats.late_frames);
+    ASSERT(stats.vblanks >= 2*(NUM_FRAMES-1), "too few vblanks: %lu", stats.vblanks);
+
+    // A forced flip ignores pacing: it is shown right away and counted
+    // both as a frame and as a forced flip, without touching the histogram
+    surface_t *disp = display_get();
+    display_stats_t before;
+    disable_interrupts();
+    display_get_stats(&before);
+    display_show_force(disp);
+    display_get_stats(&stats);
+    enable_interrupts();
+    ASSERT_EQUAL_UNSIGNED(stats.frames, before.frames + 1, "forced frame not counted");
+    ASSERT_EQUAL_UNSIGNED(stats.forced_flips, before.forced_flips + 1, "forced flip not counted");
+    ASSERT_EQUAL_MEM((uint8_t*)stats.vblank_hist, (uint8_t*)before.vblank_hist, sizeof(stats.vblank_hist),
+        "forced flip updated the histogram");
+
+    // Paced frames after it are not counted as forced
+    display_show(display_get());
+    display_show(display_get());
+    wait_ms(50);
+    display_get_stats(&stats);
+    ASSERT_EQUAL_UNSIGNED(stats.frames, before.frames + 3, "frames after the forced flip not counted");
+    ASSERT_EQUAL_UNSIGNED(stats.forced_flips, before.forced_flips + 1, "paced frames counted as forced flips");
+
+    disable_interrupts();
+    display_reset_stats();
+    display_get_stats(&stats);
+    enable_interrupts();
+    ASSERT_EQUAL_UNSIGNED(stats.forced_flips, 0, "forced flips not reset");
+}
@@ -0,0 +1,182 @@
+#include <libdragon.h>
+
+static uint32_t gfx_get(const void *buf, int bpp, int idx)
+{
+    return bpp == 16 ? ((const uint16_t*)buf)[idx] : ((const uint32_t*)buf)[idx];
+}
+
+static void gfx_put(void *buf, int bpp, int idx, uint32_t c)
+{
+    if (bpp == 16) ((uint16_t*)buf)[idx] = c;
+    else           ((uint32_t*)buf)[idx] = c;
+}
+
+static uint32_t gfx_random_color(int bpp)
+{
+    if (bpp == 16)
+        return RANDN(65536);
+    // Mix fully transparent, fully opaque and semi-transparent pixels
+    uint32_t rgb = (RANDN(65536) << 16) | (RANDN(256) << 8);
+    switch (RANDN(3)) {
+        case 0:  return rgb;
+        case 1:  return rgb | 0xFF;
+        default: return rgb | RANDN(256);
+    }
+}
+
+// Allocate a sprite filled with random pixels
+static sprite_t* gfx_sprite_alloc(tex_format_t fmt, int width, int height, int hslices, int vslices)
+{
+    int bpp = TEX_FORMAT_BITDEPTH(fmt);
+    sprite_t *s = calloc(1, sizeof(sprite_t) + width * height * bpp / 8);
+    s->width = width;
+    s->height = height;
+    s->flags = fmt;
+    s->hslices = hslices;
+    s->vslices = vslices;
+    for (int i=0; i<width*height; i++)
+        gfx_put(s->data, bpp, i, gfx_random_color(bpp));
+    return s;
+}
+
+// Reference implementation of graphics_draw_sprite / graphics_draw_sprite_trans
+static void gfx_ref_sprite(void *buf, int bpp, int w, int h, int x, int y, sprite_t *s, bool trans)
+{
+    for (int sy=0; sy<s->height; sy++) {
+        for (int sx=0; sx<s->width; sx++) {
+            int dx = x+sx, dy = y+sy;
+            if (dx < 0 || dy < 0 || dx >= w || dy >= h) continue;
+            uint32_t c = gfx_get(s->data, bpp, sy*s->width + sx);
+            int idx = dy*w + dx;
+            if (trans && bpp == 16) {
+                if (!(c & 1)) continue;
+            } else if (trans) {
+                uint32_t a = c & 0xFF;
+                if (a == 0) continue;
+                if (a != 0xFF) {
+                    uint32_t d = gfx_get(buf, bpp, idx);
+                    uint32_t r = 0xFF;
+                    for (int sh=8; sh<32; sh+=8) {
+                        uint32_t sc = (c >> sh) & 0xFF, dc = (d >> sh) & 0xFF;
+                        r |= ((sc*a + dc*(255-a)) >> 8) << sh;
+                    }
+                    c = r;
+                }
+            }
+            gfx_put(buf, bpp, idx, c);
+        }
+    }
+}
+
+// Reference implementation of graphics_draw_character with a sprite font
+static void gfx_ref_char(void *buf, int bpp, int w, int h, int x, int y, sprite_t *font, int glyph, uint32_t fg, uint32_t bg)
+{
+    int fw = font->width / font->hslices;
+    int fh = font->height / font->vslices;
+    int gx = (glyph % font->hslices) * fw;
+    int gy = (glyph / font->hslices) * fh;
+    bool trans = bpp == 16 ? !(bg & 1) : !(bg & 0xFF);
+
+    for (int yp=0; yp<fh; yp++) {
+        for (int xp=0; xp<fw; xp++) {
+            int dx = x+xp, dy = y+yp;
+            if (dx < 0 || dy < 0 || dx >= w || dy >= h) continue;
+            uint32_t c = gfx_get(font->data, bpp, (gy+yp)*font->width + gx+xp);
+            bool opaque = bpp == 16 ? (c & 1) : (c & 0xFF);
+            if (opaque)      gfx_put(buf, bpp, dy*w + dx, fg);
+            else if (!trans) gfx_put(buf, bpp, dy*w + dx, bg);
+        }
+    }
+}
+
+static void gfx_test_depth(TestContext *ctx, tex_format_t fmt)
+{
+    const int W = 100, H = 40;
+    const int bpp = TEX_FORMAT_BITDEPTH(fmt);
+    const int size = W * H * bpp / 8;
+
+    surface_t fb = surface_alloc(fmt, W, H);
+    DEFER(surface_free(&fb));
+    ASSERT_EQUAL_UNSIGNED(fb.stride, W * bpp / 8, "unexpected surface stride");
+    void *ref = malloc(size);
+    DEFER(free(ref));
+
+    // Unaligned destinations, then clipping at each of the four edges and at corners
+    static const int pos[][2] = {
+        { 1, 1 }, { 2, 3 }, { 3, 0 }, { 5, 2 },
+        { -5, 2 }, { 4, -3 }, { 90, 4 }, { 6, 37 },
+        { -3, -2 }, { 93, 35 }, { -40, 10 },
+    };
+    const int num_pos = sizeof(pos) / sizeof(pos[0]);
+
+    #define FILL_BACKGROUND() ({ \
+        for (int i=0; i<W*H; i++) gfx_put(ref, bpp, i, gfx_random_color(bpp)); \
+        memcpy(fb.buffer, ref, size); \
+    })
+
+    // Sprites narrower and wider than 64 pixels, with odd widths
+    sprite_t *sprites[2] = {
+        gfx_sprite_alloc(fmt, 13, 7, 1, 1),
+        gfx_sprite_alloc(fmt, 71, 5, 1, 1),
+    };
+    DEFER(free(sprites[0]); free(sprites[1]));
+
+    for (int s=0; s<2; s++) {
+        for (int p=0; p<num_pos; p++) {
+            for (int trans=0; trans<2; trans++) {
+                LOG("sprite %dx%d at (%d,%d) trans=%d\n", sprites[s]->width, sprites[s]->height, pos[p][0], pos[p][1], trans);
+                FILL_BACKGROUND();
+                if (trans) graphics_draw_sprite_trans(&fb, pos[p][0], pos[p][1], sprites[s]);
+                else       graphics_draw_sprite(&fb, pos[p][0], pos[p][1], sprites[s]);
+                gfx_ref_sprite(ref, bpp, W, H, pos[p][0], pos[p][1], sprites[s], trans);
+                ASSERT_EQUAL_MEM((uint8_t*)fb.buffer, (uint8_t*)ref, size,
+                    "sprite %dx%d at (%d,%d) trans=%d", sprites[s]->width, sprites[s]->height, pos[p][0], pos[p][1], trans);
+            }
+        }
+    }
+
+    // Sprite fonts of 4 glyphs, narrower and wider than 64 pixels
+    sprite_t *fonts[2] = {
+        gfx_sprite_alloc(fmt, 4*5, 6, 4, 1),
+        gfx_sprite_alloc(fmt, 4*70, 6, 4, 1),
+    };
+    DEFER(free(fonts[0]); free(fonts[1]));
+    DEFER(graphics_set_default_font());
+    DEFER(graphics_set_color(0xFFFFFFFF, 0x00000000));
+
+    const uint32_t fg = bpp == 16 ? 0xF801 : 0xFF0000FF;
+    const uint32_t bgs[2] = {
+        bpp == 16 ? 0x07C0 : 0x00FF0000,    // transparent
+        bpp == 16 ? 0x07C1 : 0x00FF00FF,    // opaque
+    };
+
+    for (int f=0; f<2; f++) {
+        graphics_set_font_sprite(fonts[f]);
+        for (int p=0; p<num_pos; p++) {
+            for (int b=0; b<2; b++) {
+                int glyph = 1 + (p % 3);
+                LOG("font %d glyph %d at (%d,%d) opaque=%d\n", f, glyph, pos[p][0], pos[p][1], b);
+                FILL_BACKGROUND();
+                graphics_set_color(fg, bgs[b]);
+                graphics_draw_character(&fb, pos[p][0], pos[p][1], glyph);
+                gfx_ref_char(ref, bpp, W, H, pos[p][0], pos[p][1], fonts[f], glyph, fg, bgs[b]);
+                ASSERT_EQUAL_MEM((uint8_t*)fb.buffer, (uint8_t*)ref, size,
+                    "font %d glyph %d at (%d,%d) opaque=%d", f, glyph, pos[p][0], pos[p][1], b);
+            }
+        }
+    }
+
+    #undef FILL_BACKGROUND
+}
+
+void test_graphics_blit16(TestContext *ctx)
+{
+    SRAND(16);
+    gfx_test_depth(ctx, FMT_RGBA16);
+}
+
+void test_graphics_blit32(TestContext *ctx)
+{
+    SRAND(32);
+    gfx_test_depth(ctx, FMT_RGBA32);
+}
@@ -0,0 +1,127 @@
+#include <libdragon.h>
+#include "../src/audio/mixer_internal.h"
+
+#define MIXER_INIT(nch) \
+    audio_init(44100, 4); DEFER(audio_close()); \
+    mixer_init(nch); DEFER(mixer_close());
+
+static void mixer_test_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bool seeking)
+{
+    int16_t *dst = samplebuffer_append(sbuf, wlen);
+    for (int i=0; i<wlen; i++)
+        dst[i] = (wpos + i) * 16;
+}
+
+static int mixer_test_event(void *ctx)
+{
+    return 37;
+}
+
+void test_mixer_pos(TestContext *ctx)
+{
+    rspq_init(); DEFER(rspq_close());
+    MIXER_INIT(2);
+
+    // A waveform with a short loop (it fits the sample buffer, so the RSP
+    // follows it), played faster than the output rate, and a waveform without
+    // loop, played slower.
+    waveform_t wloop = {
+        .name = "loop", .bits = 16, .channels = 1, .frequency = 101430,
+        .len = 1000, .loop_len = 300, .read = mixer_test_read,
+    };
+    waveform_t wonce = {
+        .name = "once", .bits = 16, .channels = 1, .frequency = 31000,
+        .len = 12000, .loop_len = 0, .read = mixer_test_read,
+    };
+    waveform_t *waves[2] = { &wloop, &wonce };
+
+    mixer_ch_set_limits(0, 16, wloop.frequency, 0);
+    mixer_ch_play(0, &wloop);
+    mixer_ch_play(1, &wonce);
+
+    // Split the mixing in multiple commands per buffer, sometimes more
+    // than the ones that can be batched in a single RSP job. The event is
+    // removed later, so that the end of the waveform is reached in the last
+    // command of a buffer, and it can be checked.
+    mixer_add_event(37, mixer_test_event, NULL);
+
+    const int MAX_SAMPLES = 200;
+    int16_t *out = malloc_uncached(MAX_SAMPLES * 2 * sizeof(int16_t));
+    DEFER(free_uncached(out));
+
+    SRAND(50);
+    int wraps = 0, ended = 0;
+    uint32_t prev_pos = 0;
+    for (int i=0; i<1000 && mixer_ch_playing(1); i++) {
+        if (i == 50)
+            mixer_remove_event(mixer_test_event, NULL);
+
+        int nsamples = 2 * (1 + RANDN(MAX_SAMPLES/2));
+        LOG("poll %d: %d samples\n", i, nsamples);
+        mixer_poll(out, nsamples);
+
+        for (int ch=0; ch<2; ch++) {
+            if (!mixer_ch_playing(ch))
+                continue;
+
+            // Positions are in bytes (16-bit mono samples), with 12 fractional bits
+            uint32_t len = (uint32_t)waves[ch]->len << 13;
+            uint32_t loop_len = (uint32_t)waves[ch]->loop_len << 13;
+            uint32_t cpu_pos, rsp_pos;
+            __mixer_get_ch_pos(ch, &cpu_pos, &rsp_pos);
+            LOG("ch %d: cpu:%08lx rsp:%08lx len:%08lx\n", ch, cpu_pos, rsp_pos, len);
+
+            if (loop_len) {
+                if (cpu_pos < prev_pos) wraps++;
+                prev_pos = cpu_pos;
+
+                // The RSP follows the loop lazily, so its position might be
+                // past the end: the wrapped position is equivalent.
+                while (rsp_pos >= len)
+                    rsp_pos -= loop_len;
+                ASSERT_EQUAL_HEX(cpu_pos, rsp_pos, "ch %d: wrong position prediction at poll %d", ch, i);
+            } else if (cpu_pos >= len) {
+                // At the end of the waveform, the RSP stops updating the
+                // position, while the CPU stops the channel in the next poll.
+                ASSERT(rsp_pos >= len, "ch %d: RSP position %08lx before the end (%08lx) at poll %d", ch, rsp_pos, len, i);
+                ended++;
+            } else {
+                ASSERT_EQUAL_HEX(cpu_pos, rsp_pos, "ch %d: wrong position prediction at poll %d", ch, i);
+            }
+        }
+    }
+
+    ASSERT(wraps > 0, "the loop was never crossed");
+    ASSERT_EQUAL_SIGNED(ended, 1, "the end of the waveform was not reached");
+    ASSERT(!mixer_ch_playing(1), "the waveform without loop did not stop");
+}
+
+void test_mixer_stall(TestContext *ctx)
+{
+    RDPQ_INIT();
+    MIXER_INIT(1);
+
+    waveform_t wloop = {
+        .name = "loop", .bits = 16, .channels = 1, .frequency = 44100,
+        .len = 1000, .loop_len = 1000, .read = mixer_test_read,
+    };
+    mixer_ch_play(0, &wloop);
+
+    surface_t fb = surface_alloc(FMT_RGBA16, 320, 240);
+    DEFER(surface_free(&fb));
+
+    // Mix in background while the RDP is busy with heavy frames, for a bit
+    // more than one second of audio, so that the stall time is measured.
+    uint32_t t0 = TICKS_READ();
+    while (TICKS_SINCE(t0) < TICKS_FROM_MS(1200)) {
+        mixer_try_play();
+
+        rdpq_attach(&fb, NULL);
+        rdpq_set_mode_fill(RGBA32(0, 0, 0, 0));
+        for (int i=0; i<64; i++)
+            rdpq_fill_rectangle(0, 0, 320, 240);
+        rdpq_detach_wait();
+    }
+
+    LOG("mixer stall: %d us per second of audio\n", mixer_get_stall_us());
+}
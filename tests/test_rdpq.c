@@ -2,6 +2,7 @@
 #include <math.h>
 #include "../src/rspq/rspq_internal.h"
 #include "../src/rdpq/rdpq_internal.h"
+#include "../src/rdpq/rdpq_debug_internal.h"
 #include <rdpq_constants.h> 
 
 #define BITS(v, b, e)  ((unsigned int)((v) << (63-(e)) >> (63-(e)+(b)))) 
@@ -496,6 +497,217 @@ void test_rdpq_block_nested(TestContext *ctx)
     ASSERT_EQUAL_HEX(rdp_stream[5]>>56, 0xFB, "SET_ENV_COLOR not in position 3");
 }
 
+void test_rdpq_block_optimize(TestContext *ctx)
+{
+    RDPQ_INIT();
+    debug_rdp_stream_init();
+
+    const int WIDTH = 16;
+    surface_t fb1 = surface_alloc(FMT_RGBA32, WIDTH, WIDTH);
+    DEFER(surface_free(&fb1));
+    surface_t fb2 = surface_alloc(FMT_RGBA32, WIDTH, WIDTH);
+    DEFER(surface_free(&fb2));
+    surface_clear(&fb1, 0);
+    surface_clear(&fb2, 0);
+
+    // Record a block with a redundant state change, a dead state change
+    // and duplicated syncs.
+    #define RECORD_BLOCK() ({ \
+        rspq_block_begin(); \
+            rdpq_set_mode_standard(); \
+            rdpq_mode_combiner(RDPQ_COMBINER1((0,0,0,ENV), (0,0,0,ENV))); \
+            rdpq_set_env_color(RGBA32(0xFF,0x00,0x00,0xFF)); \
+            rdpq_set_env_color(RGBA32(0x00,0xFF,0x00,0xFF)); \
+            rdpq_set_blend_color(RGBA32(0x11,0x22,0x33,0x44)); \
+            rdpq_set_blend_color(RGBA32(0x11,0x22,0x33,0x44)); \
+            rdpq_sync_pipe(); \
+            rdpq_sync_pipe(); \
+            rdpq_fill_rectangle(0, 0, WIDTH, WIDTH/2); \
+            rdpq_set_env_color(RGBA32(0x00,0x00,0xFF,0xFF)); \
+            rdpq_fill_rectangle(0, WIDTH/2, WIDTH, WIDTH); \
+        rspq_block_end(); \
+    })
+
+    // Only blocks recorded with RDPQ_CFG_BLOCKOPT can be optimized
+    rspq_block_t *block1 = RECORD_BLOCK();
+    DEFER(rspq_block_free(block1));
+    uint32_t old_cfg = rdpq_config_enable(RDPQ_CFG_BLOCKOPT);
+    rspq_block_t *block2 = RECORD_BLOCK();
+    DEFER(rspq_block_free(block2));
+    rdpq_config_set(old_cfg);
+
+    rdpq_block_optimize_stats_t stats;
+    rdpq_block_optimize(block1, &stats);
+    ASSERT_EQUAL_SIGNED(stats.cmds_before, 0, "block recorded without RDPQ_CFG_BLOCKOPT was optimized");
+
+    rdpq_block_optimize(block2, &stats);
+    LOG("before:%d after:%d state:%d sync:%d appends:%d\n", stats.cmds_before, stats.cmds_after,
+        stats.state_removed, stats.sync_removed, stats.appends_removed);
+    ASSERT_EQUAL_SIGNED(stats.state_removed, 2, "invalid number of state changes removed");
+    ASSERT(stats.sync_removed >= 1, "duplicated SYNC_PIPE not removed");
+    ASSERT_EQUAL_SIGNED(stats.cmds_before - stats.cmds_after, stats.state_removed + stats.sync_removed,
+        "invalid number of commands removed");
+
+    // Run both blocks: the optimized one must send fewer commands, and draw the same image
+    rdpq_set_color_image(&fb1);
+    rspq_block_run(block1);
+    rspq_wait();
+    int num_bc1 = debug_rdp_stream_count_cmd(0xF9); // SET_BLEND_COLOR
+    int num_ec1 = debug_rdp_stream_count_cmd(0xFB); // SET_ENV_COLOR
+    debug_rdp_stream_reset();
+
+    rdpq_set_color_image(&fb2);
+    rspq_block_run(block2);
+    rspq_wait();
+    int num_bc2 = debug_rdp_stream_count_cmd(0xF9); // SET_BLEND_COLOR
+    int num_ec2 = debug_rdp_stream_count_cmd(0xFB); // SET_ENV_COLOR
+    debug_rdp_stream_reset();
+
+    ASSERT_EQUAL_SIGNED(num_bc1, 2, "invalid number of SET_BLEND_COLOR in the original block");
+    ASSERT_EQUAL_SIGNED(num_ec1, 3, "invalid number of SET_ENV_COLOR in the original block");
+    ASSERT_EQUAL_SIGNED(num_bc2, 1, "invalid number of SET_BLEND_COLOR in the optimized block");
+    ASSERT_EQUAL_SIGNED(num_ec2, 2, "invalid number of SET_ENV_COLOR in the optimized block");
+    ASSERT_EQUAL_MEM((uint8_t*)fb1.buffer, (uint8_t*)fb2.buffer, WIDTH*WIDTH*4,
+        "optimized block draws a different image");
+
+    // Blocks recorded with RDPQ_CFG_BLOCKOPT are optimized automatically
+    // when they are run the first time
+    old_cfg = rdpq_config_enable(RDPQ_CFG_BLOCKOPT);
+    rspq_block_t *block3 = RECORD_BLOCK();
+    DEFER(rspq_block_free(block3));
+    rdpq_config_set(old_cfg);
+
+    surface_clear(&fb2, 0);
+    rdpq_set_color_image(&fb2);
+    rspq_block_run(block3);
+    rspq_wait();
+    int num_bc3 = debug_rdp_stream_count_cmd(0xF9); // SET_BLEND_COLOR
+    ASSERT_EQUAL_SIGNED(num_bc3, 1, "block not optimized with RDPQ_CFG_BLOCKOPT");
+    ASSERT_EQUAL_MEM((uint8_t*)fb1.buffer, (uint8_t*)fb2.buffer, WIDTH*WIDTH*4,
+        "optimized block draws a different image");
+
+    #undef RECORD_BLOCK
+}
+
+void test_rdpq_dynres(TestContext *ctx)
+{
+    RDPQ_INIT();
+
+    rdpq_dynres_init(&(rdpq_dynres_parms_t){
+        .min_scale = 0.5f, .max_scale = 0.9f,
+        .target_load = 0.8f, .max_increase = 0.05f,
+    });
+    ASSERT(fabsf(rdpq_dynres_get_scale() - 0.9f) < 0.001f, "initial scale is not the maximum");
+
+    // Simulate frames with a given RDP load, drawn at the current scale
+    int vblanks = display_get_frame_pacing() > 1 ? display_get_frame_pacing() : 1;
+    float budget = (float)RCP_FREQUENCY * vblanks / (get_tv_type() == TV_PAL ? 50 : 60);
+    void frame(float load) {
+        __rdpq_dynres_update(load * budget, rdpq_dynres_get_scale());
+    }
+
+    // Overload: the scale is lowered immediately to hit the target load,
+    // as the drawn area is proportional to the square of the scale
+    frame(1.6f);
+    LOG("load: %.3f scale: %.3f\n", rdpq_dynres_get_load(), rdpq_dynres_get_scale());
+    ASSERT(fabsf(rdpq_dynres_get_load() - 1.6f) < 0.01f, "invalid measured load");
+    ASSERT(fabsf(rdpq_dynres_get_scale() - 0.9f * sqrtf(0.8f / 1.6f)) < 0.01f, "scale not lowered");
+
+    // Heavy overload: the scale stops at the minimum
+    frame(4.0f);
+    ASSERT(fabsf(rdpq_dynres_get_scale() - 0.5f) < 0.001f, "scale below the minimum");
+    frame(4.0f);
+    ASSERT(fabsf(rdpq_dynres_get_scale() - 0.5f) < 0.001f, "scale below the minimum");
+
+    // Light load: the scale is raised slowly, up to the maximum
+    float prev = rdpq_dynres_get_scale();
+    for (int i=0; i<30; i++) {
+        frame(0.2f);
+        float scale = rdpq_dynres_get_scale();
+        ASSERT(scale >= prev, "scale lowered with a light load (frame %d)", i);
+        ASSERT(scale <= prev * 1.05f + 0.001f, "scale raised too quickly (frame %d)", i);
+        ASSERT(scale <= 0.9f + 0.001f, "scale above the maximum (frame %d)", i);
+        prev = scale;
+    }
+    ASSERT(fabsf(rdpq_dynres_get_scale() - 0.9f) < 0.001f, "scale did not reach the maximum");
+
+    // Load right at the target: the scale is stable
+    frame(0.8f);
+    ASSERT(fabsf(rdpq_dynres_get_scale() - 0.9f) < 0.001f, "scale changed at the target load");
+
+    // The attached surface has the size of the current scale
+    frame(1.6f);
+    float scale = rdpq_dynres_get_scale();
+    surface_t *disp = display_get();
+    const surface_t *fb = rdpq_dynres_attach(disp, NULL);
+    ASSERT_EQUAL_SIGNED(fb->width, (int)(disp->width * scale), "invalid frame width");
+    ASSERT_EQUAL_SIGNED(fb->height, (int)(disp->height * scale), "invalid frame height");
+    rdpq_dynres_detach_show();
+    rspq_wait();
+}
+
+void test_rdpq_profile(TestContext *ctx)
+{
+    RDPQ_INIT();
+
+    const int FBWIDTH = 64;
+    surface_t fb = surface_alloc(FMT_RGBA16, FBWIDTH, FBWIDTH);
+    DEFER(surface_free(&fb));
+    rdpq_set_color_image(&fb);
+
+    rdpq_profile_start(4);
+    DEFER(rdpq_profile_stop());
+
+    rdpq_profile_stats_t stats[4];
+    ASSERT_EQUAL_SIGNED(rdpq_profile_get_stats(stats, 4), 0, "stats available before the first period");
+
+    // The first frame only sets the starting point, so 5 frame markers
+    // are needed to complete a period of 4 frames.
+    rdpq_profile_frame();
+    for (int i=0; i<4; i++) {
+        rdpq_set_mode_fill(RGBA32(0,0,0,0));
+        rdpq_profile_begin("fill");
+        rdpq_fill_rectangle(0, 0, FBWIDTH, FBWIDTH);
+        rdpq_profile_end();
+
+        // Only run this section in some frames
+        if (i & 1) {
+            rdpq_profile_begin("std");
+            rdpq_set_mode_standard();
+            rdpq_mode_combiner(RDPQ_COMBINER_FLAT);
+            rdpq_fill_rectangle(0, 0, FBWIDTH, FBWIDTH);
+            rdpq_profile_end();
+        }
+        rspq_wait();
+        rdpq_profile_frame();
+    }
+
+    // Make sure all the samples have been processed
+    rspq_wait();
+    rdpq_profile_frame();
+
+    int n = rdpq_profile_get_stats(stats, 4);
+    ASSERT_EQUAL_SIGNED(n, 3, "invalid number of sections");
+    ASSERT_EQUAL_STR(stats[0].name, "frame", "invalid name of section 0");
+    ASSERT_EQUAL_STR(stats[1].name, "fill", "invalid name of section 1");
+    ASSERT_EQUAL_STR(stats[2].name, "std", "invalid name of section 2");
+    ASSERT_EQUAL_SIGNED(stats[0].frames, 4, "invalid number of frames");
+    ASSERT_EQUAL_SIGNED(stats[1].frames, 4, "invalid number of frames for fill");
+    ASSERT_EQUAL_SIGNED(stats[2].frames, 2, "invalid number of frames for std");
+
+    for (int i=0; i<n; i++) {
+        LOG("%s: clock=%lu busy=%lu pipe=%lu tmem=%lu\n", stats[i].name,
+            stats[i].clock.avg, stats[i].busy.avg, stats[i].pipe_busy.avg, stats[i].tmem_busy.avg);
+        ASSERT(stats[i].clock.min <= stats[i].clock.avg && stats[i].clock.avg <= stats[i].clock.max, 
+            "invalid min/avg/max in %s", stats[i].name);
+        ASSERT(stats[i].clock.avg > 0, "no clock cycles in %s", stats[i].name);
+        ASSERT(stats[i].busy.max <= stats[i].clock.max, "busy longer than clock in %s", stats[i].name);
+        if (i > 0)
+            ASSERT(stats[i].clock.max <= stats[0].clock.max, "section %s longer than frame", stats[i].name);
+    }
+    ASSERT(stats[1].pipe_busy.avg > 0, "pipe was never busy while filling");
+}
+
 void test_rdpq_change_other_modes(TestContext *ctx)
 {
     RDPQ_INIT();
@@ -1184,6 +1396,24 @@ static void __autosync_load1(void) {
 static uint8_t __autosync_load1_exp[4] = {1,1,0,1};
 static uint8_t __autosync_load1_blockexp[4] = {3,4,2,1};
 
+static void __autosync_load2(void) {
+    surface_t tex = surface_alloc(FMT_RGBA16, 8, 8);
+    DEFER(surface_free(&tex));
+
+    rdpq_set_texture_image(&tex);
+    rdpq_set_tile(0, FMT_RGBA16, 0, 16, 0);
+    rdpq_load_tile(0, 0, 0, 8, 8);
+    rdpq_texture_rectangle(0, 0, 0, 4, 4, 0, 0);
+    rdpq_set_tile(1, FMT_RGBA16, 2048, 16, 0);
+    // NO LOADSYNC HERE (disjoint TMEM area)
+    rdpq_load_tile(1, 0, 0, 8, 8);
+    rdpq_texture_rectangle(1, 0, 0, 4, 4, 0, 0);
+    // TILESYNC + LOADSYNC HERE
+    rdpq_load_tile(0, 0, 0, 8, 8);
+}
+static uint8_t __autosync_load2_exp[4] = {1,1,0,1};
+static uint8_t __autosync_load2_blockexp[4] = {5,4,0,1};
+
 void test_rdpq_autosync(TestContext *ctx) {
     LOG("__autosync_pipe1\n");
     __test_rdpq_autosyncs(ctx, __autosync_pipe1, __autosync_pipe1_exp, false);
@@ -1208,6 +1438,38 @@ void test_rdpq_autosync(TestContext *ctx) {
     LOG("__autosync_load1 (block)\n");
     __test_rdpq_autosyncs(ctx, __autosync_load1, __autosync_load1_blockexp, true);
     if (ctx->result == TEST_FAILED) return;
+
+    LOG("__autosync_load2\n");
+    __test_rdpq_autosyncs(ctx, __autosync_load2, __autosync_load2_exp, false);
+    if (ctx->result == TEST_FAILED) return;
+
+    LOG("__autosync_load2 (block)\n");
+    __test_rdpq_autosyncs(ctx, __autosync_load2, __autosync_load2_blockexp, true);
+    if (ctx->result == TEST_FAILED) return;
+}
+
+void test_rdpq_autosync_stats(TestContext *ctx) {
+    RDPQ_INIT();
+
+    surface_t fb = surface_alloc(FMT_RGBA16, 64, 64);
+    DEFER(surface_free(&fb));
+    rdpq_set_mode_standard();
+    rdpq_set_color_image(&fb);
+
+    rdpq_reset_autosync_stats();
+    __autosync_load2();
+    rspq_wait();
+
+    rdpq_autosync_stats_t stats;
+    rdpq_get_autosync_stats(&stats);
+    ASSERT_EQUAL_UNSIGNED(stats.sync_load, 1, "invalid number of SYNC_LOAD");
+    ASSERT_EQUAL_UNSIGNED(stats.sync_load_avoided, 1, "invalid number of SYNC_LOAD avoided");
+    ASSERT_EQUAL_UNSIGNED(stats.sync_tile, 1, "invalid number of SYNC_TILE");
+    ASSERT_EQUAL_UNSIGNED(stats.sync_pipe, 0, "invalid number of SYNC_PIPE");
+
+    rdpq_reset_autosync_stats();
+    rdpq_get_autosync_stats(&stats);
+    ASSERT_EQUAL_UNSIGNED(stats.sync_load + stats.sync_load_avoided, 0, "stats not reset");
 }
 
 
@@ -1932,6 +2194,70 @@ void test_rdpq_mode_freeze_stack(TestContext *ctx) {
     rspq_wait();
 }
 
+void test_rdpq_mode_state(TestContext *ctx) {
+    RDPQ_INIT();
+    debug_rdp_stream_init();
+
+    const int FULL_CVG = 7 << 5;   // full coverage
+    const int FBWIDTH = 16;
+    surface_t fb = surface_alloc(FMT_RGBA32, FBWIDTH, FBWIDTH);
+    DEFER(surface_free(&fb));
+    rdpq_set_color_image(&fb);
+    surface_clear(&fb, 0);
+
+    // Configure a render mode via the mode API, and capture it
+    rdpq_set_mode_standard();
+    rdpq_mode_combiner(RDPQ_COMBINER1((0,0,0,PRIM), (0,0,0,1)));
+    rdpq_mode_blender(RDPQ_BLENDER((IN_RGB, 0, BLEND_RGB, 1)));
+    rdpq_mode_dithering(DITHER_NONE_NONE);
+    rdpq_set_prim_color(RGBA32(0x20,0x40,0x60,0xFF));
+    rdpq_set_blend_color(RGBA32(0x10,0x10,0x10,0xFF));
+
+    rdpq_mode_state_t state;
+    rdpq_mode_state_capture(&state);
+    uint64_t som = rdpq_get_other_modes_raw();
+    ASSERT_EQUAL_HEX(state.combiner_final >> 56, 0xFC, "invalid calculated combiner");
+
+    // Switch to a different mode and apply the captured one: a single
+    // SET_COMBINE and SET_OTHER_MODES must be sent.
+    rdpq_set_mode_fill(RGBA32(0,0,0,0));
+    rdpq_fill_rectangle(0, 0, FBWIDTH, FBWIDTH);
+    rspq_wait();
+    debug_rdp_stream_reset();
+
+    rdpq_mode_state_apply(&state);
+    rspq_wait();
+    ASSERT_EQUAL_HEX(rdpq_get_other_modes_raw(), som, "invalid SOM after applying the render mode");
+    ASSERT_EQUAL_SIGNED(debug_rdp_stream_count_cmd(RDPQ_CMD_SET_COMBINE_MODE_RAW + 0xC0), 1, "invalid number of SET_COMBINE_MODE");
+    ASSERT_EQUAL_SIGNED(debug_rdp_stream_count_cmd(RDPQ_CMD_SET_OTHER_MODES + 0xC0), 1, "invalid number of SET_OTHER_MODES");
+    ASSERT_EQUAL_SIGNED(debug_rdp_stream_count_cmd(RDPQ_CMD_SET_SCISSOR + 0xC0), 1, "scissor not updated after leaving fill mode");
+
+    rdpq_fill_rectangle(0, 0, FBWIDTH, FBWIDTH);
+    rspq_wait();
+    ASSERT_SURFACE(&fb, { return RGBA32(0x10,0x10,0x10,FULL_CVG); });
+
+    // The applied mode can be further modified via the mode API
+    rdpq_mode_blender(RDPQ_BLENDER((BLEND_RGB, 0, IN_RGB, 1)));
+    rdpq_fill_rectangle(0, 0, FBWIDTH, FBWIDTH);
+    rspq_wait();
+    ASSERT_SURFACE(&fb, { return RGBA32(0x20,0x40,0x60,FULL_CVG); });
+
+    // Try again within a block
+    rdpq_debug_log_msg("Mode state: in block");
+    surface_clear(&fb, 0);
+    rspq_block_begin();
+        rdpq_set_mode_fill(RGBA32(0,0,0,0));
+        rdpq_mode_state_apply(&state);
+        rdpq_fill_rectangle(0, 0, FBWIDTH, FBWIDTH);
+    rspq_block_t *block = rspq_block_end();
+    DEFER(rspq_block_free(block));
+
+    rspq_block_run(block);
+    rspq_wait();
+    ASSERT_EQUAL_HEX(rdpq_get_other_modes_raw(), som, "invalid SOM after applying the render mode in a block");
+    ASSERT_SURFACE(&fb, { return RGBA32(0x10,0x10,0x10,FULL_CVG); });
+}
+
 void test_rdpq_mipmap(TestContext *ctx) {
     RDPQ_INIT();
     debug_rdp_stream_init();
@@ -2141,3 +2467,216 @@ void test_rdpq_texrect_passthrough(TestContext *ctx) {
     rspq_block_free(block);
     rspq_block_free(block_mode);
 }
+
+void test_rdpq_rect_batch(TestContext *ctx) {
+    RDPQ_INIT();
+
+    const int FBWIDTH = 64;
+    const int TEXWIDTH = 16;
+    const int NUM_RECTS = 100;
+    surface_t fb = surface_alloc(FMT_RGBA16, FBWIDTH, FBWIDTH);
+    DEFER(surface_free(&fb));
+    surface_t fb_ref = surface_alloc(FMT_RGBA16, FBWIDTH, FBWIDTH);
+    DEFER(surface_free(&fb_ref));
+
+    surface_t tex = surface_alloc(FMT_RGBA16, TEXWIDTH, TEXWIDTH);
+    DEFER(surface_free(&tex));
+    for (int y=0;y<TEXWIDTH;y++)
+        for (int x=0;x<TEXWIDTH;x++)
+            ((uint16_t*)tex.buffer)[y * TEXWIDTH + x] = color_to_packed16(RGBA16(x, y, x+y, 1));
+
+    // Random rectangles, also partially out of the top-left border, with
+    // some repeated colors to exercise the PRIM color change detection.
+    // The number of rectangles exceeds both the RSP fetch chunk and the
+    // RDP staging buffer.
+    rdpq_rect_item_t *rects = malloc_uncached(NUM_RECTS * sizeof(rdpq_rect_item_t));
+    DEFER(free_uncached(rects));
+    for (int i=0; i<NUM_RECTS; i++) {
+        int x = RANDN(FBWIDTH) - 4, y = RANDN(FBWIDTH) - 4;
+        int w = RANDN(TEXWIDTH-4) + 1, h = RANDN(TEXWIDTH-4) + 1;
+        if (x + w > FBWIDTH) w = FBWIDTH - x;
+        if (y + h > FBWIDTH) h = FBWIDTH - y;
+        int s = RANDN(4), t = RANDN(4);
+        rects[i] = (rdpq_rect_item_t){
+            .x = x*4, .y = y*4, .width = w*4, .height = h*4, .s = s*32, .t = t*32,
+            .color = (i & 3) ? rects[i-1].color : RGBA32(RANDN(256), RANDN(256), RANDN(256), 255),
+        };
+    }
+
+    void draw_reference(bool textured, bool prim_color) {
+        for (int i=0; i<NUM_RECTS; i++) {
+            rdpq_rect_item_t *r = &rects[i];
+            if (prim_color) rdpq_set_prim_color(r->color);
+            if (textured)
+                __rdpq_texture_rectangle_fx(TILE0, r->x, r->y, r->x+r->width, r->y+r->height, r->s, r->t);
+            else
+                __rdpq_fill_rectangle_fx(r->x, r->y, r->x+r->width, r->y+r->height);
+        }
+    }
+
+    void test_mode(const char *name, bool textured, bool prim_color, void (*set_mode)(void)) {
+        surface_clear(&fb_ref, 0);
+        rdpq_set_color_image(&fb_ref);
+        set_mode();
+        draw_reference(textured, prim_color);
+        rspq_wait();
+
+        surface_clear(&fb, 0);
+        rdpq_set_color_image(&fb);
+        set_mode();
+        if (textured)
+            rdpq_texture_rectangle_batch(TILE0, rects, NUM_RECTS, prim_color);
+        else
+            rdpq_fill_rectangle_batch(rects, NUM_RECTS, prim_color);
+        rspq_wait();
+        ASSERT_EQUAL_MEM((uint8_t*)fb.buffer, (uint8_t*)fb_ref.buffer, FBWIDTH*FBWIDTH*2,
+            "Wrong data in framebuffer (%s)", name);
+    }
+
+    void mode_fill(void) {
+        rdpq_set_mode_fill(RGBA32(255,0,255,255));
+    }
+    void mode_flat(void) {
+        rdpq_set_mode_standard();
+        rdpq_mode_combiner(RDPQ_COMBINER_FLAT);
+    }
+    void mode_copy(void) {
+        rdpq_set_mode_copy(false);
+    }
+    void mode_tex_tint(void) {
+        rdpq_set_mode_standard();
+        rdpq_mode_combiner(RDPQ_COMBINER1((TEX0,0,PRIM,0), (0,0,0,TEX0)));
+    }
+
+    rdpq_set_texture_image(&tex);
+    rdpq_set_tile(TILE0, FMT_RGBA16, 0, TEXWIDTH * 2, 0);
+    rdpq_load_tile(TILE0, 0, 0, TEXWIDTH, TEXWIDTH);
+
+    test_mode("fill", false, false, mode_fill);
+    if (ctx->result == TEST_FAILED) return;
+    test_mode("flat", false, true, mode_flat);
+    if (ctx->result == TEST_FAILED) return;
+    test_mode("copy", true, false, mode_copy);
+    if (ctx->result == TEST_FAILED) return;
+    test_mode("tinted", true, true, mode_tex_tint);
+    if (ctx->result == TEST_FAILED) return;
+
+    // Recorded in a block: the array is read when the block is run
+    surface_clear(&fb, 0);
+    rdpq_set_color_image(&fb);
+    rspq_block_begin();
+        mode_flat();
+        rdpq_fill_rectangle_batch(rects, NUM_RECTS, true);
+    rspq_block_t *block = rspq_block_end();
+    DEFER(rspq_block_free(block));
+    rspq_block_run(block);
+    rspq_wait();
+
+    surface_clear(&fb_ref, 0);
+    rdpq_set_color_image(&fb_ref);
+    mode_flat();
+    draw_reference(false, true);
+    rspq_wait();
+    ASSERT_EQUAL_MEM((uint8_t*)fb.buffer, (uint8_t*)fb_ref.buffer, FBWIDTH*FBWIDTH*2,
+        "Wrong data in framebuffer (block)");
+
+    // Rectangles moved by an offset (used by tilemaps and fonts). The offset
+    // must survive the flushes of the staging buffer.
+    for (int dir=0; dir<2; dir++) {
+        int dx = dir ? -3 : 5, dy = dir ? -2 : 7;
+        surface_clear(&fb_ref, 0);
+        rdpq_set_color_image(&fb_ref);
+        mode_tex_tint();
+        for (int i=0; i<NUM_RECTS; i++) {
+            rdpq_rect_item_t *r = &rects[i];
+            int x = r->x + dx*4, y = r->y + dy*4;
+            rdpq_set_prim_color(r->color);
+            __rdpq_texture_rectangle_fx(TILE0, x, y, x+r->width, y+r->height, r->s, r->t);
+        }
+        rspq_wait();
+
+        surface_clear(&fb, 0);
+        rdpq_set_color_image(&fb);
+        mode_tex_tint();
+        __rdpq_texture_rectangle_batch_offset(TILE0, rects, NUM_RECTS, true, dx*4, dy*4);
+        rspq_wait();
+        ASSERT_EQUAL_MEM((uint8_t*)fb.buffer, (uint8_t*)fb_ref.buffer, FBWIDTH*FBWIDTH*2,
+            "Wrong data in framebuffer (offset %d,%d)", dx, dy);
+    }
+
+    // Non-overlapping rectangles of different colors: each one must be at its
+    // position, including the last ones.
+    const int NUM_GRID = 32;
+    rdpq_rect_item_t *grid = malloc_uncached(NUM_GRID * sizeof(rdpq_rect_item_t));
+    DEFER(free_uncached(grid));
+    for (int i=0; i<NUM_GRID; i++) {
+        grid[i] = (rdpq_rect_item_t){
+            .x = (i%8)*8*4, .y = (i/8)*8*4, .width = 6*4, .height = 6*4,
+            .color = RGBA32(i*8, 255-i*8, 0x80, 255),
+        };
+    }
+    surface_clear(&fb, 0);
+    rdpq_set_color_image(&fb);
+    mode_flat();
+    __rdpq_texture_rectangle_batch_offset(TILE0, grid, NUM_GRID, true, 3*4, 5*4);
+    rspq_wait();
+    for (int i=0; i<NUM_GRID; i++) {
+        int x = (i%8)*8 + 3, y = (i/8)*8 + 5;
+        uint16_t *px = (uint16_t*)fb.buffer;
+        ASSERT_EQUAL_HEX(px[(y+3)*FBWIDTH + x+3], color_to_packed16(grid[i].color),
+            "Wrong color of rectangle %d", i);
+        ASSERT_EQUAL_HEX(px[(y-1)*FBWIDTH + x+3], 0, "Rectangle %d drawn at the wrong position", i);
+    }
+}
+
+void test_rdpq_debug_capture(TestContext *ctx) {
+    RDPQ_INIT();
+
+    const int FULL_CVG = 7 << 5;
+    surface_t fb = surface_alloc(FMT_RGBA16, 32, 32);
+    DEFER(surface_free(&fb));
+    surface_t tex = surface_alloc(FMT_RGBA16, 8, 8);
+    DEFER(surface_free(&tex));
+    surface_clear(&tex, 0xAA);
+    data_cache_hit_writeback(tex.buffer, tex.stride * tex.height);
+
+    rdpq_debug_capture_start();
+    rdpq_attach(&fb, NULL);
+    rdpq_set_mode_fill(RGBA32(0xFF, 0xFF, 0xFF, FULL_CVG));
+    rdpq_fill_rectangle(0, 0, 32, 32);
+    rdpq_set_mode_standard();
+    rdpq_tex_upload(TILE0, &tex, NULL);
+    rdpq_texture_rectangle(TILE0, 0, 0, 8, 8, 0, 0);
+    rdpq_detach_wait();
+
+    char *buf = NULL; size_t size = 0;
+    FILE *f = open_memstream(&buf, &size);
+    bool ok = rdpq_debug_capture_stop(f);
+    fclose(f);
+    DEFER(free(buf));
+    ASSERT(ok, "capture failed");
+    ASSERT(size >= 12, "capture too small: %d", size);
+    ASSERT(!memcmp(buf, RDPQ_CAPTURE_MAGIC, 4), "invalid capture magic");
+
+    // Walk the chunks: find the fill rectangle and the texture data
+    bool found_fillrect = false, found_tex = false;
+    uint32_t num_chunks = *(uint32_t*)(buf+8);
+    uint8_t *ptr = (uint8_t*)buf + 12;
+    for (int i=0; i<num_chunks; i++) {
+        uint32_t type = ((uint32_t*)ptr)[0];
+        uint32_t addr = ((uint32_t*)ptr)[1];
+        uint32_t sz = ((uint32_t*)ptr)[2];
+        uint64_t *data = (uint64_t*)(ptr + 12);
+        ASSERT(ptr + 12 + sz <= (uint8_t*)buf + size, "chunk %d out of bounds", i);
+        if (type == RDPQ_CAPTURE_CHUNK_CMDS) {
+            for (int j=0; j<sz/8; j++)
+                if ((data[j] >> 56) == 0xF6) found_fillrect = true;
+        } else if (type == RDPQ_CAPTURE_CHUNK_DATA) {
+            if (addr <= PhysicalAddr(tex.buffer) && addr + sz >= PhysicalAddr(tex.buffer) + 8*8*2)
+                found_tex = true;
+        }
+        ptr += 12 + sz;
+    }
+    ASSERT(found_fillrect, "FILL_RECT not found in capture");
+    ASSERT(found_tex, "texture data not found in capture");
+}
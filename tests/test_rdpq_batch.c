@@ -0,0 +1,201 @@
+#include <libdragon.h>
+
+void test_rdpq_batch(TestContext *ctx)
+{
+    RDPQ_INIT();
+
+    const int FBWIDTH = 64;
+    surface_t fb = surface_alloc(FMT_RGBA32, FBWIDTH, FBWIDTH);
+    DEFER(surface_free(&fb));
+    surface_t fb_ref = surface_alloc(FMT_RGBA32, FBWIDTH, FBWIDTH);
+    DEFER(surface_free(&fb_ref));
+
+    SRAND(0);
+    surface_t tex[3];
+    for (int i=0; i<3; i++)
+        tex[i] = surface_create_random(8, 8, FMT_RGBA16);
+    DEFER(for (int i=0; i<3; i++) surface_free(&tex[i]));
+
+    rspq_block_begin();
+        rdpq_set_mode_standard();
+    rspq_block_t *mode_tex = rspq_block_end();
+    DEFER(rspq_block_free(mode_tex));
+
+    rspq_block_begin();
+        rdpq_set_mode_standard();
+        rdpq_mode_combiner(RDPQ_COMBINER_FLAT);
+    rspq_block_t *mode_flat = rspq_block_end();
+    DEFER(rspq_block_free(mode_flat));
+
+    // Non-overlapping sprites interleaving textures: they can be grouped
+    // by texture.
+    surface_clear(&fb, 0);
+    rdpq_attach(&fb, NULL);
+    rdpq_batch_begin();
+    rdpq_batch_mode(mode_tex);
+    for (int i=0; i<6; i++)
+        rdpq_batch_tex_blit(&tex[i%2], i*8, 0, NULL);
+    rdpq_batch_end(NULL);
+    rdpq_detach_wait();
+
+    ASSERT_SURFACE(&fb, {
+        if (y < 8 && x < 48)
+            return surface_debug_expected_color(&tex[(x/8)%2], x%8, y);
+        return color_from_packed32(0);
+    });
+
+    rdpq_batch_stats_t stats;
+    rdpq_attach(&fb, NULL);
+    rdpq_batch_begin();
+    rdpq_batch_mode(mode_tex);
+    for (int i=0; i<6; i++)
+        rdpq_batch_tex_blit(&tex[i%2], i*8, 0, NULL);
+    rdpq_batch_end(&stats);
+    rdpq_detach_wait();
+    ASSERT_EQUAL_SIGNED(stats.items, 6, "invalid number of items");
+    ASSERT_EQUAL_SIGNED(stats.tex_switches, 2, "textures were not grouped");
+    ASSERT_EQUAL_SIGNED(stats.tex_switches_avoided, 4, "invalid number of avoided switches");
+    // The first item of each group loads the texture, the others reuse it
+    // (even if RDPQ_CFG_TEXCACHE is disabled)
+    ASSERT_EQUAL_SIGNED(stats.tex_loads_skipped, 4, "invalid number of skipped texture loads");
+
+    // Random overlapping sprites and rectangles across layers and modes: the
+    // result must be identical to drawing them in submission order.
+    for (int iter=0; iter<8; iter++) {
+        SRAND(iter+1);
+        struct { int type, layer, x, y; } items[24];
+        for (int i=0; i<24; i++) {
+            items[i].type = RANDN(4);
+            items[i].layer = RANDN(2);
+            items[i].x = RANDN(FBWIDTH-8);
+            items[i].y = RANDN(FBWIDTH-8);
+        }
+
+        surface_clear(&fb_ref, 0);
+        rdpq_attach(&fb_ref, NULL);
+        for (int layer=0; layer<2; layer++) {
+            for (int i=0; i<24; i++) {
+                if (items[i].layer != layer) continue;
+                if (items[i].type == 3) {
+                    rspq_block_run(mode_flat);
+                    rdpq_set_prim_color(RGBA32(0xFF, 0x80, i*8, 0xFF));
+                    rdpq_fill_rectangle(items[i].x, items[i].y, items[i].x+6, items[i].y+6);
+                } else {
+                    rspq_block_run(mode_tex);
+                    rdpq_tex_blit(&tex[items[i].type], items[i].x, items[i].y, NULL);
+                }
+            }
+        }
+        rdpq_detach_wait();
+
+        surface_clear(&fb, 0);
+        rdpq_attach(&fb, NULL);
+        rdpq_batch_begin();
+        for (int i=0; i<24; i++) {
+            rdpq_batch_layer(items[i].layer);
+            if (items[i].type == 3) {
+                rdpq_batch_mode(mode_flat);
+                rdpq_batch_fill_rectangle(items[i].x, items[i].y, items[i].x+6, items[i].y+6,
+                    RGBA32(0xFF, 0x80, i*8, 0xFF));
+            } else {
+                rdpq_batch_mode(mode_tex);
+                rdpq_batch_tex_blit(&tex[items[i].type], items[i].x, items[i].y, NULL);
+            }
+        }
+        rdpq_batch_end(&stats);
+        rdpq_detach_wait();
+
+        ASSERT_EQUAL_SIGNED(stats.items, 24, "invalid number of items");
+        ASSERT(stats.tex_switches_avoided >= 0 && stats.mode_switches_avoided >= 0,
+            "batch increased switches (tex:%d mode:%d)", stats.tex_switches_avoided, stats.mode_switches_avoided);
+        ASSERT_EQUAL_MEM((uint8_t*)fb.buffer, (uint8_t*)fb_ref.buffer, FBWIDTH*FBWIDTH*4,
+            "batch result differs from submission order (iter %d)", iter);
+    }
+}
+
+void test_rdpq_batch_large(TestContext *ctx)
+{
+    RDPQ_INIT();
+
+    // A full screen of small sprites and rectangles: check that the result
+    // is still correct, and measure the CPU time spent by the batch.
+    const int FBWIDTH = 320, FBHEIGHT = 240, NUM_ITEMS = 1000;
+    surface_t fb = surface_alloc(FMT_RGBA16, FBWIDTH, FBHEIGHT);
+    DEFER(surface_free(&fb));
+    surface_t fb_ref = surface_alloc(FMT_RGBA16, FBWIDTH, FBHEIGHT);
+    DEFER(surface_free(&fb_ref));
+
+    SRAND(42);
+    surface_t tex[4];
+    for (int i=0; i<4; i++)
+        tex[i] = surface_create_random(16, 16, FMT_RGBA16);
+    DEFER(for (int i=0; i<4; i++) surface_free(&tex[i]));
+
+    rspq_block_begin();
+        rdpq_set_mode_standard();
+    rspq_block_t *mode_tex = rspq_block_end();
+    DEFER(rspq_block_free(mode_tex));
+
+    rspq_block_begin();
+        rdpq_set_mode_standard();
+        rdpq_mode_combiner(RDPQ_COMBINER_FLAT);
+    rspq_block_t *mode_flat = rspq_block_end();
+    DEFER(rspq_block_free(mode_flat));
+
+    struct { int type, layer, x, y; } *items = malloc(NUM_ITEMS * sizeof(*items));
+    DEFER(free(items));
+    for (int i=0; i<NUM_ITEMS; i++) {
+        items[i].type = RANDN(5);
+        items[i].layer = RANDN(2);
+        items[i].x = RANDN(FBWIDTH-16);
+        items[i].y = RANDN(FBHEIGHT-16);
+    }
+
+    surface_clear(&fb_ref, 0);
+    rdpq_attach(&fb_ref, NULL);
+    uint32_t t0 = TICKS_READ();
+    for (int layer=0; layer<2; layer++) {
+        for (int i=0; i<NUM_ITEMS; i++) {
+            if (items[i].layer != layer) continue;
+            if (items[i].type == 4) {
+                rspq_block_run(mode_flat);
+                rdpq_set_prim_color(RGBA32(0xFF, 0x80, i, 0xFF));
+                rdpq_fill_rectangle(items[i].x, items[i].y, items[i].x+12, items[i].y+12);
+            } else {
+                rspq_block_run(mode_tex);
+                rdpq_tex_blit(&tex[items[i].type], items[i].x, items[i].y, NULL);
+            }
+        }
+    }
+    uint32_t ref_ticks = TICKS_SINCE(t0);
+    rdpq_detach_wait();
+
+    surface_clear(&fb, 0);
+    rdpq_attach(&fb, NULL);
+    rdpq_batch_stats_t stats;
+    t0 = TICKS_READ();
+    rdpq_batch_begin();
+    for (int i=0; i<NUM_ITEMS; i++) {
+        rdpq_batch_layer(items[i].layer);
+        if (items[i].type == 4) {
+            rdpq_batch_mode(mode_flat);
+            rdpq_batch_fill_rectangle(items[i].x, items[i].y, items[i].x+12, items[i].y+12,
+                RGBA32(0xFF, 0x80, i, 0xFF));
+        } else {
+            rdpq_batch_mode(mode_tex);
+            rdpq_batch_tex_blit(&tex[items[i].type], items[i].x, items[i].y, NULL);
+        }
+    }
+    rdpq_batch_end(&stats);
+    uint32_t batch_ticks = TICKS_SINCE(t0);
+    rdpq_detach_wait();
+
+    LOG("submission order: %lu us, batch: %lu us (tex switches: %d, avoided: %d, loads skipped: %d)\n",
+        TICKS_TO_US(ref_ticks), TICKS_TO_US(batch_ticks), stats.tex_switches, stats.tex_switches_avoided,
+        stats.tex_loads_skipped);
+
+    ASSERT_EQUAL_SIGNED(stats.items, NUM_ITEMS, "invalid number of items");
+    ASSERT(stats.tex_switches_avoided > 0, "no texture switches avoided");
+    ASSERT_EQUAL_MEM((uint8_t*)fb.buffer, (uint8_t*)fb_ref.buffer, FBWIDTH*FBHEIGHT*2,
+        "batch result differs from submission order");
+}
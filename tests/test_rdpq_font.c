@@ -0,0 +1,151 @@
+#include <libdragon.h>
+
+void test_rdpq_font(TestContext *ctx)
+{
+    RDPQ_INIT();
+
+    // 8x8 monospace font (ASCII 32-126), with a kerning pair A-V of -1 pixel
+    rdpq_font_t *fnt = rdpq_font_load("rom:/font8x8.font64");
+    DEFER(rdpq_font_free(fnt));
+    ASSERT_EQUAL_SIGNED(rdpq_font_get_line_height(fnt), 8, "invalid line height");
+
+    rdpq_text_t *text = rdpq_text_layout(fnt, "Hi AV\nX", -1);
+    DEFER(rdpq_text_free(text));
+    int w, h;
+    rdpq_text_get_size(text, &w, &h);
+    ASSERT_EQUAL_SIGNED(w, 5*8-1, "invalid text width");
+    ASSERT_EQUAL_SIGNED(h, 2*8, "invalid text height");
+
+    const int FBWIDTH = 32;
+    surface_t fb = surface_alloc(FMT_RGBA32, FBWIDTH, 16);
+    DEFER(surface_free(&fb));
+
+    static const uint8_t glyph_A[8] = { 0x30, 0x78, 0xCC, 0xCC, 0xFC, 0xCC, 0xCC, 0x00 };
+    static const uint8_t glyph_V[8] = { 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0x78, 0x30, 0x00 };
+
+    // Draw twice: the second time, the layout comes from the cache
+    for (int iter=0; iter<2; iter++) {
+        surface_clear(&fb, 0);
+        rdpq_attach(&fb, NULL);
+        rdpq_font_begin(RGBA32(0xFF, 0xFF, 0xFF, 0xFF));
+        rdpq_font_print(fnt, 4, 10, "AV");
+        rdpq_font_end();
+        rdpq_detach_wait();
+
+        // The baseline is at Y=10, and the ascent is 7 pixels.
+        uint32_t *pixels = fb.buffer;
+        for (int y=0; y<fb.height; y++) {
+            for (int x=0; x<FBWIDTH; x++) {
+                int gy = y - 3;
+                bool on = false;
+                if (gy >= 0 && gy < 8) {
+                    if (x >= 4 && x < 12 && (glyph_A[gy] & (0x80 >> (x-4)))) on = true;
+                    if (x >= 11 && x < 19 && (glyph_V[gy] & (0x80 >> (x-11)))) on = true;
+                }
+                uint8_t r = pixels[y*FBWIDTH + x] >> 24;
+                if (on)
+                    ASSERT(r >= 0xE0, "pixel %d,%d should be on (iter %d, r=%02x)", x, y, iter, r);
+                else
+                    ASSERT(r == 0, "pixel %d,%d should be off (iter %d, r=%02x)", x, y, iter, r);
+            }
+        }
+    }
+
+    // A long string at a position that is not aligned: glyphs are drawn as a
+    // single batch of rectangles, that is sent to RDP in multiple chunks.
+    // Check all the glyphs, and in particular the trailing ones.
+    const int NUM_GLYPHS = 22, X0 = 7, Y0 = 13, LONG_WIDTH = 176, LONG_HEIGHT = 24;
+    char str[NUM_GLYPHS+1];
+    for (int i=0; i<NUM_GLYPHS; i++) str[i] = (i & 1) ? 'V' : 'A';
+    str[NUM_GLYPHS] = 0;
+
+    surface_t fb_long = surface_alloc(FMT_RGBA32, LONG_WIDTH, LONG_HEIGHT);
+    DEFER(surface_free(&fb_long));
+    surface_clear(&fb_long, 0);
+    rdpq_attach(&fb_long, NULL);
+    rdpq_font_begin(RGBA32(0xFF, 0xFF, 0xFF, 0xFF));
+    rdpq_font_print(fnt, X0, Y0, str);
+    rdpq_font_end();
+    rdpq_detach_wait();
+
+    // Each "AV" pair is 15 pixels wide, because of the kerning
+    uint32_t *pixels = fb_long.buffer;
+    for (int y=0; y<LONG_HEIGHT; y++) {
+        for (int x=0; x<LONG_WIDTH; x++) {
+            int gy = y - (Y0 - 7);
+            bool on = false;
+            if (gy >= 0 && gy < 8) {
+                for (int i=0; i<NUM_GLYPHS; i++) {
+                    int gx = x - (X0 + (i/2)*15 + (i&1)*7);
+                    const uint8_t *glyph = (i & 1) ? glyph_V : glyph_A;
+                    if (gx >= 0 && gx < 8 && (glyph[gy] & (0x80 >> gx))) on = true;
+                }
+            }
+            uint8_t r = pixels[y*LONG_WIDTH + x] >> 24;
+            if (on)
+                ASSERT(r >= 0xE0, "pixel %d,%d should be on (r=%02x)", x, y, r);
+            else
+                ASSERT(r == 0, "pixel %d,%d should be off (r=%02x)", x, y, r);
+        }
+    }
+}
+
+void test_rdpq_font_tmem(TestContext *ctx)
+{
+    RDPQ_INIT();
+    debug_rdp_stream_init();
+
+    rdpq_font_t *fnt = rdpq_font_load("rom:/font8x8.font64");
+    DEFER(rdpq_font_free(fnt));
+    rdpq_text_t *text = rdpq_text_layout(fnt, "AV", -1);
+    DEFER(rdpq_text_free(text));
+
+    surface_t fb = surface_alloc(FMT_RGBA32, 32, 16);
+    DEFER(surface_free(&fb));
+    surface_t tex = surface_alloc(FMT_RGBA16, 8, 8);
+    DEFER(surface_free(&tex));
+    surface_clear(&tex, 0);
+
+    #define NUM_LOADS() (debug_rdp_stream_count_cmd(0xF3) + debug_rdp_stream_count_cmd(0xF4)) // LOAD_BLOCK + LOAD_TILE
+
+    // The atlas page is loaded once for all the texts, even if the
+    // TMEM residency cache is disabled (as it is by default).
+    rdpq_attach(&fb, NULL);
+    rspq_wait();
+    debug_rdp_stream_reset();
+    rdpq_font_begin(RGBA32(0xFF, 0xFF, 0xFF, 0xFF));
+    rdpq_text_draw(text, 0, 8);
+    rdpq_text_draw(text, 4, 12);
+    rdpq_font_print(fnt, 8, 16, "VA");
+    rdpq_font_end();
+    rspq_wait();
+    ASSERT_EQUAL_SIGNED(NUM_LOADS(), 1, "the atlas page was loaded again");
+
+    // Loading another texture overwrites the page, so it must be loaded again
+    debug_rdp_stream_reset();
+    rdpq_font_begin(RGBA32(0xFF, 0xFF, 0xFF, 0xFF));
+    rdpq_text_draw(text, 0, 8);
+    rdpq_tex_upload(TILE1, &tex, NULL);
+    rdpq_text_draw(text, 4, 12);
+    rdpq_font_end();
+    rspq_wait();
+    ASSERT_EQUAL_SIGNED(NUM_LOADS(), 3, "the atlas page was not loaded again after TMEM was overwritten");
+
+    // Texts drawn in a block always load the page, as TMEM contents are
+    // unknown when the block is run.
+    rspq_block_begin();
+    rdpq_font_begin(RGBA32(0xFF, 0xFF, 0xFF, 0xFF));
+    rdpq_text_draw(text, 0, 8);
+    rdpq_text_draw(text, 4, 12);
+    rdpq_font_end();
+    rspq_block_t *block = rspq_block_end();
+    DEFER(rspq_block_free(block));
+
+    debug_rdp_stream_reset();
+    rspq_block_run(block);
+    rspq_wait();
+    ASSERT_EQUAL_SIGNED(NUM_LOADS(), 2, "the atlas page was not loaded for each text in the block");
+
+    rdpq_detach_wait();
+    #undef NUM_LOADS
+}
@@ -77,3 +77,149 @@ void test_rdpq_sprite_lod(TestContext *ctx)
         return color_from_packed32(0);
     });
 }
+
+void test_rdpq_tilemap(TestContext *ctx)
+{
+    RDPQ_INIT();
+
+    // 24x24 tileset: 9 tiles of 8x8
+    sprite_t *tileset = sprite_load("rom:/grass1.rgba32.sprite");
+    DEFER(sprite_free(tileset));
+    surface_t tex = sprite_get_pixels(tileset);
+
+    const int MAP_W = 12, MAP_H = 10;
+    uint16_t map[MAP_W * MAP_H];
+    SRAND(0);
+    for (int i=0; i<MAP_W*MAP_H; i++)
+        map[i] = RANDN(4) == 0 ? RDPQ_TILEMAP_EMPTY : RANDN(9);
+
+    rdpq_tilemap_t *tm = rdpq_tilemap_new(tileset, 8, 8, MAP_W, MAP_H, map);
+    DEFER(rdpq_tilemap_free(tm));
+
+    const int FBWIDTH = 64;
+    const int VP_X = 8, VP_Y = 4, VP_W = 32, VP_H = 24;
+    surface_t fb = surface_alloc(FMT_RGBA32, FBWIDTH, FBWIDTH);
+    DEFER(surface_free(&fb));
+    rdpq_tilemap_set_viewport(tm, VP_X, VP_Y, VP_W, VP_H);
+
+    // Tiles crossing the right/bottom border of the viewport are drawn entirely,
+    // so one more column and row of cells is visible.
+    const int VP_COLS = VP_W/8 + 1, VP_ROWS = VP_H/8 + 1;
+
+    struct { int x, y; bool rebuild; } scrolls[] = {
+        {  0,  0, true  },
+        {  5,  3, false },      // sub-tile scroll: no rebuild
+        {  7,  7, false },
+        { 13,  2, true  },      // new origin cell
+        { -5, -9, true  },      // partially outside of the map
+        { 60, 50, true  },
+    };
+
+    rdpq_tilemap_stats_t stats;
+    int rebuilds = 0;
+    for (int i=0; i<sizeof(scrolls)/sizeof(scrolls[0]); i++) {
+        LOG("scroll: %d,%d\n", scrolls[i].x, scrolls[i].y);
+        int sx = scrolls[i].x, sy = scrolls[i].y;
+
+        surface_clear(&fb, 0);
+        rdpq_attach(&fb, NULL);
+        rdpq_set_mode_standard();
+        rdpq_tilemap_draw(tm, sx, sy);
+        rdpq_detach_wait();
+
+        rdpq_tilemap_get_stats(tm, &stats);
+        if (scrolls[i].rebuild) rebuilds++;
+        ASSERT_EQUAL_SIGNED(stats.rebuilds, rebuilds, "invalid number of rebuilds");
+        ASSERT(stats.chunks <= 1, "tileset should fit in a single chunk");
+
+        int ox = (sx >= 0 ? sx : sx-7) / 8, oy = (sy >= 0 ? sy : sy-7) / 8;
+        ASSERT_SURFACE(&fb, {
+            int mx = x - VP_X + sx;
+            int my = y - VP_Y + sy;
+            int cx = (mx >= 0 ? mx : mx-7) / 8;
+            int cy = (my >= 0 ? my : my-7) / 8;
+            if (cx < ox || cx >= ox + VP_COLS || cy < oy || cy >= oy + VP_ROWS)
+                return color_from_packed32(0);
+            uint16_t tile = rdpq_tilemap_get_tile(tm, cx, cy);
+            if (tile == RDPQ_TILEMAP_EMPTY)
+                return color_from_packed32(0);
+            int tx = (tile % 3) * 8 + (mx - cx*8);
+            int ty = (tile / 3) * 8 + (my - cy*8);
+            color_t c = color_from_packed32(((uint32_t*)tex.buffer)[ty*tex.width + tx]);
+            c.a = 0xE0;
+            return c;
+        });
+    }
+
+    // Changing a visible tile forces a rebuild, changing an invisible one doesn't
+    rdpq_tilemap_set_tile(tm, 0, 0, 4);
+    rdpq_tilemap_draw(tm, scrolls[5].x, scrolls[5].y);
+    rspq_wait();
+    rdpq_tilemap_get_stats(tm, &stats);
+    ASSERT_EQUAL_SIGNED(stats.rebuilds, rebuilds, "invisible tile change caused a rebuild");
+
+    rdpq_tilemap_set_tile(tm, 8, 7, map[7*MAP_W+8] == 4 ? 5 : 4);
+    rdpq_tilemap_draw(tm, scrolls[5].x, scrolls[5].y);
+    rspq_wait();
+    rdpq_tilemap_get_stats(tm, &stats);
+    ASSERT_EQUAL_SIGNED(stats.rebuilds, rebuilds+1, "visible tile change did not cause a rebuild");
+}
+
+void test_rdpq_sprite_atlas(TestContext *ctx)
+{
+    RDPQ_INIT();
+
+    // Atlas made of 4 images (bar, checker, green, red)
+    sprite_atlas_t *atlas = sprite_atlas_load("rom:/icons.atlas");
+    DEFER(sprite_atlas_free(atlas));
+    ASSERT_EQUAL_SIGNED(sprite_atlas_get_count(atlas), 4, "invalid number of images");
+    ASSERT_EQUAL_SIGNED(sprite_atlas_find(atlas, "missing"), -1, "missing image was found");
+
+    int idx = sprite_atlas_find(atlas, "checker");
+    ASSERT(idx >= 0, "checker image not found");
+    int width, height;
+    sprite_t *page = sprite_atlas_get(atlas, idx, NULL, NULL, &width, &height);
+    ASSERT_EQUAL_SIGNED(width, 16, "invalid image width");
+    ASSERT_EQUAL_SIGNED(height, 16, "invalid image height");
+    ASSERT(sprite_fits_tmem(page), "atlas page does not fit TMEM");
+    ASSERT(page == sprite_atlas_get(atlas, sprite_atlas_find(atlas, "red"), NULL, NULL, NULL, NULL),
+        "images should be in the same page");
+
+    surface_t fb = surface_alloc(FMT_RGBA32, 64, 32);
+    DEFER(surface_free(&fb));
+    surface_clear(&fb, 0);
+
+    rdpq_attach(&fb, NULL);
+    rdpq_set_mode_standard();
+    rdpq_sprite_atlas_blit(atlas, "checker", 4, 4, NULL);
+    rdpq_sprite_atlas_blit(atlas, "red", 24, 4, NULL);
+    rdpq_sprite_atlas_blit(atlas, "checker", 36, 4, &(rdpq_blitparms_t){ .flip_x = true });
+    rdpq_sprite_atlas_blit(atlas, "green", 24, 20, &(rdpq_blitparms_t){ .s0 = 2, .width = 4 });
+    rdpq_detach_wait();
+
+    ASSERT_SURFACE(&fb, {
+        int cx = -1;
+        int cy = y - 4;
+        if (x >= 4 && x < 20 && cy >= 0 && cy < 16)  cx = x - 4;
+        if (x >= 36 && x < 52 && cy >= 0 && cy < 16) cx = 15 - (x - 36);
+        if (cx >= 0) {
+            if (((cx >> 1) ^ (cy >> 1)) & 1) return RGBA32(0x00, 0x00, 0xFF, 0xE0);
+            return RGBA32(0xFF, 0xFF, 0xFF, 0xE0);
+        }
+        if (x >= 24 && x < 32 && y >= 4 && y < 12)   return RGBA32(0xFF, 0x00, 0x00, 0xE0);
+        if (x >= 24 && x < 28 && y >= 20 && y < 26)  return RGBA32(0x00, 0xFF, 0x00, 0xE0);
+        return RGBA32(0, 0, 0, 0);
+    });
+
+    // Images of the same page load it only once, even if the TMEM residency
+    // cache is disabled (as it is by default)
+    debug_rdp_stream_init();
+    rdpq_attach(&fb, NULL);
+    rdpq_set_mode_standard();
+    rdpq_sprite_atlas_blit(atlas, "checker", 4, 4, NULL);
+    rdpq_sprite_atlas_blit(atlas, "red", 24, 4, NULL);
+    rdpq_sprite_atlas_blit(atlas, "green", 24, 20, NULL);
+    rdpq_detach_wait();
+    ASSERT_EQUAL_SIGNED(debug_rdp_stream_count_cmd(0xF3) + debug_rdp_stream_count_cmd(0xF4), 1,
+        "the atlas page was loaded more than once");
+}
@@ -406,6 +406,47 @@ void test_rdpq_tex_blit_normal(TestContext *ctx)
     }
 }
 
+void test_rdpq_tex_blit_flip(TestContext *ctx)
+{
+    RDPQ_INIT();
+
+    const int FBWIDTH = 16;
+    surface_t fb = surface_alloc(FMT_RGBA32, FBWIDTH, FBWIDTH);
+    DEFER(surface_free(&fb));
+
+    SRAND(0);
+    surface_t tex = surface_create_random(FBWIDTH, FBWIDTH, FMT_RGBA32);
+    DEFER(surface_free(&tex));
+
+    rdpq_attach(&fb, NULL);
+    DEFER(rdpq_detach());
+    rdpq_set_mode_standard();
+
+    // Use a source rectangle with a non-zero origin: flipping must mirror
+    // it around its own center, not around the center of the surface.
+    const int S0 = 3, T0 = 2, W = 7, H = 5, X0 = 4, Y0 = 6;
+    for (int flip=0; flip<4; flip++) {
+        bool flip_x = flip & 1, flip_y = flip & 2;
+        LOG("flip_x:%d flip_y:%d\n", flip_x, flip_y);
+        rspq_wait();
+        surface_clear(&fb, 0);
+        rdpq_tex_blit(&tex, X0, Y0, &(rdpq_blitparms_t){
+            .s0 = S0, .t0 = T0, .width = W, .height = H, .flip_x = flip_x, .flip_y = flip_y,
+        });
+        rspq_wait();
+
+        ASSERT_SURFACE(&fb, {
+            int dx = x - X0;
+            int dy = y - Y0;
+            if (dx < 0 || dy < 0 || dx >= W || dy >= H)
+                return color_from_packed32(0);
+            int s = S0 + (flip_x ? W-1-dx : dx);
+            int t = T0 + (flip_y ? H-1-dy : dy);
+            return surface_debug_expected_color(&tex, s, t);
+        });
+    }
+}
+
 void test_rdpq_tex_upload_tlut(TestContext *ctx)
 {
     RDPQ_INIT();
@@ -467,3 +508,234 @@ void test_rdpq_tex_upload_tlut(TestContext *ctx)
         }
     }
 }
+
+void test_rdpq_tex_cache(TestContext *ctx)
+{
+    RDPQ_INIT();
+    rdpq_config_enable(RDPQ_CFG_TEXCACHE);
+    DEFER(rdpq_config_disable(RDPQ_CFG_TEXCACHE));
+
+    const int FBWIDTH = 16;
+    surface_t fb = surface_alloc(FMT_RGBA32, FBWIDTH, FBWIDTH);
+    DEFER(surface_free(&fb));
+    surface_clear(&fb, 0);
+
+    SRAND(0);
+    surface_t tex1 = surface_create_random(8, 8, FMT_RGBA16);
+    DEFER(surface_free(&tex1));
+    surface_t tex2 = surface_create_random(8, 8, FMT_RGBA16);
+    DEFER(surface_free(&tex2));
+
+    rdpq_attach(&fb, NULL);
+    DEFER(rdpq_detach());
+    rdpq_set_mode_standard();
+    rspq_wait();
+
+    debug_rdp_stream_init();
+
+    // Upload the texture and draw it
+    rdpq_tex_upload(TILE0, &tex1, NULL);
+    rdpq_texture_rectangle(TILE0, 0, 0, 8, 8, 0, 0);
+
+    // Upload it again, on another tile. The texture is still in TMEM,
+    // so no load must be performed.
+    rdpq_tex_upload(TILE1, &tex1, NULL);
+    rdpq_texture_rectangle(TILE1, 8, 0, 16, 8, 0, 0);
+    rspq_wait();
+    ASSERT_EQUAL_UNSIGNED(debug_rdp_stream_count_cmd(0xF3) + debug_rdp_stream_count_cmd(0xF4), 1,
+        "repeated upload should be skipped");
+
+    // Overwrite the same TMEM area with a raw load of another texture
+    debug_rdp_stream_reset();
+    rdpq_set_texture_image(&tex2);
+    rdpq_set_tile(TILE2, FMT_RGBA16, 0, 16, NULL);
+    rdpq_load_tile(TILE2, 0, 0, 8, 8);
+
+    // Now the upload must be performed again
+    rdpq_tex_upload(TILE0, &tex1, NULL);
+    rdpq_texture_rectangle(TILE0, 0, 8, 8, 16, 0, 0);
+
+    // A multi-texture upload reusing the same TMEM address is also cached.
+    // Only the second texture must be loaded.
+    rdpq_tex_multi_begin();
+    rdpq_tex_upload(TILE0, &tex1, NULL);
+    rdpq_tex_upload(TILE1, &tex2, NULL);
+    rdpq_tex_multi_end();
+    rdpq_texture_rectangle(TILE0, 8, 8, 16, 16, 0, 0);
+    rspq_wait();
+    ASSERT_EQUAL_UNSIGNED(debug_rdp_stream_count_cmd(0xF3) + debug_rdp_stream_count_cmd(0xF4), 3,
+        "overwritten texture should be uploaded again");
+
+    ASSERT_SURFACE(&fb, {
+        return surface_debug_expected_color(&tex1, x%8, y%8);
+    });
+
+    // After a full sync (eg: rspq_wait), the TMEM contents are forgotten,
+    // as the surface might have been modified by the CPU.
+    debug_rdp_stream_reset();
+    rdpq_tex_upload(TILE0, &tex1, NULL);
+    rspq_wait();
+    ASSERT_EQUAL_UNSIGNED(debug_rdp_stream_count_cmd(0xF3) + debug_rdp_stream_count_cmd(0xF4), 1,
+        "upload after a full sync should not be skipped");
+
+    // Palettes are cached as well: loading the same colors again at the
+    // same position is skipped
+    static uint16_t tlut[16] __attribute__((aligned(16)));
+    debug_rdp_stream_reset();
+    rdpq_tex_upload_tlut(tlut, 0, 16);
+    rdpq_tex_upload_tlut(tlut, 0, 16);
+    rdpq_tex_upload_tlut(tlut, 16, 16);
+    rspq_wait();
+    ASSERT_EQUAL_UNSIGNED(debug_rdp_stream_count_cmd(0xF0), 2,
+        "repeated palette upload should be skipped");
+
+    // Disabling the cache forces all uploads to be performed
+    rdpq_config_disable(RDPQ_CFG_TEXCACHE);
+    debug_rdp_stream_reset();
+    rdpq_tex_upload(TILE0, &tex1, NULL);
+    rdpq_tex_upload(TILE0, &tex1, NULL);
+    rspq_wait();
+    ASSERT_EQUAL_UNSIGNED(debug_rdp_stream_count_cmd(0xF3) + debug_rdp_stream_count_cmd(0xF4), 2,
+        "uploads should not be skipped with the cache disabled");
+
+    // The same goes for palettes: a palette modified by the CPU is loaded
+    // again, and its new colors are used.
+    surface_t tex_ci = surface_alloc(FMT_CI8, 8, 8);
+    DEFER(surface_free(&tex_ci));
+    memset(tex_ci.buffer, 1, 8*8);
+    uint16_t *tlut_anim = malloc_uncached(16*2);
+    DEFER(free_uncached(tlut_anim));
+    memset(tlut_anim, 0, 16*2);
+
+    debug_rdp_stream_reset();
+    rdpq_mode_tlut(TLUT_RGBA16);
+    tlut_anim[1] = color_to_packed16(RGBA32(0xFF, 0x00, 0x00, 0xFF));
+    rdpq_tex_upload_tlut(tlut_anim, 0, 16);
+    rdpq_tex_blit(&tex_ci, 0, 0, NULL);
+    rspq_wait();
+    tlut_anim[1] = color_to_packed16(RGBA32(0x00, 0x00, 0xFF, 0xFF));
+    rdpq_tex_upload_tlut(tlut_anim, 0, 16);
+    rdpq_tex_blit(&tex_ci, 8, 0, NULL);
+    rdpq_mode_tlut(TLUT_NONE);
+    rspq_wait();
+    ASSERT_EQUAL_UNSIGNED(debug_rdp_stream_count_cmd(0xF0), 2,
+        "palette uploads should not be skipped with the cache disabled");
+
+    ASSERT_SURFACE(&fb, {
+        if (y < 8 && x < 8)  return RGBA32(0xFF, 0x00, 0x00, 0xE0);
+        if (y < 8)           return RGBA32(0x00, 0x00, 0xFF, 0xE0);
+        return surface_debug_expected_color(&tex1, x%8, y%8);
+    });
+}
+
+void test_surface_convert(TestContext *ctx)
+{
+    static const tex_format_t fmts[] = {
+        FMT_RGBA32, FMT_RGBA16, FMT_IA16,
+        FMT_I8, FMT_IA8, FMT_I4, FMT_IA4,
+    };
+
+    // Converting to RGBA32 and back must be lossless for all formats
+    for (int i=0; i<sizeof(fmts) / sizeof(fmts[0]); i++) {
+        LOG("Testing format %s\n", tex_format_name(fmts[i]));
+        SRAND(i);
+        surface_t src = surface_create_random(37, 5, fmts[i]);
+        DEFER(surface_free(&src));
+        surface_t tmp = surface_alloc(FMT_RGBA32, 37, 5);
+        DEFER(surface_free(&tmp));
+        surface_t dst = surface_alloc(fmts[i], 37, 5);
+        DEFER(surface_free(&dst));
+
+        surface_convert(&tmp, &src);
+        surface_convert(&dst, &tmp);
+        for (int y=0; y<5; y++) {
+            for (int x=0; x<37; x++) {
+                ASSERT_EQUAL_HEX(surface_get_pixel(&dst, x, y), surface_get_pixel(&src, x, y),
+                    "wrong pixel at (%d,%d)", x, y);
+            }
+        }
+    }
+
+    // Check the decoding and encoding rules
+    uint32_t gray = 0x808080FF, red16 = 0xF801;
+    surface_t s32 = surface_make_linear(&gray, FMT_RGBA32, 1, 1);
+    surface_t s16 = surface_make_linear(&red16, FMT_RGBA16, 1, 1);
+    uint8_t buf[4] = {0};
+    surface_t d = surface_make_linear(buf, FMT_RGBA32, 1, 1);
+    surface_convert(&d, &s16);
+    ASSERT_EQUAL_HEX(*(uint32_t*)buf, 0xFF0000FF, "wrong RGBA16 -> RGBA32 conversion");
+    d = surface_make_linear(buf, FMT_IA8, 1, 1);
+    surface_convert(&d, &s32);
+    ASSERT_EQUAL_HEX(buf[0], 0x8F, "wrong RGBA32 -> IA8 conversion");
+    buf[0] = 0;
+    d = surface_make_linear(buf, FMT_IA4, 1, 1);
+    surface_convert(&d, &s32);
+    ASSERT_EQUAL_HEX(buf[0], 0x90, "wrong RGBA32 -> IA4 conversion");
+
+    // Converting to an odd-sized 4bpp subsurface must not touch the neighbour pixel
+    uint8_t i4[2] = { 0x00, 0x0F };
+    surface_t i4surf = surface_make_linear(i4, FMT_I4, 4, 1);
+    surface_t i4sub = surface_make_sub(&i4surf, 0, 0, 3, 1);
+    surface_t s3 = surface_make_linear((uint32_t[]){ gray, gray, gray }, FMT_RGBA32, 3, 1);
+    surface_convert(&i4sub, &s3);
+    ASSERT_EQUAL_HEX(i4[0], 0x88, "wrong RGBA32 -> I4 conversion");
+    ASSERT_EQUAL_HEX(i4[1], 0x8F, "neighbour pixel was overwritten");
+
+    // Conversions between intensity formats use dedicated row kernels: they
+    // must give the same result as going through RGBA32
+    static const tex_format_t pairs[][2] = {
+        { FMT_I8, FMT_IA16 }, { FMT_IA16, FMT_I8 }, { FMT_I8, FMT_IA8 },
+        { FMT_IA8, FMT_I8 }, { FMT_I4, FMT_I8 }, { FMT_I8, FMT_I4 },
+    };
+    for (int i=0; i<sizeof(pairs) / sizeof(pairs[0]); i++) {
+        LOG("Testing %s -> %s\n", tex_format_name(pairs[i][0]), tex_format_name(pairs[i][1]));
+        SRAND(i);
+        surface_t src = surface_create_random(37, 5, pairs[i][0]);
+        DEFER(surface_free(&src));
+        surface_t tmp = surface_alloc(FMT_RGBA32, 37, 5);
+        DEFER(surface_free(&tmp));
+        surface_t ref = surface_alloc(pairs[i][1], 37, 5);
+        DEFER(surface_free(&ref));
+        surface_t dst = surface_alloc(pairs[i][1], 37, 5);
+        DEFER(surface_free(&dst));
+
+        surface_convert(&tmp, &src);
+        surface_convert(&ref, &tmp);
+        surface_convert(&dst, &src);
+        for (int y=0; y<5; y++) {
+            for (int x=0; x<37; x++) {
+                ASSERT_EQUAL_HEX(surface_get_pixel(&dst, x, y), surface_get_pixel(&ref, x, y),
+                    "wrong pixel at (%d,%d)", x, y);
+            }
+        }
+    }
+}
+
+void test_rdpq_tex_convert(TestContext *ctx)
+{
+    RDPQ_INIT();
+
+    static const tex_format_t fmts[] = { FMT_RGBA16, FMT_I8, FMT_IA16 };
+    surface_t dst = surface_alloc(FMT_RGBA32, 37, 17);
+    DEFER(surface_free(&dst));
+
+    for (int i=0; i<sizeof(fmts) / sizeof(fmts[0]); i++) {
+        LOG("Testing format %s\n", tex_format_name(fmts[i]));
+        SRAND(i);
+        surface_t src = surface_create_random(37, 17, fmts[i]);
+        DEFER(surface_free(&src));
+        surface_t ref = surface_alloc(FMT_RGBA32, 37, 17);
+        DEFER(surface_free(&ref));
+        surface_convert(&ref, &src);
+
+        surface_clear(&dst, 0);
+        rdpq_tex_convert(&dst, &src);
+        rspq_wait();
+
+        // Colors must match the CPU conversion, while the alpha channel
+        // contains the full coverage.
+        ASSERT_SURFACE(&dst, {
+            return color_from_packed32((surface_get_pixel(&ref, x, y) & ~0xFF) | 0xE0);
+        });
+    }
+}
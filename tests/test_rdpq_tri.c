@@ -192,3 +192,315 @@ void test_rdpq_triangle_w1(TestContext *ctx) {
     ASSERT_EQUAL_HEX(BITS(rdp_stream[0],56,61), RDPQ_CMD_TRI_TEX, "invalid command");
     ASSERT_EQUAL_HEX(BITS(rdp_stream[4],16,31), 0x7FFF, "invalid W coordinate");
 }
+
+void test_rdpq_triangle_fx(TestContext *ctx) {
+    RDPQ_INIT();
+    debug_rdp_stream_init();
+
+    const int FBWIDTH = 16;
+    surface_t fb = surface_alloc(FMT_RGBA16, FBWIDTH, FBWIDTH);
+    DEFER(surface_free(&fb));
+    surface_clear(&fb, 0);
+
+    rdpq_set_color_image(&fb);
+    rdpq_set_tile(TILE4, FMT_RGBA16, 0, 64, 0);
+    rdpq_set_tile_size(TILE4, 0, 0, 32, 32);
+    rdpq_set_mode_standard();
+    rdpq_mode_combiner(RDPQ_COMBINER_TEX_SHADE);
+    rspq_wait();
+
+    const rdpq_trifmt_t trifmt = (rdpq_trifmt_t){
+        .pos_offset = 0, .z_offset = 2, .tex_offset = 3, .shade_offset = 6, .tex_tile = TILE4
+    };
+    const int RDP_TRI_SIZE = 22;
+
+    // Triangles whose coefficients can be calculated exactly with floats (dyadic slopes
+    // and gradients): the fixed-point setup must generate exactly the same command.
+    const int32_t exact[][3][10] = {
+        { { 0<<16, 0<<16, 0x0000,   0<<16,  0<<16, 1<<16,  0x0000, 0x0000, 0x0000, 0x10000 },
+          {16<<16, 0<<16, 0x8000,  32<<16,  0<<16, 1<<16,  0x8000, 0x4000, 0x0000, 0x10000 },
+          { 0<<16,16<<16, 0x4000,   0<<16, 32<<16, 1<<16,  0x0000, 0x8000, 0x10000, 0x10000 } },
+        { { 4<<16, 2<<16, 0x1000,   8<<16,  4<<16, 1<<16,  0x2000, 0x2000, 0x2000, 0x10000 },
+          {12<<16,10<<16, 0x1000,  24<<16, 20<<16, 1<<16,  0x6000, 0x2000, 0xA000, 0x10000 },
+          { 4<<16,10<<16, 0x3000,   8<<16, 20<<16, 1<<16,  0x2000, 0x6000, 0x2000, 0x10000 } },
+        { {10<<16, 1<<16, 0x8000,   2<<16,  2<<16, 1<<16,  0x10000, 0x0000, 0x0000, 0x10000 },
+          { 2<<16, 9<<16, 0x8000,   2<<16, 18<<16, 1<<16,  0x10000, 0x0000, 0x8000, 0x10000 },
+          {10<<16, 9<<16, 0x8000,  18<<16, 18<<16, 1<<16,  0x10000, 0x8000, 0x0000, 0x10000 } },
+    };
+
+    for (int tri=0; tri<sizeof(exact)/sizeof(exact[0]); tri++) {
+        float fv[3][10];
+        for (int i=0; i<3; i++)
+            for (int j=0; j<10; j++)
+                fv[i][j] = exact[tri][i][j] / 65536.0f;
+
+        debug_rdp_stream_reset();
+        rdpq_debug_log_msg("Float");
+        rdpq_triangle_cpu(&trifmt, fv[0], fv[1], fv[2]);
+        rdpq_debug_log_msg("Fixed");
+        rdpq_triangle_fx(&trifmt, exact[tri][0], exact[tri][1], exact[tri][2]);
+        rspq_wait();
+
+        uint64_t *tfloat = &rdp_stream[1];
+        uint64_t *tfx = &rdp_stream[RDP_TRI_SIZE+1+1];
+        for (int i=0; i<RDP_TRI_SIZE; i++) {
+            if (tfloat[i] != tfx[i]) {
+                debugf("Float[%d]:\n", tri); rdpq_debug_disasm(tfloat, stderr);
+                debugf("Fixed[%d]:\n", tri); rdpq_debug_disasm(tfx, stderr);
+                ASSERT_EQUAL_HEX(tfloat[i], tfx[i], "triangle %d: different command word %d", tri, i);
+            }
+        }
+    }
+
+    // Random triangles: the floating point version has rounding errors, so
+    // compare the coefficients with a small threshold. The check macros compare
+    // tcpu (floating point setup) against trsp (fixed-point setup).
+    for (int tri=0;tri<1024;tri++) {
+        SRAND(tri+1);
+        #define RXCOORD()   (((int)RANDN(4096) - 2048) << 14)     // s.2 in [-512,512]
+        #define RXZ()       ((int)RANDN(0x10000))
+        #define RXRGB()     ((int)RANDN(0x10001))
+        #define RXTEX()     (((int)RANDN(65536) - 32768) << 10)   // s9.5
+        int32_t v1[] = { RXCOORD(), RXCOORD(), RXZ(), RXTEX(), RXTEX(), 1<<16, RXRGB(), RXRGB(), RXRGB(), RXRGB() };
+        int32_t v2[] = { RXCOORD(), RXCOORD(), RXZ(), RXTEX(), RXTEX(), 1<<16, RXRGB(), RXRGB(), RXRGB(), RXRGB() };
+        int32_t v3[] = { RXCOORD(), RXCOORD(), RXZ(), RXTEX(), RXTEX(), 1<<16, RXRGB(), RXRGB(), RXRGB(), RXRGB() };
+
+        // skip degenerate triangles
+        if(v1[0] == v2[0] || v2[0] == v3[0] || v1[0] == v3[0]) continue;
+        if(v1[1] == v2[1] || v2[1] == v3[1] || v1[1] == v3[1]) continue;
+
+        float fv1[10], fv2[10], fv3[10];
+        for (int j=0; j<10; j++) {
+            fv1[j] = v1[j] / 65536.0f; fv2[j] = v2[j] / 65536.0f; fv3[j] = v3[j] / 65536.0f;
+        }
+
+        debug_rdp_stream_reset();
+        rdpq_debug_log_msg("Float");
+        rdpq_triangle_cpu(&trifmt, fv1, fv2, fv3);
+        rdpq_debug_log_msg("Fixed");
+        rdpq_triangle_fx(&trifmt, v1, v2, v3);
+        rspq_wait();
+
+        uint64_t *tcpu = &rdp_stream[1];
+        uint64_t *trsp = &rdp_stream[RDP_TRI_SIZE+1+1];
+
+        TRI_CHECK(0, 48, 63, "invalid command header (top 16 bits)");
+        TRI_CHECK(0, 32, 45, "invalid YL");
+        TRI_CHECK(0, 16, 29, "invalid YM");
+        TRI_CHECK(0,  0, 13, "invalid YH");
+        TRI_CHECK_F1616(1,48, 1,32, 0.01f, "invalid XL");
+        TRI_CHECK_F1616(2,48, 2,32, 0.01f, "invalid XH");
+        TRI_CHECK_F1616(3,48, 3,32, 0.01f, "invalid XM");
+        TRI_CHECK_F1616(1,16, 1, 0, 0.01f, "invalid ISL");
+        TRI_CHECK_F1616(2,16, 2, 0, 0.01f, "invalid ISH");
+        TRI_CHECK_F1616(3,16, 3, 0, 0.01f, "invalid ISM");
+
+        int off = 4;
+        TRI_CHECK_F1616(off+0,48, off+2,48, 0.05f, "invalid Red");
+        TRI_CHECK_F1616(off+1,48, off+3,48, 0.05f, "invalid DrDx");
+        TRI_CHECK_F1616(off+4,48, off+6,48, 0.05f, "invalid DrDe");
+        TRI_CHECK_F1616(off+5,48, off+7,48, 0.05f, "invalid DrDy");
+        TRI_CHECK_F1616(off+0,0,  off+2,0,  0.05f, "invalid Alpha");
+        TRI_CHECK_F1616(off+5,0,  off+7,0,  0.05f, "invalid DaDy");
+        off += 8;
+
+        TRI_CHECK_F1616(off+0,48, off+2,48, 0.5f, "invalid S");
+        TRI_CHECK_F1616(off+0,32, off+2,32, 0.5f, "invalid T");
+        TRI_CHECK_F1616(off+1,48, off+3,48, 0.5f, "invalid DsDx");
+        TRI_CHECK_F1616(off+4,32, off+6,32, 0.5f, "invalid DtDe");
+        TRI_CHECK_F1616(off+5,32, off+7,32, 0.5f, "invalid DtDy");
+        off += 8;
+
+        TRI_CHECK_F1616(off+0,48, off+0,32, 0.5f, "invalid Z");
+        TRI_CHECK_F1616(off+0,16, off+0,0,  0.5f, "invalid DzDx");
+        TRI_CHECK_F1616(off+1,16, off+1,0,  0.5f, "invalid DzDy");
+        TRI_CHECK_F1616(off+1,48, off+1,32, 0.5f, "invalid DzDe");
+    }
+}
+
+void test_rdpq_triangle_fx_bench(TestContext *ctx) {
+    RDPQ_INIT();
+
+    const int NUM_TRIS = 512;
+    int32_t (*vtx)[3][6] = malloc(NUM_TRIS * sizeof(*vtx));
+    DEFER(free(vtx));
+    float (*fvtx)[3][6] = malloc(NUM_TRIS * sizeof(*fvtx));
+    DEFER(free(fvtx));
+
+    // Generate 2D shaded triangles with integer coordinates, as typical of UI code
+    for (int i=0; i<NUM_TRIS; i++) {
+        for (int j=0; j<3; j++) {
+            vtx[i][j][0] = RANDN(320) << 16;
+            vtx[i][j][1] = RANDN(240) << 16;
+            for (int k=2; k<6; k++)
+                vtx[i][j][k] = RANDN(0x10001);
+            for (int k=0; k<6; k++)
+                fvtx[i][j][k] = vtx[i][j][k] / 65536.0f;
+        }
+    }
+
+    // Record the triangles into blocks, so that only the CPU setup is measured
+    // (there is no wait for RSP/RDP).
+    const rdpq_trifmt_t *fmts[2] = { &TRIFMT_FILL, &TRIFMT_SHADE };
+    const char *names[2] = { "fill", "shade" };
+    for (int f=0; f<2; f++) {
+        rspq_block_begin();
+        uint32_t t0 = TICKS_READ();
+        for (int i=0; i<NUM_TRIS; i++)
+            rdpq_triangle_cpu(fmts[f], fvtx[i][0], fvtx[i][1], fvtx[i][2]);
+        uint32_t t1 = TICKS_READ();
+        rspq_block_free(rspq_block_end());
+
+        rspq_block_begin();
+        uint32_t t2 = TICKS_READ();
+        for (int i=0; i<NUM_TRIS; i++)
+            rdpq_triangle_fx(fmts[f], vtx[i][0], vtx[i][1], vtx[i][2]);
+        uint32_t t3 = TICKS_READ();
+        rspq_block_free(rspq_block_end());
+
+        int64_t tps_float = (int64_t)NUM_TRIS * TICKS_PER_SECOND / TICKS_DISTANCE(t0, t1);
+        int64_t tps_fx = (int64_t)NUM_TRIS * TICKS_PER_SECOND / TICKS_DISTANCE(t2, t3);
+        LOG("%s triangles per second: float=%lld fixed=%lld\n", names[f], tps_float, tps_fx);
+
+        // The exact speedup depends on the triangles, but a fixed-point setup
+        // much slower than the floating point one means that 64-bit divisions
+        // (about 70 cycles each on VR4300) are being done per attribute.
+        ASSERT(tps_fx * 2 > tps_float, "fixed-point setup too slow for %s triangles: float=%lld fixed=%lld",
+            names[f], tps_float, tps_fx);
+    }
+}
+
+void test_rdpq_triangle_clip(TestContext *ctx) {
+    RDPQ_INIT();
+    debug_rdp_stream_init();
+
+    const int FULL_CVG = 7 << 5;   // full coverage
+    const int FBWIDTH = 16;
+    surface_t fb = surface_alloc(FMT_RGBA32, FBWIDTH, FBWIDTH);
+    DEFER(surface_free(&fb));
+    surface_t ref = surface_alloc(FMT_RGBA32, FBWIDTH, FBWIDTH);
+    DEFER(surface_free(&ref));
+
+    rdpq_set_color_image(&fb);
+    rdpq_set_mode_standard();
+    rdpq_mode_combiner(RDPQ_COMBINER_FLAT);
+    rdpq_set_prim_color(RGBA32(255,255,255,255));
+    rdpq_mode_antialias(AA_NONE);
+    rdpq_reset_triangle_stats();
+
+    // A triangle outside of the RDP coordinate range must be clipped and
+    // still cover the whole framebuffer.
+    surface_clear(&fb, 0);
+    rdpq_triangle(&TRIFMT_FILL,
+        (float[]){ -5000,   -1 },
+        (float[]){  5000,   -1 },
+        (float[]){     0, 5000 });
+    rspq_wait();
+    ASSERT_SURFACE(&fb, { return RGBA32(255,255,255,FULL_CVG); });
+
+    rdpq_triangle_stats_t stats;
+    rdpq_get_triangle_stats(&stats);
+    ASSERT_EQUAL_SIGNED(stats.clipped, 1, "invalid number of clipped triangles");
+    ASSERT(stats.clip_output >= 1, "no triangles generated by clipping");
+    ASSERT_EQUAL_SIGNED(stats.rejected_cpu, 0, "invalid number of triangles rejected by CPU");
+    ASSERT_EQUAL_SIGNED(stats.rejected_rsp, 0, "invalid number of triangles rejected by RSP");
+
+    // A triangle fully outside of the guard band is rejected by the CPU
+    rdpq_reset_triangle_stats();
+    debug_rdp_stream_reset();
+    rdpq_triangle(&TRIFMT_FILL,
+        (float[]){ 3000, 10 },
+        (float[]){ 3500, 10 },
+        (float[]){ 3000, 20 });
+    rspq_wait();
+    rdpq_get_triangle_stats(&stats);
+    ASSERT_EQUAL_SIGNED(stats.rejected_cpu, 1, "invalid number of triangles rejected by CPU");
+    ASSERT_EQUAL_SIGNED(debug_rdp_stream_count_cmd(0xC8), 0, "triangle was not rejected");
+
+    // A triangle within the guard band but outside of the scissor is
+    // rejected by the RSP
+    rdpq_reset_triangle_stats();
+    debug_rdp_stream_reset();
+    rdpq_triangle(&TRIFMT_FILL,
+        (float[]){ 100, 2 },
+        (float[]){ 200, 2 },
+        (float[]){ 100, 8 });
+    rspq_wait();
+    rdpq_get_triangle_stats(&stats);
+    ASSERT_EQUAL_SIGNED(stats.rejected_cpu, 0, "invalid number of triangles rejected by CPU");
+    ASSERT_EQUAL_SIGNED(stats.rejected_rsp, 1, "invalid number of triangles rejected by RSP");
+    ASSERT_EQUAL_SIGNED(debug_rdp_stream_count_cmd(0xC8), 0, "triangle was not rejected");
+
+    // Triangles touching the scissor are not rejected
+    rdpq_reset_triangle_stats();
+    debug_rdp_stream_reset();
+    rdpq_triangle(&TRIFMT_FILL,
+        (float[]){ 15.5f, 2 },
+        (float[]){ 200,   2 },
+        (float[]){ 100,   8 });
+    rspq_wait();
+    rdpq_get_triangle_stats(&stats);
+    ASSERT_EQUAL_SIGNED(stats.rejected_rsp, 0, "invalid number of triangles rejected by RSP");
+    ASSERT_EQUAL_SIGNED(debug_rdp_stream_count_cmd(0xC8), 1, "triangle was rejected");
+
+    // Rejection can be disabled
+    rdpq_config_disable(RDPQ_CFG_TRIREJECT);
+    rdpq_reset_triangle_stats();
+    debug_rdp_stream_reset();
+    rdpq_triangle(&TRIFMT_FILL,
+        (float[]){ 100, 2 },
+        (float[]){ 200, 2 },
+        (float[]){ 100, 8 });
+    rspq_wait();
+    rdpq_get_triangle_stats(&stats);
+    ASSERT_EQUAL_SIGNED(stats.rejected_rsp, 0, "invalid number of triangles rejected by RSP");
+    ASSERT_EQUAL_SIGNED(debug_rdp_stream_count_cmd(0xC8), 1, "triangle was rejected");
+    rdpq_config_enable(RDPQ_CFG_TRIREJECT);
+
+    // Clipping must preserve the interpolation of the attributes. Draw a shaded,
+    // textured triangle without clipping, and then clipped against a small
+    // guard band, and compare the results.
+    surface_t tex = surface_alloc(FMT_RGBA32, 8, 8);
+    DEFER(surface_free(&tex));
+    uint32_t *texels = tex.buffer;
+    for (int i=0; i<8*8; i++)
+        texels[i] = ((i * 0x1F) << 24) | ((i * 0x0B) << 16) | ((i * 0x17) << 8) | 0xFF;
+    data_cache_hit_writeback(tex.buffer, 8*8*4);
+
+    rdpq_mode_combiner(RDPQ_COMBINER_TEX_SHADE);
+    rdpq_mode_persp(true);
+    rdpq_tex_upload(TILE0, &tex, &(rdpq_texparms_t){ .s.repeats = REPEAT_INFINITE, .t.repeats = REPEAT_INFINITE });
+
+    void draw_tri(void) {
+        rdpq_triangle(&TRIFMT_SHADE_TEX,
+            //         X    Y    R     G     B     A     S     T     INV_W
+            (float[]){ -30, -20, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f  },
+            (float[]){ 50,  -10, 0.0f, 1.0f, 0.0f, 1.0f, 32.0f,0.0f, 0.5f  },
+            (float[]){ -10,  60, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 32.0f,0.25f });
+    }
+
+    surface_clear(&ref, 0);
+    rdpq_set_color_image(&ref);
+    draw_tri();
+    rdpq_set_triangle_guardband(-4, -4, 20, 20);
+    rdpq_reset_triangle_stats();
+    surface_clear(&fb, 0);
+    rdpq_set_color_image(&fb);
+    draw_tri();
+    rspq_wait();
+
+    rdpq_get_triangle_stats(&stats);
+    ASSERT_EQUAL_SIGNED(stats.clipped, 1, "invalid number of clipped triangles");
+
+    // Allow small rounding differences, as the edges and gradients are
+    // recalculated on the clipped vertices.
+    uint32_t *pfb = fb.buffer, *pref = ref.buffer;
+    for (int i=0; i<FBWIDTH*FBWIDTH; i++) {
+        for (int sh=8; sh<32; sh+=8) {
+            int c0 = (pref[i] >> sh) & 0xFF, c1 = (pfb[i] >> sh) & 0xFF;
+            if (abs(c0 - c1) > 8) {
+                ASSERT_EQUAL_HEX(pfb[i], pref[i], "wrong pixel at (%d,%d)", i % FBWIDTH, i / FBWIDTH);
+            }
+        }
+    }
+}
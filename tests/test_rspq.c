@@ -426,6 +426,48 @@ void test_rspq_wait(TestContext *ctx)
     ASSERT_EQUAL_UNSIGNED(*actual_sum, 100, "Sum is incorrect!");
 }
 
+static void test_rspq_idle_cb(void *arg)
+{
+    int *counter = arg;
+    (*counter)++;
+}
+
+void test_rspq_wait_idle(TestContext *ctx)
+{
+    TEST_RSPQ_PROLOG();
+    
+    test_ovl_init();
+    DEFER(test_ovl_close());
+
+    int idle_calls = 0;
+    rspq_set_idle_callback(test_rspq_idle_cb, &idle_calls);
+    DEFER(rspq_set_idle_callback(NULL, NULL));
+
+    rspq_reset_wait_stats();
+
+    // Schedule a long RSP command and wait for it. The idle callback
+    // must be called while the CPU waits.
+    rspq_test_wait(0x8000);
+    rspq_syncpoint_wait(rspq_syncpoint_new());
+
+    rspq_wait_stats_t stats;
+    rspq_get_wait_stats(&stats);
+
+    ASSERT(idle_calls > 0, "idle callback was never called");
+    ASSERT_EQUAL_SIGNED(stats.idle_calls, idle_calls, "invalid number of idle calls in stats");
+    ASSERT_EQUAL_SIGNED(stats.syncpoint_waits, 1, "invalid number of syncpoint waits");
+    ASSERT(stats.syncpoint_ticks > 0, "wait time was not recorded");
+
+    // Waiting for a syncpoint that was already reached must not be counted
+    rspq_syncpoint_t sync = rspq_syncpoint_new();
+    rspq_wait();
+    rspq_reset_wait_stats();
+    rspq_syncpoint_wait(sync);
+    rspq_get_wait_stats(&stats);
+    ASSERT_EQUAL_SIGNED(stats.syncpoint_waits, 0, "immediate wait was counted");
+    ASSERT_EQUAL_SIGNED(stats.idle_calls, 0, "idle callback was called on immediate wait");
+}
+
 void test_rspq_rapid_sync(TestContext *ctx)
 {
     TEST_RSPQ_PROLOG();
@@ -707,6 +749,94 @@ void test_rspq_highpri_overlay(TestContext *ctx)
     TEST_RSPQ_EPILOG(0, rspq_timeout);
 }
 
+void test_rspq_user_queues(TestContext *ctx)
+{
+    TEST_RSPQ_PROLOG();
+    test_ovl_init();
+    DEFER(test_ovl_close());
+
+    rspq_queue_t *render_a = rspq_queue_new("render_a", 0, 2);
+    DEFER(rspq_queue_free(render_a));
+    rspq_queue_t *render_b = rspq_queue_new("render_b", 0, 1);
+    DEFER(rspq_queue_free(render_b));
+    rspq_queue_t *audio = rspq_queue_new("audio", 1, 1);
+    DEFER(rspq_queue_free(audio));
+
+    // Each job adds a value to the test variable, and then writes it to
+    // its own slot of the log. The values found in the log tell the order
+    // in which the jobs were run.
+    uint64_t log[8][2] __attribute__((aligned(16))) = {0};
+    data_cache_hit_writeback_invalidate(log, sizeof(log));
+
+    // Record jobs in reverse priority order
+    int slot = 0;
+    for (int i=0; i<4; i++) {
+        rspq_queue_begin(render_a);
+        rspq_test_8(1);
+        rspq_test_output(log[slot++]);
+        rspq_queue_end();
+    }
+    for (int i=0; i<2; i++) {
+        rspq_queue_begin(render_b);
+        rspq_test_8(100);
+        rspq_test_output(log[slot++]);
+        rspq_queue_end();
+    }
+    for (int i=0; i<2; i++) {
+        rspq_queue_begin(audio);
+        rspq_test_8(10000);
+        rspq_test_output(log[slot++]);
+        rspq_queue_end();
+    }
+
+    rspq_queue_stats_t stats;
+    rspq_queue_get_stats(audio, &stats);
+    ASSERT_EQUAL_UNSIGNED(stats.jobs_submitted, 2, "invalid number of submitted jobs");
+    ASSERT_EQUAL_UNSIGNED(stats.jobs_pending, 2, "invalid number of pending jobs");
+    ASSERT_EQUAL_UNSIGNED(stats.jobs_completed, 0, "jobs completed before dispatch");
+
+    rspq_test_reset();
+    rspq_queue_dispatch();
+    rspq_wait();
+
+    // The audio queue has higher priority, so it must have been run first
+    // even if its jobs were recorded later. Then render_a and render_b
+    // alternate, with render_a running two jobs per round.
+    const uint64_t expected[8] = {
+        20001, 20002, 20103, 20104,     // render_a
+        20102, 20204,                   // render_b
+        10000, 20000,                   // audio
+    };
+    for (int i=0; i<8; i++)
+        ASSERT_EQUAL_UNSIGNED(log[i][0], expected[i], "job %d run in the wrong order", i);
+
+    rspq_queue_get_stats(audio, &stats);
+    ASSERT_EQUAL_UNSIGNED(stats.jobs_pending, 0, "audio jobs were not dispatched");
+    ASSERT_EQUAL_UNSIGNED(stats.jobs_completed, 2, "audio jobs were not completed");
+    ASSERT(stats.latency_max > 0, "audio latency was not recorded");
+
+    rspq_queue_get_stats(render_a, &stats);
+    ASSERT_EQUAL_UNSIGNED(stats.jobs_completed, 4, "render jobs were not completed");
+
+    // Record more jobs: they reuse the memory of the completed ones.
+    data_cache_hit_writeback_invalidate(log, sizeof(log));
+    rspq_queue_begin(render_b);
+    rspq_test_8(100);
+    rspq_test_output(log[0]);
+    rspq_queue_end();
+    rspq_queue_begin(audio);
+    rspq_test_8(10000);
+    rspq_test_output(log[1]);
+    rspq_queue_end();
+
+    rspq_test_reset();
+    rspq_queue_dispatch();
+    rspq_wait();
+
+    ASSERT_EQUAL_UNSIGNED(log[1][0], 10000, "audio job run in the wrong order");
+    ASSERT_EQUAL_UNSIGNED(log[0][0], 10100, "render job run in the wrong order");
+}
+
 void test_rspq_big_command(TestContext *ctx)
 {
     TEST_RSPQ_PROLOG();
@@ -211,6 +211,11 @@ int assert_equal_mem(TestContext *ctx, const char *file, int line, const uint8_t
 #include "test_rdpq_tex.c"
 #include "test_rdpq_attach.c"
 #include "test_rdpq_sprite.c"
+#include "test_rdpq_batch.c"
+#include "test_rdpq_font.c"
+#include "test_display.c"
+#include "test_graphics.c"
+#include "test_mixer.c"
 
 /**********************************************************************
  * MAIN
@@ -268,6 +273,7 @@ static const struct Testsuite
 	TEST_FUNC(test_rspq_switch_overlay,        0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_multiple_flush,        0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_wait,                  0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspq_wait_idle,             0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_rapid_sync,            0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_flush,                 0, TEST_FLAGS_NO_BENCHMARK | TEST_FLAGS_NO_EMULATOR),
 	TEST_FUNC(test_rspq_rapid_flush,           0, TEST_FLAGS_NO_BENCHMARK | TEST_FLAGS_NO_EMULATOR),
@@ -276,6 +282,7 @@ static const struct Testsuite
 	TEST_FUNC(test_rspq_highpri_basic,         0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_highpri_multiple,      0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_highpri_overlay,       0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspq_user_queues,           0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_big_command,           0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_rdp_dynamic,           0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_rdp_dynamic_switch,    0, TEST_FLAGS_NO_BENCHMARK),
@@ -288,6 +295,9 @@ static const struct Testsuite
 	TEST_FUNC(test_rdpq_block_contiguous,      0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_block_dynamic,         0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_block_nested,          0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_block_optimize,        0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_profile,               0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_dynres,                0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_change_other_modes,    0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_fixup_setfillcolor,    0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_fixup_setscissor,      0, TEST_FLAGS_NO_BENCHMARK),
@@ -298,6 +308,7 @@ static const struct Testsuite
 	TEST_FUNC(test_rdpq_syncfull_cb,           0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_syncfull_resume,       0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_autosync,              0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_autosync_stats,        0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_automode,              0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_blender,               0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_blender_memory,        0, TEST_FLAGS_NO_BENCHMARK),
@@ -306,21 +317,44 @@ static const struct Testsuite
 	TEST_FUNC(test_rdpq_mode_alphacompare,     0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_mode_freeze,           0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_mode_freeze_stack,     0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_mode_state,           0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_mipmap,                0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_autotmem,              0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_autotmem_reuse,        0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_texrect_passthrough,   0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_rect_batch,            0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_debug_capture,         0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_triangle,              0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_triangle_w1,           0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_triangle_fx,           0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_triangle_fx_bench,     0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_triangle_clip,         0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_attach_clear,             0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_attach_stack,             0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_tex_upload,            0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_tex_upload_multi,      0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_tex_blit_normal,       0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_tex_blit_flip,         0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_tex_multi_i4,          0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_tex_upload_tlut,       0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_tex_cache,             0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_tex_convert,           0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_surface_convert,            0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_sprite_upload,         0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_sprite_lod,            0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_tilemap,               0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_sprite_atlas,          0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_batch,                 0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_batch_large,           0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_font,                  0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_font_tmem,             0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_display_stats,              0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_display_frame_size,         0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_display_pacing,             0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_graphics_blit16,            0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_graphics_blit32,            0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_mixer_pos,                  0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_mixer_stall,                0, TEST_FLAGS_NO_BENCHMARK),
 };
 
 int main() {
@@ -0,0 +1,532 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include "../common/binout.c"
+#include "../common/binout.h"
+#include "../common/polyfill.h"
+
+#define LODEPNG_NO_COMPILE_ANCILLARY_CHUNKS    // No need to parse PNG extra fields
+#define LODEPNG_NO_COMPILE_CPP                 // No need to use C++ API
+#include "../common/lodepng.h"
+#include "../common/lodepng.c"
+
+// Compression library
+#include "../common/assetcomp.h"
+
+// Bring in tex_format_t definition
+#include "surface.h"
+#include "../../src/rdpq/rdpq_font_internal.h"
+
+// Padding between glyphs in the atlas (avoids bleeding with bilinear filtering)
+#define ATLAS_PADDING   1
+
+bool flag_verbose = false;
+
+typedef struct {
+    uint32_t codepoint;
+    int x, y, width, height;    // Rectangle in the source page
+    int xoff, yoff, xadvance;
+    int page;                   // Source page
+    int atlas, s, t;            // Placement in the output atlas
+} glyph_t;
+
+typedef struct {
+    uint32_t first, second;
+    int amount;
+} kerning_t;
+
+typedef struct {
+    int line_height;
+    int base;
+    glyph_t *glyphs;
+    int num_glyphs;
+    kerning_t *kernings;
+    int num_kernings;
+    char *pages[256];
+    int num_pages;
+} bmfont_t;
+
+typedef struct {
+    int width, height;
+    uint8_t *pixels;            // 8-bit coverage, one byte per texel
+} atlas_t;
+
+void print_args( char * name )
+{
+    fprintf(stderr, "%s -- Libdragon font conversion tool\n\n", name);
+    fprintf(stderr, "This tool converts bitmap fonts in the BMFont text format (.fnt + .png pages)\n");
+    fprintf(stderr, "into .font64 files that can be loaded with rdpq_font_load(). Glyphs are repacked\n");
+    fprintf(stderr, "into 4bpp atlas pages that fit in TMEM. TrueType fonts must be rasterized into\n");
+    fprintf(stderr, "BMFont format first (eg: with AngelCode BMFont or Hiero).\n\n");
+    fprintf(stderr, "Usage: %s [flags] <input files...>\n", name);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Command-line flags:\n");
+    fprintf(stderr, "   -v/--verbose          Verbose output\n");
+    fprintf(stderr, "   -o/--output <dir>     Specify output directory (default: .)\n");
+    fprintf(stderr, "   -f/--format <fmt>     Specify atlas format: I4 or IA4 (default: I4)\n");
+    fprintf(stderr, "   -c/--compress <level> Compress output files (default: %d)\n", DEFAULT_COMPRESSION);
+    fprintf(stderr, "\n");
+}
+
+// Parse an integer value in a BMFont line (eg: " x=12")
+static bool bm_int(const char *line, const char *key, int *val)
+{
+    char pattern[32];
+    snprintf(pattern, sizeof(pattern), " %s=", key);
+    const char *p = strstr(line, pattern);
+    if (!p) return false;
+    *val = atoi(p + strlen(pattern));
+    return true;
+}
+
+// Parse a string value in a BMFont line (eg: " file="font_0.png"")
+static char* bm_str(const char *line, const char *key)
+{
+    char pattern[32];
+    snprintf(pattern, sizeof(pattern), " %s=", key);
+    const char *p = strstr(line, pattern);
+    if (!p) return NULL;
+    p += strlen(pattern);
+    if (*p == '"') {
+        const char *end = strchr(p+1, '"');
+        if (!end) return NULL;
+        return strndup(p+1, end-p-1);
+    }
+    return strndup(p, strcspn(p, " \t\r\n"));
+}
+
+static bool bmfont_load(const char *infn, bmfont_t *fnt)
+{
+    FILE *f = fopen(infn, "r");
+    if (!f) {
+        fprintf(stderr, "ERROR: cannot open input file %s\n", infn);
+        return false;
+    }
+
+    char *line = NULL; size_t linesz = 0;
+    int max_glyphs = 0, max_kernings = 0;
+    bool first = true, ok = true;
+    while (getline(&line, &linesz, f) != -1) {
+        if (first) {
+            first = false;
+            if (!strncmp(line, "BMF", 3) || !strncmp(line, "<?xml", 5)) {
+                fprintf(stderr, "ERROR: %s: only the text BMFont format is supported\n", infn);
+                ok = false;
+                break;
+            }
+            if (strncmp(line, "info", 4) != 0) {
+                fprintf(stderr, "ERROR: %s: not a BMFont file\n", infn);
+                ok = false;
+                break;
+            }
+        }
+
+        if (!strncmp(line, "common ", 7)) {
+            bm_int(line, "lineHeight", &fnt->line_height);
+            bm_int(line, "base", &fnt->base);
+        } else if (!strncmp(line, "page ", 5)) {
+            int id;
+            char *file = bm_str(line, "file");
+            if (!bm_int(line, "id", &id) || !file || id < 0 || id >= 256) {
+                fprintf(stderr, "ERROR: %s: invalid page line: %s", infn, line);
+                free(file);
+                ok = false;
+                break;
+            }
+            free(fnt->pages[id]);
+            fnt->pages[id] = file;
+            if (id >= fnt->num_pages) fnt->num_pages = id+1;
+        } else if (!strncmp(line, "char ", 5)) {
+            if (fnt->num_glyphs == max_glyphs) {
+                max_glyphs = max_glyphs ? max_glyphs*2 : 256;
+                fnt->glyphs = realloc(fnt->glyphs, max_glyphs * sizeof(glyph_t));
+            }
+            glyph_t *g = &fnt->glyphs[fnt->num_glyphs++];
+            memset(g, 0, sizeof(*g));
+            int id = 0;
+            bm_int(line, "id", &id);
+            g->codepoint = id;
+            bm_int(line, "x", &g->x);
+            bm_int(line, "y", &g->y);
+            bm_int(line, "width", &g->width);
+            bm_int(line, "height", &g->height);
+            bm_int(line, "xoffset", &g->xoff);
+            bm_int(line, "yoffset", &g->yoff);
+            bm_int(line, "xadvance", &g->xadvance);
+            bm_int(line, "page", &g->page);
+        } else if (!strncmp(line, "kerning ", 8)) {
+            if (fnt->num_kernings == max_kernings) {
+                max_kernings = max_kernings ? max_kernings*2 : 256;
+                fnt->kernings = realloc(fnt->kernings, max_kernings * sizeof(kerning_t));
+            }
+            kerning_t *k = &fnt->kernings[fnt->num_kernings++];
+            int first = 0, second = 0;
+            bm_int(line, "first", &first);
+            bm_int(line, "second", &second);
+            bm_int(line, "amount", &k->amount);
+            k->first = first; k->second = second;
+        }
+    }
+    free(line);
+    fclose(f);
+
+    if (ok && fnt->num_glyphs == 0) {
+        fprintf(stderr, "ERROR: %s: no glyphs found\n", infn);
+        ok = false;
+    }
+    return ok;
+}
+
+static void bmfont_free(bmfont_t *fnt)
+{
+    for (int i=0; i<fnt->num_pages; i++)
+        free(fnt->pages[i]);
+    free(fnt->glyphs);
+    free(fnt->kernings);
+}
+
+static int glyph_cmp_codepoint(const void *a, const void *b)
+{
+    const glyph_t *ga = a, *gb = b;
+    return (ga->codepoint > gb->codepoint) - (ga->codepoint < gb->codepoint);
+}
+
+static int glyph_cmp_pack(const void *a, const void *b)
+{
+    const glyph_t *ga = *(const glyph_t**)a, *gb = *(const glyph_t**)b;
+    // ASCII glyphs first, so that common text only needs the first pages
+    bool aa = ga->codepoint < 128, ab = gb->codepoint < 128;
+    if (aa != ab) return ab - aa;
+    // Then sort by decreasing height, for better shelf packing
+    if (ga->height != gb->height) return gb->height - ga->height;
+    return (ga->codepoint > gb->codepoint) - (ga->codepoint < gb->codepoint);
+}
+
+static int kerning_cmp(const void *a, const void *b)
+{
+    const kerning_t *ka = a, *kb = b;
+    if (ka->first != kb->first) return (ka->first > kb->first) - (ka->first < kb->first);
+    return (ka->second > kb->second) - (ka->second < kb->second);
+}
+
+static int glyph_find(bmfont_t *fnt, uint32_t codepoint)
+{
+    glyph_t key = { .codepoint = codepoint };
+    glyph_t *g = bsearch(&key, fnt->glyphs, fnt->num_glyphs, sizeof(glyph_t), glyph_cmp_codepoint);
+    return g ? g - fnt->glyphs : -1;
+}
+
+// Pack the glyphs into atlas pages using a shelf packer, and copy their pixels.
+static bool atlas_pack(const char *infn, bmfont_t *fnt, atlas_t **out_atlases, int *out_num_atlases)
+{
+    // Load the source pages (relative to the directory of the .fnt file)
+    char *dir = strdup(infn);
+    char *slash = strrchr(dir, '/');
+    if (slash) slash[1] = '\0'; else dir[0] = '\0';
+
+    uint8_t *pages[256] = {0};
+    unsigned pages_w[256] = {0}, pages_h[256] = {0};
+    bool ok = true;
+    for (int i=0; i<fnt->num_pages && ok; i++) {
+        if (!fnt->pages[i]) continue;
+        char *fn; asprintf(&fn, "%s%s", dir, fnt->pages[i]);
+        unsigned err = lodepng_decode32_file(&pages[i], &pages_w[i], &pages_h[i], fn);
+        if (err) {
+            fprintf(stderr, "ERROR: %s: PNG decoding error: %s\n", fn, lodepng_error_text(err));
+            ok = false;
+        }
+        free(fn);
+    }
+    free(dir);
+
+    glyph_t **order = malloc(fnt->num_glyphs * sizeof(glyph_t*));
+    for (int i=0; i<fnt->num_glyphs; i++)
+        order[i] = &fnt->glyphs[i];
+    qsort(order, fnt->num_glyphs, sizeof(glyph_t*), glyph_cmp_pack);
+
+    atlas_t *atlases = NULL;
+    int num_atlases = 0;
+    int x = 0, y = 0, shelf_h = 0;
+    for (int i=0; i<fnt->num_glyphs && ok; i++) {
+        glyph_t *g = order[i];
+        if (g->width == 0 || g->height == 0) {
+            g->width = g->height = 0;
+            continue;
+        }
+        if (g->width > FONT_ATLAS_WIDTH || g->height > FONT_ATLAS_HEIGHT) {
+            fprintf(stderr, "ERROR: %s: glyph %d is too big (%dx%d, max %dx%d)\n", infn,
+                g->codepoint, g->width, g->height, FONT_ATLAS_WIDTH, FONT_ATLAS_HEIGHT);
+            ok = false;
+            break;
+        }
+        if (g->page < 0 || g->page >= fnt->num_pages || !pages[g->page] ||
+            g->x < 0 || g->y < 0 || g->x + g->width > pages_w[g->page] || g->y + g->height > pages_h[g->page]) {
+            fprintf(stderr, "ERROR: %s: glyph %d is outside of its page\n", infn, g->codepoint);
+            ok = false;
+            break;
+        }
+
+        // Go to the next shelf, or to the next page
+        if (num_atlases && x + g->width > FONT_ATLAS_WIDTH) {
+            x = 0;
+            y += shelf_h + ATLAS_PADDING;
+            shelf_h = 0;
+        }
+        if (!num_atlases || y + g->height > FONT_ATLAS_HEIGHT) {
+            atlases = realloc(atlases, (num_atlases+1) * sizeof(atlas_t));
+            atlases[num_atlases].width = FONT_ATLAS_WIDTH;
+            atlases[num_atlases].height = 0;
+            atlases[num_atlases].pixels = calloc(FONT_ATLAS_WIDTH * FONT_ATLAS_HEIGHT, 1);
+            num_atlases++;
+            x = y = shelf_h = 0;
+        }
+
+        atlas_t *atlas = &atlases[num_atlases-1];
+        g->atlas = num_atlases-1;
+        g->s = x;
+        g->t = y;
+
+        // Copy the glyph pixels. Coverage is taken from the alpha channel,
+        // modulated by the brightest color channel, so that both white glyphs
+        // on a transparent background and opaque grayscale pages work.
+        for (int j=0; j<g->height; j++) {
+            for (int i=0; i<g->width; i++) {
+                uint8_t *px = &pages[g->page][((g->y + j) * pages_w[g->page] + g->x + i) * 4];
+                int c = px[0]; if (px[1] > c) c = px[1]; if (px[2] > c) c = px[2];
+                atlas->pixels[(y + j) * FONT_ATLAS_WIDTH + x + i] = px[3] * c / 255;
+            }
+        }
+
+        x += g->width + ATLAS_PADDING;
+        if (g->height > shelf_h) shelf_h = g->height;
+        if (y + g->height > atlas->height) atlas->height = y + g->height;
+    }
+
+    free(order);
+    for (int i=0; i<fnt->num_pages; i++)
+        free(pages[i]);
+
+    *out_atlases = atlases;
+    *out_num_atlases = num_atlases;
+    return ok;
+}
+
+static uint8_t conv_texel(tex_format_t fmt, uint8_t v)
+{
+    if (fmt == FMT_IA4)
+        return v >= 0x80 ? 0xF : 0x0;
+    return (v * 15 + 127) / 255;
+}
+
+int convert(const char *infn, const char *outfn, tex_format_t fmt)
+{
+    bmfont_t fnt = {0};
+    atlas_t *atlases = NULL;
+    int num_atlases = 0;
+    FILE *out = NULL;
+    int ret = 1;
+
+    if (flag_verbose)
+        fprintf(stderr, "Converting: %s => %s [%s]\n", infn, outfn, fmt == FMT_IA4 ? "IA4" : "I4");
+
+    if (!bmfont_load(infn, &fnt))
+        goto end;
+
+    qsort(fnt.glyphs, fnt.num_glyphs, sizeof(glyph_t), glyph_cmp_codepoint);
+    for (int i=1; i<fnt.num_glyphs; i++) {
+        if (fnt.glyphs[i].codepoint == fnt.glyphs[i-1].codepoint) {
+            fprintf(stderr, "ERROR: %s: duplicated glyph %d\n", infn, fnt.glyphs[i].codepoint);
+            goto end;
+        }
+    }
+    if (fnt.num_glyphs > 0xFFFF) {
+        fprintf(stderr, "ERROR: %s: too many glyphs (%d)\n", infn, fnt.num_glyphs);
+        goto end;
+    }
+
+    if (!atlas_pack(infn, &fnt, &atlases, &num_atlases))
+        goto end;
+    if (num_atlases > 255) {
+        fprintf(stderr, "ERROR: %s: too many atlas pages (%d)\n", infn, num_atlases);
+        goto end;
+    }
+
+    // Convert kerning pairs to glyph indices, dropping those referring to
+    // missing glyphs or with no effect.
+    int num_kernings = 0;
+    for (int i=0; i<fnt.num_kernings; i++) {
+        int g1 = glyph_find(&fnt, fnt.kernings[i].first);
+        int g2 = glyph_find(&fnt, fnt.kernings[i].second);
+        if (g1 < 0 || g2 < 0 || fnt.kernings[i].amount == 0) continue;
+        fnt.kernings[num_kernings++] = (kerning_t){ g1, g2, fnt.kernings[i].amount };
+    }
+    qsort(fnt.kernings, num_kernings, sizeof(kerning_t), kerning_cmp);
+
+    out = fopen(outfn, "wb");
+    if (!out) {
+        fprintf(stderr, "ERROR: cannot open output file %s\n", outfn);
+        goto end;
+    }
+
+    // Header
+    fwrite(FONT_MAGIC, 1, 3, out);
+    w8(out, FONT_VERSION);
+    w16(out, fnt.line_height);
+    w16(out, fnt.base);
+    w16(out, fnt.num_glyphs);
+    w16(out, num_kernings);
+    w16(out, num_atlases);
+    w16(out, 0);
+    int w_glyphs = w32_placeholder(out);
+    int w_kerning = w32_placeholder(out);
+    int w_atlases = w32_placeholder(out);
+    w32(out, 0);
+
+    // Glyphs
+    walign(out, 4);
+    w32_at(out, w_glyphs, ftell(out));
+    for (int i=0; i<fnt.num_glyphs; i++) {
+        glyph_t *g = &fnt.glyphs[i];
+        w32(out, g->codepoint);
+        w16(out, g->xadvance);
+        w16(out, g->xoff);
+        w16(out, g->yoff);
+        w8(out, g->width);
+        w8(out, g->height);
+        w8(out, g->s);
+        w8(out, g->t);
+        w8(out, g->atlas);
+        w8(out, 0);
+    }
+
+    // Kerning pairs
+    walign(out, 4);
+    w32_at(out, w_kerning, ftell(out));
+    for (int i=0; i<num_kernings; i++) {
+        w16(out, fnt.kernings[i].first);
+        w16(out, fnt.kernings[i].second);
+        w16(out, fnt.kernings[i].amount);
+        w16(out, 0);
+    }
+
+    // Atlas pages
+    walign(out, 4);
+    w32_at(out, w_atlases, ftell(out));
+    int *w_data = alloca(num_atlases * sizeof(int));
+    for (int i=0; i<num_atlases; i++) {
+        w_data[i] = w32_placeholder(out);
+        w16(out, atlases[i].width);
+        w16(out, atlases[i].height);
+        w8(out, fmt);
+        w8(out, 0); w8(out, 0); w8(out, 0);
+    }
+
+    // Pixels, 4 bits per texel (high nibble first)
+    for (int i=0; i<num_atlases; i++) {
+        walign(out, 8);
+        w32_at(out, w_data[i], ftell(out));
+        atlas_t *a = &atlases[i];
+        for (int j=0; j<a->width * a->height; j+=2)
+            w8(out, (conv_texel(fmt, a->pixels[j]) << 4) | conv_texel(fmt, a->pixels[j+1]));
+    }
+
+    if (flag_verbose) {
+        fprintf(stderr, "glyphs: %d, kerning pairs: %d, atlas pages: %d\n", fnt.num_glyphs, num_kernings, num_atlases);
+        for (int i=0; i<num_atlases; i++)
+            fprintf(stderr, "  page %d: %dx%d (%d bytes)\n", i, atlases[i].width, atlases[i].height, atlases[i].width * atlases[i].height / 2);
+    }
+    ret = 0;
+
+end:
+    if (out) fclose(out);
+    for (int i=0; i<num_atlases; i++)
+        free(atlases[i].pixels);
+    free(atlases);
+    bmfont_free(&fnt);
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    char *infn = NULL, *outdir = ".", *outfn = NULL;
+    tex_format_t fmt = FMT_I4;
+    int compression = DEFAULT_COMPRESSION;
+    bool error = false;
+
+    if (argc < 2) {
+        print_args(argv[0]);
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-') {
+            if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+                print_args(argv[0]);
+                return 0;
+            } else if (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose")) {
+                flag_verbose = true;
+            } else if (!strcmp(argv[i], "-o") || !strcmp(argv[i], "--output")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                outdir = argv[i];
+            } else if (!strcmp(argv[i], "-f") || !strcmp(argv[i], "--format")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                if (!strcasecmp(argv[i], "I4")) fmt = FMT_I4;
+                else if (!strcasecmp(argv[i], "IA4")) fmt = FMT_IA4;
+                else {
+                    fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+                    return 1;
+                }
+            } else if (!strcmp(argv[i], "-c") || !strcmp(argv[i], "--compress")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                char extra;
+                if (sscanf(argv[i], "%d%c", &compression, &extra) != 1 || compression < 0 || compression > MAX_COMPRESSION) {
+                    fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+                    return 1;
+                }
+            } else {
+                fprintf(stderr, "invalid flag: %s\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+
+        infn = argv[i];
+        char *basename = strrchr(infn, '/');
+        if (!basename) basename = infn; else basename += 1;
+        char* basename_noext = strdup(basename);
+        char* ext = strrchr(basename_noext, '.');
+        if (ext) *ext = '\0';
+
+        asprintf(&outfn, "%s/%s.font64", outdir, basename_noext);
+        if (convert(infn, outfn, fmt) != 0) {
+            error = true;
+        } else if (compression) {
+            struct stat st_decomp = {0}, st_comp = {0};
+            stat(outfn, &st_decomp);
+            asset_compress(outfn, outfn, compression, 0);
+            stat(outfn, &st_comp);
+            if (flag_verbose)
+                fprintf(stderr, "compressed: %s (%d -> %d, ratio %.1f%%)\n", outfn,
+                (int)st_decomp.st_size, (int)st_comp.st_size, 100.0 * (float)st_comp.st_size / (float)(st_decomp.st_size == 0 ? 1 :st_decomp.st_size));
+        }
+
+        free(basename_noext);
+        free(outfn);
+    }
+
+    return error ? 1 : 0;
+}
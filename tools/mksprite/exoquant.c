@@ -411,29 +411,84 @@ void exq_sum_node(exq_node *pNode)
 //	printf("error sum: %f, vdif: %f\n", pNode->err, pNode->vdif);
 }
 
+void (*exq_parallel_for)(int n, exq_range_func fn, void *arg) = NULL;
+
+typedef struct _exq_optimize_job
+{
+	exq_data		*pExq;
+	exq_histogram	**ppHist;
+	unsigned char	*pIndex;
+} exq_optimize_job;
+
+static void exq_optimize_nearest(void *arg, int i0, int i1)
+{
+	exq_optimize_job *pJob = (exq_optimize_job*)arg;
+	int i;
+
+	for(i = i0; i < i1; i++)
+		pJob->pIndex[i] = exq_find_nearest_color(pJob->pExq, &pJob->ppHist[i]->color);
+}
+
+static void exq_optimize_sum(void *arg, int i0, int i1)
+{
+	exq_optimize_job *pJob = (exq_optimize_job*)arg;
+	int i;
+
+	for(i = i0; i < i1; i++)
+		exq_sum_node(&pJob->pExq->node[i]);
+}
+
 void exq_optimize_palette(exq_data *pExq, int iter)
 {
-	int n, i, j;
+	int n, i, j, nHist;
 	exq_histogram *pCur;
+	exq_optimize_job job;
 
 	pExq->optimized = 1;
 
+	/* the nearest colors are searched first (possibly in parallel), and
+	   then the histogram entries are linked in the original order, so that
+	   the result does not depend on the number of threads */
+	nHist = 0;
+	for(i = 0; i < EXQ_HASH_SIZE; i++)
+		for(pCur = pExq->pHash[i]; pCur != NULL; pCur = pCur->pNextInHash)
+			nHist++;
+
+	job.pExq = pExq;
+	job.ppHist = (exq_histogram**)malloc(nHist * sizeof(exq_histogram*) + 1);
+	job.pIndex = (unsigned char*)malloc(nHist + 1);
+
+	j = 0;
+	for(i = 0; i < EXQ_HASH_SIZE; i++)
+		for(pCur = pExq->pHash[i]; pCur != NULL; pCur = pCur->pNextInHash)
+			job.ppHist[j++] = pCur;
+
 	for(n = 0; n < iter; n++)
 	{
 		for(i = 0; i < pExq->numColors; i++)
 			pExq->node[i].pHistogram = NULL;
 
-		for(i = 0; i < EXQ_HASH_SIZE; i++)
-			for(pCur = pExq->pHash[i]; pCur != NULL; pCur = pCur->pNextInHash)
-			{
-				j = exq_find_nearest_color(pExq, &pCur->color);
-				pCur->pNext = pExq->node[j].pHistogram;
-				pExq->node[j].pHistogram = pCur;
-			}
+		if(exq_parallel_for)
+			exq_parallel_for(nHist, exq_optimize_nearest, &job);
+		else
+			exq_optimize_nearest(&job, 0, nHist);
 
-		for(i = 0; i < pExq->numColors; i++)
-			exq_sum_node(&pExq->node[i]);
+		for(i = 0; i < nHist; i++)
+		{
+			pCur = job.ppHist[i];
+			j = job.pIndex[i];
+			pCur->pNext = pExq->node[j].pHistogram;
+			pExq->node[j].pHistogram = pCur;
+		}
+
+		if(exq_parallel_for)
+			exq_parallel_for(pExq->numColors, exq_optimize_sum, &job);
+		else
+			exq_optimize_sum(&job, 0, pExq->numColors);
 	}
+
+	free(job.ppHist);
+	free(job.pIndex);
 }
 
 void exq_map_image(exq_data *pExq, int nPixels, unsigned char *pIn,
@@ -696,7 +751,7 @@ exq_float exq_sort_by_a(const exq_histogram *pHist)
 	return pHist->color.a;
 }
 
-exq_color exq_sort_dir;
+__thread exq_color exq_sort_dir;
 
 exq_float exq_sort_by_dir(const exq_histogram *pHist)
 {
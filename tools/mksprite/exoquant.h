@@ -141,7 +141,12 @@ exq_float			exq_sort_by_b(const exq_histogram *pHist);
 exq_float			exq_sort_by_a(const exq_histogram *pHist);
 exq_float			exq_sort_by_dir(const exq_histogram *pHist);
 
-extern exq_color	exq_sort_dir;
+extern __thread exq_color	exq_sort_dir;
+
+/* optional hook to run loops in parallel: must call fn(arg, i0, i1) on
+   disjoint ranges covering [0, n), and return when all calls are done */
+typedef void		(*exq_range_func)(void *arg, int i0, int i1);
+extern void			(*exq_parallel_for)(int n, exq_range_func fn, void *arg);
 
 #ifdef __cplusplus
 }
@@ -5,7 +5,16 @@
 #include <stdbool.h>
 #include <string.h>
 #include <assert.h>
+#include <math.h>
 #include <sys/stat.h>
+#include <dirent.h>
+#include <pthread.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
 #include "../common/binout.c"
 #include "../common/binout.h"
 #include "../common/polyfill.h"
@@ -27,10 +36,16 @@
 #include "surface.h"
 #include "sprite.h"
 
+// Pixel format conversions, shared with the library
+#include "../../src/surface_convert.c"
+
 #define FMT_ZBUF   (64 + 0)
 #define FMT_IHQ    (64 + 1)
 
 #define SWAP(a, b) ({ typeof(a) t = a; a = b; b = t; })
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define CLAMP(x, a, b) MIN(MAX(x, a), b)
 #define ROUND_UP(n, d) ({ \
 	typeof(n) _n = n; typeof(d) _d = d; \
 	(((_n) + (_d) - 1) / (_d) * (_d)); \
@@ -69,13 +84,17 @@ tex_format_t tex_format_from_name(const char *name) {
     return FMT_NONE;
 }
 
-#define MIPMAP_ALGO_NONE  0
-#define MIPMAP_ALGO_BOX   1
+#define MIPMAP_ALGO_NONE     0
+#define MIPMAP_ALGO_BOX      1
+#define MIPMAP_ALGO_LANCZOS  2
+#define MIPMAP_ALGO_KAISER   3
 
 const char *mipmap_algo_name(int algo) {
     switch (algo) {
     case MIPMAP_ALGO_NONE: return "NONE";
     case MIPMAP_ALGO_BOX: return "BOX";
+    case MIPMAP_ALGO_LANCZOS: return "LANCZOS";
+    case MIPMAP_ALGO_KAISER: return "KAISER";
     default: assert(0); return "";
     }
 }
@@ -111,7 +130,10 @@ typedef struct {
     int tilew;
     int tileh;
     int mipmap_algo;
+    float mipmap_sharpen;   // Amount of sharpening applied to each mipmap (0: none)
     int dither_algo;
+    float psnr;             // Quality target for AUTO format (dB), or 0 for autodetection
+    bool shared_palette;    // Quantize using the palette shared by the batch (see shared_palette_build)
     texparms_t texparms;
     struct{
         const char   *infn;       // Input file for detail texture
@@ -128,12 +150,58 @@ typedef struct {
 bool flag_verbose = false;
 bool flag_debug = false;
 
+// Number of threads that can be used to process a single image
+int image_threads = 1;
+
+typedef void (*parallel_fn)(void *arg, int i0, int i1);
+
+typedef struct {
+    parallel_fn fn;
+    void *arg;
+    int i0, i1;
+} parallel_range_t;
+
+static void *parallel_thread(void *arg) {
+    parallel_range_t *pr = arg;
+    pr->fn(pr->arg, pr->i0, pr->i1);
+    return NULL;
+}
+
+/**
+ * @brief Run a loop over [0, n) in parallel, using up to #image_threads threads
+ * 
+ * The range is split in contiguous chunks of at least min_chunk items.
+ * Small loops are run by the calling thread.
+ */
+void parallel_for(int n, int min_chunk, parallel_fn fn, void *arg) {
+    int nthreads = MIN(image_threads, n / min_chunk);
+    if (nthreads <= 1) {
+        fn(arg, 0, n);
+        return;
+    }
+
+    int chunk = (n + nthreads - 1) / nthreads;
+    pthread_t threads[nthreads];
+    parallel_range_t ranges[nthreads];
+    for (int i=0; i<nthreads; i++) {
+        ranges[i] = (parallel_range_t){ fn, arg, MIN(i*chunk, n), MIN((i+1)*chunk, n) };
+        pthread_create(&threads[i], NULL, parallel_thread, &ranges[i]);
+    }
+    for (int i=0; i<nthreads; i++)
+        pthread_join(threads[i], NULL);
+}
+
+/** @brief Parallel loop hook for the quantizer (exq_parallel_for) */
+static void exq_parallel(int n, exq_range_func fn, void *arg) {
+    parallel_for(n, 256, fn, arg);
+}
+
 void print_supported_formats(void) {
     fprintf(stderr, "Supported formats: AUTO, RGBA32, RGBA16, IA16, CI8, I8, IA8, CI4, I4, IA4, ZBUF\n");
 }
 
 void print_supported_mipmap(void) {
-    fprintf(stderr, "Supported mipmap algorithms: NONE (disable), BOX\n");
+    fprintf(stderr, "Supported mipmap algorithms: NONE (disable), BOX, LANCZOS, KAISER\n");
 }
 
 void print_supported_dithers(void) {
@@ -144,19 +212,31 @@ void print_args( char * name )
 {
     fprintf(stderr, "Usage: %s [flags] <input files...>\n", name);
     fprintf(stderr, "\n");
+    fprintf(stderr, "Input files are PNG images, converted into .sprite files. If a directory is\n");
+    fprintf(stderr, "specified, all the PNG images within it are packed into a .atlas file, made of\n");
+    fprintf(stderr, "pages that fit TMEM.\n");
+    fprintf(stderr, "\n");
     fprintf(stderr, "Command-line flags:\n");
     fprintf(stderr, "   -v/--verbose          Verbose output\n");
     fprintf(stderr, "   -o/--output <dir>     Specify output directory (default: .)\n");
     fprintf(stderr, "   -f/--format <fmt>     Specify output format (default: AUTO)\n");
+    fprintf(stderr, "   --psnr <dB>           With AUTO format, pick the smallest format reaching this quality\n");
     fprintf(stderr, "   -D/--dither <dither>  Dithering algorithm (default: NONE)\n");
     fprintf(stderr, "   -c/--compress <level> Compress output files (default: %d)\n", DEFAULT_COMPRESSION);
     fprintf(stderr, "   -d/--debug            Dump computed images (eg: mipmaps) as PNG files in output directory\n");
+    fprintf(stderr, "\nBatch flags:\n");
+    fprintf(stderr, "   -j/--jobs <num>       Number of files converted in parallel (default: 1, 0: number of CPUs)\n");
+    fprintf(stderr, "   -M/--manifest <file>  Read the input files from a file (one per line)\n");
+    fprintf(stderr, "   --cache <file>        Skip files whose inputs and flags did not change since the last run\n");
+    fprintf(stderr, "   --shared-palette <file>  Quantize the next input files (CI4 or CI8) to a single palette,\n");
+    fprintf(stderr, "                         stored in <file> rather than in each sprite\n");
     fprintf(stderr, "\nSampling flags:\n");
     fprintf(stderr, "   --texparms <x,s,r,m>          Sampling parameters:\n");
     fprintf(stderr, "                                 x=translation, s=scale, r=repetitions, m=mirror\n");
     fprintf(stderr, "   --texparms <x,x,s,s,r,r,m,m>  Sampling parameters (different for S/T)\n");
     fprintf(stderr, "\nMipmapping flags:\n");
     fprintf(stderr, "   -m/--mipmap <algo>                    Calculate mipmap levels using the specified algorithm (default: NONE)\n");
+    fprintf(stderr, "   --mipmap-sharpen <amount>             Sharpen each mipmap level (LANCZOS/KAISER only, default: 0)\n");
     fprintf(stderr, "   --detail [<image>[,<fmt>]][,<factor>] Activate detail texture:\n");
     fprintf(stderr, "                                         <image> is the file to use as detail (default: reuse input image)\n");
     fprintf(stderr, "                                         <fmt> is the output format (default: AUTO)\n");
@@ -219,11 +299,17 @@ typedef struct {
 
 #define MAX_IMAGES 8
 
+// Output file of the palette shared by the batch (NULL if none)
+const char *shared_palette_fn = NULL;
+// Palette shared by the batch (see shared_palette_build)
+palette_t shared_palette;
+
 typedef struct {
     const char *infn;       // Input file
     const char *outfn;      // Output file
     image_t images[MAX_IMAGES]; // Pixel images (one per lod level).
     palette_t palette;      // Palette (if any)
+    bool shared_palette;    // If true, the palette is stored in a separate file
     int vslices;            // Number of vertical slices (deprecated API for old rdp.c)
     int hslices;            // Number of horizontal slices (deprecated API for old rdp.c)
     texparms_t texparms;    // Texture parameters
@@ -531,9 +617,232 @@ static uint8_t *image_shrink_box(uint8_t *src, int width, int height, bool half_
     return imgdst;
 }
 
-bool spritemaker_calc_lods(spritemaker_t *spr, int algo) {
+// Pixels of the filtered mipmaps are processed as vectors of 4 floats (one
+// per channel). GCC lowers the vector operations to SIMD instructions where
+// available (eg: SSE on x86, NEON on ARM), and to scalar code elsewhere.
+typedef float v4sf __attribute__((vector_size(16)));
+
+/** @brief An image with float channels, used to compute filtered mipmaps */
+typedef struct {
+    v4sf *pixels;           // Pixels (RGBA in linear light with premultiplied alpha, or I in the first channel)
+    int width, height;      // Image dimensions
+} fimage_t;
+
+/** @brief Edge mode when sampling outside an image (see #fimage_edge) */
+typedef enum {
+    EDGE_CLAMP,
+    EDGE_WRAP,
+    EDGE_MIRROR,
+} edge_mode_t;
+
+/** @brief Map a coordinate outside the image back into it */
+static int fimage_edge(int x, int size, edge_mode_t mode) {
+    switch (mode) {
+    case EDGE_WRAP:
+        x %= size;
+        return x < 0 ? x + size : x;
+    case EDGE_MIRROR:
+        x %= 2*size;
+        if (x < 0) x += 2*size;
+        return x < size ? x : 2*size - 1 - x;
+    default:
+        return CLAMP(x, 0, size-1);
+    }
+}
+
+/** @brief Convert a sRGB component to linear light */
+static float srgb_to_linear(float c) {
+    return c <= 0.04045f ? c * (1.0f / 12.92f) : powf((c + 0.055f) * (1.0f / 1.055f), 2.4f);
+}
+
+/** @brief Convert a linear light component to sRGB */
+static float linear_to_srgb(float c) {
+    return c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+}
+
+/** @brief Convert an image (RGBA or GREY) to float, optionally premultiplying alpha */
+static fimage_t fimage_from_image(const image_t *img, bool premultiply) {
+    fimage_t fimg = { malloc(img->width * img->height * sizeof(v4sf)), img->width, img->height };
+    float lut[256];
+    for (int i=0; i<256; i++)
+        lut[i] = srgb_to_linear(i / 255.0f);
+
+    for (int i=0; i<img->width * img->height; i++) {
+        if (img->ct == LCT_RGBA) {
+            const uint8_t *src = img->image + i*4;
+            float a = src[3] / 255.0f;
+            float m = premultiply ? a : 1.0f;
+            fimg.pixels[i] = (v4sf){ lut[src[0]] * m, lut[src[1]] * m, lut[src[2]] * m, a };
+        } else {
+            fimg.pixels[i] = (v4sf){ img->image[i] / 255.0f, 0, 0, 0 };
+        }
+    }
+    return fimg;
+}
+
+/**
+ * @brief Convert a float image back to 8-bit pixels of the specified color type
+ * 
+ * For RGBA, the image has premultiplied alpha. The color of fully transparent
+ * pixels is taken from the straight alpha image (if any), so that it does not
+ * become black, and it does not bleed into the neighbors with bilinear filtering.
+ */
+static uint8_t *fimage_to_bytes(const fimage_t *fimg, const fimage_t *fstraight, LodePNGColorType ct) {
+    int npixels = fimg->width * fimg->height;
+    uint8_t *out = malloc(npixels * (ct == LCT_RGBA ? 4 : 1));
+    for (int i=0; i<npixels; i++) {
+        v4sf px = fimg->pixels[i];
+        if (ct == LCT_RGBA) {
+            // Filters with negative lobes can overshoot, so clamp before
+            // removing the premultiplication
+            float a = CLAMP(px[3], 0.0f, 1.0f);
+            for (int c=0; c<3; c++) {
+                float v = 0;
+                if (a >= 0.5f / 255.0f) v = CLAMP(px[c], 0.0f, a) / a;
+                else if (fstraight) v = CLAMP(fstraight->pixels[i][c], 0.0f, 1.0f);
+                out[i*4+c] = (uint8_t)(linear_to_srgb(v) * 255.0f + 0.5f);
+            }
+            out[i*4+3] = (uint8_t)(a * 255.0f + 0.5f);
+        } else {
+            out[i] = (uint8_t)(CLAMP(px[0], 0.0f, 1.0f) * 255.0f + 0.5f);
+        }
+    }
+    return out;
+}
+
+/** @brief Normalized sinc function */
+static float sincf(float x) {
+    if (fabsf(x) < 1e-6f) return 1.0f;
+    x *= M_PI;
+    return sinf(x) / x;
+}
+
+/** @brief Zeroth order modified Bessel function of the first kind (for the Kaiser window) */
+static float bessel_i0(float x) {
+    float sum = 1.0f, term = 1.0f;
+    for (int k=1; k<20; k++) {
+        term *= (x / (2*k)) * (x / (2*k));
+        sum += term;
+    }
+    return sum;
+}
+
+/** @brief Radius of the filters used for mipmaps (in destination pixels) */
+#define MIPMAP_FILTER_RADIUS    3
+
+/** @brief Evaluate the windowed sinc filter of a mipmap algorithm */
+static float mipmap_filter(int algo, float x) {
+    const float r = MIPMAP_FILTER_RADIUS;
+    if (fabsf(x) >= r) return 0;
+    switch (algo) {
+    case MIPMAP_ALGO_LANCZOS:
+        return sincf(x) * sincf(x / r);
+    case MIPMAP_ALGO_KAISER: {
+        const float beta = 4.0f;
+        float t = x / r;
+        return sincf(x) * bessel_i0(beta * sqrtf(1.0f - t*t)) / bessel_i0(beta);
+    }
+    default:
+        assert(0); return 0;
+    }
+}
+
+/**
+ * @brief Resample one dimension of a float image
+ * 
+ * This reads src_len pixels spaced by src_step, and writes dst_len pixels
+ * spaced by dst_step, for num_lines lines (spaced by src_pitch / dst_pitch).
+ */
+static void fimage_resample_1d(int algo, edge_mode_t edge, int num_lines,
+    const v4sf *src, int src_len, int src_step, int src_pitch,
+    v4sf *dst, int dst_len, int dst_step, int dst_pitch)
+{
+    // Precompute the filter taps of each destination pixel
+    float scale = (float)src_len / dst_len;
+    int ntaps = (int)ceilf(MIPMAP_FILTER_RADIUS * scale) * 2 + 1;
+    int *tap_idx = malloc(dst_len * ntaps * sizeof(int));
+    float *tap_w = malloc(dst_len * ntaps * sizeof(float));
+    for (int i=0; i<dst_len; i++) {
+        float center = (i + 0.5f) * scale;
+        int first = (int)floorf(center - MIPMAP_FILTER_RADIUS * scale);
+        float sum = 0;
+        for (int k=0; k<ntaps; k++) {
+            float w = mipmap_filter(algo, (first + k + 0.5f - center) / scale);
+            tap_idx[i*ntaps + k] = fimage_edge(first + k, src_len, edge) * src_step;
+            tap_w[i*ntaps + k] = w;
+            sum += w;
+        }
+        for (int k=0; k<ntaps; k++)
+            tap_w[i*ntaps + k] /= sum;
+    }
+
+    for (int l=0; l<num_lines; l++) {
+        const v4sf *s = src + l*src_pitch;
+        v4sf *d = dst + l*dst_pitch;
+        for (int i=0; i<dst_len; i++) {
+            const int *idx = tap_idx + i*ntaps;
+            const float *w = tap_w + i*ntaps;
+            v4sf acc = {0};
+            for (int k=0; k<ntaps; k++)
+                acc += s[idx[k]] * w[k];
+            d[i*dst_step] = acc;
+        }
+    }
+
+    free(tap_idx);
+    free(tap_w);
+}
+
+/** @brief Resample a float image to a new size, using a separable filter */
+static fimage_t fimage_resample(const fimage_t *src, int width, int height, int algo, edge_mode_t edge_s, edge_mode_t edge_t) {
+    fimage_t tmp = { malloc(width * src->height * sizeof(v4sf)), width, src->height };
+    fimage_t dst = { malloc(width * height * sizeof(v4sf)), width, height };
+    fimage_resample_1d(algo, edge_s, src->height, src->pixels, src->width, 1, src->width, tmp.pixels, width, 1, width);
+    fimage_resample_1d(algo, edge_t, width, tmp.pixels, src->height, width, 1, dst.pixels, height, width, 1);
+    free(tmp.pixels);
+    return dst;
+}
+
+/** @brief Sharpen a float image with an unsharp mask (3x3 binomial blur) */
+static fimage_t fimage_sharpen(const fimage_t *src, float amount, edge_mode_t edge_s, edge_mode_t edge_t) {
+    fimage_t dst = { malloc(src->width * src->height * sizeof(v4sf)), src->width, src->height };
+    static const float k[3] = { 0.25f, 0.5f, 0.25f };
+    for (int y=0; y<src->height; y++) {
+        for (int x=0; x<src->width; x++) {
+            v4sf blur = {0};
+            for (int j=-1; j<=1; j++) {
+                const v4sf *row = src->pixels + fimage_edge(y+j, src->height, edge_t) * src->width;
+                for (int i=-1; i<=1; i++)
+                    blur += row[fimage_edge(x+i, src->width, edge_s)] * (k[j+1] * k[i+1]);
+            }
+            v4sf px = src->pixels[y*src->width + x];
+            dst.pixels[y*src->width + x] = px + (px - blur) * amount;
+        }
+    }
+    return dst;
+}
+
+/** @brief Edge mode to use when filtering a texture, depending on how it is sampled */
+static edge_mode_t texparms_edge(const texparms_t *parms, bool s) {
+    float repeats = s ? parms->s.repeats : parms->t.repeats;
+    int mirror = s ? parms->s.mirror : parms->t.mirror;
+    if (!parms->defined || repeats <= 1) return EDGE_CLAMP;
+    return mirror ? EDGE_MIRROR : EDGE_WRAP;
+}
+
+/**
+ * @brief Calculate the mipmap levels of the sprite
+ * 
+ * BOX averages 2x2 blocks of pixels. LANCZOS and KAISER use windowed sinc
+ * filters, that preserve more detail: each level is computed from the previous
+ * one in floating point, in linear light and with premultiplied alpha, to
+ * avoid accumulating rounding errors and darkening. Optionally, each
+ * level is sharpened before being stored (this does not affect the next
+ * levels).
+ */
+bool spritemaker_calc_lods(spritemaker_t *spr, int algo, float sharpen) {
     // Calculate mipmap levels
-    assert(algo == MIPMAP_ALGO_BOX);
+    assert(algo == MIPMAP_ALGO_BOX || algo == MIPMAP_ALGO_LANCZOS || algo == MIPMAP_ALGO_KAISER);
 
     int tmem_usage;
     if (!spritemaker_fit_tmem(spr, &tmem_usage)) {
@@ -546,6 +855,26 @@ bool spritemaker_calc_lods(spritemaker_t *spr, int algo) {
     int maxlevels = MAX_IMAGES;
     if (spr->detail.enabled) maxlevels--;
     bool done = false;
+
+    // Filtered mipmaps are computed starting from a float copy of the image.
+    // If the image has transparent pixels, a copy with straight alpha is
+    // filtered as well, to compute the color of the transparent pixels.
+    fimage_t flevel = {0}, fstraight = {0};
+    edge_mode_t edge_s = texparms_edge(&spr->texparms, true);
+    edge_mode_t edge_t = texparms_edge(&spr->texparms, false);
+    if (algo != MIPMAP_ALGO_BOX) {
+        if (spr->images[0].ct != LCT_RGBA && spr->images[0].ct != LCT_GREY) {
+            fprintf(stderr, "ERROR: mipmap calculation for format %s/%s not implemented yet\n", tex_format_name(spr->images[0].fmt), colortype_to_string(spr->images[0].ct));
+            return false;
+        }
+        flevel = fimage_from_image(&spr->images[0], true);
+        bool transparent = false;
+        for (int i=0; spr->images[0].ct == LCT_RGBA && i<spr->images[0].width*spr->images[0].height && !transparent; i++)
+            transparent = spr->images[0].image[i*4+3] != 0xFF;
+        if (transparent)
+            fstraight = fimage_from_image(&spr->images[0], false);
+    }
+
     for (int i=1; i<maxlevels && !done; i++) {
         image_t *prev = &spr->images[i-1];
         int mw = prev->width / 2, mh = prev->height / 2;
@@ -557,7 +886,23 @@ bool spritemaker_calc_lods(spritemaker_t *spr, int algo) {
             break;
         }
         uint8_t *mipmap = NULL;
-        switch (prev->ct) {
+        if (algo != MIPMAP_ALGO_BOX) {
+            fimage_t fnext = fimage_resample(&flevel, mw, mh, algo, edge_s, edge_t);
+            if (fstraight.pixels) {
+                fimage_t fsnext = fimage_resample(&fstraight, mw, mh, algo, edge_s, edge_t);
+                free(fstraight.pixels);
+                fstraight = fsnext;
+            }
+            if (sharpen > 0) {
+                fimage_t fsharp = fimage_sharpen(&fnext, sharpen, edge_s, edge_t);
+                mipmap = fimage_to_bytes(&fsharp, fstraight.pixels ? &fstraight : NULL, prev->ct);
+                free(fsharp.pixels);
+            } else {
+                mipmap = fimage_to_bytes(&fnext, fstraight.pixels ? &fstraight : NULL, prev->ct);
+            }
+            free(flevel.pixels);
+            flevel = fnext;
+        } else switch (prev->ct) {
         case LCT_RGBA:
             mipmap = malloc(mw * mh * 4);
             for (int y=0;y<mh;y++) {
@@ -603,6 +948,8 @@ bool spritemaker_calc_lods(spritemaker_t *spr, int algo) {
         }
     }
 
+    free(flevel.pixels);
+    free(fstraight.pixels);
     return true;
 }
 
@@ -641,11 +988,24 @@ bool spritemaker_expand_rgba(spritemaker_t *spr) {
     return true;
 }
 
+typedef struct {
+    exq_data *exq;
+    image_t *img;
+    uint8_t *ci_image;
+} quantize_map_t;
+
+static void quantize_map_rows(void *arg, int y0, int y1) {
+    quantize_map_t *qm = arg;
+    int width = qm->img->width;
+    exq_map_image(qm->exq, width * (y1-y0), qm->img->image + y0*width*4, qm->ci_image + y0*width);
+}
+
 bool spritemaker_quantize(spritemaker_t *spr, uint8_t *colors, int num_colors, int dither) {
     if (flag_verbose)
         fprintf(stderr, "quantizing image(s) to %d colors%s\n", num_colors, colors ? " (using existing palette)" : "");
 
     // Initialize the quantizer engine
+    exq_parallel_for = exq_parallel;
     exq_data *exq = exq_init();
     exq->numBitsPerChannel = 5;   // force calculations using rgb555
 
@@ -685,7 +1045,10 @@ bool spritemaker_quantize(spritemaker_t *spr, uint8_t *colors, int num_colors, i
         uint8_t* ci_image = malloc(img->width * img->height);
         switch (dither) {
         case DITHER_ALGO_NONE:
-            exq_map_image(exq, img->width * img->height, img->image, ci_image);
+            // Mapping without dithering can be split by rows. Make sure the palette
+            // is optimized first, as exq_map_image would do it lazily.
+            exq_map_image(exq, 0, img->image, ci_image);
+            parallel_for(img->height, 32, quantize_map_rows, &(quantize_map_t){ exq, img, ci_image });
             break;
         case DITHER_ALGO_RANDOM:
             exq_map_image_random(exq, img->width * img->height, img->image, ci_image);
@@ -910,24 +1273,13 @@ bool spritemaker_convert_ihq(spritemaker_t *spr) {
     return true;
 }
 
-bool spritemaker_write(spritemaker_t *spr) {
-    FILE *out;
-    if (strcmp(spr->outfn, "(stdout)") == 0) {
-        // We can't directly write to stdout because we need to seek.
-        // So use a temporary file, and then copy it to stdout.
-        out = tmpfile();
-        if (!out) {
-            perror("ERROR: cannot create temporary file");
-            return false;
-        }
-    } else {
-        out = fopen(spr->outfn, "wb");
-        if (!out) {
-            fprintf(stderr, "ERROR: cannot open output file %s\n", spr->outfn);
-            return false;
-        }
-    }
-
+/**
+ * @brief Write the sprite into an open file
+ * 
+ * The file must be positioned at its beginning, as the sprite format contains
+ * absolute offsets.
+ */
+void spritemaker_write_file(spritemaker_t *spr, FILE *out) {
     // Write the sprite header
     // For Z-buffer image, we currently encode them as RGBA16 though that's not really correct.
     tex_format_t img0fmt = spr->images[0].fmt;
@@ -982,26 +1334,17 @@ bool spritemaker_write(spritemaker_t *spr) {
             break;
         }
 
-        case FMT_IA8: {
-            assert(image->ct == LCT_GREY_ALPHA);
-            uint8_t *img = image->image;
-            for (int i=0; i<image->width*image->height; i++) {
-                uint8_t I = *img++; uint8_t A = *img++;
-                w8(out, (uint8_t)((I & 0xF0) | (A >> 4)));
-            }
-            break;
-        }
-
-        case FMT_I4: {
-            assert(image->ct == LCT_GREY);
-            uint8_t *img = image->image;
-            for (int j=0; j<image->height; j++) {
-                for (int i=0; i<image->width; i+=2) {
-                    uint8_t I0 = *img++;
-                    uint8_t I1 = (i+1 == image->width) ? 0 : *img++;
-                    w8(out, (uint8_t)((I0 & 0xF0) | (I1 >> 4)));
-                }
-            }
+        case FMT_IA8: case FMT_I4: {
+            // Expanded grayscale images have the same layout of IA16 / I8
+            // surfaces, so they can be packed by surface_convert.
+            assert(image->ct == (image->fmt == FMT_I4 ? LCT_GREY : LCT_GREY_ALPHA));
+            surface_t src = surface_make_linear(image->image,
+                image->fmt == FMT_I4 ? FMT_I8 : FMT_IA16, image->width, image->height);
+            int numbytes = TEX_FORMAT_PIX2BYTES(image->fmt, image->width) * image->height;
+            surface_t dst = surface_make_linear(calloc(1, numbytes), image->fmt, image->width, image->height);
+            surface_convert(&dst, &src);
+            fwrite(dst.buffer, 1, numbytes, out);
+            free(dst.buffer);
             break;
         }
 
@@ -1067,6 +1410,7 @@ bool spritemaker_write(spritemaker_t *spr) {
             if (spr->texparms.defined) flags |= 0x8;
             if (spr->detail.enabled) flags |= 0x10;
             if (spritemaker_fit_tmem(spr, NULL)) flags |= 0x20;
+            if (spr->shared_palette) flags |= 0x40;
             w16(out, flags);
             w16(out, 0); // padding
             wf32(out, spr->texparms.s.translate);
@@ -1102,7 +1446,7 @@ bool spritemaker_write(spritemaker_t *spr) {
     }
 
     // Finally, write the palette if needed, stored in the first image
-    if (spr->palette.num_colors > 0) {
+    if (spr->palette.num_colors > 0 && !spr->shared_palette) {
         assert(spr->images[0].fmt == FMT_CI8 || spr->images[0].fmt == FMT_CI4);
         w32_at(out, w_palpos, ftell(out));
 
@@ -1117,6 +1461,27 @@ bool spritemaker_write(spritemaker_t *spr) {
         }
         walign(out, 8);
     }
+}
+
+bool spritemaker_write(spritemaker_t *spr) {
+    FILE *out;
+    if (strcmp(spr->outfn, "(stdout)") == 0) {
+        // We can't directly write to stdout because we need to seek.
+        // So use a temporary file, and then copy it to stdout.
+        out = tmpfile();
+        if (!out) {
+            perror("ERROR: cannot create temporary file");
+            return false;
+        }
+    } else {
+        out = fopen(spr->outfn, "wb");
+        if (!out) {
+            fprintf(stderr, "ERROR: cannot open output file %s\n", spr->outfn);
+            return false;
+        }
+    }
+
+    spritemaker_write_file(spr, out);
 
     if (strcmp(spr->outfn, "(stdout)") == 0) {
         // Copy the temporary file to stdout
@@ -1177,102 +1542,113 @@ void spritemaker_free(spritemaker_t *spr) {
     memset(spr, 0, sizeof(*spr));
 }
 
-int convert(const char *infn, const char *outfn, const parms_t *pm) {
-    if (flag_verbose)
-        fprintf(stderr, "Converting: %s -> %s [fmt=%s tiles=%d,%d mipmap=%s dither=%s]\n",
-            infn, outfn, tex_format_name(pm->outfmt), pm->tilew, pm->tileh, mipmap_algo_name(pm->mipmap_algo), dither_algo_name(pm->dither_algo));
-
-    spritemaker_t spr = {0};
-
-    spr.infn = infn;
-    spr.outfn = outfn;
-    spr.texparms = pm->texparms;
-    if (!spr.texparms.defined) {
-        spr.texparms.s.translate = 0.0f;
-        spr.texparms.s.scale = 0;
-        spr.texparms.s.repeats = 1;
-        spr.texparms.s.mirror = 0;
-        spr.texparms.t = spr.texparms.s;
+/**
+ * @brief Load and convert an image into a sprite, without writing it
+ * 
+ * On failure, the sprite must still be freed with #spritemaker_free.
+ */
+bool spritemaker_make(spritemaker_t *spr, const char *infn, const char *outfn, const parms_t *pm) {
+    memset(spr, 0, sizeof(*spr));
+    spr->infn = infn;
+    spr->outfn = outfn;
+    spr->texparms = pm->texparms;
+    if (!spr->texparms.defined) {
+        spr->texparms.s.translate = 0.0f;
+        spr->texparms.s.scale = 0;
+        spr->texparms.s.repeats = 1;
+        spr->texparms.s.mirror = 0;
+        spr->texparms.t = spr->texparms.s;
     }
 
-    spr.detail.enabled = pm->detail.enabled;
-    spr.detail.use_main_tex = pm->detail.use_main_tex;
-    spr.detail.infn = pm->detail.infn;
-    spr.detail.blend_factor = pm->detail.blend_factor;
-    spr.detail.texparms = pm->detail.texparms;
-    if (!spr.detail.texparms.defined) {
-        spr.detail.texparms.s.translate = 0.0f;
-        spr.detail.texparms.s.scale = -1;
-        spr.detail.texparms.s.repeats = 2048;
-        spr.detail.texparms.s.mirror = 0;
-        spr.detail.texparms.t = spr.detail.texparms.s;
+    spr->detail.enabled = pm->detail.enabled;
+    spr->detail.use_main_tex = pm->detail.use_main_tex;
+    spr->detail.infn = pm->detail.infn;
+    spr->detail.blend_factor = pm->detail.blend_factor;
+    spr->detail.texparms = pm->detail.texparms;
+    if (!spr->detail.texparms.defined) {
+        spr->detail.texparms.s.translate = 0.0f;
+        spr->detail.texparms.s.scale = -1;
+        spr->detail.texparms.s.repeats = 2048;
+        spr->detail.texparms.s.mirror = 0;
+        spr->detail.texparms.t = spr->detail.texparms.s;
     }
 
     int mipmap_algo = pm->mipmap_algo;
 
     // Load the PNG, passing the desired output format (or FMT_NONE if autodetect).
-    if (!spritemaker_load_png(&spr, pm->outfmt))
-        goto error;
+    if (!spritemaker_load_png(spr, pm->outfmt))
+        return false;
 
-    if (spr.images[0].fmt == FMT_IHQ) {
-        if (!spritemaker_convert_ihq(&spr))
-            goto error;
+    if (spr->images[0].fmt == FMT_IHQ) {
+        if (!spritemaker_convert_ihq(spr))
+            return false;
         // Compute mipmaps for IHQ
         mipmap_algo = MIPMAP_ALGO_BOX;
-    } else if (spr.detail.enabled && !spr.detail.use_main_tex) {
+    } else if (spr->detail.enabled && !spr->detail.use_main_tex) {
         // Load the detail PNG, passing the desired output format (or FMT_NONE if autodetect).
-        if (!spritemaker_load_detail_png(&spr, pm->detail.outfmt))
-            goto error;
+        if (!spritemaker_load_detail_png(spr, pm->detail.outfmt))
+            return false;
+    }
+
+    // With a shared palette, the original palette (if any) is not preserved
+    if (pm->shared_palette && spr->images[0].ct == LCT_PALETTE) {
+        if (!spritemaker_expand_rgba(spr))
+            return false;
     }
 
     // Calculate mipmap levels, if requested
     if (mipmap_algo != MIPMAP_ALGO_NONE) {
-        switch (spr.images[0].ct) {
+        switch (spr->images[0].ct) {
         case LCT_PALETTE: {
             // Mipmap generation of indexed image. In this case, we want to
             // preserve the original palette for all the mipmaps. To reuse
             // existing code, we expand first to RGBA and then quantize again
             // the original palette.
-            palette_t orig_palette = spr.palette;
-            int fmt_colors = spr.images[0].fmt == FMT_CI8 ? 256 : 16;
+            palette_t orig_palette = spr->palette;
+            int fmt_colors = spr->images[0].fmt == FMT_CI8 ? 256 : 16;
 
             // Expand to RGBA, calc lods, and quantize with the original palette
-            if (!spritemaker_expand_rgba(&spr)
-                || !spritemaker_calc_lods(&spr, mipmap_algo)
-                || !spritemaker_quantize(&spr, orig_palette.colors[0], fmt_colors, pm->dither_algo))
-                goto error;
+            if (!spritemaker_expand_rgba(spr)
+                || !spritemaker_calc_lods(spr, mipmap_algo, pm->mipmap_sharpen)
+                || !spritemaker_quantize(spr, orig_palette.colors[0], fmt_colors, pm->dither_algo))
+                return false;
 
             // Restore palette. Notice that spritemake_quantize has already done that
             // but the palette might contain additional colors (eg: a CI4 sprite
             // might be shipped with a 64 color palette that the user will use
             // at runtime). So we quantized all lods with the first 16 colors
             // (like the first image), but then we restore the other colors.
-            spr.palette = orig_palette;
+            spr->palette = orig_palette;
         }   break;
 
         default:
-            if (!spritemaker_calc_lods(&spr, mipmap_algo))
-                goto error;
+            if (!spritemaker_calc_lods(spr, mipmap_algo, pm->mipmap_sharpen))
+                return false;
             break;
         }
     }
 
     // Run quantization if needed
-    if (spr.images[0].fmt == FMT_CI8 || spr.images[0].fmt == FMT_CI4) {
-        int expected_colors = spr.images[0].fmt == FMT_CI8 ? 256 : 16;
+    if (pm->shared_palette) {
+        assert(spr->images[0].fmt == FMT_CI8 || spr->images[0].fmt == FMT_CI4);
+        if (!spritemaker_quantize(spr, shared_palette.colors[0], shared_palette.num_colors, pm->dither_algo))
+            return false;
+        spr->shared_palette = true;
+    } else if (spr->images[0].fmt == FMT_CI8 || spr->images[0].fmt == FMT_CI4) {
+        int expected_colors = spr->images[0].fmt == FMT_CI8 ? 256 : 16;
 
-        switch (spr.images[0].ct) {
+        switch (spr->images[0].ct) {
         case LCT_RGBA:
-            if (!spritemaker_quantize(&spr, NULL, expected_colors, pm->dither_algo))
-                goto error;
+            if (!spritemaker_quantize(spr, NULL, expected_colors, pm->dither_algo))
+                return false;
             break;
         case LCT_PALETTE:
             // When the source image is already palettized, we quantize only if
             // the requested number of colors is less than the actually used colors.
-            if (expected_colors < spr.palette.used_colors) {
-                if (!spritemaker_expand_rgba(&spr) || 
-                    !spritemaker_quantize(&spr, NULL, expected_colors, pm->dither_algo))
-                    goto error;
+            if (expected_colors < spr->palette.used_colors) {
+                if (!spritemaker_expand_rgba(spr) || 
+                    !spritemaker_quantize(spr, NULL, expected_colors, pm->dither_algo))
+                    return false;
             }
             break;
         default:
@@ -1282,27 +1658,298 @@ int convert(const char *infn, const char *outfn, const parms_t *pm) {
 
     // Dump TMEM usage
     if (flag_verbose) {
-        int tmem_usage; spritemaker_fit_tmem(&spr, &tmem_usage);
+        int tmem_usage; spritemaker_fit_tmem(spr, &tmem_usage);
         fprintf(stderr, "TMEM required: %d bytes\n", tmem_usage);
     }
 
     // Legacy support for old mksprite usage
-    if (pm->hslices) spr.hslices = pm->hslices;
-    if (pm->vslices) spr.vslices = pm->vslices;
+    if (pm->hslices) spr->hslices = pm->hslices;
+    if (pm->vslices) spr->vslices = pm->vslices;
     // Autodetection of optimal slice size. NOTE: we currently don't
     // use this in rdpq. rdpq_tex does its own from-scratch calculation,
     // but we could skip some runtime work by doing the same here.
-    if (pm->tilew) spr.hslices = spr.images[0].width / pm->tilew;
-    if (pm->tileh) spr.vslices = spr.images[0].height / pm->tileh;
-    if (!spr.hslices) {
-        spr.hslices = spr.images[0].width / 16;
-        if (!spr.hslices) spr.hslices = 1;
+    if (pm->tilew) spr->hslices = spr->images[0].width / pm->tilew;
+    if (pm->tileh) spr->vslices = spr->images[0].height / pm->tileh;
+    if (!spr->hslices) {
+        spr->hslices = spr->images[0].width / 16;
+        if (!spr->hslices) spr->hslices = 1;
+    }
+    if (!spr->vslices) {
+        spr->vslices = spr->images[0].height / 16;
+        if (!spr->vslices) spr->vslices = 1;
+    }
+
+    return true;
+}
+
+/** @brief Expand a n-bit color component to 8 bits, as done by the RDP */
+static uint8_t expand_bits(uint8_t v, int bits) {
+    v >>= 8 - bits;
+    int out = 0;
+    for (int shift = 8 - bits; shift > -bits; shift -= bits)
+        out |= shift >= 0 ? v << shift : v >> -shift;
+    return out;
+}
+
+/** @brief Convert a RGBA32 color to RGBA5551 and back */
+static void decode_rgba16(const uint8_t *src, uint8_t *dst) {
+    dst[0] = expand_bits(src[0], 5);
+    dst[1] = expand_bits(src[1], 5);
+    dst[2] = expand_bits(src[2], 5);
+    dst[3] = src[3] ? 0xFF : 0;
+}
+
+/**
+ * @brief Decode the first image of a converted sprite into RGBA32
+ * 
+ * This applies the same bit reductions done when writing the sprite, and
+ * expands the texels like the RDP does when sampling them, so that the result
+ * can be compared with the source image. For IHQ, the two planes are combined
+ * like the converter models them (see #spritemaker_convert_ihq).
+ */
+uint8_t *spritemaker_decode(spritemaker_t *spr, tex_format_t fmt) {
+    image_t *img = &spr->images[0];
+    int width = img->width, height = img->height;
+    if (fmt == FMT_IHQ) {
+        width = spr->images[7].width;
+        height = spr->images[7].height;
+    }
+    uint8_t *rgba = malloc(width * height * 4);
+
+    for (int y=0; y<height; y++) {
+        for (int x=0; x<width; x++) {
+            uint8_t *dst = rgba + (y*width + x)*4;
+            const uint8_t *src;
+            switch ((int)fmt) {
+            case FMT_RGBA32:
+                memcpy(dst, img->image + (y*width + x)*4, 4);
+                break;
+            case FMT_RGBA16:
+                decode_rgba16(img->image + (y*width + x)*4, dst);
+                break;
+            case FMT_CI8: case FMT_CI4:
+                decode_rgba16(spr->palette.colors[img->image[y*width + x]], dst);
+                break;
+            case FMT_I8: case FMT_I4:
+                dst[0] = dst[1] = dst[2] = dst[3] = expand_bits(img->image[y*width + x], fmt == FMT_I8 ? 8 : 4);
+                break;
+            case FMT_IA16: case FMT_IA8: case FMT_IA4:
+                src = img->image + (y*width + x)*2;
+                dst[0] = dst[1] = dst[2] = expand_bits(src[0], fmt == FMT_IA16 ? 8 : fmt == FMT_IA8 ? 4 : 3);
+                dst[3] = fmt == FMT_IA16 ? src[1] : fmt == FMT_IA8 ? expand_bits(src[1], 4) : (src[1] ? 0xFF : 0);
+                break;
+            case FMT_IHQ: {
+                // Bilinear sample of the RGB plane, blended with the I4 plane
+                float xx = (float)x * img->width / width;
+                float yy = (float)y * img->height / height;
+                int xx0 = xx, yy0 = yy;
+                int xx1 = MIN(xx0+1, img->width-1), yy1 = MIN(yy0+1, img->height-1);
+                float xxf = xx - xx0, yyf = yy - yy0;
+                uint8_t c0[4], c1[4], c2[4], c3[4];
+                decode_rgba16(img->image + (yy0*img->width + xx0)*4, c0);
+                decode_rgba16(img->image + (yy0*img->width + xx1)*4, c1);
+                decode_rgba16(img->image + (yy1*img->width + xx0)*4, c2);
+                decode_rgba16(img->image + (yy1*img->width + xx1)*4, c3);
+                float ifactor = spr->detail.blend_factor;
+                uint8_t i = expand_bits(spr->images[7].image[y*width + x], 4);
+                for (int c=0; c<3; c++) {
+                    float v = c0[c] * (1-xxf) * (1-yyf) + c1[c] * xxf * (1-yyf) + c2[c] * (1-xxf) * yyf + c3[c] * xxf * yyf;
+                    dst[c] = CLAMP((int)(v * (1-ifactor) + i * ifactor), 0, 255);
+                }
+                dst[3] = 0xFF;
+            }   break;
+            default:
+                assert(0);
+            }
+        }
+    }
+    return rgba;
+}
+
+/**
+ * @brief Calculate the PSNR (in dB) of an image compared to a reference
+ * 
+ * Both images are RGBA32. The alpha channel is compared only if requested.
+ * Returns INFINITY for identical images.
+ */
+static double image_psnr(const uint8_t *ref, const uint8_t *img, int npixels, bool alpha) {
+    int nchannels = alpha ? 4 : 3;
+    double sqerr = 0;
+    for (int i=0; i<npixels; i++) {
+        for (int c=0; c<nchannels; c++) {
+            int diff = ref[i*4+c] - img[i*4+c];
+            sqerr += diff*diff;
+        }
+    }
+    if (sqerr == 0) return INFINITY;
+    double mse = sqerr / ((double)npixels * nchannels);
+    return 10.0 * log10(255.0 * 255.0 / mse);
+}
+
+/** @brief Size of the sprite data in bytes (pixels of all images and palette) */
+static int spritemaker_data_size(spritemaker_t *spr) {
+    int size = spr->palette.num_colors * 2;
+    for (int i=0; i<MAX_IMAGES; i++)
+        if (spr->images[i].image)
+            size += TEX_FORMAT_PIX2BYTES(spr->images[i].fmt, spr->images[i].width * spr->images[i].height);
+    return size;
+}
+
+/**
+ * @brief Candidate formats for AUTO with a quality target
+ * 
+ * They are sorted by increasing size (bits per texel), and for the same size,
+ * by upload cost (formats with a palette require an additional TLUT load).
+ * The first candidate that reaches the quality target is the cheapest one.
+ */
+static const tex_format_t auto_candidates[] = {
+    FMT_I4, FMT_IA4, FMT_CI4,       // 4 bpp
+    FMT_IHQ,                        // 6 bpp (4x2 downscaled RGBA16 + I4)
+    FMT_I8, FMT_IA8, FMT_CI8,       // 8 bpp
+    FMT_IA16, FMT_RGBA16,           // 16 bpp
+    FMT_RGBA32,                     // 32 bpp
+};
+
+/**
+ * @brief Convert an image picking the cheapest format that reaches a quality target
+ * 
+ * Each candidate format is converted in memory, decoded back and compared
+ * with the source image. A candidate is accepted if its PSNR is at least
+ * pm->psnr and, when mipmaps are requested, if the whole mipmap chain fits
+ * TMEM. If no candidate is accepted, the one with the highest PSNR is used
+ * (preferring candidates that fit TMEM).
+ */
+int convert_auto(const char *infn, const char *outfn, const parms_t *pm) {
+    if (!strcmp(infn, "(stdin)")) {
+        fprintf(stderr, "ERROR: --psnr cannot be used when reading from standard input\n");
+        return 1;
+    }
+
+    // Load the reference image
+    image_t ref = {0}; palette_t refpal;
+    if (!load_png_image(infn, FMT_RGBA32, &ref, &refpal))
+        return 1;
+    int width = ref.width, height = ref.height;
+    bool opaque = true;
+    for (int i=0; i<width*height && opaque; i++)
+        opaque = ref.image[i*4+3] == 0xFF;
+
+    spritemaker_t best = {0}, fallback = {0};
+    tex_format_t best_fmt = FMT_NONE, fallback_fmt = FMT_NONE;
+    double best_psnr = 0, fallback_psnr = 0; bool fallback_fits = false;
+
+    for (int c=0; c<sizeof(auto_candidates)/sizeof(auto_candidates[0]) && best_fmt == FMT_NONE; c++) {
+        tex_format_t fmt = auto_candidates[c];
+        bool has_palette = (fmt == FMT_CI4 || fmt == FMT_CI8);
+
+        // Skip the candidates that cannot be used with this image
+        const char *skip = NULL;
+        if (fmt == FMT_IHQ) {
+            if (!opaque) skip = "image is not opaque";
+            else if (pm->detail.enabled || pm->detail.texparms.defined) skip = "detail texture";
+            else if (calc_tmem_usage(FMT_RGBA16, width, height) > 8192) skip = "image too big";
+            else if (width % 2 || height % 2 || (width % 4 && height % 4)) skip = "unsupported size";
+        } else if (pm->mipmap_algo != MIPMAP_ALGO_NONE) {
+            if (fmt == FMT_I4 || fmt == FMT_IA4 || fmt == FMT_IA8 || fmt == FMT_IA16)
+                skip = "mipmaps not supported";
+            else if (calc_tmem_usage(fmt, width, height) + (has_palette ? 2048 : 0) > 4096)
+                skip = "does not fit TMEM";
+        }
+        if (skip) {
+            if (flag_verbose)
+                fprintf(stderr, "auto: %-6s skipped (%s)\n", tex_format_name(fmt), skip);
+            continue;
+        }
+
+        parms_t cpm = *pm;
+        cpm.outfmt = fmt;
+        spritemaker_t spr;
+        if (!spritemaker_make(&spr, infn, outfn, &cpm)) {
+            spritemaker_free(&spr);
+            continue;
+        }
+
+        uint8_t *decoded = spritemaker_decode(&spr, fmt);
+        double psnr = image_psnr(ref.image, decoded, width*height, !opaque);
+        free(decoded);
+
+        // Check that the requested mipmap chain is complete and fits TMEM
+        int tmem_usage;
+        bool fits = spritemaker_fit_tmem(&spr, &tmem_usage);
+        if (pm->mipmap_algo != MIPMAP_ALGO_NONE) {
+            int levels = 1, expected = 1;
+            int mw = spr.images[0].width / 2, mh = spr.images[0].height / 2;
+            for (; expected < MAX_IMAGES-1 && mw >= 4 && mh >= 4; mw /= 2, mh /= 2)
+                expected++;
+            for (int i=1; i<MAX_IMAGES-1; i++)
+                levels += spr.images[i].image != NULL;
+            fits = fits && levels == expected;
+        }
+
+        if (flag_verbose)
+            fprintf(stderr, "auto: %-6s psnr=%.2f dB, size=%d, TMEM=%d%s\n", tex_format_name(fmt),
+                psnr, spritemaker_data_size(&spr), tmem_usage, fits ? "" : " (mipmaps do not fit)");
+
+        if (psnr >= pm->psnr && (fits || pm->mipmap_algo == MIPMAP_ALGO_NONE)) {
+            best = spr;
+            best_fmt = fmt;
+            best_psnr = psnr;
+        } else if (fallback_fmt == FMT_NONE || (fits && !fallback_fits) || (fits == fallback_fits && psnr > fallback_psnr)) {
+            spritemaker_free(&fallback);
+            fallback = spr;
+            fallback_fmt = fmt;
+            fallback_psnr = psnr;
+            fallback_fits = fits;
+        } else {
+            spritemaker_free(&spr);
+        }
     }
-    if (!spr.vslices) {
-        spr.vslices = spr.images[0].height / 16;
-        if (!spr.vslices) spr.vslices = 1;
+
+    if (best_fmt == FMT_NONE) {
+        if (fallback_fmt == FMT_NONE) {
+            fprintf(stderr, "ERROR: %s: no format can be used for this image\n", infn);
+            goto error;
+        }
+        fprintf(stderr, "WARNING: %s: no format reaches %.2f dB%s\n", infn, pm->psnr,
+            pm->mipmap_algo != MIPMAP_ALGO_NONE ? " with mipmaps fitting TMEM" : "");
+        best = fallback;
+        best_fmt = fallback_fmt;
+        best_psnr = fallback_psnr;
+        memset(&fallback, 0, sizeof(fallback));
     }
 
+    int tmem_usage; spritemaker_fit_tmem(&best, &tmem_usage);
+    fprintf(stderr, "%s: %s (psnr=%.2f dB, size=%d, TMEM=%d)\n", infn, tex_format_name(best_fmt),
+        best_psnr, spritemaker_data_size(&best), tmem_usage);
+
+    if (!spritemaker_write(&best))
+        goto error;
+    if (flag_debug)
+        spritemaker_write_pngs(&best);
+
+    spritemaker_free(&best);
+    free(ref.image);
+    return 0;
+
+error:
+    spritemaker_free(&best);
+    spritemaker_free(&fallback);
+    free(ref.image);
+    return 1;
+}
+
+int convert(const char *infn, const char *outfn, const parms_t *pm) {
+    if (flag_verbose)
+        fprintf(stderr, "Converting: %s -> %s [fmt=%s tiles=%d,%d mipmap=%s dither=%s]\n",
+            infn, outfn, tex_format_name(pm->outfmt), pm->tilew, pm->tileh, mipmap_algo_name(pm->mipmap_algo), dither_algo_name(pm->dither_algo));
+
+    if (pm->outfmt == FMT_NONE && pm->psnr > 0)
+        return convert_auto(infn, outfn, pm);
+
+    spritemaker_t spr;
+    if (!spritemaker_make(&spr, infn, outfn, pm))
+        goto error;
+
     // Write the sprite
     if (!spritemaker_write(&spr))
         goto error;
@@ -1319,7 +1966,360 @@ error:
     return 1;
 }
 
-bool cli_parse_texparms(const char *opt, texparms_t *parms)
+/** @brief Magic number of atlas files */
+#define ATLAS_MAGIC         "ATL"
+/** @brief Current version of the atlas file format */
+#define ATLAS_VERSION       1
+/** @brief Padding around each image in an atlas page (for bilinear filtering) */
+#define ATLAS_PADDING       1
+/** @brief Maximum number of images in an atlas */
+#define ATLAS_MAX_IMAGES    4096
+
+/** @brief An image to be packed into an atlas */
+typedef struct {
+    char *name;             // Name of the image (filename without extension)
+    uint8_t *rgba;          // RGBA32 pixels
+    int width, height;      // Size of the image
+    int page, x, y;         // Position within the atlas
+} atlas_image_t;
+
+static int atlas_cmp_name(const void *a, const void *b) {
+    return strcmp(((const atlas_image_t*)a)->name, ((const atlas_image_t*)b)->name);
+}
+
+static int atlas_cmp_height(const void *a, const void *b) {
+    const atlas_image_t *ia = *(const atlas_image_t**)a, *ib = *(const atlas_image_t**)b;
+    if (ia->height != ib->height) return ib->height - ia->height;
+    if (ia->width != ib->width) return ib->width - ia->width;
+    return strcmp(ia->name, ib->name);
+}
+
+/**
+ * @brief Autodetect the format of an atlas from the color types of its images
+ * 
+ * This follows the same rules of #load_png_image, picking the format that
+ * preserves all the images: a single color image makes the atlas RGBA16.
+ */
+static tex_format_t atlas_autodetect_format(const char *dirname, atlas_image_t *imgs, int num_imgs, const char **fns)
+{
+    // Check if the directory name contains a texformat, like for files
+    tex_format_t fmt = FMT_NONE;
+    char *fntok = strdup(dirname);
+    char *sect = strtok(fntok, ".");
+    while (sect) {
+        fmt = tex_format_from_name(sect);
+        if (fmt != FMT_NONE) break;
+        sect = strtok(NULL, ".");
+    }
+    free(fntok);
+    if (fmt != FMT_NONE) return fmt;
+
+    int grey_depth = 0, grey_alpha_depth = 0; bool color = false;
+    for (int i=0; i<num_imgs; i++) {
+        LodePNGState state; unsigned w, h;
+        unsigned char *png = NULL; size_t pngsize;
+        lodepng_state_init(&state);
+        if (lodepng_load_file(&png, &pngsize, fns[i]) == 0 &&
+            lodepng_inspect(&w, &h, &state, png, pngsize) == 0) {
+            switch (state.info_png.color.colortype) {
+            case LCT_GREY:       grey_depth = MAX(grey_depth, state.info_png.color.bitdepth); break;
+            case LCT_GREY_ALPHA: grey_alpha_depth = MAX(grey_alpha_depth, state.info_png.color.bitdepth); break;
+            default:             color = true; break;
+            }
+        }
+        lodepng_state_cleanup(&state);
+        free(png);
+    }
+
+    if (color) return FMT_RGBA16;
+    if (grey_alpha_depth) {
+        if (grey_alpha_depth < 4) return FMT_IA4;
+        if (grey_alpha_depth < 8) return FMT_IA8;
+        return FMT_IA16;
+    }
+    return grey_depth > 4 ? FMT_I8 : FMT_I4;
+}
+
+/** @brief Convert a RGBA32 atlas page into the image format expected by #spritemaker_write_file */
+static void atlas_page_image(uint8_t *rgba, int width, int height, tex_format_t fmt, image_t *img)
+{
+    *img = (image_t){ .width = width, .height = height, .fmt = fmt };
+    switch ((int)fmt) {
+    case FMT_I8: case FMT_I4:
+        // Same conversion done by lodepng: the intensity is the red channel
+        img->ct = LCT_GREY;
+        img->image = malloc(width * height);
+        for (int i=0; i<width*height; i++)
+            img->image[i] = rgba[i*4+0];
+        free(rgba);
+        break;
+    case FMT_IA16: case FMT_IA8: case FMT_IA4:
+        img->ct = LCT_GREY_ALPHA;
+        img->image = malloc(width * height * 2);
+        for (int i=0; i<width*height; i++) {
+            img->image[i*2+0] = rgba[i*4+0];
+            img->image[i*2+1] = rgba[i*4+3];
+        }
+        free(rgba);
+        break;
+    default:
+        // RGBA32, RGBA16, and CI formats (that will be quantized)
+        img->ct = LCT_RGBA;
+        img->image = rgba;
+        break;
+    }
+}
+
+/**
+ * @brief Pack all the PNG images of a directory into a sprite atlas
+ * 
+ * The images are packed into pages that fit TMEM, leaving a padding of
+ * #ATLAS_PADDING pixels around each image, filled by extending the border
+ * of the image, so that bilinear filtering does not bleed from neighbouring
+ * images. Each page is a complete sprite, and all the pages are stored in the
+ * atlas file, together with an index of the images sorted by name.
+ */
+int convert_atlas(const char *indir, const char *outfn, const parms_t *pm)
+{
+    atlas_image_t *imgs = calloc(ATLAS_MAX_IMAGES, sizeof(atlas_image_t));
+    const char **fns = calloc(ATLAS_MAX_IMAGES, sizeof(char*));
+    int num_imgs = 0, num_pages = 0, ret = 1;
+    int *w_names = NULL, *w_page_pos = NULL;
+    FILE *out = NULL;
+
+    // Load all the PNG images in the directory, as RGBA32
+    DIR *dir = opendir(indir);
+    if (!dir) {
+        fprintf(stderr, "ERROR: cannot open directory %s\n", indir);
+        goto end;
+    }
+    struct dirent *de;
+    while ((de = readdir(dir))) {
+        int len = strlen(de->d_name);
+        if (len < 5 || strcasecmp(de->d_name + len - 4, ".png") != 0)
+            continue;
+        if (num_imgs == ATLAS_MAX_IMAGES) {
+            fprintf(stderr, "ERROR: too many images in %s (max: %d)\n", indir, ATLAS_MAX_IMAGES);
+            closedir(dir);
+            goto end;
+        }
+        atlas_image_t *img = &imgs[num_imgs++];
+        img->name = strndup(de->d_name, len - 4);
+    }
+    closedir(dir);
+    if (num_imgs == 0) {
+        fprintf(stderr, "ERROR: no PNG images found in %s\n", indir);
+        goto end;
+    }
+
+    // Sort the images by name: this is the order of the index in the file
+    qsort(imgs, num_imgs, sizeof(atlas_image_t), atlas_cmp_name);
+    for (int i=0; i<num_imgs; i++) {
+        atlas_image_t *img = &imgs[i];
+        char *fn; asprintf(&fn, "%s/%s.png", indir, img->name);
+        fns[i] = fn;
+        unsigned w, h;
+        int error = lodepng_decode32_file(&img->rgba, &w, &h, fn);
+        if (error) {
+            fprintf(stderr, "%s: PNG reading error: %u: %s\n", fn, error, lodepng_error_text(error));
+            goto end;
+        }
+        img->width = w; img->height = h;
+        if (strlen(img->name) > 255) {
+            fprintf(stderr, "ERROR: image name too long: %s\n", img->name);
+            goto end;
+        }
+    }
+
+    // Select the format of the pages
+    const char *dirname = strrchr(indir, '/');
+    dirname = dirname ? dirname+1 : indir;
+    tex_format_t fmt = pm->outfmt;
+    if (fmt == FMT_NONE) {
+        fmt = atlas_autodetect_format(dirname, imgs, num_imgs, fns);
+        if (flag_verbose)
+            fprintf(stderr, "auto selected format: %s\n", tex_format_name(fmt));
+    }
+    if (fmt == FMT_IHQ || fmt == FMT_ZBUF || fmt == FMT_YUV16) {
+        fprintf(stderr, "ERROR: format %s is not supported for atlases\n", tex_format_name(fmt));
+        goto end;
+    }
+    if (pm->mipmap_algo != MIPMAP_ALGO_NONE || pm->detail.enabled) {
+        fprintf(stderr, "ERROR: mipmaps and detail textures are not supported for atlases\n");
+        goto end;
+    }
+
+    // Select the size of a page. The page must fit TMEM (half of it for
+    // palettized formats, as the other half contains the palette). We prefer
+    // pages that are wider than taller, as the last one will be trimmed in height.
+    int tmem_size = (fmt == FMT_CI4 || fmt == FMT_CI8) ? 2048 : 4096;
+    int max_w = 0, max_h = 0;
+    for (int i=0; i<num_imgs; i++) {
+        max_w = MAX(max_w, imgs[i].width + 2*ATLAS_PADDING);
+        max_h = MAX(max_h, imgs[i].height + 2*ATLAS_PADDING);
+    }
+    int page_w = 0, page_h = 0;
+    for (int w=16; w<=1024; w*=2) {
+        int h = 0;
+        while (calc_tmem_usage(fmt, w, h+1) <= tmem_size) h++;
+        if (w < max_w || h < max_h)
+            continue;
+        if (!page_w || page_w < page_h) {
+            page_w = w; page_h = h;
+        }
+    }
+    if (!page_w) {
+        fprintf(stderr, "ERROR: the images are too big for an atlas in format %s (max: %dx%d with padding)\n",
+            tex_format_name(fmt), max_w, max_h);
+        goto end;
+    }
+
+    // Pack the images with a shelf algorithm, tallest first
+    atlas_image_t **sorted = malloc(num_imgs * sizeof(atlas_image_t*));
+    for (int i=0; i<num_imgs; i++) sorted[i] = &imgs[i];
+    qsort(sorted, num_imgs, sizeof(atlas_image_t*), atlas_cmp_height);
+
+    int pages_h[256];
+    int px = 0, py = 0, shelf_h = 0;
+    num_pages = 1; pages_h[0] = 0;
+    for (int i=0; i<num_imgs; i++) {
+        atlas_image_t *img = sorted[i];
+        int w = img->width + 2*ATLAS_PADDING, h = img->height + 2*ATLAS_PADDING;
+        if (px + w > page_w) {
+            px = 0; py += shelf_h; shelf_h = 0;
+        }
+        if (py + h > page_h) {
+            if (num_pages == 256) {
+                fprintf(stderr, "ERROR: too many atlas pages\n");
+                free(sorted);
+                goto end;
+            }
+            px = py = shelf_h = 0;
+            pages_h[num_pages++] = 0;
+        }
+        img->page = num_pages-1;
+        img->x = px + ATLAS_PADDING;
+        img->y = py + ATLAS_PADDING;
+        px += w;
+        shelf_h = MAX(shelf_h, h);
+        pages_h[num_pages-1] = MAX(pages_h[num_pages-1], py + h);
+    }
+    free(sorted);
+
+    if (flag_verbose)
+        fprintf(stderr, "packed %d images into %d pages of %dx%d (%s)\n", num_imgs, num_pages, page_w, page_h, tex_format_name(fmt));
+
+    out = fopen(outfn, "wb");
+    if (!out) {
+        fprintf(stderr, "ERROR: cannot open output file %s\n", outfn);
+        goto end;
+    }
+
+    // Header
+    fwrite(ATLAS_MAGIC, 1, 3, out);
+    w8(out, ATLAS_VERSION);
+    w16(out, num_pages);
+    w16(out, num_imgs);
+    int w_pages = w32_placeholder(out);
+    int w_images = w32_placeholder(out);
+
+    // Index of images (sorted by name)
+    walign(out, 8);
+    w32_at(out, w_images, ftell(out));
+    w_names = malloc(num_imgs * sizeof(int));
+    for (int i=0; i<num_imgs; i++) {
+        w_names[i] = w32_placeholder(out);
+        w16(out, imgs[i].page);
+        w16(out, imgs[i].x);
+        w16(out, imgs[i].y);
+        w16(out, imgs[i].width);
+        w16(out, imgs[i].height);
+        w16(out, 0); // padding
+    }
+    for (int i=0; i<num_imgs; i++) {
+        w32_at(out, w_names[i], ftell(out));
+        fwrite(imgs[i].name, 1, strlen(imgs[i].name)+1, out);
+    }
+
+    // Page table
+    walign(out, 8);
+    w32_at(out, w_pages, ftell(out));
+    w_page_pos = malloc(num_pages * sizeof(int));
+    for (int p=0; p<num_pages; p++) {
+        w_page_pos[p] = w32_placeholder(out);
+        w32(out, 0); // size, written later
+    }
+
+    // Pages
+    for (int p=0; p<num_pages; p++) {
+        int pw = page_w, ph = pages_h[p];
+
+        // Compose the page, extending the border of each image into the padding
+        uint8_t *rgba = calloc(pw * ph, 4);
+        for (int i=0; i<num_imgs; i++) {
+            atlas_image_t *img = &imgs[i];
+            if (img->page != p) continue;
+            for (int y=-ATLAS_PADDING; y<img->height+ATLAS_PADDING; y++) {
+                int sy = CLAMP(y, 0, img->height-1);
+                for (int x=-ATLAS_PADDING; x<img->width+ATLAS_PADDING; x++) {
+                    int sx = CLAMP(x, 0, img->width-1);
+                    memcpy(&rgba[((img->y+y)*pw + img->x+x)*4], &img->rgba[(sy*img->width + sx)*4], 4);
+                }
+            }
+        }
+
+        // Convert the page through the same pipeline of standalone sprites
+        spritemaker_t spr = {0};
+        spr.infn = indir;
+        spr.outfn = outfn;
+        spr.hslices = spr.vslices = 1;
+        spr.texparms.s.repeats = 1;
+        spr.texparms.t = spr.texparms.s;
+        atlas_page_image(rgba, pw, ph, fmt, &spr.images[0]);
+        if (fmt == FMT_CI4 || fmt == FMT_CI8) {
+            if (!spritemaker_quantize(&spr, NULL, fmt == FMT_CI8 ? 256 : 16, pm->dither_algo)) {
+                spritemaker_free(&spr);
+                goto end;
+            }
+        }
+
+        FILE *tmp = tmpfile();
+        if (!tmp) {
+            perror("ERROR: cannot create temporary file");
+            spritemaker_free(&spr);
+            goto end;
+        }
+        spritemaker_write_file(&spr, tmp);
+        spritemaker_free(&spr);
+
+        // Pages are aligned to 16 bytes, so that they can be used in-place
+        walign(out, 16);
+        w32_at(out, w_page_pos[p], ftell(out));
+        w32_at(out, w_page_pos[p]+4, ftell(tmp));
+        char buf[4096]; size_t n;
+        rewind(tmp);
+        while ((n = fread(buf, 1, sizeof(buf), tmp)) > 0)
+            fwrite(buf, 1, n, out);
+        fclose(tmp);
+    }
+    walign(out, 8);
+    ret = 0;
+
+end:
+    if (out) fclose(out);
+    for (int i=0; i<num_imgs; i++) {
+        free(imgs[i].name);
+        free(imgs[i].rgba);
+        free((void*)fns[i]);
+    }
+    free(imgs);
+    free(fns);
+    free(w_names);
+    free(w_page_pos);
+    return ret;
+}
+
+bool cli_parse_texparms(const char *opt, texparms_t *parms)
 {
     char extra;
     if (sscanf(opt, "%f,%f,%d,%d,%f,%f,%d,%d%c", 
@@ -1359,10 +2359,422 @@ bool cli_parse_texparms(const char *opt, texparms_t *parms)
 }
 
 
+/** @brief A conversion to perform */
+typedef struct {
+    char *infn;             // Input file (or directory, for atlases)
+    char *outfn;            // Output file
+    parms_t pm;             // Conversion parameters
+    int compression;        // Compression level (-1: default)
+    bool is_atlas;          // True if the input is a directory to pack into an atlas
+    uint64_t hash;          // Hash of the inputs and parameters (0: not cacheable)
+    bool skipped;           // True if the output was up to date
+    bool failed;            // True if the conversion failed
+} job_t;
+
+job_t *jobs = NULL;
+int num_jobs = 0;
+int next_job = 0;
+pthread_mutex_t jobs_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t compress_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** @brief An entry of the cache of conversions (output file and hash of its inputs) */
+typedef struct {
+    char *outfn;
+    uint64_t hash;
+} cache_entry_t;
+
+cache_entry_t *cache = NULL;
+int cache_size = 0;
+
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t size) {
+    // FNV-1a
+    const uint8_t *p = data;
+    for (size_t i=0; i<size; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+static uint64_t hash_file(uint64_t h, const char *fn, bool *ok) {
+    FILE *f = fopen(fn, "rb");
+    if (!f) { *ok = false; return h; }
+    h = hash_bytes(h, fn, strlen(fn));
+    char buf[16384]; size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        h = hash_bytes(h, buf, n);
+    fclose(f);
+    return h;
+}
+
+static int cmp_str(const void *a, const void *b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static uint64_t hash_dir(uint64_t h, const char *dirname, bool *ok) {
+    DIR *dir = opendir(dirname);
+    if (!dir) { *ok = false; return h; }
+    char **fns = NULL; int num_fns = 0;
+    struct dirent *de;
+    while ((de = readdir(dir))) {
+        int len = strlen(de->d_name);
+        if (len < 5 || strcasecmp(de->d_name + len - 4, ".png") != 0)
+            continue;
+        fns = realloc(fns, (num_fns+1) * sizeof(char*));
+        asprintf(&fns[num_fns++], "%s/%s", dirname, de->d_name);
+    }
+    closedir(dir);
+    qsort(fns, num_fns, sizeof(char*), cmp_str);
+    for (int i=0; i<num_fns; i++) {
+        h = hash_file(h, fns[i], ok);
+        free(fns[i]);
+    }
+    free(fns);
+    return h;
+}
+
+static uint64_t hash_texparms(uint64_t h, const texparms_t *tp) {
+    h = hash_bytes(h, &tp->defined, sizeof(tp->defined));
+    h = hash_bytes(h, &tp->s.translate, sizeof(tp->s.translate));
+    h = hash_bytes(h, &tp->s.scale, sizeof(tp->s.scale));
+    h = hash_bytes(h, &tp->s.repeats, sizeof(tp->s.repeats));
+    h = hash_bytes(h, &tp->s.mirror, sizeof(tp->s.mirror));
+    h = hash_bytes(h, &tp->t.translate, sizeof(tp->t.translate));
+    h = hash_bytes(h, &tp->t.scale, sizeof(tp->t.scale));
+    h = hash_bytes(h, &tp->t.repeats, sizeof(tp->t.repeats));
+    h = hash_bytes(h, &tp->t.mirror, sizeof(tp->t.mirror));
+    return h;
+}
+
+/**
+ * @brief Calculate the hash of everything that affects the output of a job
+ * 
+ * This includes the contents of the input files, the conversion parameters,
+ * and the build of mksprite itself. Returns 0 if an input cannot be read
+ * (the conversion will report the error).
+ */
+uint64_t job_hash(job_t *job) {
+    bool ok = true;
+    const parms_t *pm = &job->pm;
+    uint64_t h = 0xcbf29ce484222325ull;
+    h = hash_bytes(h, __DATE__ " " __TIME__, strlen(__DATE__ " " __TIME__));
+    h = job->is_atlas ? hash_dir(h, job->infn, &ok) : hash_file(h, job->infn, &ok);
+    int compression = job->compression == -1 ? DEFAULT_COMPRESSION : job->compression;
+    int values[] = { pm->outfmt, pm->hslices, pm->vslices, pm->tilew, pm->tileh,
+        pm->mipmap_algo, pm->dither_algo, compression };
+    h = hash_bytes(h, values, sizeof(values));
+    h = hash_bytes(h, &pm->psnr, sizeof(pm->psnr));
+    h = hash_bytes(h, &pm->mipmap_sharpen, sizeof(pm->mipmap_sharpen));
+    h = hash_bytes(h, &pm->shared_palette, sizeof(pm->shared_palette));
+    h = hash_texparms(h, &pm->texparms);
+    if (pm->detail.enabled) {
+        if (pm->detail.infn) h = hash_file(h, pm->detail.infn, &ok);
+        int dvalues[] = { pm->detail.outfmt, pm->detail.use_main_tex };
+        h = hash_bytes(h, dvalues, sizeof(dvalues));
+        h = hash_bytes(h, &pm->detail.blend_factor, sizeof(pm->detail.blend_factor));
+        h = hash_texparms(h, &pm->detail.texparms);
+    }
+    return ok && h ? h : 0;
+}
+
+void cache_load(const char *fn) {
+    FILE *f = fopen(fn, "r");
+    if (!f) return;
+    char line[4096];
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long hash; int pos;
+        line[strcspn(line, "\r\n")] = 0;
+        if (sscanf(line, "%16llx %n", &hash, &pos) != 1 || !line[pos])
+            continue;
+        cache = realloc(cache, (cache_size+1) * sizeof(cache_entry_t));
+        cache[cache_size++] = (cache_entry_t){ strdup(line+pos), hash };
+    }
+    fclose(f);
+}
+
+cache_entry_t *cache_find(const char *outfn) {
+    for (int i=0; i<cache_size; i++)
+        if (!strcmp(cache[i].outfn, outfn))
+            return &cache[i];
+    return NULL;
+}
+
+bool cache_save(const char *fn) {
+    // Write to a temporary file and rename, so that an interrupted build
+    // never leaves a truncated cache behind.
+    char *tmpfn; asprintf(&tmpfn, "%s.tmp", fn);
+    FILE *f = fopen(tmpfn, "w");
+    if (!f) {
+        fprintf(stderr, "ERROR: cannot write cache file %s\n", tmpfn);
+        free(tmpfn);
+        return false;
+    }
+    for (int i=0; i<cache_size; i++)
+        fprintf(f, "%016llx %s\n", (unsigned long long)cache[i].hash, cache[i].outfn);
+    fclose(f);
+    remove(fn);
+    bool ok = rename(tmpfn, fn) == 0;
+    if (!ok) fprintf(stderr, "ERROR: cannot write cache file %s\n", fn);
+    free(tmpfn);
+    return ok;
+}
+
+void job_add(const char *infn, const char *outdir, const parms_t *pm, int compression) {
+    job_t job = { .infn = strdup(infn), .pm = *pm, .compression = compression };
+
+    // A directory is packed into an atlas, named after the directory
+    struct stat st_in = {0};
+    job.is_atlas = stat(infn, &st_in) == 0 && S_ISDIR(st_in.st_mode);
+    if (job.is_atlas) {
+        int len = strlen(job.infn);
+        while (len > 1 && job.infn[len-1] == '/') job.infn[--len] = '\0';
+    }
+
+    char *basename = strrchr(job.infn, '/');
+    if (!basename) basename = job.infn; else basename += 1;
+    char* basename_noext = strdup(basename);
+    char* ext = strrchr(basename_noext, '.');
+    if (ext && !job.is_atlas) *ext = '\0';
+    asprintf(&job.outfn, "%s/%s.%s", outdir, basename_noext, job.is_atlas ? "atlas" : "sprite");
+    free(basename_noext);
+
+    jobs = realloc(jobs, (num_jobs+1) * sizeof(job_t));
+    jobs[num_jobs++] = job;
+}
+
+/** @brief Record the hash of the inputs of an output file in the cache */
+void cache_update(const char *outfn, uint64_t hash) {
+    cache_entry_t *ce = cache_find(outfn);
+    if (!ce) {
+        cache = realloc(cache, (cache_size+1) * sizeof(cache_entry_t));
+        ce = &cache[cache_size++];
+        ce->outfn = strdup(outfn);
+    }
+    ce->hash = hash;
+}
+
+bool job_run(job_t *job) {
+    // Skip the conversion if the output exists and the inputs did not change
+    struct stat st_out;
+    cache_entry_t *ce = job->hash ? cache_find(job->outfn) : NULL;
+    if (ce && ce->hash == job->hash && stat(job->outfn, &st_out) == 0) {
+        if (flag_verbose)
+            fprintf(stderr, "up to date: %s\n", job->outfn);
+        job->skipped = true;
+        return true;
+    }
+
+    if ((job->is_atlas ? convert_atlas(job->infn, job->outfn, &job->pm) : convert(job->infn, job->outfn, &job->pm)) != 0)
+        return false;
+
+    int compression = job->compression == -1 ? DEFAULT_COMPRESSION : job->compression;
+    if (compression) {
+        struct stat st_decomp = {0}, st_comp = {0};
+        stat(job->outfn, &st_decomp);
+        // Only LZ4 is known to be thread-safe: serialize the other compressors
+        if (compression > 1) pthread_mutex_lock(&compress_mutex);
+        asset_compress(job->outfn, job->outfn, compression, 0);
+        if (compression > 1) pthread_mutex_unlock(&compress_mutex);
+        stat(job->outfn, &st_comp);
+        if (flag_verbose)
+            fprintf(stderr, "compressed: %s (%d -> %d, ratio %.1f%%)\n", job->outfn,
+            (int)st_decomp.st_size, (int)st_comp.st_size, 100.0 * (float)st_comp.st_size / (float)(st_decomp.st_size == 0 ? 1 :st_decomp.st_size));
+    }
+    return true;
+}
+
+void *job_thread(void *arg) {
+    while (1) {
+        pthread_mutex_lock(&jobs_mutex);
+        int idx = next_job++;
+        pthread_mutex_unlock(&jobs_mutex);
+        if (idx >= num_jobs)
+            break;
+        jobs[idx].failed = !job_run(&jobs[idx]);
+    }
+    return NULL;
+}
+
+int cpu_count(void) {
+    #ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors;
+    #else
+    return MAX((int)sysconf(_SC_NPROCESSORS_ONLN), 1);
+    #endif
+}
+
+/**
+ * @brief Quantize all the images marked with --shared-palette to a single palette
+ * 
+ * The palette is written to #shared_palette_fn, and then used when converting
+ * each of these images. Since changing any of the images changes the palette,
+ * the hash of each of these jobs includes the hashes of all the others.
+ * 
+ * @return true if the palette was created (or was up to date)
+ */
+bool shared_palette_build(const char *cache_fn) {
+    int num_colors = 0;
+    bool cacheable = cache_fn != NULL;
+    uint64_t group_hash = 0xcbf29ce484222325ull;
+    for (int i=0; i<num_jobs; i++) {
+        job_t *job = &jobs[i];
+        if (!job->pm.shared_palette) continue;
+        if (job->is_atlas || (job->pm.outfmt != FMT_CI4 && job->pm.outfmt != FMT_CI8)) {
+            fprintf(stderr, "ERROR: %s: a shared palette requires CI4 or CI8 format\n", job->infn);
+            return false;
+        }
+        int n = job->pm.outfmt == FMT_CI4 ? 16 : 256;
+        if (num_colors && n != num_colors) {
+            fprintf(stderr, "ERROR: %s: all the images sharing a palette must have the same format\n", job->infn);
+            return false;
+        }
+        num_colors = n;
+        group_hash = hash_bytes(group_hash, &job->hash, sizeof(job->hash));
+        if (!job->hash) cacheable = false;
+    }
+    if (!num_colors)
+        return true;
+
+    // Check whether the palette and all the images are up to date
+    struct stat st_out;
+    cache_entry_t *ce = cacheable ? cache_find(shared_palette_fn) : NULL;
+    bool up_to_date = ce && ce->hash == group_hash && stat(shared_palette_fn, &st_out) == 0;
+    for (int i=0; i<num_jobs; i++) {
+        job_t *job = &jobs[i];
+        if (!job->pm.shared_palette) continue;
+        job->hash = cacheable ? hash_bytes(job->hash, &group_hash, sizeof(group_hash)) : 0;
+        ce = job->hash ? cache_find(job->outfn) : NULL;
+        up_to_date = up_to_date && ce && ce->hash == job->hash && stat(job->outfn, &st_out) == 0;
+    }
+    if (up_to_date) {
+        if (flag_verbose)
+            fprintf(stderr, "up to date: %s\n", shared_palette_fn);
+        return true;
+    }
+
+    // Feed all the images to the quantizer
+    if (flag_verbose)
+        fprintf(stderr, "quantizing shared palette: %s (%d colors)\n", shared_palette_fn, num_colors);
+    exq_parallel_for = exq_parallel;
+    exq_data *exq = exq_init();
+    exq->numBitsPerChannel = 5;   // force calculations using rgb555
+    for (int i=0; i<num_jobs; i++) {
+        job_t *job = &jobs[i];
+        if (!job->pm.shared_palette) continue;
+        image_t img; palette_t pal;
+        if (!load_png_image(job->infn, FMT_RGBA32, &img, &pal)) {
+            exq_free(exq);
+            return false;
+        }
+        exq_feed(exq, img.image, img.width * img.height);
+        free(img.image);
+    }
+    exq_quantize_hq(exq, num_colors);
+    exq_get_palette(exq, shared_palette.colors[0], num_colors);
+    shared_palette.num_colors = num_colors;
+    shared_palette.used_colors = num_colors;
+    exq_free(exq);
+
+    // Write the palette file. See sprite_palette_s (sprite_internal.h)
+    FILE *out = fopen(shared_palette_fn, "wb");
+    if (!out) {
+        fprintf(stderr, "ERROR: cannot open output file %s\n", shared_palette_fn);
+        return false;
+    }
+    fwrite("PAL", 1, 3, out);
+    w8(out, 1);     // version
+    w16(out, num_colors);
+    w16(out, 0);    // padding
+    for (int i=0; i<num_colors; i++) {
+        uint8_t *c = shared_palette.colors[i];
+        w16(out, conv_rgb5551(c[0], c[1], c[2], c[3]));
+    }
+    walign(out, 8);
+    fclose(out);
+
+    if (cacheable)
+        cache_update(shared_palette_fn, group_hash);
+    return true;
+}
+
+/**
+ * @brief Run all the jobs, using a pool of threads
+ * 
+ * Threads that are not needed to process different files (eg: when there are
+ * less files than threads) are used to process each image in parallel.
+ * 
+ * @return true if all the jobs succeeded
+ */
+bool jobs_run(int num_threads, const char *cache_fn) {
+    if (cache_fn) {
+        cache_load(cache_fn);
+        for (int i=0; i<num_jobs; i++)
+            jobs[i].hash = job_hash(&jobs[i]);
+    }
+
+    // Create the shared palette first, using all the threads
+    image_threads = num_threads;
+    if (shared_palette_fn && !shared_palette_build(cache_fn))
+        return false;
+
+    // With a single file, all threads work on the same image
+    image_threads = num_jobs == 1 ? num_threads : 1;
+    num_threads = MIN(num_threads, num_jobs);
+
+    if (num_threads <= 1) {
+        job_thread(NULL);
+    } else {
+        pthread_t threads[num_threads];
+        for (int i=0; i<num_threads; i++)
+            pthread_create(&threads[i], NULL, job_thread, NULL);
+        for (int i=0; i<num_threads; i++)
+            pthread_join(threads[i], NULL);
+    }
+
+    bool ok = true; int skipped = 0;
+    for (int i=0; i<num_jobs; i++) {
+        job_t *job = &jobs[i];
+        if (job->failed) { ok = false; continue; }
+        if (job->skipped) { skipped++; continue; }
+        if (cache_fn && job->hash)
+            cache_update(job->outfn, job->hash);
+    }
+    if (flag_verbose && cache_fn)
+        fprintf(stderr, "%d files converted, %d up to date\n", num_jobs - skipped, skipped);
+    if (cache_fn && skipped < num_jobs)
+        ok = cache_save(cache_fn) && ok;
+    return ok;
+}
+
+/** @brief Add the input files listed in a manifest file (one per line) */
+bool manifest_load(const char *fn, const char *outdir, const parms_t *pm, int compression) {
+    FILE *f = fopen(fn, "r");
+    if (!f) {
+        fprintf(stderr, "ERROR: cannot open manifest file %s\n", fn);
+        return false;
+    }
+    char line[4096];
+    while (fgets(line, sizeof(line), f)) {
+        // Strip whitespace, skip empty lines and comments
+        char *start = line;
+        while (*start == ' ' || *start == '\t') start++;
+        char *end = start + strlen(start);
+        while (end > start && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t')) *--end = 0;
+        if (!*start || *start == '#')
+            continue;
+        job_add(start, outdir, pm, compression);
+    }
+    fclose(f);
+    return true;
+}
+
 int main(int argc, char *argv[])
 {
     char *infn = NULL, *outdir = ".", *outfn = NULL;
     parms_t pm = {0}; int compression = -1;
+    int num_threads = 1; const char *cache_fn = NULL;
     bool at_least_one_file = false;
 
     if (argc < 2) {
@@ -1433,6 +2845,20 @@ int main(int argc, char *argv[])
                 }
             } 
 
+            /* ---------------- PSNR console argument ------------------- */
+            /* --psnr <dB>           With AUTO format, pick the smallest format reaching this quality             */
+            else if (!strcmp(argv[i], "--psnr")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                char extra;
+                if (sscanf(argv[i], "%f%c", &pm.psnr, &extra) != 1 || pm.psnr <= 0) {
+                    fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+                    return 1;
+                }
+            }
+
             /* ---------------- HV TILES console argument ------------------- */
             else if (!strcmp(argv[i], "-t") || !strcmp(argv[i], "--tiles")) {
                 if (++i == argc) {
@@ -1455,6 +2881,8 @@ int main(int argc, char *argv[])
                 }
                 if (!strcmp(argv[i], "NONE")) pm.mipmap_algo = MIPMAP_ALGO_NONE;
                 else if (!strcmp(argv[i], "BOX")) pm.mipmap_algo = MIPMAP_ALGO_BOX;
+                else if (!strcmp(argv[i], "LANCZOS")) pm.mipmap_algo = MIPMAP_ALGO_LANCZOS;
+                else if (!strcmp(argv[i], "KAISER")) pm.mipmap_algo = MIPMAP_ALGO_KAISER;
                 else {
                     fprintf(stderr, "invalid mipmap algorithm: %s\n", argv[i]);
                     print_supported_mipmap();
@@ -1462,6 +2890,19 @@ int main(int argc, char *argv[])
                 }
             } 
 
+            /* --mipmap-sharpen <amount>             Sharpen each mipmap level (LANCZOS/KAISER only, default: 0)             */
+            else if (!strcmp(argv[i], "--mipmap-sharpen")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                char extra;
+                if (sscanf(argv[i], "%f%c", &pm.mipmap_sharpen, &extra) != 1 || pm.mipmap_sharpen < 0) {
+                    fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+                    return 1;
+                }
+            }
+
             /* ---------------- DITHER console argument ------------------- */
             /* -D/--dither <dither>  Dithering algorithm (default: NONE)             */
             else if (!strcmp(argv[i], "-D") || !strcmp(argv[i], "--dither")) {
@@ -1496,6 +2937,57 @@ int main(int argc, char *argv[])
                 }
             }
 
+            /* ---------------- JOBS console argument ------------------- */
+            /* -j/--jobs <num>       Number of parallel jobs (default: 1, 0: number of CPUs)             */
+            else if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                char extra;
+                if (sscanf(argv[i], "%d%c", &num_threads, &extra) != 1 || num_threads < 0) {
+                    fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+                    return 1;
+                }
+                if (num_threads == 0) num_threads = cpu_count();
+            }
+
+            /* ---------------- MANIFEST console argument ------------------- */
+            /* -M/--manifest <file>  Read the list of input files from a file             */
+            else if (!strcmp(argv[i], "-M") || !strcmp(argv[i], "--manifest")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                if (!manifest_load(argv[i], outdir, &pm, compression))
+                    return 1;
+                at_least_one_file = true;
+            }
+
+            /* ---------------- CACHE console argument ------------------- */
+            /* --cache <file>        Skip conversions whose inputs did not change             */
+            else if (!strcmp(argv[i], "--cache")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                cache_fn = argv[i];
+            }
+
+            /* --shared-palette <file>  Quantize the next input files to a single palette             */
+            else if (!strcmp(argv[i], "--shared-palette")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                if (shared_palette_fn && strcmp(shared_palette_fn, argv[i]) != 0) {
+                    fprintf(stderr, "only one shared palette can be created at a time\n");
+                    return 1;
+                }
+                shared_palette_fn = argv[i];
+                pm.shared_palette = true;
+            }
+
             /* ---------------- TEXTURE PARAMETERS console argument ------------------- */
             /* --texparms <x,s,r,m>          Sampling parameters             */
             /* --texparms <x,x,s,s,r,r,m,m>  Sampling parameters (different for S/T)             */
@@ -1579,35 +3071,13 @@ int main(int argc, char *argv[])
         }
 
         at_least_one_file = true;
-        infn = argv[i];
-        char *basename = strrchr(infn, '/');
-        if (!basename) basename = infn; else basename += 1;
-        char* basename_noext = strdup(basename);
-        char* ext = strrchr(basename_noext, '.');
-        if (ext) *ext = '\0';
-
-        asprintf(&outfn, "%s/%s.sprite", outdir, basename_noext);
-
-        if (convert(infn, outfn, &pm) != 0) {
-            error = true;
-        } else {
-            if (compression == -1)
-                compression = DEFAULT_COMPRESSION;
-            if (compression) {
-                struct stat st_decomp = {0}, st_comp = {0};
-                stat(outfn, &st_decomp);
-                asset_compress(outfn, outfn, compression, 0);
-                stat(outfn, &st_comp);
-                if (flag_verbose)
-                    fprintf(stderr, "compressed: %s (%d -> %d, ratio %.1f%%)\n", outfn,
-                    (int)st_decomp.st_size, (int)st_comp.st_size, 100.0 * (float)st_comp.st_size / (float)(st_decomp.st_size == 0 ? 1 :st_decomp.st_size));
-            }
-        }
-
-        free(outfn);
+        job_add(argv[i], outdir, &pm, compression);
     }
 
-    if (!at_least_one_file) {
+    if (at_least_one_file) {
+        if (!jobs_run(num_threads, cache_fn))
+            error = true;
+    } else {
         infn = "(stdin)";
         outfn = "(stdout)";
         if (compression > 0) {
@@ -0,0 +1,488 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "../../src/rdpq/rdpq_debug.c"
+
+bool flag_verbose = false;
+
+/** @brief A chunk of a RDP capture (see rdpq_debug_internal.h) */
+typedef struct {
+    uint32_t type;          ///< Chunk type (RDPQ_CAPTURE_CHUNK_*)
+    uint32_t addr;          ///< RDRAM physical address
+    uint32_t size;          ///< Size in bytes
+    uint64_t *data;         ///< Chunk data (converted to host endianness)
+} chunk_t;
+
+/** @brief A RDP capture loaded from file */
+typedef struct {
+    int num_chunks;         ///< Number of chunks
+    chunk_t *chunks;        ///< Chunks
+    int num_cmds;           ///< Number of RDP commands (in all CMDS chunks)
+    uint64_t **cmds;        ///< Pointers to all the RDP commands
+    uint32_t *addrs;        ///< RDRAM address of each RDP command
+} capture_t;
+
+static const char *cmd_names[64] = {
+    [0x00] = "NOP",
+    [0x08] = "TRI_FILL",          [0x09] = "TRI_FILL_ZBUF",
+    [0x0A] = "TRI_TEX",           [0x0B] = "TRI_TEX_ZBUF",
+    [0x0C] = "TRI_SHADE",         [0x0D] = "TRI_SHADE_ZBUF",
+    [0x0E] = "TRI_SHADE_TEX",     [0x0F] = "TRI_SHADE_TEX_ZBUF",
+    [0x24] = "TEX_RECT",          [0x25] = "TEX_RECT_FLIP",
+    [0x26] = "SYNC_LOAD",         [0x27] = "SYNC_PIPE",
+    [0x28] = "SYNC_TILE",         [0x29] = "SYNC_FULL",
+    [0x2A] = "SET_KEY_GB",        [0x2B] = "SET_KEY_R",
+    [0x2C] = "SET_CONVERT",       [0x2D] = "SET_SCISSOR",
+    [0x2E] = "SET_PRIM_DEPTH",    [0x2F] = "SET_OTHER_MODES",
+    [0x30] = "LOAD_TLUT",         [0x32] = "SET_TILE_SIZE",
+    [0x33] = "LOAD_BLOCK",        [0x34] = "LOAD_TILE",
+    [0x35] = "SET_TILE",          [0x36] = "FILL_RECT",
+    [0x37] = "SET_FILL_COLOR",    [0x38] = "SET_FOG_COLOR",
+    [0x39] = "SET_BLEND_COLOR",   [0x3A] = "SET_PRIM_COLOR",
+    [0x3B] = "SET_ENV_COLOR",     [0x3C] = "SET_COMBINE",
+    [0x3D] = "SET_TEX_IMAGE",     [0x3E] = "SET_Z_IMAGE",
+    [0x3F] = "SET_COLOR_IMAGE",
+};
+
+/** @brief RDP clock frequency (Hz), used for fill-rate estimates */
+#define RDP_CLOCK       62500000
+
+void print_args(char * name)
+{
+    fprintf(stderr, "%s -- Libdragon RDP capture analysis tool\n\n", name);
+    fprintf(stderr, "This tool can be used to analyze RDP captures created on the N64 with\n");
+    fprintf(stderr, "rdpq_debug_capture_start() / rdpq_debug_capture_stop(), or raw RDP\n");
+    fprintf(stderr, "command buffers dumped from RDRAM (with --raw).\n\n");
+    fprintf(stderr, "Usage: %s [flags] <capture file>\n", name);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Command-line flags:\n");
+    fprintf(stderr, "   -v/--verbose            Verbose output\n");
+    fprintf(stderr, "   -d/--disasm             Disassemble the RDP command stream (default)\n");
+    fprintf(stderr, "   -s/--stats              Show per-command statistics and analysis\n");
+    fprintf(stderr, "   -V/--validate           Run the RDP validator on the command stream\n");
+    fprintf(stderr, "   -D/--diff <file>        Compare the capture against another capture\n");
+    fprintf(stderr, "   -r/--raw                Input files are raw RDP command buffers (big-endian)\n");
+    fprintf(stderr, "   -b/--base <addr>        RDRAM address of raw buffers (default: 0)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "With --validate, the exit code is 1 if any validation error was found,\n");
+    fprintf(stderr, "so that the tool can be used in automated tests.\n");
+    fprintf(stderr, "\n");
+}
+
+static uint32_t read_be32(FILE *f, bool *ok)
+{
+    uint8_t b[4];
+    if (fread(b, 1, 4, f) != 4) *ok = false;
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+}
+
+static bool read_chunk_data(FILE *f, chunk_t *c)
+{
+    bool ok = true;
+    c->data = malloc(c->size);
+    for (int j=0; ok && j<c->size/8; j++) {
+        uint64_t hi = read_be32(f, &ok);
+        uint64_t lo = read_be32(f, &ok);
+        c->data[j] = (hi << 32) | lo;
+    }
+    return ok;
+}
+
+/** @brief Index all the commands of a capture, so that they can be easily iterated */
+static void capture_index(capture_t *cap)
+{
+    for (int pass=0; pass<2; pass++) {
+        cap->num_cmds = 0;
+        for (int i=0; i<cap->num_chunks; i++) {
+            chunk_t *c = &cap->chunks[i];
+            if (c->type != RDPQ_CAPTURE_CHUNK_CMDS) continue;
+            for (int j=0; j<c->size/8; j += rdpq_debug_disasm_size(&c->data[j])) {
+                if (j + rdpq_debug_disasm_size(&c->data[j]) > c->size/8) break;
+                if (pass == 1) {
+                    cap->cmds[cap->num_cmds] = &c->data[j];
+                    cap->addrs[cap->num_cmds] = c->addr + j*8;
+                }
+                cap->num_cmds++;
+            }
+        }
+        if (pass == 0) {
+            cap->cmds = malloc(cap->num_cmds * sizeof(uint64_t*));
+            cap->addrs = malloc(cap->num_cmds * sizeof(uint32_t));
+        }
+    }
+}
+
+static bool capture_load(const char *fn, capture_t *cap)
+{
+    FILE *f = fopen(fn, "rb");
+    if (!f) {
+        fprintf(stderr, "cannot open file: %s\n", fn);
+        return false;
+    }
+
+    bool ok = true;
+    char magic[4];
+    if (fread(magic, 1, 4, f) != 4 || memcmp(magic, RDPQ_CAPTURE_MAGIC, 4)) {
+        fprintf(stderr, "%s: not a RDP capture file\n", fn);
+        fclose(f);
+        return false;
+    }
+    uint32_t version = read_be32(f, &ok);
+    if (ok && version != RDPQ_CAPTURE_VERSION) {
+        fprintf(stderr, "%s: unsupported capture version: %u\n", fn, version);
+        fclose(f);
+        return false;
+    }
+
+    memset(cap, 0, sizeof(*cap));
+    cap->num_chunks = read_be32(f, &ok);
+    cap->chunks = calloc(cap->num_chunks, sizeof(chunk_t));
+    for (int i=0; ok && i<cap->num_chunks; i++) {
+        chunk_t *c = &cap->chunks[i];
+        c->type = read_be32(f, &ok);
+        c->addr = read_be32(f, &ok);
+        c->size = read_be32(f, &ok);
+        if (!ok || c->size % 8) { ok = false; break; }
+        ok = read_chunk_data(f, c);
+    }
+    fclose(f);
+
+    if (!ok) {
+        fprintf(stderr, "%s: truncated or corrupted capture file\n", fn);
+        return false;
+    }
+    capture_index(cap);
+    return true;
+}
+
+static bool capture_load_raw(const char *fn, uint32_t base, capture_t *cap)
+{
+    FILE *f = fopen(fn, "rb");
+    if (!f) {
+        fprintf(stderr, "cannot open file: %s\n", fn);
+        return false;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size % 8) {
+        fprintf(stderr, "%s: size is not a multiple of 8, ignoring trailing bytes\n", fn);
+        size &= ~7;
+    }
+
+    // A raw buffer is handled as a capture made of a single CMDS chunk
+    memset(cap, 0, sizeof(*cap));
+    cap->num_chunks = 1;
+    cap->chunks = calloc(1, sizeof(chunk_t));
+    cap->chunks[0] = (chunk_t){ .type = RDPQ_CAPTURE_CHUNK_CMDS, .addr = base, .size = size };
+    bool ok = read_chunk_data(f, &cap->chunks[0]);
+    fclose(f);
+
+    if (!ok) {
+        fprintf(stderr, "%s: read error\n", fn);
+        return false;
+    }
+    capture_index(cap);
+    return true;
+}
+
+static void capture_free(capture_t *cap)
+{
+    for (int i=0; i<cap->num_chunks; i++)
+        free(cap->chunks[i].data);
+    free(cap->chunks);
+    free(cap->cmds);
+    free(cap->addrs);
+}
+
+static void do_disasm(capture_t *cap)
+{
+    for (int i=0; i<cap->num_cmds; i++)
+        __rdpq_debug_disasm(cap->addrs[i], cap->cmds[i], stdout);
+
+    if (flag_verbose) {
+        for (int i=0; i<cap->num_chunks; i++) {
+            chunk_t *c = &cap->chunks[i];
+            if (c->type == RDPQ_CAPTURE_CHUNK_DATA)
+                printf("DATA [0x%08x-0x%08x] %u bytes\n", c->addr, c->addr + c->size, c->size);
+        }
+    }
+}
+
+static int do_validate(capture_t *cap)
+{
+    int errs = 0, warns = 0;
+
+    for (int i=0; i<cap->num_cmds; i++) {
+        int e, w;
+        __rdpq_validate_at(cap->addrs[i], cap->cmds[i], 0, &e, &w);
+        errs += e;
+        warns += w;
+    }
+
+    fprintf(stderr, "Validation: %d commands, %d errors, %d warnings\n", cap->num_cmds, errs, warns);
+    return errs ? 1 : 0;
+}
+
+/** @brief Compute the approximate area (in pixels) of a RDP triangle */
+static float tri_area(uint64_t *cmd)
+{
+    float yh = SBITS(cmd[0], 0, 13)*FX(2);
+    float ym = SBITS(cmd[0], 16, 29)*FX(2);
+    float yl = SBITS(cmd[0], 32, 45)*FX(2);
+    float xl = SBITS(cmd[1], 32, 63)*FX(16);
+    float xh = SBITS(cmd[2], 32, 63)*FX(16);
+    float dxhdy = SBITS(cmd[2], 0, 31)*FX(16);
+
+    // The triangle is split in two by the horizontal line at ym: its length
+    // is the distance between the major edge and the minor edge at that point.
+    float width = xl - (xh + dxhdy * (ym - yh));
+    if (width < 0) width = -width;
+    return 0.5f * width * (yl - yh);
+}
+
+static void do_stats(capture_t *cap)
+{
+    int count[64] = {0};
+    int words[64] = {0};
+    int total = 0, total_words = 0, data_bytes = 0, data_chunks = 0;
+
+    // Analysis state
+    uint64_t last_value[64] = {0};
+    bool has_value[64] = {0};
+    int redundant[64] = {0};
+    int tex_bits = 16, cycle_type = 0, color_bits = 16;
+    int tmem_loads = 0, tmem_bytes = 0;
+    double pixels_rect = 0, pixels_tri = 0, cycles = 0;
+
+    for (int i=0; i<cap->num_cmds; i++) {
+        uint64_t *cmd = cap->cmds[i];
+        int sz = rdpq_debug_disasm_size(cmd);
+        int id = CMD(cmd[0]);
+        count[id]++;
+        words[id] += sz;
+        total++;
+        total_words += sz;
+
+        double pixels = 0;
+        switch (id) {
+        case 0x2A ... 0x2F: case 0x37 ... 0x3C: case 0x3E ... 0x3F:
+            // Mode / state changes: check if they are redundant
+            if (has_value[id] && last_value[id] == cmd[0])
+                redundant[id]++;
+            has_value[id] = true;
+            last_value[id] = cmd[0];
+            if (id == 0x2F) cycle_type = BITS(cmd[0], 52, 53);
+            if (id == 0x3F) color_bits = 4 << BITS(cmd[0], 51, 52);
+            break;
+        case 0x3D: // SET_TEX_IMAGE
+            tex_bits = 4 << BITS(cmd[0], 51, 52);
+            break;
+        case 0x30: // LOAD_TLUT
+            tmem_loads++;
+            tmem_bytes += ((BITS(cmd[0], 12, 23) >> 2) - (BITS(cmd[0], 44, 55) >> 2) + 1) * 2;
+            break;
+        case 0x33: // LOAD_BLOCK
+            tmem_loads++;
+            tmem_bytes += (BITS(cmd[0], 12, 23) + 1) * tex_bits / 8;
+            break;
+        case 0x34: // LOAD_TILE
+            tmem_loads++;
+            tmem_bytes += ((BITS(cmd[0], 12, 23) >> 2) - (BITS(cmd[0], 44, 55) >> 2) + 1) *
+                          ((BITS(cmd[0],  0, 11) >> 2) - (BITS(cmd[0], 32, 43) >> 2) + 1) * tex_bits / 8;
+            break;
+        case 0x24: case 0x25: case 0x36: { // TEX_RECT, TEX_RECT_FLIP, FILL_RECT
+            // In copy/fill mode, rectangles are inclusive of the bottom-right edge
+            int incl = cycle_type >= 2 ? 1 : 0;
+            int w = (BITS(cmd[0], 44, 55) >> 2) - (BITS(cmd[0], 12, 23) >> 2) + incl;
+            int h = (BITS(cmd[0], 32, 43) >> 2) - (BITS(cmd[0],  0, 11) >> 2) + incl;
+            pixels = MAX(w, 0) * MAX(h, 0);
+            pixels_rect += pixels;
+        }   break;
+        case 0x08 ... 0x0F:
+            pixels = tri_area(cmd);
+            pixels_tri += pixels;
+            break;
+        }
+
+        // Estimate RDP cycles: 1 pixel per clock in 1-cycle mode, 2 clocks
+        // per pixel in 2-cycle mode, 4 pixels per clock in copy mode and
+        // 64 bits per clock in fill mode.
+        switch (cycle_type) {
+        case 0: cycles += pixels; break;
+        case 1: cycles += pixels * 2; break;
+        case 2: cycles += pixels / 4; break;
+        case 3: cycles += pixels * color_bits / 64; break;
+        }
+    }
+    for (int i=0; i<cap->num_chunks; i++) {
+        if (cap->chunks[i].type == RDPQ_CAPTURE_CHUNK_DATA) {
+            data_chunks++;
+            data_bytes += cap->chunks[i].size;
+        }
+    }
+
+    printf("%-20s %8s %8s %8s %10s\n", "Command", "Count", "Bytes", "%", "Redundant");
+    for (int i=0; i<64; i++) {
+        if (!count[i]) continue;
+        printf("%-20s %8d %8d %7.1f%%", cmd_names[i] ? cmd_names[i] : "???",
+            count[i], words[i]*8, 100.0f * words[i] / total_words);
+        if (redundant[i]) printf(" %10d", redundant[i]);
+        printf("\n");
+    }
+    printf("%-20s %8d %8d\n", "Total", total, total_words*8);
+
+    int total_redundant = 0;
+    for (int i=0; i<64; i++) total_redundant += redundant[i];
+
+    printf("\n");
+    printf("Syncs:            pipe=%d load=%d tile=%d full=%d\n",
+        count[0x27], count[0x26], count[0x28], count[0x29]);
+    printf("Redundant modes:  %d state changes identical to the previous one\n", total_redundant);
+    printf("TMEM loads:       %d loads, %d bytes\n", tmem_loads, tmem_bytes);
+    printf("Pixels drawn:     %.0f (rectangles: %.0f, triangles: %.0f)\n",
+        pixels_rect + pixels_tri, pixels_rect, pixels_tri);
+    printf("Fill-rate:        ~%.0f RDP cycles (~%.2f ms), memory stalls excluded\n",
+        cycles, cycles * 1000.0 / RDP_CLOCK);
+    if (data_chunks)
+        printf("Referenced RDRAM: %d ranges, %d bytes\n", data_chunks, data_bytes);
+}
+
+static int do_diff(capture_t *cap1, capture_t *cap2)
+{
+    uint64_t **cmds1 = cap1->cmds, **cmds2 = cap2->cmds;
+    uint32_t *addrs1 = cap1->addrs, *addrs2 = cap2->addrs;
+    int n1 = cap1->num_cmds, n2 = cap2->num_cmds;
+    int diffs = 0;
+
+    // Compare the command streams. Addresses are ignored as they will
+    // normally change across runs.
+    for (int i=0; i<MAX(n1, n2); i++) {
+        uint64_t *a = i < n1 ? cmds1[i] : NULL;
+        uint64_t *b = i < n2 ? cmds2[i] : NULL;
+        if (a && b) {
+            int sz = rdpq_debug_disasm_size(a);
+            if (sz == rdpq_debug_disasm_size(b) && !memcmp(a, b, sz*8))
+                continue;
+        }
+        if (diffs++ == 0) printf("Command stream differences:\n");
+        printf("@%d:\n", i);
+        if (a) { printf("  - "); __rdpq_debug_disasm(addrs1[i], a, stdout); }
+        if (b) { printf("  + "); __rdpq_debug_disasm(addrs2[i], b, stdout); }
+    }
+
+    // Compare referenced RDRAM data, matching chunks by address.
+    int data_diffs = 0;
+    for (int i=0; i<cap1->num_chunks; i++) {
+        chunk_t *c1 = &cap1->chunks[i];
+        if (c1->type != RDPQ_CAPTURE_CHUNK_DATA) continue;
+        chunk_t *c2 = NULL;
+        for (int j=0; j<cap2->num_chunks; j++) {
+            if (cap2->chunks[j].type == RDPQ_CAPTURE_CHUNK_DATA && cap2->chunks[j].addr == c1->addr) {
+                c2 = &cap2->chunks[j];
+                break;
+            }
+        }
+        const char *reason = NULL;
+        if (!c2) reason = "missing";
+        else if (c2->size != c1->size) reason = "size mismatch";
+        else if (memcmp(c1->data, c2->data, c1->size)) reason = "contents differ";
+        if (reason) {
+            if (data_diffs++ == 0) printf("RDRAM data differences:\n");
+            printf("  [0x%08x-0x%08x]: %s\n", c1->addr, c1->addr + c1->size, reason);
+        }
+    }
+
+    printf("%d commands vs %d commands, %d differences, %d data differences\n", n1, n2, diffs, data_diffs);
+    return (diffs || data_diffs) ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char *infn = NULL, *difffn = NULL;
+    bool flag_stats = false, flag_disasm = false, flag_validate = false, flag_raw = false;
+    uint32_t base = 0;
+
+    if (argc < 2) {
+        print_args(argv[0]);
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-') {
+            if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+                print_args(argv[0]);
+                return 0;
+            } else if (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose")) {
+                flag_verbose = true;
+            } else if (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--disasm")) {
+                flag_disasm = true;
+            } else if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--stats")) {
+                flag_stats = true;
+            } else if (!strcmp(argv[i], "-V") || !strcmp(argv[i], "--validate")) {
+                flag_validate = true;
+            } else if (!strcmp(argv[i], "-r") || !strcmp(argv[i], "--raw")) {
+                flag_raw = true;
+            } else if (!strcmp(argv[i], "-b") || !strcmp(argv[i], "--base")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                char extra;
+                if (sscanf(argv[i], "%i%c", (int*)&base, &extra) != 1) {
+                    fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+                    return 1;
+                }
+            } else if (!strcmp(argv[i], "-D") || !strcmp(argv[i], "--diff")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                difffn = argv[i];
+            } else {
+                fprintf(stderr, "invalid flag: %s\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+        if (infn) {
+            fprintf(stderr, "only one input file can be specified\n");
+            return 1;
+        }
+        infn = argv[i];
+    }
+
+    if (!infn) {
+        fprintf(stderr, "missing input file\n");
+        return 1;
+    }
+    if (!flag_stats && !flag_validate && !difffn)
+        flag_disasm = true;
+
+    capture_t cap;
+    if (!(flag_raw ? capture_load_raw(infn, base, &cap) : capture_load(infn, &cap)))
+        return 1;
+
+    int ret = 0;
+    if (flag_disasm)
+        do_disasm(&cap);
+    if (flag_validate)
+        ret |= do_validate(&cap);
+    if (flag_stats)
+        do_stats(&cap);
+    if (difffn) {
+        capture_t cap2;
+        if (!(flag_raw ? capture_load_raw(difffn, base, &cap2) : capture_load(difffn, &cap2)))
+            return 1;
+        ret |= do_diff(&cap, &cap2);
+        capture_free(&cap2);
+    }
+
+    capture_free(&cap);
+    return ret;
+}